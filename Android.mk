@@ -43,6 +43,9 @@ LOCAL_CFLAGS := \
 	-D_XOPEN_SOURCE \
 	-D_POSIX_C_SOURCE \
 	-DHAVE_CLOCK_GETTIME=1 \
+	-DHAVE_LINUX_SPI_SPIDEV_H=1 \
+	-DHAVE_SYS_EVENTFD_H=1 \
+	-DHAVE_PTHREAD_H=1 \
 	-DHAVE_SYS_WAIT_H=1 \
 	-DOPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER=0 \
 	-DPACKAGE=\"wpantund\" \
@@ -99,6 +102,9 @@ LOCAL_SRC_FILES := \
 	src/wpantund/NetworkRetain.cpp \
 	src/wpantund/Pcap.cpp \
 	src/wpantund/wpan-error.c \
+	src/util/IPv6FlowTable.cpp \
+	src/util/IPv6PacketClassifier.cpp \
+	src/util/IPv6PacketFilter.cpp \
 	src/util/IPv6PacketMatcher.cpp \
 	src/util/IPv6Helpers.cpp \
 	src/util/tunnel.c \
@@ -110,15 +116,22 @@ LOCAL_SRC_FILES := \
 	src/util/time-utils.c \
 	src/util/nlpt-select.c \
 	src/util/Data.cpp \
+	src/util/EventBackend.cpp \
+	src/util/IOUring.cpp \
+	src/util/LoopProfiler.cpp \
 	src/util/SocketWrapper.cpp \
 	src/util/SocketAdapter.cpp \
 	src/util/UnixSocket.cpp \
+	src/util/SpiSocket.cpp \
+	src/util/ShmSocket.cpp \
+	src/util/spi-xfer.c \
 	src/util/SuperSocket.cpp \
 	src/util/EventHandler.cpp \
 	src/util/TunnelIPv6Interface.cpp \
 	src/util/ValueMap.cpp \
 	src/util/Timer.cpp \
 	src/util/sec-random.c \
+	src/util/hdlc.c \
 	src/missing/strlcpy/strlcpy.c \
 	$(NCP_SPINEL_SRC_FILES:$(LOCAL_PATH)/%=%) \
 	third_party/openthread/src/ncp/spinel.c \
@@ -180,27 +180,21 @@ DBUSIPCServer::process(void)
 }
 
 int
-DBUSIPCServer::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout)
+DBUSIPCServer::update_fd_interest(EventBackend *backend, cms_t *timeout)
 {
 	int ret = -1;
 	int unix_fd = -1;
 
 	require(dbus_connection_get_unix_fd(mConnection, &unix_fd), bail);
 
-	if (read_fd_set != NULL) {
-		FD_SET(unix_fd, read_fd_set);
-	}
-
-	if (error_fd_set != NULL) {
-		FD_SET(unix_fd, error_fd_set);
-	}
+	if (backend != NULL) {
+		int events = EventBackend::kEventRead | EventBackend::kEventError;
 
-	if ((write_fd_set != NULL) && dbus_connection_has_messages_to_send(mConnection)) {
-		FD_SET(unix_fd, write_fd_set);
-	}
+		if (dbus_connection_has_messages_to_send(mConnection)) {
+			events |= EventBackend::kEventWrite;
+		}
 
-	if ((max_fd != NULL)) {
-		*max_fd = std::max(*max_fd, unix_fd);
+		backend->watch(unix_fd, events);
 	}
 
 	if (timeout != NULL) {
@@ -44,7 +44,7 @@ public:
 	virtual int add_interface(NCPControlInterface* instance);
 	virtual cms_t get_ms_to_next_event(void );
 	virtual void process(void);
-	virtual int update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout);
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout);
 
 private:
 	DBusHandlerResult message_handler(
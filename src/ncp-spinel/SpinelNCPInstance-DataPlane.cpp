@@ -0,0 +1,792 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Optional thread which moves IPv6 traffic between the tunnel
+ *      interface and the NCP without going through the main loop.
+ *
+ */
+
+// When enabled (see `Daemon:NCP:DataPlaneThread`), a dedicated thread
+// takes over all I/O on the serial adapter and reads from the primary
+// tunnel interface, so that bulk IPv6 traffic doesn't have to wait for
+// D-Bus calls, tasks and timers in the main loop:
+//
+//  *  Host-bound: the thread de-frames everything the NCP sends. Plain
+//     `STREAM_NET` packets are written straight to the tunnel, every
+//     other frame is handed to the main loop through `mDataPlaneFromNCP`
+//     and goes through the usual `handle_inbound_frame()` path.
+//
+//  *  NCP-bound: packets read from the tunnel are framed and written
+//     by the thread. Frames staged by tasks in `mOutboundBuffer` are
+//     framed by the main loop and passed to the thread through
+//     `mDataPlaneToNCP`, and always go out ahead of IPv6 packets.
+//
+// The main loop keeps ownership of all daemon state. The thread only
+// bypasses `should_forward_hostbound_frame()` and
+// `should_forward_ncpbound_frame()` while those would let every secure
+// packet through unchanged (see `data_plane_can_bypass_filters()`).
+// Otherwise it hands IPv6 packets to the main loop to be filtered, and
+// packets it forwards itself are passed back through
+// `mDataPlaneRecords` so that `StatCollector` still sees them.
+//
+// The thread is only used with a plain serial adapter, without a
+// legacy interface, and is stopped before anything else touches the
+// serial adapter (resets, detaching and firmware upgrades).
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "SpinelNCPInstance.h"
+#include "time-utils.h"
+#include "assert-macros.h"
+#include <syslog.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "IPv6Helpers.h"
+#include "EventBackend.h"
+
+using namespace nl;
+using namespace wpantund;
+
+// ----------------------------------------------------------------------------
+// MARK: Main loop side
+
+// True while the host-bound and NCP-bound filters would forward every
+// secure IPv6 packet as-is, without touching any state.
+bool
+SpinelNCPInstance::data_plane_can_bypass_filters(void)
+{
+	const NCPState ncp_state = get_ncp_state();
+
+	return ncp_state_is_interface_up(ncp_state)
+		&& !ncp_state_is_joining(ncp_state)
+		&& (ncp_state != CREDENTIALS_NEEDED)
+		&& (mCommissioningExpiration == 0)
+		&& mInsecureFirewall.empty()
+		&& mLegacyCommissioningMatcher.empty();
+}
+
+void
+SpinelNCPInstance::publish_data_plane_policy(void)
+{
+	__atomic_store_n(&mDataPlaneBypassFilters, data_plane_can_bypass_filters(), __ATOMIC_RELEASE);
+}
+
+bool
+SpinelNCPInstance::data_plane_has_work(void)
+{
+	return !mDataPlaneFromNCP.empty()
+		|| (mDataPlaneRunning && !mDataPlaneRecords.empty());
+}
+
+void
+SpinelNCPInstance::hard_reset_ncp(void)
+{
+	stop_data_plane();
+
+	// Whatever the thread left behind came from the NCP we are
+	// about to reset.
+	mDataPlaneFromNCP.clear();
+
+	NCPInstanceBase::hard_reset_ncp();
+}
+
+int
+SpinelNCPInstance::update_fd_interest(EventBackend *backend, cms_t *timeout)
+{
+	int ret = NCPInstanceBase::update_fd_interest(backend, timeout);
+
+	if ((ret == 0) && (backend != NULL) && mDataPlaneRunning) {
+		backend->watch(mDataPlaneNotifyFD[0], EventBackend::kEventRead);
+	}
+
+	return ret;
+}
+
+// Called at the start of every run through the main loop to start or
+// stop the thread as needed, and to pick up what it left for us.
+void
+SpinelNCPInstance::update_data_plane(void)
+{
+#if WPANTUND_SPINEL_DATA_PLANE_THREAD
+	// Anything else using the serial adapter needs the thread gone
+	// right away.
+	const bool may_run = !ncp_state_is_detached_from_ncp(get_ncp_state())
+		&& (get_upgrade_status() != EINPROGRESS)
+		&& (mSerialAdapter == mRawSerialAdapter)
+		// The thread only speaks HDLC.
+		&& (get_framing() == kFramingHDLC)
+		// The thread reads the descriptors itself, which would race
+		// with reads posted to io_uring from the main loop.
+		&& !mSerialAdapter->has_posted_reads()
+		&& !mPrimaryInterface->has_posted_reads();
+
+	if (mDataPlaneRunning) {
+		const int error = __atomic_load_n(&mDataPlaneError, __ATOMIC_ACQUIRE);
+
+		drain_data_plane_records();
+
+		if (error != 0) {
+			stop_data_plane();
+			syslog(LOG_ERR, "[-NCP-]: Data-plane thread failed: %s", strerror(error));
+			errno = error;
+			signal_fatal_error(ERRORCODE_ERRNO);
+
+		} else if (!may_run) {
+			stop_data_plane();
+
+		} else if ((!mDataPlaneThreadEnabled || is_legacy_interface_enabled())
+			&& (mDataPlaneSentCount == 0)
+			&& (mOutboundBufferLen <= 0)
+		) {
+			// Otherwise we wait until no command is in flight,
+			// so that none of them get canceled.
+			stop_data_plane();
+
+		} else {
+			publish_data_plane_policy();
+		}
+
+	} else if (may_run
+		&& mDataPlaneThreadEnabled
+		&& !is_legacy_interface_enabled()
+		&& mDataPlaneFromNCP.empty()
+		&& (mInboundChunkOffset >= mInboundChunkLen)
+		&& (mInboundFrameDecoder.length == 0)
+		&& (mOutboundQueueCount == 0)
+		&& (get_outbound_packet_count() == 0)
+	) {
+		// The pumps are between frames, so the thread can pick
+		// up the streams without losing anything.
+		start_data_plane();
+	}
+#endif // WPANTUND_SPINEL_DATA_PLANE_THREAD
+}
+
+void
+SpinelNCPInstance::start_data_plane(void)
+{
+#if WPANTUND_SPINEL_DATA_PLANE_THREAD
+	sigset_t all_signals;
+	sigset_t old_signals;
+	int ret;
+
+	for (int i = 0; i < 2; i++) {
+		int* fds = (i == 0) ? mDataPlaneWakeFD : mDataPlaneNotifyFD;
+
+		if (fds[0] >= 0) {
+			continue;
+		}
+
+		require_string(pipe(fds) == 0, on_error, strerror(errno));
+
+		for (int j = 0; j < 2; j++) {
+			fcntl(fds[j], F_SETFL, fcntl(fds[j], F_GETFL) | O_NONBLOCK);
+			fcntl(fds[j], F_SETFD, FD_CLOEXEC);
+		}
+	}
+
+	// Both pumps start over once the thread is done.
+	NLPT_INIT(&mNCPToDriverPumpPT);
+	NLPT_INIT(&mDriverToNCPPumpPT);
+
+	mDataPlaneFromNCP.clear();
+	mDataPlaneFromHost.clear();
+	mDataPlaneToNCP.clear();
+	mDataPlaneRecords.clear();
+	mDataPlaneSentHead = 0;
+	mDataPlaneSentCount = 0;
+
+	hdlc_decoder_init(&mDataPlaneDecoder, mDataPlaneFromNCP.back()->mData, sizeof(mDataPlaneFromNCP.back()->mData));
+	mDataPlaneChunkLen = 0;
+	mDataPlaneChunkOffset = 0;
+	mDataPlaneDataFramePending = false;
+	mDataPlaneTXFrame = NULL;
+	mDataPlaneTXHalted = false;
+
+	mDataPlaneStop = false;
+	mDataPlaneError = 0;
+	mDataPlaneWakePending = false;
+	mDataPlaneNotifyPending = false;
+	publish_data_plane_policy();
+
+	// Signals are for the main loop to handle.
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	ret = pthread_create(&mDataPlaneThread, NULL, &SpinelNCPInstance::data_plane_thread_entry, this);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	require_string(ret == 0, on_error, strerror(ret));
+
+	mDataPlaneRunning = true;
+	syslog(LOG_INFO, "[-NCP-]: Data-plane thread started");
+	return;
+
+on_error:
+	syslog(LOG_ERR, "[-NCP-]: Unable to start data-plane thread, staying on the main loop");
+	mDataPlaneThreadEnabled = false;
+#endif // WPANTUND_SPINEL_DATA_PLANE_THREAD
+}
+
+void
+SpinelNCPInstance::stop_data_plane(void)
+{
+#if WPANTUND_SPINEL_DATA_PLANE_THREAD
+	if (!mDataPlaneRunning) {
+		return;
+	}
+
+	__atomic_store_n(&mDataPlaneStop, true, __ATOMIC_RELEASE);
+	IGNORE_RETURN_VALUE(write(mDataPlaneWakeFD[1], "", 1));
+	pthread_join(mDataPlaneThread, NULL);
+
+	mDataPlaneRunning = false;
+	syslog(LOG_INFO, "[-NCP-]: Data-plane thread stopped");
+
+	// Commands the thread finished writing went out fine, the rest
+	// never will.
+	reap_data_plane_frames();
+
+	while (mDataPlaneSentCount > 0) {
+		DataPlaneSent& sent = mDataPlaneSent[mDataPlaneSentHead];
+		boost::function<void(int)> callback = sent.mCallback;
+
+		sent.mCallback.clear();
+		mDataPlaneSentHead = (mDataPlaneSentHead + 1) % kDataPlaneToNCPSlots;
+		mDataPlaneSentCount--;
+
+		if (!callback.empty()) {
+			callback(kWPANTUNDStatus_Canceled);
+		}
+	}
+
+	mDataPlaneToNCP.clear();
+	mDataPlaneFromHost.clear();
+	drain_data_plane_records();
+
+	// Frames in `mDataPlaneFromNCP` are still handled, in order,
+	// before the inbound pump goes back to the serial adapter.
+#endif // WPANTUND_SPINEL_DATA_PLANE_THREAD
+}
+
+#if WPANTUND_SPINEL_DATA_PLANE_THREAD
+
+void
+SpinelNCPInstance::wake_data_plane(void)
+{
+	if (!__atomic_exchange_n(&mDataPlaneWakePending, true, __ATOMIC_ACQ_REL)) {
+		IGNORE_RETURN_VALUE(write(mDataPlaneWakeFD[1], "", 1));
+	}
+}
+
+void
+SpinelNCPInstance::drain_data_plane_records(void)
+{
+	DataPlaneRecord* record;
+
+	while ((record = mDataPlaneRecords.front()) != NULL) {
+		if (record->mInbound) {
+			get_stat_collector().record_inbound_packet(record->mHeader);
+		} else {
+			get_stat_collector().record_outbound_packet(record->mHeader);
+		}
+
+		mDataPlaneRecords.pop();
+	}
+}
+
+// Handles the frames the thread couldn't handle itself, within the
+// same per-iteration budget as the inbound pump.
+void
+SpinelNCPInstance::data_plane_to_driver(void)
+{
+	DataPlaneFrame* frame;
+	bool did_pop = false;
+	char byte;
+
+	if (mDataPlaneRunning) {
+		while (read(mDataPlaneNotifyFD[0], &byte, 1) > 0) { }
+		__atomic_store_n(&mDataPlaneNotifyPending, false, __ATOMIC_RELEASE);
+
+	} else if (ncp_state_is_detached_from_ncp(get_ncp_state())) {
+		mDataPlaneFromNCP.clear();
+		return;
+	}
+
+	while ((frame = mDataPlaneFromNCP.front()) != NULL) {
+		hdlc_decode_status_t status;
+		uint16_t crc;
+
+		if (mInboundFramesThisIteration >= mMaxInboundFramesPerIteration) {
+			mInboundFrameBudgetHitCount++;
+			break;
+		}
+
+		if (mInboundFramesThisIteration++ == 0) {
+			mInboundPumpIterationCount++;
+		}
+
+		memcpy(mInboundFrame, frame->mData, frame->mLen);
+		mInboundFrameSize = frame->mLen;
+		mInboundHeader = 0;
+		status = frame->mStatus;
+		crc = frame->mCRC;
+
+		mDataPlaneFromNCP.pop();
+		did_pop = true;
+
+		if (status == HDLC_DECODE_BAD_CRC) {
+			handle_inbound_bad_crc_frame(crc);
+		} else {
+			// Frames we can't make sense of are dropped. There is
+			// no stream to resynchronize with here.
+			IGNORE_RETURN_VALUE(handle_inbound_frame());
+		}
+	}
+
+	if (mDataPlaneRunning) {
+		// Those frames may well have changed the firewall state.
+		publish_data_plane_policy();
+
+		if (did_pop) {
+			wake_data_plane();
+		}
+	}
+}
+
+// Hands staged commands to the thread, along with any IPv6 packets it
+// needed us to filter.
+void
+SpinelNCPInstance::driver_to_data_plane(void)
+{
+	OutboundPacket* packet;
+	bool did_pop = false;
+
+	reap_data_plane_frames();
+
+	if (!mDataPlaneRunning) {
+		return;
+	}
+
+	if ((mOutboundBufferLen > 0) && (mDataPlaneSentCount < kDataPlaneToNCPSlots)) {
+		log_spinel_frame(kDriverToNCP, mOutboundBuffer, mOutboundBufferLen);
+
+		send_to_data_plane(mOutboundBuffer, mOutboundBufferLen, mOutboundCallback);
+
+		mOutboundCallback.clear();
+		mOutboundBufferLen = 0;
+	}
+
+	// One slot is always left for the next command.
+	while ((mDataPlaneSentCount < kDataPlaneToNCPSlots - 1)
+		&& ((packet = mDataPlaneFromHost.front()) != NULL)
+	) {
+		uint8_t type = FRAME_TYPE_DATA;
+
+		if (should_forward_ncpbound_frame(&type, &packet->mFrame[5], packet->mLen)) {
+			if (get_ncp_state() == CREDENTIALS_NEEDED) {
+				type = FRAME_TYPE_INSECURE_DATA;
+			}
+
+			send_to_data_plane(packet->mFrame, set_outbound_packet_header(packet->mFrame, packet->mLen, type), NULL);
+		}
+
+		mDataPlaneFromHost.pop();
+		did_pop = true;
+	}
+
+	if (did_pop) {
+		publish_data_plane_policy();
+		wake_data_plane();
+	}
+}
+
+void
+SpinelNCPInstance::send_to_data_plane(uint8_t* frame, spinel_ssize_t frame_len, const boost::function<void(int)>& callback)
+{
+	OutboundFrame* slot = mDataPlaneToNCP.back();
+	DataPlaneSent& sent = mDataPlaneSent[(mDataPlaneSentHead + mDataPlaneSentCount) % kDataPlaneToNCPSlots];
+
+	// `mDataPlaneSentCount` never exceeds the ring's depth, so there
+	// is always a slot here.
+	frame_outbound(*slot, frame, frame_len);
+
+	sent.mCallback = callback;
+	sent.mIsReset = slot->mIsReset;
+
+	mDataPlaneToNCP.push();
+	mDataPlaneSentCount++;
+
+	wake_data_plane();
+}
+
+// Completes every frame the thread has finished writing.
+void
+SpinelNCPInstance::reap_data_plane_frames(void)
+{
+	// Callbacks may stop the thread, so the count is checked again
+	// for every frame.
+	while (mDataPlaneSentCount > static_cast<int>(mDataPlaneToNCP.size())) {
+		DataPlaneSent& sent = mDataPlaneSent[mDataPlaneSentHead];
+		boost::function<void(int)> callback = sent.mCallback;
+		const bool is_reset = sent.mIsReset;
+
+		sent.mCallback.clear();
+		mDataPlaneSentHead = (mDataPlaneSentHead + 1) % kDataPlaneToNCPSlots;
+		mDataPlaneSentCount--;
+
+		if (is_reset) {
+#if HAVE_LIBUDEV
+			hard_reset_ncp();
+#endif
+		}
+
+		if (!callback.empty()) {
+			callback(kWPANTUNDStatus_Ok);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// MARK: Thread side
+
+void*
+SpinelNCPInstance::data_plane_thread_entry(void* context)
+{
+	static_cast<SpinelNCPInstance*>(context)->data_plane_main();
+
+	return NULL;
+}
+
+void
+SpinelNCPInstance::notify_data_plane_owner(void)
+{
+	if (!__atomic_exchange_n(&mDataPlaneNotifyPending, true, __ATOMIC_ACQ_REL)) {
+		IGNORE_RETURN_VALUE(write(mDataPlaneNotifyFD[1], "", 1));
+	}
+}
+
+void
+SpinelNCPInstance::data_plane_main(void)
+{
+	const int serial_read_fd = mSerialAdapter->get_read_fd();
+	const int serial_write_fd = mSerialAdapter->get_write_fd();
+	const int tun_fd = mPrimaryInterface->get_read_fd();
+	int ret = 0;
+
+	while (!__atomic_load_n(&mDataPlaneStop, __ATOMIC_ACQUIRE)) {
+		struct pollfd fds[4];
+		const bool can_take_frame = !mDataPlaneFromNCP.full();
+		const bool has_chunk_bytes = (mDataPlaneChunkOffset < mDataPlaneChunkLen);
+		const bool has_tx_frame = !mDataPlaneTXHalted
+			&& ((mDataPlaneTXFrame != NULL) || mDataPlaneDataFramePending || !mDataPlaneToNCP.empty());
+		bool notify = false;
+		char byte;
+
+		fds[0].fd = mDataPlaneWakeFD[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = serial_read_fd;
+		fds[1].events = (can_take_frame && !has_chunk_bytes) ? POLLIN : 0;
+		fds[2].fd = serial_write_fd;
+		fds[2].events = has_tx_frame ? POLLOUT : 0;
+		fds[3].fd = tun_fd;
+		fds[3].events = (!mDataPlaneDataFramePending && !mDataPlaneFromHost.full()) ? POLLIN : 0;
+
+		if (serial_write_fd == serial_read_fd) {
+			fds[1].events |= fds[2].events;
+			fds[2].events = 0;
+		}
+
+		// Ignore descriptors we have no interest in, hang-ups
+		// included, until there is room to act on them.
+		for (int i = 1; i < 4; i++) {
+			if (fds[i].events == 0) {
+				fds[i].fd = -1;
+			}
+		}
+
+		ret = poll(fds, 4, (can_take_frame && has_chunk_bytes) ? 0 : -1);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ret = -errno;
+			break;
+		}
+
+		while (read(mDataPlaneWakeFD[0], &byte, 1) > 0) { }
+		__atomic_store_n(&mDataPlaneWakePending, false, __ATOMIC_RELEASE);
+
+		if (can_take_frame && (has_chunk_bytes || (fds[1].revents & (POLLIN|POLLERR|POLLHUP)))) {
+			ret = data_plane_read_ncp(&notify);
+			require_quiet(ret >= 0, on_error);
+		}
+
+		if (has_tx_frame && ((fds[1].revents | fds[2].revents) & (POLLOUT|POLLERR|POLLHUP))) {
+			ret = data_plane_write_ncp(&notify);
+			require_quiet(ret >= 0, on_error);
+		}
+
+		if (fds[3].revents & (POLLIN|POLLERR|POLLHUP)) {
+			ret = data_plane_read_host(&notify);
+			require_quiet(ret >= 0, on_error);
+		}
+
+		if (notify) {
+			notify_data_plane_owner();
+		}
+	}
+
+on_error:
+	if (ret < 0) {
+		__atomic_store_n(&mDataPlaneError, (int)-ret, __ATOMIC_RELEASE);
+		notify_data_plane_owner();
+	}
+}
+
+// De-frames one read's worth of bytes from the NCP, for as long as
+// there is room for the frames the main loop has to handle.
+int
+SpinelNCPInstance::data_plane_read_ncp(bool* notify)
+{
+	DataPlaneFrame* slot;
+
+	if (mDataPlaneChunkOffset >= mDataPlaneChunkLen) {
+		ssize_t retlen = mSerialAdapter->read(mDataPlaneChunk, sizeof(mDataPlaneChunk));
+
+		if (retlen <= 0) {
+			return (int)retlen;
+		}
+
+		mDataPlaneChunkOffset = 0;
+		mDataPlaneChunkLen = (size_t)retlen;
+	}
+
+	while ((mDataPlaneChunkOffset < mDataPlaneChunkLen) && ((slot = mDataPlaneFromNCP.back()) != NULL)) {
+		hdlc_decode_status_t status;
+		size_t consumed = 0;
+
+		// Frames are decoded in place in the ring. The slot only
+		// changes once the previous frame has been pushed.
+		mDataPlaneDecoder.buffer = slot->mData;
+
+		status = hdlc_decoder_feed(
+			&mDataPlaneDecoder,
+			&mDataPlaneChunk[mDataPlaneChunkOffset],
+			mDataPlaneChunkLen - mDataPlaneChunkOffset,
+			&consumed
+		);
+		mDataPlaneChunkOffset += consumed;
+
+		if (status == HDLC_DECODE_OVERFLOW) {
+			syslog(LOG_ERR, "[NCP->]: Frame too large for buffer (%d bytes max), dropped", (int)sizeof(slot->mData));
+			continue;
+		}
+
+		if (status == HDLC_DECODE_NEED_MORE) {
+			continue;
+		}
+
+		if ((status == HDLC_DECODE_FRAME)
+			&& data_plane_forward_to_host(slot->mData, mDataPlaneDecoder.frame_len, notify)
+		) {
+			continue;
+		}
+
+		slot->mLen = mDataPlaneDecoder.frame_len;
+		slot->mStatus = status;
+		slot->mCRC = mDataPlaneDecoder.crc;
+		mDataPlaneFromNCP.push();
+		__atomic_add_fetch(&mDataPlaneHandoffCount, 1, __ATOMIC_RELAXED);
+		*notify = true;
+	}
+
+	return 0;
+}
+
+// Writes an unsolicited secure IPv6 packet from the NCP straight to
+// the tunnel, if the filters would have let it through as-is.
+bool
+SpinelNCPInstance::data_plane_forward_to_host(const uint8_t* frame, spinel_size_t frame_len, bool* notify)
+{
+	unsigned int command = 0;
+	unsigned int key = 0;
+	const uint8_t* value_data_ptr = NULL;
+	spinel_size_t value_data_len = 0;
+	const uint8_t* packet = NULL;
+	unsigned int packet_len = 0;
+	ssize_t ret;
+
+	require_quiet(__atomic_load_n(&mDataPlaneBypassFilters, __ATOMIC_ACQUIRE), bail);
+
+	// Only TID zero: anything else may be a response to a task.
+	require_quiet((frame_len > 0) && (frame[0] == (SPINEL_HEADER_FLAG | SPINEL_HEADER_IID_0)), bail);
+
+	ret = spinel_datatype_unpack(frame, frame_len, "CiiD", NULL, &command, &key, &value_data_ptr, &value_data_len);
+	require_quiet(ret > 0, bail);
+	require_quiet((command == SPINEL_CMD_PROP_VALUE_IS) && (key == SPINEL_PROP_STREAM_NET), bail);
+
+	ret = spinel_datatype_unpack(
+		value_data_ptr,
+		value_data_len,
+		SPINEL_DATATYPE_DATA_S SPINEL_DATATYPE_DATA_S,
+		&packet,
+		&packet_len,
+		NULL,
+		NULL
+	);
+	require_quiet(ret > 0, bail);
+	require_quiet(is_valid_ipv6_packet(packet, packet_len), bail);
+
+	data_plane_record_packet(true, packet, packet_len, notify);
+
+	ret = mPrimaryInterface->write(packet, packet_len);
+
+	if (ret != (ssize_t)packet_len) {
+		syslog(LOG_INFO, "[NCP->] IPv6 packet refused by host stack! (ret = %ld)", (long)ret);
+	}
+
+	__atomic_add_fetch(&mDataPlaneToHostCount, 1, __ATOMIC_RELAXED);
+	return true;
+
+bail:
+	return false;
+}
+
+// Reads one IPv6 packet from the tunnel. It is framed right here if the
+// filters would have let it through as-is, otherwise it goes to the
+// main loop.
+int
+SpinelNCPInstance::data_plane_read_host(bool* notify)
+{
+	OutboundPacket* packet = mDataPlaneFromHost.back();
+	spinel_ssize_t len;
+
+	if (packet == NULL) {
+		return 0;
+	}
+
+	len = (spinel_ssize_t)mPrimaryInterface->read(&packet->mFrame[5], sizeof(packet->mFrame) - 5);
+
+	if (len <= 0) {
+		return (int)len;
+	}
+
+	if (__atomic_load_n(&mDataPlaneBypassFilters, __ATOMIC_ACQUIRE)
+		&& is_valid_ipv6_packet(&packet->mFrame[5], len)
+		&& (mDropFirewall.match_outbound(IPv6PacketFields().update_from_packet(&packet->mFrame[5], len)) == NULL)
+	) {
+		data_plane_record_packet(false, &packet->mFrame[5], len, notify);
+
+		len = set_outbound_packet_header(packet->mFrame, len, FRAME_TYPE_DATA);
+		frame_outbound(mDataPlaneDataFrame, packet->mFrame, len);
+		mDataPlaneDataFramePending = true;
+
+	} else {
+		packet->mLen = len;
+		packet->mQueuedAt = time_ms();
+		mDataPlaneFromHost.push();
+		__atomic_add_fetch(&mDataPlaneHandoffCount, 1, __ATOMIC_RELAXED);
+		*notify = true;
+	}
+
+	return 1;
+}
+
+// Writes as much as the NCP will take. Commands from the main loop
+// go first, but a frame is never interrupted once it is started.
+int
+SpinelNCPInstance::data_plane_write_ncp(bool* notify)
+{
+	while (!mDataPlaneTXHalted) {
+		OutboundFrame* frame = mDataPlaneTXFrame;
+		ssize_t ret;
+
+		if (frame == NULL) {
+			frame = mDataPlaneToNCP.front();
+
+			if ((frame == NULL) && mDataPlaneDataFramePending) {
+				frame = &mDataPlaneDataFrame;
+			}
+
+			if (frame == NULL) {
+				break;
+			}
+
+			mDataPlaneTXFrame = frame;
+		}
+
+		ret = mSerialAdapter->write(frame->mData + frame->mSent, frame->mLen - frame->mSent);
+
+		if (ret == -EAGAIN) {
+			break;
+		}
+
+		if (ret < 0) {
+			return (int)ret;
+		}
+
+		frame->mSent += ret;
+
+		if (frame->mSent < frame->mLen) {
+			break;
+		}
+
+		mDataPlaneTXFrame = NULL;
+
+		if (frame == &mDataPlaneDataFrame) {
+			mDataPlaneDataFramePending = false;
+			__atomic_add_fetch(&mDataPlaneToNCPCount, 1, __ATOMIC_RELAXED);
+
+		} else {
+			// Nothing should follow a reset until the main loop
+			// has dealt with it.
+			mDataPlaneTXHalted = frame->mIsReset;
+			mDataPlaneToNCP.pop();
+			*notify = true;
+		}
+	}
+
+	return 0;
+}
+
+void
+SpinelNCPInstance::data_plane_record_packet(bool inbound, const uint8_t* packet, size_t len, bool* notify)
+{
+	DataPlaneRecord* record = mDataPlaneRecords.back();
+
+	if (record == NULL) {
+		__atomic_add_fetch(&mDataPlaneRecordDropCount, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	len = std::min(len, sizeof(record->mHeader));
+	memcpy(record->mHeader, packet, len);
+	memset(record->mHeader + len, 0, sizeof(record->mHeader) - len);
+	record->mInbound = inbound;
+
+	mDataPlaneRecords.push();
+	*notify = true;
+}
+
+#endif // WPANTUND_SPINEL_DATA_PLANE_THREAD
@@ -30,6 +30,7 @@
 #include <stdexcept>
 #include <sys/file.h>
 #include "SuperSocket.h"
+#include "IPv6PacketMatcher.h"
 
 #if OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
 #include "spinel_encrypter.hpp"
@@ -38,92 +39,11 @@
 using namespace nl;
 using namespace wpantund;
 
-#define HDLC_BYTE_FLAG             0x7E
-#define HDLC_BYTE_ESC              0x7D
-#define HDLC_BYTE_XON              0x11
-#define HDLC_BYTE_XOFF             0x13
-#define HDLC_BYTE_SPECIAL          0xF8
-#define HDLC_ESCAPE_XFORM          0x20
-
-static bool
-hdlc_byte_needs_escape(uint8_t byte)
-{
-	switch(byte) {
-	case HDLC_BYTE_SPECIAL:
-	case HDLC_BYTE_ESC:
-	case HDLC_BYTE_FLAG:
-	case HDLC_BYTE_XOFF:
-	case HDLC_BYTE_XON:
-		return true;
-
-	default:
-		return false;
-	}
-}
-
-static uint16_t
-hdlc_crc16(uint16_t aFcs, uint8_t aByte)
-{
-#if 1
-	// CRC-16/CCITT, CRC-16/CCITT-TRUE, CRC-CCITT
-	// width=16 poly=0x1021 init=0x0000 refin=true refout=true xorout=0x0000 check=0x2189 name="KERMIT"
-	// http://reveng.sourceforge.net/crc-catalogue/16.htm#crc.cat.kermit
-    static const uint16_t sFcsTable[256] =
-    {
-        0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-        0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-        0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-        0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-        0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-        0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-        0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-        0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-        0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-        0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-        0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-        0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-        0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-        0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-        0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-        0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-        0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-        0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-        0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-        0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-        0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-        0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-        0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-        0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-        0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-        0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-        0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-        0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-        0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-        0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-        0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-        0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-    };
-    return (aFcs >> 8) ^ sFcsTable[(aFcs ^ aByte) & 0xff];
-#else
-	// CRC-16/CCITT-FALSE, same CRC as 802.15.4
-	// width=16 poly=0x1021 init=0xffff refin=false refout=false xorout=0x0000 check=0x29b1 name="CRC-16/CCITT-FALSE"
-	// http://reveng.sourceforge.net/crc-catalogue/16.htm#crc.cat.crc-16-ccitt-false
-	aFcs = (uint16_t)((aFcs >> 8) | (aFcs << 8));
-	aFcs ^= aByte;
-	aFcs ^= ((aFcs & 0xff) >> 4);
-	aFcs ^= (aFcs << 12);
-	aFcs ^= ((aFcs & 0xff) << 5);
-	return aFcs;
-#endif
-}
-
 char
 SpinelNCPInstance::ncp_to_driver_pump()
 {
 	struct nlpt*const pt = &mNCPToDriverPumpPT;
-//	unsigned int prop_key = 0;
-	unsigned int command_value = 0;
-	uint8_t byte;
+	hdlc_decode_status_t decode_status = HDLC_DECODE_NEED_MORE;
 
 	// Automatically detect socket resets and behave accordingly.
 	if (mSerialAdapter->did_reset()) {
@@ -134,167 +54,195 @@ SpinelNCPInstance::ncp_to_driver_pump()
 		process_event(EVENT_NCP_CONN_RESET);
 	}
 
+	// Each call to this method is one run through the main loop.
+	mInboundFramesThisIteration = 0;
+
+#if WPANTUND_SPINEL_DATA_PLANE_THREAD
+	// While the data-plane thread owns the serial adapter (and until
+	// the frames it left behind are handled) inbound frames come
+	// from it instead.
+	if (mDataPlaneRunning || !mDataPlaneFromNCP.empty()) {
+		data_plane_to_driver();
+		return PT_WAITING;
+	}
+#endif
+
 	NLPT_BEGIN(pt);
 
-	// This macro abstracts the logic to read a single character into
-	// `data`, in a protothreads-friendly way.
-#define READ_CHARACTER(pt, data, on_fail) \
-	while(1) {                                  \
+	// Anything left over from before the pump was restarted
+	// belongs to a stream we are no longer in sync with.
+	mInboundChunkLen = 0;
+	mInboundChunkOffset = 0;
+	hdlc_decoder_reset(&mInboundFrameDecoder);
+
+	// This macro abstracts the logic to refill `mInboundChunk` once
+	// all of its bytes have been consumed, in a protothreads-friendly
+	// way. We read as much as the socket will give us at once so that
+	// we aren't making a call to `read()` for every single byte.
+#define FILL_INBOUND_CHUNK(pt, on_fail) \
+	while (mInboundChunkOffset >= mInboundChunkLen) { \
 		NLPT_WAIT_UNTIL_READABLE_OR_COND(pt, mSerialAdapter->get_read_fd(), mSerialAdapter->can_read()); \
-		ssize_t retlen = mSerialAdapter->read(data, 1); \
+		ssize_t retlen = mSerialAdapter->read(mInboundChunk, sizeof(mInboundChunk)); \
 		if (retlen < 0) { \
 			syslog(LOG_ERR, "[-NCP-]: Socket error on read: %s %d", \
 			       strerror((int)-retlen), (int)(-retlen)); \
 			signal_fatal_error(ERRORCODE_ERRNO); \
 			goto on_fail; \
-		} else if (retlen == 0) { \
-			continue; \
 		} \
-		break ; \
-	};
+		mInboundChunkOffset = 0; \
+		mInboundChunkLen = (size_t)retlen; \
+	}
+
+	// This macro abstracts the logic to read a single character into
+	// `data`, in a protothreads-friendly way.
+#define READ_CHARACTER(pt, data, on_fail) \
+	FILL_INBOUND_CHUNK(pt, on_fail); \
+	*(uint8_t*)(data) = mInboundChunk[mInboundChunkOffset++]
 
 	while (!ncp_state_is_detached_from_ncp(get_ncp_state())) {
 		mInboundHeader = 0;
 		mInboundFrameSize = 0;
 
-		// Yield until the socket is readable. We do a
-		// yield here instead of a wait because we want to
-		// only handle one packet per run through the main loop.
-		// Using `YIELD` instead of `WAIT` guarantees that we
-		// will yield control of the protothread at least once,
-		// even if the socket is already readable.
-		NLPT_YIELD_UNTIL_READABLE_OR_COND(pt, mSerialAdapter->get_read_fd(), mSerialAdapter->can_read());
+		if (mInboundFramesThisIteration < mMaxInboundFramesPerIteration) {
+			// We still have budget left for this run through the
+			// main loop, so go ahead and handle the next frame
+			// right away if there is one.
+			NLPT_WAIT_UNTIL_READABLE_OR_COND(
+				pt,
+				mSerialAdapter->get_read_fd(),
+				(mInboundChunkOffset < mInboundChunkLen) || mSerialAdapter->can_read()
+			);
 
-#if WPANTUND_SPINEL_USE_FLEN
-		do {
-			READ_CHARACTER(pt, (void*)&mInboundFrame[0], on_error);
+		} else {
+			// We have handled as many frames as we are allowed to
+			// for this run through the main loop. Using `YIELD`
+			// instead of `WAIT` guarantees that we will yield control
+			// of the protothread at least once, even if the socket is
+			// already readable, so that everything else gets a turn.
+			mInboundFrameBudgetHitCount++;
 
-			if (HDLC_BYTE_FLAG != mInboundFrame[0]) {
-				// The dreaded extraneous character error.
+			NLPT_YIELD_UNTIL_READABLE_OR_COND(
+				pt,
+				mSerialAdapter->get_read_fd(),
+				(mInboundChunkOffset < mInboundChunkLen) || mSerialAdapter->can_read()
+			);
+		}
 
-				// Log the error.
-				{
-					char printable = mInboundFrame[0];
-					if(iscntrl(printable) || printable<0)
-						printable = '.';
-
-					syslog(LOG_WARNING,
-						   "[NCP->] Extraneous Character: 0x%02X [%c] (%d)\n",
-						   (uint8_t)mInboundFrame[0],
-						   printable,
-						   (uint8_t)mInboundFrame[0]);
-				}
+		if (mInboundFramesThisIteration++ == 0) {
+			mInboundPumpIterationCount++;
+		}
 
-				// Flush out all remaining data since this is a strong
-				// indication that something has gone horribly wrong.
-				while (mSerialAdapter->can_read()) {
-					READ_CHARACTER(pt, (void*)&mInboundFrame[0], on_error);
-				}
+		if (get_framing() == kFramingDatagram) {
+			// The socket hands us whole frames, so there is
+			// nothing to de-frame.
+			ssize_t retlen = mSerialAdapter->read(mInboundFrame, sizeof(mInboundFrame));
 
-				ncp_is_misbehaving();
+			if (retlen < 0) {
+				syslog(LOG_ERR, "[-NCP-]: Socket error on read: %s %d",
+				       strerror((int)-retlen), (int)(-retlen));
+				signal_fatal_error(ERRORCODE_ERRNO);
 				goto on_error;
 			}
-		} while (UART_STREAM_FLAG != mInboundFrame[0]);
-
-		// Read the frame length
-		READ_CHARACTER(pt, (void*)((char*)&mInboundFrame+0), on_error);
-		READ_CHARACTER(pt, (void*)((char*)&mInboundFrame+1), on_error);
-
-		mInboundFrameSize = (mInboundFrame[0] << 8) + mInboundFrame[1];
-
-		require(mInboundFrameSize > 1, on_error);
-		require(mInboundFrameSize <= SPINEL_FRAME_MAX_SIZE, on_error);
-
-		// Read the rest of the packet.
-		NLPT_ASYNC_READ_STREAM(
-			pt,
-			mSerialAdapter.get(),
-			mInboundFrame,
-			mInboundFrameSize
-		);
-#else // if WPANTUND_SPINEL_USE_FLEN
-
-		mInboundFrameSize = 0;
-		mInboundFrameHDLCCRC = 0xffff;
-
-		do {
-			READ_CHARACTER(pt, &byte, on_error);
-
-			if (byte == HDLC_BYTE_FLAG) {
-				break;
-			}
-			if (byte == HDLC_BYTE_ESC) {
-				READ_CHARACTER(pt, &byte, on_error);
-				if (byte == HDLC_BYTE_FLAG) {
-					break;
-				} else {
-					byte ^= HDLC_ESCAPE_XFORM;
-				}
-			}
 
-			if (mInboundFrameSize >= 2) {
-				mInboundFrameHDLCCRC = hdlc_crc16(mInboundFrameHDLCCRC, mInboundFrame[mInboundFrameSize-2]);
+			if (retlen == 0) {
+				continue;
 			}
 
-			require(mInboundFrameSize < sizeof(mInboundFrame), on_error);
-
-			mInboundFrame[mInboundFrameSize++] = byte;
+			mInboundFrameSize = (size_t)retlen;
 
-		} while(true);
+		} else if (get_framing() == kFramingFLEN) {
+			do {
+				READ_CHARACTER(pt, &mInboundFrame[0], on_error);
 
-		if (mInboundFrameSize <= 2) {
-			continue;
-		}
+				if (HDLC_BYTE_FLAG != mInboundFrame[0]) {
+					// The dreaded extraneous character error.
 
-		mInboundFrameSize -= 2;
-		mInboundFrameHDLCCRC ^= 0xFFFF;
+					// Log the error.
+					{
+						char printable = mInboundFrame[0];
+						if(iscntrl(printable) || printable<0)
+							printable = '.';
 
-#if !FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION // Don't do CRC checks when in fuzzing mode
-		{
-			uint16_t frame_crc = (mInboundFrame[mInboundFrameSize]|(mInboundFrame[mInboundFrameSize+1]<<8));
-			if (mInboundFrameHDLCCRC != frame_crc) {
+						syslog(LOG_WARNING,
+							   "[NCP->] Extraneous Character: 0x%02X [%c] (%d)\n",
+							   (uint8_t)mInboundFrame[0],
+							   printable,
+							   (uint8_t)mInboundFrame[0]);
+					}
 
-				int i;
-				static const uint8_t kAsciiCR = 13;
-				static const uint8_t kAsciiBEL = 7;
+					// Flush out all remaining data since this is a strong
+					// indication that something has gone horribly wrong.
+					mInboundChunkOffset = mInboundChunkLen;
+					while (mSerialAdapter->can_read()) {
+						FILL_INBOUND_CHUNK(pt, on_error);
+						mInboundChunkOffset = mInboundChunkLen;
+					}
 
-				syslog(LOG_ERR, "[NCP->]: Frame CRC Mismatch: Calc:0x%04X != Frame:0x%04X, Garbage on line?", mInboundFrameHDLCCRC, frame_crc);
+					ncp_is_misbehaving();
+					goto on_error;
+				}
+			} while (HDLC_BYTE_FLAG != mInboundFrame[0]);
 
-				// This frame might be an ASCII backtrace, so we check to
-				// see if all of the characters are ascii characters, and if
-				// so we dump out this packet directly to syslog.
+			// Read the frame length
+			READ_CHARACTER(pt, &mInboundFrame[0], on_error);
+			READ_CHARACTER(pt, &mInboundFrame[1], on_error);
 
-				mInboundFrameSize += 2;
+			mInboundFrameSize = (mInboundFrame[0] << 8) + mInboundFrame[1];
 
-				for (i = 0; i < mInboundFrameSize; i++) {
-					// Acceptable control codes
-					if (mInboundFrame[i] >= kAsciiBEL && mInboundFrame[i] <= kAsciiCR) {
-						continue;
-					}
-					// NUL characters are OK.
-					if (mInboundFrame[i] == 0) {
-						continue;
-					}
-					// Acceptable characters
-					if (mInboundFrame[i] >= 32 && mInboundFrame[i] <= 127) {
-						continue;
-					}
+			require(mInboundFrameSize > 1, on_error);
+			require(mInboundFrameSize <= SPINEL_FRAME_MAX_SIZE, on_error);
 
-					syslog(LOG_ERR, "[NCP->]: Garbage is not ASCII ([%d]=%d)", i, mInboundFrame[i]);
-					break;
+			// Read the rest of the packet, taking as much as we can
+			// from what is already buffered.
+			pt->byte_count = 0;
+			while (pt->byte_count < mInboundFrameSize) {
+				FILL_INBOUND_CHUNK(pt, on_error);
+				{
+					size_t len = std::min(
+						(size_t)(mInboundFrameSize - pt->byte_count),
+						mInboundChunkLen - mInboundChunkOffset
+					);
+					memcpy(&mInboundFrame[pt->byte_count], &mInboundChunk[mInboundChunkOffset], len);
+					mInboundChunkOffset += len;
+					pt->byte_count += len;
 				}
+			}
 
-				if (i == mInboundFrameSize) {
-					handle_ncp_debug_stream(mInboundFrame, mInboundFrameSize);
+		} else {
+			// Run the HDLC de-framer over the buffered bytes until it
+			// hands us a complete frame.
+			do {
+				FILL_INBOUND_CHUNK(pt, on_error);
+				{
+					size_t consumed = 0;
+					decode_status = hdlc_decoder_feed(
+						&mInboundFrameDecoder,
+						&mInboundChunk[mInboundChunkOffset],
+						mInboundChunkLen - mInboundChunkOffset,
+						&consumed
+					);
+					mInboundChunkOffset += consumed;
 				}
+			} while (decode_status == HDLC_DECODE_NEED_MORE);
 
+			mInboundFrameSize = mInboundFrameDecoder.frame_len;
+
+			if (decode_status == HDLC_DECODE_OVERFLOW) {
+				syslog(LOG_ERR, "[NCP->]: Frame too large for buffer (%d bytes max), dropped", (int)sizeof(mInboundFrame));
 				continue;
 			}
-		}
 
+#if !FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION // Don't do CRC checks when in fuzzing mode
+			if (decode_status == HDLC_DECODE_BAD_CRC) {
+				handle_inbound_bad_crc_frame(mInboundFrameDecoder.crc);
+				continue;
+			}
+#else
+			if (decode_status == HDLC_DECODE_BAD_CRC) {
+				mInboundFrameSize -= HDLC_CRC_SIZE;
+			}
 #endif // !FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-
-#endif // else WPANTUND_SPINEL_USE_FLEN
+		}
 
 		if (pt->last_errno) {
 			syslog(LOG_ERR, "[-NCP-]: Socket error on read: %s", strerror(pt->last_errno));
@@ -303,259 +251,675 @@ SpinelNCPInstance::ncp_to_driver_pump()
 			goto on_error;
 		}
 
-#if OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
-		size_t dataLen = mInboundFrameSize;
-		if (!SpinelEncrypter::DecryptInbound(mInboundFrame, sizeof(mInboundFrame), &dataLen))
-		{
-			syslog(LOG_ERR, "[-NCP-]: Unable to transform inbound data");
+		if (!handle_inbound_frame()) {
 			break;
 		}
-		mInboundFrameSize = dataLen;
+	} // while (!ncp_state_is_detached_from_ncp(get_ncp_state()))
+
+on_error:;
+	// If we get here, we will restart the protothread at the next iteration.
+
+	NLPT_END(pt);
+}
+
+// Dispatches the complete frame in `mInboundFrame`. Returns false if
+// the frame shows that we are out of sync with the NCP.
+bool
+SpinelNCPInstance::handle_inbound_frame(void)
+{
+	unsigned int command_value = 0;
+
+#if OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
+	size_t dataLen = mInboundFrameSize;
+	if (!SpinelEncrypter::DecryptInbound(mInboundFrame, sizeof(mInboundFrame), &dataLen))
+	{
+		syslog(LOG_ERR, "[-NCP-]: Unable to transform inbound data");
+		return false;
+	}
+	mInboundFrameSize = dataLen;
 #endif // OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
 
-		if (spinel_datatype_unpack(mInboundFrame, mInboundFrameSize, "Ci", &mInboundHeader, &command_value) > 0) {
-			if ((mInboundHeader&SPINEL_HEADER_FLAG) != SPINEL_HEADER_FLAG) {
-				// Unrecognized frame.
-				syslog(LOG_ERR, "[-NCP-]: Unrecognized frame (0x%02X)", mInboundHeader);
-				break;
-			}
+	if (spinel_datatype_unpack(mInboundFrame, mInboundFrameSize, "Ci", &mInboundHeader, &command_value) > 0) {
+		if ((mInboundHeader&SPINEL_HEADER_FLAG) != SPINEL_HEADER_FLAG) {
+			// Unrecognized frame.
+			syslog(LOG_ERR, "[-NCP-]: Unrecognized frame (0x%02X)", mInboundHeader);
+			return false;
+		}
 
-			if (SPINEL_HEADER_GET_IID(mInboundHeader) != 0) {
-				// We only support IID zero for now.
+		if (SPINEL_HEADER_GET_IID(mInboundHeader) != 0) {
+			// We only support IID zero for now.
 #if DEBUG
-				syslog(LOG_INFO, "[-NCP-]: Unsupported IID: %d", SPINEL_HEADER_GET_IID(mInboundHeader));
+			syslog(LOG_INFO, "[-NCP-]: Unsupported IID: %d", SPINEL_HEADER_GET_IID(mInboundHeader));
 #endif
-				break;
-			}
+			return false;
+		}
+
+		mInboundPumpFrameCount++;
+
+		log_spinel_frame(kNCPToDriver, mInboundFrame, mInboundFrameSize);
 
-			log_spinel_frame(kNCPToDriver, mInboundFrame, mInboundFrameSize);
+		handle_ncp_spinel_callback(command_value, mInboundFrame, mInboundFrameSize);
+	}
+
+	return true;
+}
 
-			handle_ncp_spinel_callback(command_value, mInboundFrame, mInboundFrameSize);
+// Handles a frame in `mInboundFrame` (trailing CRC included) whose
+// CRC didn't check out.
+void
+SpinelNCPInstance::handle_inbound_bad_crc_frame(uint16_t crc)
+{
+	spinel_size_t i;
+	static const uint8_t kAsciiCR = 13;
+	static const uint8_t kAsciiBEL = 7;
+	uint16_t frame_crc = (mInboundFrame[mInboundFrameSize-2]|(mInboundFrame[mInboundFrameSize-1]<<8));
+
+	syslog(LOG_ERR, "[NCP->]: Frame CRC Mismatch: Calc:0x%04X != Frame:0x%04X, Garbage on line?", crc, frame_crc);
+
+	// This frame might be an ASCII backtrace, so we check to
+	// see if all of the characters are ascii characters, and if
+	// so we dump out this packet directly to syslog.
+
+	for (i = 0; i < mInboundFrameSize; i++) {
+		// Acceptable control codes
+		if (mInboundFrame[i] >= kAsciiBEL && mInboundFrame[i] <= kAsciiCR) {
+			continue;
+		}
+		// NUL characters are OK.
+		if (mInboundFrame[i] == 0) {
+			continue;
+		}
+		// Acceptable characters
+		if (mInboundFrame[i] >= 32 && mInboundFrame[i] <= 127) {
+			continue;
 		}
-	} // while (!ncp_state_is_detached_from_ncp(get_ncp_state()))
 
-on_error:;
-	// If we get here, we will restart the protothread at the next iteration.
+		syslog(LOG_ERR, "[NCP->]: Garbage is not ASCII ([%u]=%d)", i, mInboundFrame[i]);
+		break;
+	}
 
-	NLPT_END(pt);
+	if (i == mInboundFrameSize) {
+		handle_ncp_debug_stream(mInboundFrame, mInboundFrameSize);
+	}
 }
 
-char
-SpinelNCPInstance::driver_to_ncp_pump()
+#define MLE_UDP_PORT               19788
+
+SpinelNCPInstance::OutboundClass
+SpinelNCPInstance::classify_outbound_packet(const uint8_t* packet, spinel_ssize_t len)
 {
-	struct nlpt*const pt = &mDriverToNCPPumpPT;
+	uint8_t type;
+	size_t offset = 40;
 
-	NLPT_BEGIN(pt);
+	if (len < 40) {
+		return kOutboundClassBulk;
+	}
 
-	while (!ncp_state_is_detached_from_ncp(get_ncp_state())) {
-		// If there is an outbound callback at this
-		// point, then we assume it is stale and
-		// immediately clear it out.
-		if (!mOutboundCallback.empty()) {
-			mOutboundCallback(kWPANTUNDStatus_Canceled);
-			mOutboundCallback.clear();
+	type = packet[6];
+
+	if ((type == IPv6PacketMatcherRule::TYPE_HOP_BY_HOP) && (len >= 42)) {
+		// MLD reports are carried behind a hop-by-hop header.
+		type = packet[40];
+		offset += (packet[41] + 1) * 8;
+	}
+
+	if (type == IPv6PacketMatcherRule::TYPE_ICMP) {
+		return kOutboundClassNetControl;
+	}
+
+	if ((type == IPv6PacketMatcherRule::TYPE_UDP) && (len >= (spinel_ssize_t)(offset + 4))) {
+		const uint16_t src_port = (packet[offset] << 8) | packet[offset + 1];
+		const uint16_t dst_port = (packet[offset + 2] << 8) | packet[offset + 3];
+
+		if ((src_port == MLE_UDP_PORT) || (dst_port == MLE_UDP_PORT)) {
+			return kOutboundClassNetControl;
 		}
+	}
 
-		// Wait for a packet to be available from interface OR management queue.
-		if (mOutboundBufferLen > 0) {
-			// If there is something in the outbound queue,
-			// we shouldn't try any of the checks below, since it
-			// will delay processing.
+	return kOutboundClassBulk;
+}
 
-#if FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-		} else {
-			NLPT_YIELD_UNTIL(pt,(mOutboundBufferLen > 0));
+// Fills in the Spinel command in front of the `len` byte IPv6 packet
+// at `frame + 5`. Returns the length of the whole frame.
+spinel_ssize_t
+SpinelNCPInstance::set_outbound_packet_header(uint8_t* frame, spinel_ssize_t len, uint8_t type)
+{
+	frame[3] = (len & 0xFF);
+	frame[4] = ((len >> 8) & 0xFF);
+
+	frame[0] = SPINEL_HEADER_FLAG | SPINEL_HEADER_IID_0;
+	frame[1] = SPINEL_CMD_PROP_VALUE_SET;
+
+	if (type == FRAME_TYPE_DATA) {
+		frame[2] = SPINEL_PROP_STREAM_NET;
+
+	} else if (type == FRAME_TYPE_INSECURE_DATA) {
+		frame[2] = SPINEL_PROP_STREAM_NET_INSECURE;
+
+	} else {
+		frame[0] = SPINEL_HEADER_FLAG | SPINEL_HEADER_IID_1;
+		frame[2] = SPINEL_PROP_STREAM_NET;
+	}
+
+	return len + 5;
+}
+
+// Reads one IPv6 packet from the tunnel interfaces into the queue for
+// its traffic class. Returns 1 if a packet was consumed (even if it
+// was then filtered out), 0 if there was nothing to read or no room
+// to read it into, and -1 on error.
+int
+SpinelNCPInstance::read_outbound_packet(void)
+{
+	OutboundPacket* packet = NULL;
+	uint8_t type = FRAME_TYPE_DATA;
+	spinel_ssize_t len = 0;
+	OutboundClass frame_class;
+	int ret = 0;
+
+	require_quiet(
+		mPrimaryInterface->can_read()
+		|| (static_cast<bool>(mLegacyInterface) && is_legacy_interface_enabled() && mLegacyInterface->can_read()),
+		bail
+	);
+
+	packet = mOutboundPacketPool.alloc();
+	require_quiet(packet != NULL, bail);
+
+	if (mPrimaryInterface->can_read()) {
+		len = (spinel_ssize_t)mPrimaryInterface->read(
+			&packet->mFrame[5],
+			sizeof(packet->mFrame)-5
+		);
+		type = FRAME_TYPE_DATA;
+	} else {
+		len = (spinel_ssize_t)mLegacyInterface->read(
+			&packet->mFrame[5],
+			sizeof(packet->mFrame)-5
+		);
+		type = FRAME_TYPE_LEGACY_DATA;
+	}
+
+	if (0 > len) {
+		syslog(LOG_ERR,
+		       "driver_to_ncp_pump: Socket error on read: %s",
+		       strerror(errno));
+		ret = -1;
+		goto bail;
+	}
+
+	// No packet...?
+	require_quiet(len > 0, bail);
+
+	ret = 1;
+
+	require_quiet(should_forward_ncpbound_frame(&type, &packet->mFrame[5], len), bail);
+
+	if (get_ncp_state() == CREDENTIALS_NEEDED) {
+		type = FRAME_TYPE_INSECURE_DATA;
+	}
+
+	frame_class = classify_outbound_packet(&packet->mFrame[5], len);
+
+	packet->mLen = set_outbound_packet_header(packet->mFrame, len, type);
+	packet->mQueuedAt = time_ms();
+
+	mOutboundPacketQueue[frame_class].write(packet);
+	packet = NULL;
+
+bail:
+	if (packet != NULL) {
+		mOutboundPacketPool.free(packet);
+	}
+
+	return ret;
+}
+
+// Picks the next IPv6 packet to send, giving network-control traffic
+// `kOutboundNetControlWeight` turns for every turn of bulk traffic.
+SpinelNCPInstance::OutboundPacket*
+SpinelNCPInstance::dequeue_outbound_packet(OutboundClass* frame_class)
+{
+	RingBuffer<OutboundPacket*, kOutboundPacketPoolSize>& net_control = mOutboundPacketQueue[kOutboundClassNetControl];
+	RingBuffer<OutboundPacket*, kOutboundPacketPoolSize>& bulk = mOutboundPacketQueue[kOutboundClassBulk];
+	OutboundPacket* packet = NULL;
+
+	if (!net_control.empty() && (bulk.empty() || (mOutboundNetControlCredit > 0))) {
+		*frame_class = kOutboundClassNetControl;
+		packet = *net_control.front();
+		net_control.pop(1);
+
+		if (mOutboundNetControlCredit > 0) {
+			mOutboundNetControlCredit--;
 		}
+
+	} else if (!bulk.empty()) {
+		*frame_class = kOutboundClassBulk;
+		packet = *bulk.front();
+		bulk.pop(1);
+		mOutboundNetControlCredit = kOutboundNetControlWeight;
+	}
+
+	return packet;
+}
+
+int
+SpinelNCPInstance::get_outbound_packet_count(void) const
+{
+	return mOutboundPacketQueue[kOutboundClassNetControl].size()
+		+ mOutboundPacketQueue[kOutboundClassBulk].size();
+}
+
+// Number of IPv6 frames in the outbound queue.
+int
+SpinelNCPInstance::get_outbound_data_frame_count(void) const
+{
+	int count = 0;
+
+	for (int i = 0; i < mOutboundQueueCount; i++) {
+		if (mOutboundQueue[(mOutboundQueueHead + i) % kOutboundQueueSlots].mClass != kOutboundClassControl) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+int
+SpinelNCPInstance::get_outbound_class_depth(OutboundClass frame_class) const
+{
+	int depth = mOutboundPacketQueue[frame_class].size();
+
+	for (int i = 0; i < mOutboundQueueCount; i++) {
+		if (mOutboundQueue[(mOutboundQueueHead + i) % kOutboundQueueSlots].mClass == frame_class) {
+			depth++;
+		}
+	}
+
+	if ((frame_class == kOutboundClassControl) && (mOutboundBufferLen > 0)) {
+		depth++;
+	}
+
+	return depth;
+}
+
+SpinelNCPInstance::Framing
+SpinelNCPInstance::get_framing(void) const
+{
+	return resolve_framing(mFraming);
+}
+
+// The framing that `framing`, as configured, stands for on this socket.
+SpinelNCPInstance::Framing
+SpinelNCPInstance::resolve_framing(Framing framing) const
+{
+	if (framing != kFramingAuto) {
+		return framing;
+	}
+
+	if (mSerialAdapter->is_framed()) {
+		return kFramingDatagram;
+	}
+
+#if WPANTUND_SPINEL_USE_FLEN
+	return kFramingFLEN;
 #else
-		} else if (static_cast<bool>(mLegacyInterface) && is_legacy_interface_enabled()) {
-			NLPT_YIELD_UNTIL_READABLE2_OR_COND(
-				pt,
-				mPrimaryInterface->get_read_fd(),
-				mLegacyInterface->get_read_fd(),
-				(mOutboundBufferLen > 0)
-				|| mLegacyInterface->can_read()
-				|| mPrimaryInterface->can_read()
-			);
+	return kFramingHDLC;
+#endif
+}
 
-		} else {
-			NLPT_YIELD_UNTIL_READABLE_OR_COND(
-				pt,
-				mPrimaryInterface->get_read_fd(),
-				mPrimaryInterface->can_read() || (mOutboundBufferLen > 0)
-			);
+const char*
+SpinelNCPInstance::framing_to_cstr(Framing framing)
+{
+	switch (framing) {
+	case kFramingHDLC:
+		return "hdlc";
+	case kFramingFLEN:
+		return "flen";
+	case kFramingDatagram:
+		return "datagram";
+	default:
+		return "auto";
+	}
+}
+
+// Frames the given Spinel frame for the wire into `slot`.
+bool
+SpinelNCPInstance::frame_outbound(OutboundFrame& slot, uint8_t* frame, spinel_ssize_t frame_len)
+{
+	const Framing framing = get_framing();
+	bool ret = false;
+
+#if VERBOSE_DEBUG
+	// Very verbose debugging. Dumps out all outbound packets.
+	{
+		char readable_buffer[300];
+		encode_data_into_string(frame,
+		                        frame_len,
+		                        readable_buffer,
+		                        sizeof(readable_buffer),
+		                        0);
+		syslog(LOG_DEBUG, "\t↳ %s", (const char*)readable_buffer);
+	}
+#endif // VERBOSE_DEBUG
+
+	slot.mIsReset = false;
+
+#if HAVE_LIBUDEV
+	{
+		uint8_t header = 0;
+		unsigned int command = 0;
+		(void)spinel_datatype_unpack(frame, frame_len, "CiD", &header,
+					     &command, NULL, 0);
+		slot.mIsReset = (command == SPINEL_CMD_RESET);
+	}
+#endif
+
+#if OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
+	if (framing != kFramingFLEN) {
+		size_t dataLen = frame_len;
+		if (!SpinelEncrypter::EncryptOutbound(frame, SPINEL_FRAME_BUFFER_SIZE, &dataLen))
+		{
+			syslog(LOG_ERR, "[-NCP-]: Unable to transform outbound data");
+			goto bail;
 		}
+		frame_len = dataLen;
+	}
+#endif // OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
+
+	switch (framing) {
+	case kFramingDatagram:
+		// The socket keeps frames apart by itself.
+		memcpy(slot.mData, frame, frame_len);
+		slot.mLen = frame_len;
+		break;
+
+	case kFramingFLEN:
+		slot.mData[0] = HDLC_BYTE_FLAG;
+		slot.mData[1] = (frame_len >> 8);
+		slot.mData[2] = (frame_len & 0xFF);
+		memcpy(&slot.mData[3], frame, frame_len);
+		slot.mLen = frame_len + 3;
+		break;
+
+	default:
+		slot.mLen = hdlc_encode_frame(slot.mData, frame, frame_len, true);
+		break;
+	}
+
+	slot.mSent = 0;
+	ret = true;
+
+#if OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
+bail:
 #endif
+	return ret;
+}
 
-		// Get packet or management command, and also
-		// perform any necessary filtering.
-		if (mOutboundBufferLen > 0) {
-			log_spinel_frame(kDriverToNCP, mOutboundBuffer, mOutboundBufferLen);
-		} else {
-			// There is an IPv6 packet waiting on one of the tunnel interfaces.
+// Frames the given Spinel frame into the next free slot of the
+// outbound queue. `callback` is called once it has been written out.
+bool
+SpinelNCPInstance::enqueue_outbound_frame(uint8_t* frame, spinel_ssize_t frame_len, OutboundClass frame_class, cms_t queued_at, const boost::function<void(int)>& callback)
+{
+	OutboundFrame& slot = mOutboundQueue[(mOutboundQueueHead + mOutboundQueueCount) % kOutboundQueueSlots];
 
-			if (mPrimaryInterface->can_read()) {
-				mOutboundBufferLen = (spinel_ssize_t)mPrimaryInterface->read(
-					&mOutboundBuffer[5],
-					sizeof(mOutboundBuffer)-5
-				);
-				mOutboundBufferType = FRAME_TYPE_DATA;
-			} else if (static_cast<bool>(mLegacyInterface)) {
-				mOutboundBufferLen = (spinel_ssize_t)mLegacyInterface->read(
-					&mOutboundBuffer[5],
-					sizeof(mOutboundBuffer)-5
-				);
-				mOutboundBufferType = FRAME_TYPE_LEGACY_DATA;
-			}
+	require_quiet(frame_outbound(slot, frame, frame_len), bail);
 
-			if (0 > mOutboundBufferLen) {
-				syslog(LOG_ERR,
-				       "driver_to_ncp_pump: Socket error on read: %s",
-				       strerror(errno));
-				signal_fatal_error(ERRORCODE_ERRNO);
-				break;
-			}
+	slot.mClass = frame_class;
+	slot.mQueuedAt = queued_at;
+	slot.mCallback = callback;
 
-			if (mOutboundBufferLen <= 0) {
-				// No packet...?
-				mOutboundBufferLen = 0;
-				continue;
-			}
+	mOutboundQueueCount++;
+	return true;
 
-			if (!should_forward_ncpbound_frame(&mOutboundBufferType, &mOutboundBuffer[5], mOutboundBufferLen)) {
-				mOutboundBufferLen = 0;
-				continue;
-			}
+bail:
+	return false;
+}
 
-			if (get_ncp_state() == CREDENTIALS_NEEDED) {
-				mOutboundBufferType = FRAME_TYPE_INSECURE_DATA;
-			}
+void
+SpinelNCPInstance::complete_outbound_frame(int status)
+{
+	OutboundFrame& frame = mOutboundQueue[mOutboundQueueHead];
+	boost::function<void(int)> callback = frame.mCallback;
 
-			mOutboundBuffer[3] = (mOutboundBufferLen & 0xFF);
-			mOutboundBuffer[4] = ((mOutboundBufferLen >> 8) & 0xFF);
+	if (status == kWPANTUNDStatus_Ok) {
+		OutboundClassStats& stats = mOutboundClassStats[frame.mClass];
+		const cms_t latency = CMS_SINCE(frame.mQueuedAt);
 
-			mOutboundBufferLen += 5;
+		stats.mFrameCount++;
+		stats.mLatencySum += latency;
 
-			mOutboundBuffer[0] = SPINEL_HEADER_FLAG | SPINEL_HEADER_IID_0;
-			mOutboundBuffer[1] = SPINEL_CMD_PROP_VALUE_SET;
+		if (latency > stats.mLatencyMax) {
+			stats.mLatencyMax = latency;
+		}
+	}
 
-			if (mOutboundBufferType == FRAME_TYPE_DATA) {
-				mOutboundBuffer[2] = SPINEL_PROP_STREAM_NET;
+	frame.mCallback.clear();
+	mOutboundQueueHead = (mOutboundQueueHead + 1) % kOutboundQueueSlots;
+	mOutboundQueueCount--;
 
-			} else if (mOutboundBufferType == FRAME_TYPE_INSECURE_DATA) {
-				mOutboundBuffer[2] = SPINEL_PROP_STREAM_NET_INSECURE;
+	// Fire the callback last, since it may well stage another frame.
+	if (!callback.empty()) {
+		callback(status);
+	}
+}
 
-			} else {
-				mOutboundBuffer[0] = SPINEL_HEADER_FLAG | SPINEL_HEADER_IID_1;
-				mOutboundBuffer[2] = SPINEL_PROP_STREAM_NET;
-			}
+void
+SpinelNCPInstance::drain_outbound_queue(int status)
+{
+	OutboundClass frame_class;
+	OutboundPacket* packet;
+
+	while (mOutboundQueueCount > 0) {
+		complete_outbound_frame(status);
+	}
+
+	while ((packet = dequeue_outbound_packet(&frame_class)) != NULL) {
+		mOutboundPacketPool.free(packet);
+	}
+}
+
+// Writes out as much of the outbound queue as the serial adapter will
+// take with a single call, and completes every frame that went out in
+// full. Returns the number of bytes written, or a negative errno.
+ssize_t
+SpinelNCPInstance::flush_outbound_queue(void)
+{
+	struct iovec iov[kOutboundQueueSlots];
+	ssize_t ret;
+	size_t remaining;
+	int i;
+
+	for (i = 0; i < mOutboundQueueCount; i++) {
+		OutboundFrame& frame = mOutboundQueue[(mOutboundQueueHead + i) % kOutboundQueueSlots];
+		iov[i].iov_base = frame.mData + frame.mSent;
+		iov[i].iov_len = frame.mLen - frame.mSent;
+	}
+
+	ret = mSerialAdapter->writev(iov, mOutboundQueueCount);
+
+	if (ret == -EAGAIN) {
+		ret = 0;
+	}
+
+	require_quiet(ret > 0, bail);
+
+	remaining = static_cast<size_t>(ret);
+
+	while ((remaining > 0) && (mOutboundQueueCount > 0)) {
+		OutboundFrame& frame = mOutboundQueue[mOutboundQueueHead];
+		size_t len = std::min(remaining, frame.mLen - frame.mSent);
+
+		frame.mSent += len;
+		remaining -= len;
+
+		if (frame.mSent < frame.mLen) {
+			break;
 		}
 
-#if VERBOSE_DEBUG
-		// Very verbose debugging. Dumps out all outbound packets.
-		{
-			char readable_buffer[300];
-			encode_data_into_string(mOutboundBuffer,
-			                        mOutboundBufferLen,
-			                        readable_buffer,
-			                        sizeof(readable_buffer),
-			                        0);
-			syslog(LOG_DEBUG, "\t↳ %s", (const char*)readable_buffer);
+		if (frame.mIsReset) {
+#if HAVE_LIBUDEV
+			hard_reset_ncp();
+#endif
+			complete_outbound_frame(kWPANTUNDStatus_Ok);
+
+			// Whatever is queued behind a reset would only
+			// reach an NCP which is about to go away.
+			drain_outbound_queue(kWPANTUNDStatus_Canceled);
+			break;
 		}
-#endif // VERBOSE_DEBUG
 
+		complete_outbound_frame(kWPANTUNDStatus_Ok);
+	}
 
-#if WPANTUND_SPINEL_USE_FLEN
-		mOutboundBufferHeader[0] = HDLC_BYTE_FLAG;
-		mOutboundBufferHeader[1] = (mOutboundBufferLen >> 8);
-		mOutboundBufferHeader[2] = (mOutboundBufferLen & 0xFF);
+bail:
+	return ret;
+}
+
+char
+SpinelNCPInstance::driver_to_ncp_pump()
+{
+	struct nlpt*const pt = &mDriverToNCPPumpPT;
+	int ret = 0;
 
-		mOutboundBufferSent = 0;
+#if WPANTUND_SPINEL_DATA_PLANE_THREAD
+	if (mDataPlaneRunning) {
+		driver_to_data_plane();
+		return PT_WAITING;
+	}
+#endif
 
-		// Go ahead send
-		NLPT_ASYNC_WRITE_STREAM(
-			pt,
-			mSerialAdapter.get(),
-			mOutboundBufferHeader,
-			mOutboundBufferLen + sizeof(mOutboundBufferHeader)
-		);
-		mOutboundBufferSent += pt->byte_count;
-#else
+	NLPT_BEGIN(pt);
 
-		mOutboundBufferEscapedLen = 1;
-		mOutboundBufferEscaped[0] = HDLC_BYTE_FLAG;
-		{
-			spinel_ssize_t i;
-			uint8_t byte;
-			uint16_t crc(0xFFFF);
+	// Anything still queued from before the pump was restarted
+	// will never be sent, and a callback for the staged frame
+	// at this point is assumed to be stale.
+	drain_outbound_queue(kWPANTUNDStatus_Canceled);
 
-#if OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
-			size_t dataLen = mOutboundBufferLen;
-			if (!SpinelEncrypter::EncryptOutbound(mOutboundBuffer, sizeof(mOutboundBuffer), &dataLen))
-			{
-				syslog(LOG_ERR, "[-NCP-]: Unable to transform outbound data");
-				break;
+	if (!mOutboundCallback.empty()) {
+		mOutboundCallback(kWPANTUNDStatus_Canceled);
+		mOutboundCallback.clear();
+	}
+
+	while (!ncp_state_is_detached_from_ncp(get_ncp_state())) {
+#if !FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+		// Read ahead from the tunnel interfaces, sorting the packets
+		// by traffic class so that they can be scheduled below.
+		while (0 != (ret = read_outbound_packet())) {
+			if (ret < 0) {
+				signal_fatal_error(ERRORCODE_ERRNO);
+				goto on_error;
 			}
-			mOutboundBufferLen = dataLen;
-#endif // OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER
+		}
+#endif
 
-			for (i = 0; i < mOutboundBufferLen; i++) {
-				byte = mOutboundBuffer[i];
-				crc = hdlc_crc16(crc, byte);
-				if (hdlc_byte_needs_escape(byte)) {
-					mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = HDLC_BYTE_ESC;
-					mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = byte ^ HDLC_ESCAPE_XFORM;
-				} else {
-					mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = byte;
+		// Move pending frames into the outbound queue. They are
+		// framed right away so that they are ready to go while
+		// earlier frames are still being written out. Management
+		// commands always go first, then IPv6 packets for as long
+		// as they don't hold too many slots.
+		while (mOutboundQueueCount < kOutboundQueueSlots) {
+			OutboundClass frame_class;
+			OutboundPacket* packet;
+
+			if (mOutboundBufferLen > 0) {
+				log_spinel_frame(kDriverToNCP, mOutboundBuffer, mOutboundBufferLen);
+
+				if (!enqueue_outbound_frame(mOutboundBuffer, mOutboundBufferLen, kOutboundClassControl, time_ms(), mOutboundCallback)) {
+					mOutboundBufferLen = 0;
+					goto on_error;
 				}
-			}
-			crc ^= 0xFFFF;
-			byte = (crc & 0xFF);
-			if (hdlc_byte_needs_escape(byte)) {
-				mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = HDLC_BYTE_ESC;
-				mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = byte ^ HDLC_ESCAPE_XFORM;
+
+				// The send callback now belongs to the queued frame,
+				// which frees up the staging buffer for the next one.
+				mOutboundCallback.clear();
+				mOutboundBufferLen = 0;
+
+			} else if ((get_outbound_data_frame_count() < kOutboundQueueDataSlots)
+				&& ((packet = dequeue_outbound_packet(&frame_class)) != NULL)
+			) {
+				const bool did_enqueue = enqueue_outbound_frame(packet->mFrame, packet->mLen, frame_class, packet->mQueuedAt, NULL);
+
+				mOutboundPacketPool.free(packet);
+				require(did_enqueue, on_error);
+
 			} else {
-				mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = byte;
+				break;
 			}
-			byte = ((crc>>8) & 0xFF);
-			if (hdlc_byte_needs_escape(byte)) {
-				mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = HDLC_BYTE_ESC;
-				mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = byte ^ HDLC_ESCAPE_XFORM;
+		}
+
+		if (mOutboundQueueCount == 0) {
+			// Wait for a packet to be available from interface OR management queue.
+#if FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+			NLPT_YIELD_UNTIL(pt,(mOutboundBufferLen > 0));
+#else
+			if (static_cast<bool>(mLegacyInterface) && is_legacy_interface_enabled()) {
+				NLPT_YIELD_UNTIL_READABLE2_OR_COND(
+					pt,
+					mPrimaryInterface->get_read_fd(),
+					mLegacyInterface->get_read_fd(),
+					(mOutboundBufferLen > 0)
+					|| mLegacyInterface->can_read()
+					|| mPrimaryInterface->can_read()
+				);
+
 			} else {
-				mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = byte;
+				NLPT_YIELD_UNTIL_READABLE_OR_COND(
+					pt,
+					mPrimaryInterface->get_read_fd(),
+					mPrimaryInterface->can_read() || (mOutboundBufferLen > 0)
+				);
 			}
-			mOutboundBufferEscaped[mOutboundBufferEscapedLen++] = HDLC_BYTE_FLAG;
+#endif
+			continue;
 		}
 
-		mOutboundBufferSent = 0;
-
-		// Go ahead send
-		NLPT_ASYNC_WRITE_STREAM(
+		// Wait for the NCP to take more bytes. Also wake up for new
+		// frames while there is room for them, so that they can be
+		// framed (and prioritized) while the write is in progress.
+#if FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+		NLPT_WAIT_UNTIL_WRITABLE_OR_COND(
 			pt,
-			mSerialAdapter.get(),
-			mOutboundBufferEscaped,
-			mOutboundBufferEscapedLen
+			mSerialAdapter->get_write_fd(),
+			mSerialAdapter->can_write()
+			|| ((mOutboundQueueCount < kOutboundQueueSlots) && (mOutboundBufferLen > 0))
+		);
+#else
+		NLPT_WAIT_UNTIL_WRITABLE_OR_READABLE2_OR_COND(
+			pt,
+			mSerialAdapter->get_write_fd(),
+			(get_outbound_packet_count() < kOutboundPacketPoolSize) ? mPrimaryInterface->get_read_fd() : -1,
+			((get_outbound_packet_count() < kOutboundPacketPoolSize) && static_cast<bool>(mLegacyInterface) && is_legacy_interface_enabled())
+				? mLegacyInterface->get_read_fd()
+				: -1,
+			mSerialAdapter->can_write()
+			|| ((mOutboundQueueCount < kOutboundQueueSlots) && (mOutboundBufferLen > 0))
 		);
-		mOutboundBufferSent += pt->byte_count;
 #endif
 
-#if HAVE_LIBUDEV
-		uint8_t header = 0;
-		unsigned int command = 0;
-		(void)spinel_datatype_unpack(mOutboundBuffer, mOutboundBufferLen, "CiD", &header,
-					     &command, NULL, 0);
-		if (command == SPINEL_CMD_RESET) {
-			hard_reset_ncp();
+		if (!mSerialAdapter->can_write()) {
+			// We were woken up to take on more frames.
+			continue;
 		}
-#endif
 
-		mOutboundBufferLen = 0;
+		// Go ahead and send everything we have queued up.
+		ret = static_cast<int>(flush_outbound_queue());
 
-		require(pt->last_errno == 0, on_error);
+		if (0 > ret) {
+			syslog(LOG_ERR, "[-NCP-]: Socket error on write: %s", strerror(-ret));
+			goto on_error;
+		}
 
-		// Go ahead and fire off the "did send" callback.
-		if (!mOutboundCallback.empty()) {
-			mOutboundCallback(kWPANTUNDStatus_Ok);
-			mOutboundCallback.clear();
+		if (mOutboundQueueCount > 0) {
+			// The write came up short. Give the rest of the
+			// main loop a chance to run before trying again.
+			// Framed sockets have no descriptor to watch, and
+			// make room as they send frames from `process()`.
+			NLPT_YIELD_UNTIL_WRITABLE_OR_COND(
+				pt,
+				mSerialAdapter->get_write_fd(),
+				mSerialAdapter->is_framed() && mSerialAdapter->can_write()
+			);
 		}
 
 	} // while(true)
@@ -563,6 +927,8 @@ SpinelNCPInstance::driver_to_ncp_pump()
 on_error:
 	// If we get here, we will restart the protothread at the next iteration.
 
+	drain_outbound_queue(kWPANTUNDStatus_Failure);
+
 	if (!mOutboundCallback.empty()) {
 		mOutboundCallback(kWPANTUNDStatus_Failure);
 		mOutboundCallback.clear();
@@ -566,21 +566,55 @@ SpinelNCPInstance::vprocess_event(int event, va_list args)
 		return 0;
 	}
 
-	while (!mTaskQueue.empty()) {
-		va_list tmp;
-		boost::shared_ptr<SpinelNCPTask> current_task(mTaskQueue.front());
-		va_copy(tmp, args);
-		char ret = current_task->vprocess_event(event, tmp);
-		va_end(tmp);
-
-		if (ret == PT_ENDED || ret == PT_EXITED) {
-			mTaskQueue.pop_front();
-			continue;
-		}
+	if (mRoutingResponse && IS_EVENT_FROM_NCP(event)) {
+		// Responses only wake whoever is waiting for them.
+		return dispatch_routed_response(event, args);
+	}
 
-		break;
+	mTaskDispatchSerial++;
+
+	// Hand the event to every task that is allowed to run. When a task
+	// finishes, look again: the next task in line gets this event too.
+	for (bool rescan = true; rescan; ) {
+		std::vector<boost::shared_ptr<SpinelNCPTask> > runnable_tasks;
+		std::vector<boost::shared_ptr<SpinelNCPTask> >::iterator iter;
+
+		rescan = false;
+		collect_runnable_tasks(runnable_tasks);
+
+		for (iter = runnable_tasks.begin(); iter != runnable_tasks.end(); ++iter) {
+			boost::shared_ptr<SpinelNCPTask> current_task(*iter);
+			va_list tmp;
+			char ret;
+
+			if (current_task->mDispatchSerial == mTaskDispatchSerial) {
+				continue;
+			}
+
+			current_task->mDispatchSerial = mTaskDispatchSerial;
+
+			if (!current_task->mStarted) {
+				note_task_started(*current_task);
+			}
+
+			va_copy(tmp, args);
+			ret = current_task->vprocess_event(event, tmp);
+			va_end(tmp);
+
+			if (ret == PT_ENDED || ret == PT_EXITED) {
+				mTaskQueue.remove(current_task);
+				rescan = true;
+			}
+		}
 	}
 
+	return vprocess_control(event, args);
+}
+
+// The driver's own protothread, which runs alongside the tasks.
+int
+SpinelNCPInstance::vprocess_control(int event, va_list args)
+{
 	EH_BEGIN();
 
 	EH_SPAWN(&mSubPT, vprocess_init(event, args));
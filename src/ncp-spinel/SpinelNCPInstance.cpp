@@ -283,10 +283,271 @@ SpinelNCPInstance::start_new_task(const boost::shared_ptr<SpinelNCPTask> &task)
 			}
 		}
 
+		task->mQueuedAt = time_ms();
 		mTaskQueue.push_back(task);
 	}
 }
 
+bool
+SpinelNCPInstance::can_start_shared_task(void) const
+{
+	const NCPState ncp_state = get_ncp_state();
+
+	// While the NCP is resetting or asleep, shareable tasks wait their
+	// turn like everybody else.
+	return !ncp_state_is_initializing(ncp_state)
+	    && !ncp_state_is_sleeping(ncp_state)
+	    && !ncp_state_is_detached_from_ncp(ncp_state)
+	    && !is_initializing_ncp();
+}
+
+void
+SpinelNCPInstance::collect_runnable_tasks(std::vector<boost::shared_ptr<SpinelNCPTask> >& tasks) const
+{
+	std::list<boost::shared_ptr<SpinelNCPTask> >::const_iterator iter;
+	bool can_start = can_start_shared_task();
+	int running_count = 0;
+
+	if (mTaskQueue.empty()) {
+		return;
+	}
+
+	// The task at the head of the queue always runs. Unless it allows
+	// it, nothing starts beside an exclusive task at the head, which
+	// may leave the NCP in intermediate states or put it to sleep.
+	tasks.push_back(mTaskQueue.front());
+
+	if (!mTaskQueue.front()->is_shareable() && !mTaskQueue.front()->allows_concurrent_reads()) {
+		can_start = false;
+	}
+
+	for (iter = ++mTaskQueue.begin(); iter != mTaskQueue.end(); ++iter) {
+		if ((*iter)->mStarted) {
+			running_count++;
+		}
+	}
+
+	// Shareable tasks further back may start early, as long as there
+	// aren't too many of them running already and no exclusive task is
+	// queued ahead of them, since that task may change what they read.
+	// The head is the one exception, when it allows concurrent reads.
+	// Once started, they keep running until they finish.
+	for (iter = ++mTaskQueue.begin(); iter != mTaskQueue.end(); ++iter) {
+		if ((*iter)->mStarted) {
+			tasks.push_back(*iter);
+
+		} else if (!(*iter)->is_shareable()) {
+			can_start = false;
+
+		} else if (can_start && (running_count < kMaxConcurrentSharedTasks)) {
+			tasks.push_back(*iter);
+			running_count++;
+		}
+	}
+}
+
+void
+SpinelNCPInstance::note_task_started(SpinelNCPTask& task)
+{
+	TaskWaitStats& stats = mTaskWaitStats[task.is_shareable() ? 1 : 0];
+	cms_t wait = time_ms() - task.mQueuedAt;
+
+	if (wait < 0) {
+		wait = 0;
+	}
+
+	task.mStarted = true;
+
+	stats.mTaskCount++;
+	stats.mWaitSum += wait;
+
+	if (wait > stats.mWaitMax) {
+		stats.mWaitMax = wait;
+	}
+}
+
+// Returns the TID to send the next command with, or zero if every TID
+// is still held by a command waiting for its response.
+uint8_t
+SpinelNCPInstance::get_next_tid(void)
+{
+	uint8_t tid = mLastTID;
+	int i;
+
+	// Skip over any TIDs that are still held, so that their responses
+	// can't be mistaken for ours.
+	for (i = 0; i < SPINEL_HEADER_TID_MASK; i++) {
+		tid = SPINEL_GET_NEXT_TID(tid);
+
+		if ((mReservedTIDs & (1 << tid)) == 0) {
+			return tid;
+		}
+	}
+
+	return 0;
+}
+
+bool
+SpinelNCPInstance::has_free_tid(void) const
+{
+	// TID zero is for unsolicited frames, and is never held.
+	return (mReservedTIDs | 1) != (1 << (SPINEL_HEADER_TID_MASK + 1)) - 1;
+}
+
+// Called when a command is sent with the given header. Its response
+// is delivered to `waiter` (a task, or the instance itself for the
+// control protothread) and nobody else.
+void
+SpinelNCPInstance::route_response_to(uint8_t header, EventHandler* waiter)
+{
+	ResponseRoute& route = mResponseRoutes[SPINEL_HEADER_GET_TID(header)];
+
+	route.mWaiter = waiter;
+	route.mHeader = header;
+}
+
+// Called when the sender of `header` stops waiting for its response,
+// so that a response that still shows up is counted as late.
+void
+SpinelNCPInstance::expire_response_route(uint8_t header)
+{
+	ResponseRoute& route = mResponseRoutes[SPINEL_HEADER_GET_TID(header)];
+
+	if (route.mHeader == header) {
+		route.mWaiter = NULL;
+	}
+}
+
+void
+SpinelNCPInstance::forget_response_routes(EventHandler* waiter)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(mResponseRoutes) / sizeof(mResponseRoutes[0]); i++) {
+		if (mResponseRoutes[i].mWaiter == waiter) {
+			mResponseRoutes[i].mWaiter = NULL;
+		}
+	}
+
+	if (mRoutedResponseWaiter == waiter) {
+		mRoutedResponseWaiter = NULL;
+	}
+}
+
+// Called before the events for an inbound frame are generated. Frames
+// with TID zero are unsolicited and still go to everybody.
+void
+SpinelNCPInstance::begin_response_routing(void)
+{
+	const spinel_tid_t tid = SPINEL_HEADER_GET_TID(mInboundHeader);
+	const ResponseRoute& route = mResponseRoutes[tid];
+
+	mRoutingResponse = (tid != 0);
+	mRoutedResponseWaiter = NULL;
+
+	if (!mRoutingResponse) {
+		return;
+	}
+
+	if (route.mHeader != mInboundHeader) {
+		// Nothing we sent is waiting on this TID.
+		mResponseOrphanedCount++;
+
+	} else if (route.mWaiter == NULL) {
+		// The sender already gave up on it.
+		mResponseLateCount++;
+
+	} else {
+		mRoutedResponseWaiter = route.mWaiter;
+		mResponseRoutedCount++;
+	}
+}
+
+void
+SpinelNCPInstance::end_response_routing(void)
+{
+	if (mRoutingResponse) {
+		ResponseRoute& route = mResponseRoutes[SPINEL_HEADER_GET_TID(mInboundHeader)];
+
+		// Each command gets one response; anything else with this
+		// header is either late or orphaned.
+		if (route.mHeader == mInboundHeader) {
+			route.mWaiter = NULL;
+		}
+	}
+
+	mRoutingResponse = false;
+	mRoutedResponseWaiter = NULL;
+}
+
+// Delivers `event` only to whoever is waiting for the response to the
+// command sent with `header`, such as a failure to send that command.
+int
+SpinelNCPInstance::process_event_for_command(uint8_t header, int event)
+{
+	const ResponseRoute& route = mResponseRoutes[SPINEL_HEADER_GET_TID(header)];
+	EventHandler* const routed_response_waiter = mRoutedResponseWaiter;
+	int ret = 0;
+
+	if ((route.mHeader == header) && (route.mWaiter != NULL)) {
+		mRoutedResponseWaiter = route.mWaiter;
+		ret = dispatch_routed_event(event);
+		mRoutedResponseWaiter = routed_response_waiter;
+	}
+
+	return ret;
+}
+
+int
+SpinelNCPInstance::dispatch_routed_event(int event, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, event);
+	ret = dispatch_routed_response(event, args);
+	va_end(args);
+
+	return ret;
+}
+
+// Delivers an event generated by a response to the one waiting for it.
+int
+SpinelNCPInstance::dispatch_routed_response(int event, va_list args)
+{
+	std::list<boost::shared_ptr<SpinelNCPTask> >::iterator iter;
+	int ret = 0;
+
+	if (mRoutedResponseWaiter == NULL) {
+		return ret;
+	}
+
+	if (mRoutedResponseWaiter == static_cast<EventHandler*>(this)) {
+		return vprocess_control(event, args);
+	}
+
+	for (iter = mTaskQueue.begin(); iter != mTaskQueue.end(); ++iter) {
+		if (static_cast<EventHandler*>(iter->get()) == mRoutedResponseWaiter) {
+			boost::shared_ptr<SpinelNCPTask> task(*iter);
+			va_list tmp;
+
+			va_copy(tmp, args);
+			ret = task->vprocess_event(event, tmp);
+			va_end(tmp);
+
+			if (ret == PT_ENDED || ret == PT_EXITED) {
+				mTaskQueue.remove(task);
+
+				// Let the next task in line get started.
+				process_event(EVENT_IDLE);
+			}
+			break;
+		}
+	}
+
+	return ret;
+}
+
 int
 nl::wpantund::spinel_status_to_wpantund_status(int spinel_status)
 {
@@ -365,8 +626,16 @@ SpinelNCPInstance::SpinelNCPInstance(const Settings& settings) :
 	mInboundFrameDataLen = 0;
 	mInboundFrameDataPtr = NULL;
 	mInboundFrameDataType = 0;
-	mInboundFrameHDLCCRC = 0;
 	mInboundFrameSize = 0;
+	mInboundChunkLen = 0;
+	mInboundChunkOffset = 0;
+	hdlc_decoder_init(&mInboundFrameDecoder, mInboundFrame, sizeof(mInboundFrame));
+	mFraming = kFramingAuto;
+	mMaxInboundFramesPerIteration = kDefaultMaxInboundFramesPerIteration;
+	mInboundFramesThisIteration = 0;
+	mInboundPumpIterationCount = 0;
+	mInboundPumpFrameCount = 0;
+	mInboundFrameBudgetHitCount = 0;
 	mInboundHeader = 0;
 	mIsCommissioned = false;
 	mFilterRLOCAddresses = true;
@@ -375,11 +644,42 @@ SpinelNCPInstance::SpinelNCPInstance(const Settings& settings) :
 	mIsPcapInProgress = false;
 	mLastHeader = 0;
 	mLastTID = 0;
+	mReservedTIDs = 0;
+	memset(mResponseRoutes, 0, sizeof(mResponseRoutes));
+	mRoutingResponse = false;
+	mRoutedResponseWaiter = NULL;
+	mResponseRoutedCount = 0;
+	mResponseOrphanedCount = 0;
+	mResponseLateCount = 0;
+	mTaskDispatchSerial = 0;
+	memset(mTaskWaitStats, 0, sizeof(mTaskWaitStats));
 	mNetworkKeyIndex = 0;
-	mOutboundBufferEscapedLen = 0;
 	mOutboundBufferLen = 0;
-	mOutboundBufferSent = 0;
-	mOutboundBufferType = 0;
+	mOutboundQueueHead = 0;
+	mOutboundQueueCount = 0;
+	mOutboundNetControlCredit = kOutboundNetControlWeight;
+	memset(mOutboundClassStats, 0, sizeof(mOutboundClassStats));
+	mDataPlaneThreadEnabled = false;
+	mDataPlaneRunning = false;
+	mDataPlaneWakeFD[0] = mDataPlaneWakeFD[1] = -1;
+	mDataPlaneNotifyFD[0] = mDataPlaneNotifyFD[1] = -1;
+	mDataPlaneStop = false;
+	mDataPlaneBypassFilters = false;
+	mDataPlaneWakePending = false;
+	mDataPlaneNotifyPending = false;
+	mDataPlaneError = 0;
+	mDataPlaneToHostCount = 0;
+	mDataPlaneToNCPCount = 0;
+	mDataPlaneHandoffCount = 0;
+	mDataPlaneRecordDropCount = 0;
+	mDataPlaneSentHead = 0;
+	mDataPlaneSentCount = 0;
+	hdlc_decoder_init(&mDataPlaneDecoder, NULL, 0);
+	mDataPlaneChunkLen = 0;
+	mDataPlaneChunkOffset = 0;
+	mDataPlaneDataFramePending = false;
+	mDataPlaneTXFrame = NULL;
+	mDataPlaneTXHalted = false;
 #if WPANTUND_NCP_RESET_EXPECTED_ON_START
 	mResetIsExpected = true;
 #else
@@ -400,6 +700,11 @@ SpinelNCPInstance::SpinelNCPInstance(const Settings& settings) :
 
 	mSettings.clear();
 
+	mPropertyCacheHitCount = 0;
+	mPropertyCacheMissCount = 0;
+	mPropertyCacheInvalidationCount = 0;
+	setup_property_cache_policies();
+
 	regsiter_all_get_handlers();
 	regsiter_all_set_handlers();
 	regsiter_all_insert_handlers();
@@ -409,15 +714,26 @@ SpinelNCPInstance::SpinelNCPInstance(const Settings& settings) :
 
 	if (!settings.empty()) {
 		int status;
+		int pass;
 		Settings::const_iterator iter;
 
-		for(iter = settings.begin(); iter != settings.end(); iter++) {
-			if (!NCPInstanceBase::setup_property_supported_by_class(iter->first)) {
-				status = static_cast<NCPControlInterface&>(get_control_interface())
-					.property_set_value(iter->first, iter->second);
+		// The statistics memory budget goes first, since the history
+		// sizes set after it are checked against it.
+		for (pass = 0; pass < 2; pass++) {
+			for(iter = settings.begin(); iter != settings.end(); iter++) {
+				const bool is_budget = strcaseequal(iter->first.c_str(), kWPANTUNDProperty_StatMemoryBudget);
 
-				if (status != 0 && status != kWPANTUNDStatus_InProgress) {
-					syslog(LOG_WARNING, "Attempt to set property \"%s\" failed with err %s", iter->first.c_str(), wpantund_status_to_cstr(status));
+				if (is_budget != (pass == 0)) {
+					continue;
+				}
+
+				if (!NCPInstanceBase::setup_property_supported_by_class(iter->first)) {
+					status = static_cast<NCPControlInterface&>(get_control_interface())
+						.property_set_value(iter->first, iter->second);
+
+					if (status != 0 && status != kWPANTUNDStatus_InProgress) {
+						syslog(LOG_WARNING, "Attempt to set property \"%s\" failed with err %s", iter->first.c_str(), wpantund_status_to_cstr(status));
+					}
 				}
 			}
 		}
@@ -426,6 +742,19 @@ SpinelNCPInstance::SpinelNCPInstance(const Settings& settings) :
 
 SpinelNCPInstance::~SpinelNCPInstance()
 {
+	stop_data_plane();
+
+	for (int i = 0; i < 2; i++) {
+		if (mDataPlaneWakeFD[i] >= 0) {
+			EventBackend::fd_closed(mDataPlaneWakeFD[i]);
+			close(mDataPlaneWakeFD[i]);
+		}
+
+		if (mDataPlaneNotifyFD[i] >= 0) {
+			EventBackend::fd_closed(mDataPlaneNotifyFD[i]);
+			close(mDataPlaneNotifyFD[i]);
+		}
+	}
 }
 
 std::string
@@ -470,6 +799,7 @@ SpinelNCPInstance::get_supported_property_keys()const
 	std::set<std::string> properties (NCPInstanceBase::get_supported_property_keys());
 
 	properties.insert(kWPANTUNDProperty_ConfigNCPDriverName);
+	properties.insert(kWPANTUNDProperty_ConfigNCPFraming);
 	properties.insert(kWPANTUNDProperty_NCPChannel);
 	properties.insert(kWPANTUNDProperty_NCPChannelMask);
 	properties.insert(kWPANTUNDProperty_NCPPreferredChannelMask);
@@ -655,10 +985,29 @@ SpinelNCPInstance::get_ms_to_next_event(void)
 		cms = 0;
 	}
 
+	// Inbound bytes that were already read from the serial adapter
+	// won't make its file descriptor readable again, so don't sleep
+	// while the inbound pump still has some left to process.
+	if (mInboundChunkOffset < mInboundChunkLen) {
+		cms = 0;
+	}
+
+	// Same for frames the data-plane thread has already handed over.
+	if (data_plane_has_work()) {
+		cms = 0;
+	}
+
 	if (!mTaskQueue.empty()) {
-		int tmp_cms = mTaskQueue.front()->get_ms_to_next_event();
-		if (tmp_cms < cms) {
-			cms = tmp_cms;
+		std::vector<boost::shared_ptr<SpinelNCPTask> > runnable_tasks;
+		std::vector<boost::shared_ptr<SpinelNCPTask> >::const_iterator iter;
+
+		collect_runnable_tasks(runnable_tasks);
+
+		for (iter = runnable_tasks.begin(); iter != runnable_tasks.end(); ++iter) {
+			int tmp_cms = (*iter)->get_ms_to_next_event();
+			if (tmp_cms < cms) {
+				cms = tmp_cms;
+			}
 		}
 	}
 
@@ -2479,18 +2828,27 @@ void
 SpinelNCPInstance::get_spinel_prop(CallbackWithStatusArg1 cb, spinel_prop_key_t prop_key,
 	const std::string &reply_format)
 {
-	start_new_task(SpinelNCPTaskSendCommand::Factory(this)
-		.set_callback(cb)
-		.add_command(SpinelPackData(SPINEL_FRAME_PACK_CMD_PROP_VALUE_GET, prop_key))
-		.set_reply_format(reply_format)
-		.finish()
-	);
+	get_spinel_prop_with_unpacker(cb, prop_key, SpinelNCPTaskSendCommand::make_simple_unpacker(reply_format));
 }
 
 void
 SpinelNCPInstance::get_spinel_prop_with_unpacker(CallbackWithStatusArg1 cb, spinel_prop_key_t prop_key,
 	ReplyUnpacker unpacker)
 {
+	const Data* cached_value = property_cache_lookup(prop_key);
+
+	if (cached_value != NULL) {
+		boost::any value;
+
+		if (unpacker(cached_value->data(), static_cast<spinel_size_t>(cached_value->size()), value) == kWPANTUNDStatus_Ok) {
+			cb(kWPANTUNDStatus_Ok, value);
+			return;
+		}
+
+		// Whatever is in the cache can't be parsed, so ask the NCP.
+		property_cache_invalidate(prop_key);
+	}
+
 	start_new_task(SpinelNCPTaskSendCommand::Factory(this)
 		.set_callback(cb)
 		.add_command(SpinelPackData(SPINEL_FRAME_PACK_CMD_PROP_VALUE_GET, prop_key))
@@ -2513,6 +2871,134 @@ void SpinelNCPInstance::check_capability_prop_get(CallbackWithStatusArg1 cb, con
 	}
 }
 
+// ----------------------------------------------------------------------------
+// Property Value Cache
+
+void
+SpinelNCPInstance::set_property_cache_policy(spinel_prop_key_t prop_key, PropertyCachePolicy policy, cms_t ttl)
+{
+	PropertyCacheEntry& entry = mPropertyCache[prop_key];
+
+	entry.mPolicy = policy;
+	entry.mTTL = ttl;
+	entry.mIsValid = false;
+	entry.mUpdatedAt = 0;
+	entry.mValue.clear();
+}
+
+void
+SpinelNCPInstance::setup_property_cache_policies(void)
+{
+	static const cms_t kDefaultTTL = 5 * MSEC_PER_SEC;
+
+	// The NCP sends an unsolicited `PROP_VALUE_IS` whenever one of
+	// these changes, so what we last heard is always current.
+	set_property_cache_policy(SPINEL_PROP_NET_ROLE, kPropertyCacheUntilInvalidated);
+	set_property_cache_policy(SPINEL_PROP_NET_PARTITION_ID, kPropertyCacheUntilInvalidated);
+	set_property_cache_policy(SPINEL_PROP_NET_KEY_SEQUENCE_COUNTER, kPropertyCacheUntilInvalidated);
+	set_property_cache_policy(SPINEL_PROP_NET_MASTER_KEY, kPropertyCacheUntilInvalidated);
+	set_property_cache_policy(SPINEL_PROP_NET_PSKC, kPropertyCacheUntilInvalidated);
+	set_property_cache_policy(SPINEL_PROP_MAC_EXTENDED_ADDR, kPropertyCacheUntilInvalidated);
+	set_property_cache_policy(SPINEL_PROP_THREAD_LEADER_NETWORK_DATA, kPropertyCacheUntilInvalidated);
+
+	// These aren't always announced, but change rarely enough that a
+	// value a few seconds old is fine for status polling.
+	set_property_cache_policy(SPINEL_PROP_THREAD_RLOC16, kPropertyCacheTTL, kDefaultTTL);
+	set_property_cache_policy(SPINEL_PROP_THREAD_LEADER_ADDR, kPropertyCacheTTL, kDefaultTTL);
+	set_property_cache_policy(SPINEL_PROP_THREAD_LEADER_RID, kPropertyCacheTTL, kDefaultTTL);
+	set_property_cache_policy(SPINEL_PROP_THREAD_LEADER_WEIGHT, kPropertyCacheTTL, kDefaultTTL);
+	set_property_cache_policy(SPINEL_PROP_THREAD_NETWORK_DATA, kPropertyCacheTTL, kDefaultTTL);
+	set_property_cache_policy(SPINEL_PROP_THREAD_NETWORK_DATA_VERSION, kPropertyCacheTTL, kDefaultTTL);
+	set_property_cache_policy(SPINEL_PROP_THREAD_STABLE_NETWORK_DATA, kPropertyCacheTTL, kDefaultTTL);
+	set_property_cache_policy(SPINEL_PROP_THREAD_STABLE_NETWORK_DATA_VERSION, kPropertyCacheTTL, kDefaultTTL);
+	set_property_cache_policy(SPINEL_PROP_THREAD_STABLE_LEADER_NETWORK_DATA, kPropertyCacheTTL, kDefaultTTL);
+
+	// Everything else is `kPropertyCacheAlwaysFresh`.
+}
+
+const Data*
+SpinelNCPInstance::property_cache_lookup(spinel_prop_key_t prop_key)
+{
+	std::map<spinel_prop_key_t, PropertyCacheEntry>::iterator iter = mPropertyCache.find(prop_key);
+	const Data* ret = NULL;
+
+	if ((iter == mPropertyCache.end()) || (iter->second.mPolicy == kPropertyCacheAlwaysFresh)) {
+		goto bail;
+	}
+
+	if (ncp_state_is_initializing(get_ncp_state()) || is_initializing_ncp()) {
+		property_cache_invalidate_all();
+	}
+
+	if ( iter->second.mIsValid
+	  && (iter->second.mPolicy == kPropertyCacheTTL)
+	  && (CMS_SINCE(iter->second.mUpdatedAt) >= iter->second.mTTL)
+	) {
+		iter->second.mIsValid = false;
+	}
+
+	if (iter->second.mIsValid && !is_property_change_pending(prop_key)) {
+		mPropertyCacheHitCount++;
+		ret = &iter->second.mValue;
+	} else {
+		mPropertyCacheMissCount++;
+	}
+
+bail:
+	return ret;
+}
+
+// Whether a queued task may still change `prop_key`, such as a set of
+// it that hasn't been answered yet. Until then a get has to be queued
+// behind that task rather than answered from the cache.
+bool
+SpinelNCPInstance::is_property_change_pending(spinel_prop_key_t prop_key) const
+{
+	std::list<boost::shared_ptr<SpinelNCPTask> >::const_iterator iter;
+
+	for (iter = mTaskQueue.begin(); iter != mTaskQueue.end(); ++iter) {
+		if ((*iter)->may_change_property(prop_key)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void
+SpinelNCPInstance::property_cache_update(spinel_prop_key_t prop_key, const uint8_t* value_data_ptr, spinel_size_t value_data_len)
+{
+	std::map<spinel_prop_key_t, PropertyCacheEntry>::iterator iter = mPropertyCache.find(prop_key);
+
+	if ((iter != mPropertyCache.end()) && (iter->second.mPolicy != kPropertyCacheAlwaysFresh)) {
+		iter->second.mValue = Data(value_data_ptr, value_data_len);
+		iter->second.mUpdatedAt = time_ms();
+		iter->second.mIsValid = true;
+	}
+}
+
+void
+SpinelNCPInstance::property_cache_invalidate(spinel_prop_key_t prop_key)
+{
+	std::map<spinel_prop_key_t, PropertyCacheEntry>::iterator iter = mPropertyCache.find(prop_key);
+
+	if ((iter != mPropertyCache.end()) && iter->second.mIsValid) {
+		iter->second.mIsValid = false;
+		iter->second.mValue.clear();
+		mPropertyCacheInvalidationCount++;
+	}
+}
+
+void
+SpinelNCPInstance::property_cache_invalidate_all(void)
+{
+	std::map<spinel_prop_key_t, PropertyCacheEntry>::iterator iter;
+
+	for (iter = mPropertyCache.begin(); iter != mPropertyCache.end(); ++iter) {
+		property_cache_invalidate(iter->first);
+	}
+}
+
 void
 SpinelNCPInstance::register_get_handler(const char *prop_name, PropGetHandler handler)
 {
@@ -3169,6 +3655,9 @@ SpinelNCPInstance::regsiter_all_get_handlers(void)
 	register_get_handler(
 		kWPANTUNDProperty_ConfigNCPDriverName,
 		boost::bind(&SpinelNCPInstance::get_prop_ConfigNCPDriverName, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_ConfigNCPFraming,
+		boost::bind(&SpinelNCPInstance::get_prop_ConfigNCPFraming, this, _1));
 	register_get_handler(
 		kWPANTUNDProperty_NCPCapabilities,
 		boost::bind(&SpinelNCPInstance::get_prop_NCPCapabilities, this, _1));
@@ -3286,6 +3775,36 @@ SpinelNCPInstance::regsiter_all_get_handlers(void)
 	register_get_handler(
 		kWPANTUNDProperty_DaemonTickleOnHostDidWake,
 		boost::bind(&SpinelNCPInstance::get_prop_DaemonTickleOnHostDidWake, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonNCPMaxFramesPerIteration,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonNCPMaxFramesPerIteration, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonNCPInboundPumpCounters,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonNCPInboundPumpCounters, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonNCPDataPlaneThread,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonNCPDataPlaneThread, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonNCPDataPlaneCounters,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonNCPDataPlaneCounters, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonNCPOutboundQueueDepth,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonNCPOutboundQueueDepth, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonNCPOutboundQueueLatency,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonNCPOutboundQueueLatency, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonNCPPropertyCache,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonNCPPropertyCache, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonTaskQueueDepth,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonTaskQueueDepth, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonTaskQueueWaitTime,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonTaskQueueWaitTime, this, _1));
+	register_get_handler(
+		kWPANTUNDProperty_DaemonNCPResponseCounters,
+		boost::bind(&SpinelNCPInstance::get_prop_DaemonNCPResponseCounters, this, _1));
 
 	// Properties requiring capability check with a dedicated handler method
 
@@ -3341,6 +3860,12 @@ SpinelNCPInstance::get_prop_ConfigNCPDriverName(CallbackWithStatusArg1 cb)
 	cb(kWPANTUNDStatus_Ok, boost::any(std::string("spinel")));
 }
 
+void
+SpinelNCPInstance::get_prop_ConfigNCPFraming(CallbackWithStatusArg1 cb)
+{
+	cb(kWPANTUNDStatus_Ok, boost::any(std::string(framing_to_cstr(get_framing()))));
+}
+
 void
 SpinelNCPInstance::get_prop_NCPCapabilities(CallbackWithStatusArg1 cb)
 {
@@ -3788,6 +4313,195 @@ SpinelNCPInstance::get_prop_DaemonTickleOnHostDidWake(CallbackWithStatusArg1 cb)
 	cb(kWPANTUNDStatus_Ok, boost::any(mTickleOnHostDidWake));
 }
 
+void
+SpinelNCPInstance::get_prop_DaemonNCPMaxFramesPerIteration(CallbackWithStatusArg1 cb)
+{
+	cb(kWPANTUNDStatus_Ok, boost::any(mMaxInboundFramesPerIteration));
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonNCPInboundPumpCounters(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+	char c_string[80];
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Iterations", mInboundPumpIterationCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Frames", mInboundPumpFrameCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "BudgetHits", mInboundFrameBudgetHitCount);
+	result.push_back(c_string);
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonNCPDataPlaneThread(CallbackWithStatusArg1 cb)
+{
+	cb(kWPANTUNDStatus_Ok, boost::any(mDataPlaneThreadEnabled));
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonNCPDataPlaneCounters(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+	char c_string[80];
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %s", "Running", mDataPlaneRunning ? "true" : "false");
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "ToHost", __atomic_load_n(&mDataPlaneToHostCount, __ATOMIC_RELAXED));
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "ToNCP", __atomic_load_n(&mDataPlaneToNCPCount, __ATOMIC_RELAXED));
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "HandedToMainLoop", __atomic_load_n(&mDataPlaneHandoffCount, __ATOMIC_RELAXED));
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "StatRecordDrops", __atomic_load_n(&mDataPlaneRecordDropCount, __ATOMIC_RELAXED));
+	result.push_back(c_string);
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+static const char*
+outbound_class_to_string(int frame_class)
+{
+	static const char* const kNames[] = { "Control", "NetControl", "Bulk" };
+
+	return kNames[frame_class];
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonNCPOutboundQueueDepth(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+	char c_string[80];
+
+	for (int i = 0; i < kOutboundClassCount; i++) {
+		snprintf(c_string, sizeof(c_string), "%-20s = %d", outbound_class_to_string(i),
+			get_outbound_class_depth(static_cast<OutboundClass>(i)));
+		result.push_back(c_string);
+	}
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonNCPOutboundQueueLatency(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+	char c_string[120];
+
+	for (int i = 0; i < kOutboundClassCount; i++) {
+		const OutboundClassStats& stats = mOutboundClassStats[i];
+		unsigned int average = 0;
+
+		if (stats.mFrameCount != 0) {
+			average = static_cast<unsigned int>(stats.mLatencySum / stats.mFrameCount);
+		}
+
+		snprintf(c_string, sizeof(c_string), "%-20s = avg %u ms, max %u ms, %u frames",
+			outbound_class_to_string(i), average, static_cast<unsigned int>(stats.mLatencyMax),
+			stats.mFrameCount);
+		result.push_back(c_string);
+	}
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonNCPPropertyCache(CallbackWithStatusArg1 cb)
+{
+	std::map<spinel_prop_key_t, PropertyCacheEntry>::const_iterator iter;
+	std::list<std::string> result;
+	char c_string[80];
+	unsigned int entry_count = 0;
+
+	for (iter = mPropertyCache.begin(); iter != mPropertyCache.end(); ++iter) {
+		if (iter->second.mIsValid) {
+			entry_count++;
+		}
+	}
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Hits", mPropertyCacheHitCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Misses", mPropertyCacheMissCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Invalidations", mPropertyCacheInvalidationCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "ValidEntries", entry_count);
+	result.push_back(c_string);
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonTaskQueueDepth(CallbackWithStatusArg1 cb)
+{
+	std::list<boost::shared_ptr<SpinelNCPTask> >::const_iterator iter;
+	std::list<std::string> result;
+	char c_string[80];
+	int exclusive_count = 0;
+	int shareable_count = 0;
+	int running_count = 0;
+
+	for (iter = mTaskQueue.begin(); iter != mTaskQueue.end(); ++iter) {
+		if ((*iter)->mStarted) {
+			running_count++;
+		} else if ((*iter)->is_shareable()) {
+			shareable_count++;
+		} else {
+			exclusive_count++;
+		}
+	}
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %d", "Running", running_count);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %d", "WaitingExclusive", exclusive_count);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %d", "WaitingShareable", shareable_count);
+	result.push_back(c_string);
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonTaskQueueWaitTime(CallbackWithStatusArg1 cb)
+{
+	static const char* const kNames[] = { "Exclusive", "Shareable" };
+	std::list<std::string> result;
+	char c_string[120];
+
+	for (int i = 0; i < 2; i++) {
+		const TaskWaitStats& stats = mTaskWaitStats[i];
+		unsigned int average = 0;
+
+		if (stats.mTaskCount != 0) {
+			average = static_cast<unsigned int>(stats.mWaitSum / stats.mTaskCount);
+		}
+
+		snprintf(c_string, sizeof(c_string), "%-20s = avg %u ms, max %u ms, %u tasks",
+			kNames[i], average, static_cast<unsigned int>(stats.mWaitMax), stats.mTaskCount);
+		result.push_back(c_string);
+	}
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+SpinelNCPInstance::get_prop_DaemonNCPResponseCounters(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+	char c_string[80];
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Routed", mResponseRoutedCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Late", mResponseLateCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Orphaned", mResponseOrphanedCount);
+	result.push_back(c_string);
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
 void
 SpinelNCPInstance::get_prop_POSIXAppRCPVersionCached(CallbackWithStatusArg1 cb)
 {
@@ -4268,6 +4982,15 @@ SpinelNCPInstance::regsiter_all_set_handlers(void)
 	register_set_handler(
 		kWPANTUNDProperty_DaemonTickleOnHostDidWake,
 		boost::bind(&SpinelNCPInstance::set_prop_DaemonTickleOnHostDidWake, this, _1, _2));
+	register_set_handler(
+		kWPANTUNDProperty_DaemonNCPMaxFramesPerIteration,
+		boost::bind(&SpinelNCPInstance::set_prop_DaemonNCPMaxFramesPerIteration, this, _1, _2));
+	register_set_handler(
+		kWPANTUNDProperty_DaemonNCPDataPlaneThread,
+		boost::bind(&SpinelNCPInstance::set_prop_DaemonNCPDataPlaneThread, this, _1, _2));
+	register_set_handler(
+		kWPANTUNDProperty_ConfigNCPFraming,
+		boost::bind(&SpinelNCPInstance::set_prop_ConfigNCPFraming, this, _1, _2));
 	register_set_handler(
 		kWPANTUNDProperty_MACFilterFixedRssi,
 		boost::bind(&SpinelNCPInstance::set_prop_MACFilterFixedRssi, this, _1, _2));
@@ -4752,6 +5475,103 @@ SpinelNCPInstance::set_prop_DaemonTickleOnHostDidWake(const boost::any &value, C
 	cb(kWPANTUNDStatus_Ok);
 }
 
+void
+SpinelNCPInstance::set_prop_DaemonNCPMaxFramesPerIteration(const boost::any &value, CallbackWithStatus cb)
+{
+	int max_frames = any_to_int(value);
+
+	if (max_frames < 1) {
+		cb(kWPANTUNDStatus_InvalidArgument);
+		return;
+	}
+
+	mMaxInboundFramesPerIteration = max_frames;
+	syslog(LOG_INFO, "MaxFramesPerIteration is %d", mMaxInboundFramesPerIteration);
+	cb(kWPANTUNDStatus_Ok);
+}
+
+void
+SpinelNCPInstance::set_prop_DaemonNCPDataPlaneThread(const boost::any &value, CallbackWithStatus cb)
+{
+	bool enabled = any_to_bool(value);
+
+#if !WPANTUND_SPINEL_DATA_PLANE_THREAD
+	if (enabled) {
+		cb(kWPANTUNDStatus_FeatureNotSupported);
+		return;
+	}
+#endif
+
+	// The thread is started or stopped from the main loop.
+	mDataPlaneThreadEnabled = enabled;
+	syslog(LOG_INFO, "DataPlaneThread is %s", enabled ? "enabled" : "disabled");
+	cb(kWPANTUNDStatus_Ok);
+}
+
+void
+SpinelNCPInstance::set_prop_ConfigNCPFraming(const boost::any &value, CallbackWithStatus cb)
+{
+	std::string name = any_to_string(value);
+	Framing framing;
+
+	if (name.empty() || strcaseequal(name.c_str(), "auto")) {
+		framing = kFramingAuto;
+	} else if (strcaseequal(name.c_str(), "hdlc")) {
+		framing = kFramingHDLC;
+	} else if (strcaseequal(name.c_str(), "flen")) {
+		framing = kFramingFLEN;
+	} else if (strcaseequal(name.c_str(), "datagram")) {
+		framing = kFramingDatagram;
+	} else {
+		cb(kWPANTUNDStatus_InvalidArgument);
+		return;
+	}
+
+	if ((framing == kFramingDatagram) && !mSerialAdapter->is_framed()) {
+		syslog(LOG_WARNING, "Framing is datagram, but the NCP socket doesn't keep message boundaries");
+	}
+
+#if WPANTUND_SPINEL_DATA_PLANE_THREAD
+	// The data-plane thread frames and unframes on its own, and only
+	// knows HDLC.
+	if ((resolve_framing(framing) != get_framing()) && mDataPlaneRunning) {
+		cb(kWPANTUNDStatus_InvalidForCurrentState);
+		return;
+	}
+#endif
+
+	if (framing != mFraming) {
+		const Framing old_framing = get_framing();
+
+		mFraming = framing;
+
+		if (get_framing() != old_framing) {
+			// Anything read or queued so far was framed the old way.
+			// The callbacks are fired last, since they may well stage
+			// another frame, which will go out with the new framing.
+			boost::function<void(int)> callback = mOutboundCallback;
+
+			mOutboundCallback.clear();
+			mOutboundBufferLen = 0;
+			mInboundChunkLen = 0;
+			mInboundChunkOffset = 0;
+			hdlc_decoder_reset(&mInboundFrameDecoder);
+
+			NLPT_INIT(&mNCPToDriverPumpPT);
+			NLPT_INIT(&mDriverToNCPPumpPT);
+
+			drain_outbound_queue(kWPANTUNDStatus_Canceled);
+
+			if (!callback.empty()) {
+				callback(kWPANTUNDStatus_Canceled);
+			}
+		}
+	}
+
+	syslog(LOG_INFO, "Framing is %s", framing_to_cstr(get_framing()));
+	cb(kWPANTUNDStatus_Ok);
+}
+
 void
 SpinelNCPInstance::set_prop_MACFilterFixedRssi(const boost::any &value, CallbackWithStatus cb)
 {
@@ -5410,6 +6230,7 @@ SpinelNCPInstance::handle_ncp_spinel_value_is(spinel_prop_key_t key, const uint8
 		syslog(LOG_INFO, "[-NCP-]: Last status (%s, %d)", spinel_status_to_cstr(status), status);
 		if ((status >= SPINEL_STATUS_RESET__BEGIN) && (status <= SPINEL_STATUS_RESET__END)) {
 			syslog(LOG_NOTICE, "[-NCP-]: NCP was reset (%s, %d)", spinel_status_to_cstr(status), status);
+			property_cache_invalidate_all();
 			process_event(EVENT_NCP_RESET, status);
 			if (!mResetIsExpected && (mDriverState == NORMAL_OPERATION)) {
 				wpantund_status_t wstatus = kWPANTUNDStatus_NCP_Reset;
@@ -6535,6 +7356,11 @@ SpinelNCPInstance::handle_ncp_spinel_value_removed(spinel_prop_key_t key, const
 void
 SpinelNCPInstance::handle_ncp_state_change(NCPState new_ncp_state, NCPState old_ncp_state)
 {
+	// The base class may reset or hibernate the serial adapter.
+	if (ncp_state_is_detached_from_ncp(new_ncp_state)) {
+		stop_data_plane();
+	}
+
 	NCPInstanceBase::handle_ncp_state_change(new_ncp_state, old_ncp_state);
 
 	if ( ncp_state_is_joining_or_joined(old_ncp_state)
@@ -6571,11 +7397,15 @@ SpinelNCPInstance::handle_ncp_state_change(NCPState new_ncp_state, NCPState old_
 			);
 		}
 	}
+
+	publish_data_plane_policy();
 }
 
 void
 SpinelNCPInstance::handle_ncp_spinel_callback(unsigned int command, const uint8_t* cmd_data_ptr, spinel_size_t cmd_data_len)
 {
+	begin_response_routing();
+
 	switch (command) {
 	case SPINEL_CMD_PROP_VALUE_IS:
 	case SPINEL_CMD_PROP_VALUE_INSERTED:
@@ -6596,12 +7426,15 @@ SpinelNCPInstance::handle_ncp_spinel_callback(unsigned int command, const uint8_
 
 			switch (command) {
 			case SPINEL_CMD_PROP_VALUE_IS:
+				property_cache_update(key, value_data_ptr, value_data_len);
 				handle_ncp_spinel_value_is(key, value_data_ptr, value_data_len);
 				break;
 			case SPINEL_CMD_PROP_VALUE_INSERTED:
+				property_cache_invalidate(key);
 				handle_ncp_spinel_value_inserted(key, value_data_ptr, value_data_len);
 				break;
 			case SPINEL_CMD_PROP_VALUE_REMOVED:
+				property_cache_invalidate(key);
 				handle_ncp_spinel_value_removed(key, value_data_ptr, value_data_len);
 				break;
 			}
@@ -6611,6 +7444,8 @@ SpinelNCPInstance::handle_ncp_spinel_callback(unsigned int command, const uint8_
 	default:
 		process_event(EVENT_NCP(command), cmd_data_ptr[0], cmd_data_ptr, cmd_data_len);
 	}
+
+	end_response_routing();
 }
 
 bool
@@ -7115,6 +7950,8 @@ SpinelNCPInstance::is_busy(void)
 void
 SpinelNCPInstance::process(void)
 {
+	update_data_plane();
+
 	NCPInstanceBase::process();
 
 	mVendorCustom.process();
@@ -28,11 +28,18 @@
 #include "SocketWrapper.h"
 #include "SocketAsyncOp.h"
 #include "ValueMap.h"
+#include "RingBuffer.h"
+#include "ObjectPool.h"
+#include "SPSCRing.h"
+#include "hdlc.h"
 
 #include <queue>
 #include <set>
 #include <map>
 #include <errno.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "spinel.h"
 
 #include "SpinelNCPVendorCustom.h"
@@ -41,7 +48,7 @@ WPANTUND_DECLARE_NCPINSTANCE_PLUGIN(spinel, SpinelNCPInstance);
 
 #define EVENT_NCP_MARKER         0xAB000000
 #define EVENT_NCP(x)             ((x)|EVENT_NCP_MARKER)
-#define IS_EVENT_FROM_NCP(x)     (((x)&~0xFFFFFF) == EVENT_NCP_MARKER)
+#define IS_EVENT_FROM_NCP(x)     (((x)&~0xFFFFFF) == static_cast<int>(EVENT_NCP_MARKER))
 
 
 #define EVENT_NCP_RESET                (0xFF0000|EVENT_NCP_MARKER)
@@ -51,6 +58,16 @@ WPANTUND_DECLARE_NCPINSTANCE_PLUGIN(spinel, SpinelNCPInstance);
 
 #define NCP_FRAMING_OVERHEAD 3
 
+// The data-plane thread only speaks plain HDLC to the NCP, so it is
+// left out of builds which transform the stream, and only runs while
+// the framing in use is HDLC.
+#if HAVE_PTHREAD_H && !OPENTHREAD_ENABLE_NCP_SPINEL_ENCRYPTER \
+	&& !FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+#define WPANTUND_SPINEL_DATA_PLANE_THREAD 1
+#else
+#define WPANTUND_SPINEL_DATA_PLANE_THREAD 0
+#endif
+
 #define CONTROL_REQUIRE_EMPTY_OUTBOUND_BUFFER_WITHIN(seconds, error_label) do { \
 		EH_WAIT_UNTIL_WITH_TIMEOUT(seconds, (GetInstance(this)->mOutboundBufferLen <= 0) && GetInstance(this)->mOutboundCallback.empty()); \
 		require_string(!eh_did_timeout, error_label, "Timed out while waiting " # seconds " seconds for empty outbound buffer"); \
@@ -72,17 +89,22 @@ WPANTUND_DECLARE_NCPINSTANCE_PLUGIN(spinel, SpinelNCPInstance);
 	} while (0)
 
 #define CONTROL_REQUIRE_PREP_TO_SEND_COMMAND_WITHIN(timeout, error_label) do { \
-		CONTROL_REQUIRE_EMPTY_OUTBOUND_BUFFER_WITHIN(timeout, error_label); \
-		GetInstance(this)->mLastTID = SPINEL_GET_NEXT_TID(GetInstance(this)->mLastTID); \
+		EH_WAIT_UNTIL_WITH_TIMEOUT(timeout, (GetInstance(this)->mOutboundBufferLen <= 0) && GetInstance(this)->mOutboundCallback.empty() && GetInstance(this)->has_free_tid()); \
+		require_string(!eh_did_timeout, error_label, "Timed out while waiting " # timeout " seconds for empty outbound buffer and a free TID"); \
+		GetInstance(this)->mLastTID = GetInstance(this)->get_next_tid(); \
 		mLastHeader = (SPINEL_HEADER_FLAG | SPINEL_HEADER_IID_0 | (GetInstance(this)->mLastTID << SPINEL_HEADER_TID_SHIFT)); \
+		GetInstance(this)->route_response_to(mLastHeader, this); \
 	} while (false)
 
 #define CONTROL_REQUIRE_COMMAND_RESPONSE_WITHIN(timeout, error_label) do { \
-		EH_REQUIRE_WITHIN(	\
+		EH_WAIT_UNTIL_WITH_TIMEOUT(	\
 			timeout,	\
-			IS_EVENT_FROM_NCP(event) && GetInstance(this)->mInboundHeader == mLastHeader, \
-			error_label	\
+			IS_EVENT_FROM_NCP(event) && GetInstance(this)->mInboundHeader == mLastHeader \
 		);	\
+		if (eh_did_timeout) { \
+			GetInstance(this)->expire_response_route(mLastHeader); \
+		} \
+		require_string(!eh_did_timeout, error_label, "Timed out waiting for command response"); \
 	} while (false)
 
 namespace nl {
@@ -137,6 +159,7 @@ protected:
 
 protected:
 
+	int vprocess_control(int event, va_list args);
 	int vprocess_init(int event, va_list args);
 	int vprocess_disabled(int event, va_list args);
 	int vprocess_associated(int event, va_list args);
@@ -230,7 +253,31 @@ private:
 
 	void regsiter_all_get_handlers(void);
 
+	// Property value cache, filled from `PROP_VALUE_IS` frames.
+	enum PropertyCachePolicy {
+		kPropertyCacheAlwaysFresh,        // Never cached
+		kPropertyCacheUntilInvalidated,   // The NCP reports every change
+		kPropertyCacheTTL,                // Cached for a fixed time
+	};
+
+	struct PropertyCacheEntry {
+		PropertyCachePolicy mPolicy;
+		cms_t mTTL;
+		bool mIsValid;
+		cms_t mUpdatedAt;
+		Data mValue;
+	};
+
+	void set_property_cache_policy(spinel_prop_key_t prop_key, PropertyCachePolicy policy, cms_t ttl = 0);
+	void setup_property_cache_policies(void);
+	const Data* property_cache_lookup(spinel_prop_key_t prop_key);
+	bool is_property_change_pending(spinel_prop_key_t prop_key) const;
+	void property_cache_update(spinel_prop_key_t prop_key, const uint8_t* value_data_ptr, spinel_size_t value_data_len);
+	void property_cache_invalidate(spinel_prop_key_t prop_key);
+	void property_cache_invalidate_all(void);
+
 	void get_prop_ConfigNCPDriverName(CallbackWithStatusArg1 cb);
+	void get_prop_ConfigNCPFraming(CallbackWithStatusArg1 cb);
 	void get_prop_NCPCapabilities(CallbackWithStatusArg1 cb);
 	void get_prop_NetworkIsCommissioned(CallbackWithStatusArg1 cb);
 	void get_prop_ThreadRouterID(CallbackWithStatusArg1 cb);
@@ -278,6 +325,16 @@ private:
 	void get_prop_DatasetAllFiledsAsValMap(CallbackWithStatusArg1 cb);
 	void get_prop_DatasetCommand(CallbackWithStatusArg1 cb);
 	void get_prop_DaemonTickleOnHostDidWake(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonNCPMaxFramesPerIteration(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonNCPInboundPumpCounters(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonNCPDataPlaneThread(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonNCPDataPlaneCounters(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonNCPOutboundQueueDepth(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonNCPOutboundQueueLatency(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonTaskQueueDepth(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonTaskQueueWaitTime(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonNCPResponseCounters(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonNCPPropertyCache(CallbackWithStatusArg1 cb);
 	void get_prop_POSIXAppRCPVersionCached(CallbackWithStatusArg1 cb);
 	void get_prop_MACFilterFixedRssi(CallbackWithStatusArg1 cb);
 
@@ -338,6 +395,9 @@ private:
 	void set_prop_DatasetDestIpAddress(const boost::any &value, CallbackWithStatus cb);
 	void set_prop_DatasetCommand(const boost::any &value, CallbackWithStatus cb);
 	void set_prop_DaemonTickleOnHostDidWake(const boost::any &value, CallbackWithStatus cb);
+	void set_prop_DaemonNCPMaxFramesPerIteration(const boost::any &value, CallbackWithStatus cb);
+	void set_prop_DaemonNCPDataPlaneThread(const boost::any &value, CallbackWithStatus cb);
+	void set_prop_ConfigNCPFraming(const boost::any &value, CallbackWithStatus cb);
 	void set_prop_MACFilterFixedRssi(const boost::any &value, CallbackWithStatus cb);
 	void set_prop_JoinerDiscernerBitLength(const boost::any &value, CallbackWithStatus cb);
 	void set_prop_JoinerDiscernerValue(const boost::any &value, CallbackWithStatus cb);
@@ -379,6 +439,10 @@ public:
 public:
 	virtual cms_t get_ms_to_next_event(void);
 
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout);
+
+	virtual void hard_reset_ncp(void);
+
 	virtual void reset_tasks(wpantund_status_t status = kWPANTUNDStatus_Canceled);
 
 	static void handle_ncp_debug_stream(const uint8_t* data_ptr, int data_len);
@@ -420,31 +484,271 @@ private:
 	enum {
 		kMaxCommissionerEnergyScanResultEntries = 64,
 		kMaxCommissionerPanIdConflictResultEntries = 64,
+		kInboundChunkSize = 4096,
+		kDefaultMaxInboundFramesPerIteration = 8,
+		kOutboundQueueSlots = 4,
+
+		// At most this many slots of the outbound queue may hold IPv6
+		// traffic, so that a control command never has more than a
+		// couple of data frames ahead of it.
+		kOutboundQueueDataSlots = 2,
+
+		// Number of IPv6 packets which may be read ahead from the
+		// tunnel interfaces while waiting for the outbound queue.
+		kOutboundPacketPoolSize = 8,
+
+		// Network-control packets sent per bulk packet when both
+		// classes have packets waiting.
+		kOutboundNetControlWeight = 4,
+
+		// Shareable tasks allowed to run ahead of the task queue's head.
+		kMaxConcurrentSharedTasks = 4,
+
+		// Depths of the rings between the main loop and the
+		// data-plane thread.
+		kDataPlaneFromNCPSlots = 16,
+		kDataPlaneFromHostSlots = 8,
+		kDataPlaneToNCPSlots = 4,
+		kDataPlaneRecordSlots = 64,
+
+		// Enough of an IPv6 packet for `StatCollector`: the IPv6
+		// header and the transport ports.
+		kDataPlaneRecordHeaderSize = 48,
+	};
+
+	// Traffic classes for the driver-to-NCP direction. Control frames
+	// have strict priority, the other two share what is left by
+	// weighted round robin.
+	enum OutboundClass {
+		kOutboundClassControl,     // Spinel commands from tasks
+		kOutboundClassNetControl,  // ICMPv6 (incl. ND and MLD) and MLE
+		kOutboundClassBulk,        // All other IPv6 traffic
+		kOutboundClassCount
+	};
+
+	// How Spinel frames are kept apart on the serial adapter.
+	enum Framing {
+		kFramingAuto,              // Datagram on sockets which keep message boundaries, else the default
+		kFramingHDLC,              // HDLC-lite, with escaping and a CRC
+		kFramingFLEN,              // A flag byte and a big-endian length
+		kFramingDatagram,          // Exactly one frame per read or write
+	};
+
+	// An outbound frame which has already been framed for the wire
+	// and is waiting to be written to the serial adapter.
+	struct OutboundFrame {
+		uint8_t mData[HDLC_ENCODED_FRAME_SIZE_MAX(SPINEL_FRAME_BUFFER_SIZE)];
+		size_t mLen;
+		size_t mSent;
+		bool mIsReset;
+		OutboundClass mClass;
+		cms_t mQueuedAt;
+		boost::function<void(int)> mCallback;
+	};
+
+	// An IPv6 packet read from a tunnel interface, already wrapped
+	// in its Spinel command, waiting for room in the outbound queue.
+	struct OutboundPacket {
+		uint8_t mFrame[SPINEL_FRAME_BUFFER_SIZE];
+		spinel_ssize_t mLen;
+		cms_t mQueuedAt;
+	};
+
+	struct OutboundClassStats {
+		uint32_t mFrameCount;
+		uint64_t mLatencySum;
+		cms_t mLatencyMax;
 	};
 
+	// A frame de-framed by the data-plane thread for the main loop.
+	struct DataPlaneFrame {
+		uint8_t mData[SPINEL_FRAME_BUFFER_SIZE];
+		spinel_size_t mLen;
+		hdlc_decode_status_t mStatus;
+		uint16_t mCRC;
+	};
+
+	// The start of an IPv6 packet forwarded by the data-plane thread,
+	// so that the main loop can account for it in `StatCollector`.
+	struct DataPlaneRecord {
+		uint8_t mHeader[kDataPlaneRecordHeaderSize];
+		bool mInbound;
+	};
+
+	// A frame handed to the data-plane thread, as seen by the main loop.
+	struct DataPlaneSent {
+		boost::function<void(int)> mCallback;
+		bool mIsReset;
+	};
+
+	static OutboundClass classify_outbound_packet(const uint8_t* packet, spinel_ssize_t len);
+	static spinel_ssize_t set_outbound_packet_header(uint8_t* frame, spinel_ssize_t len, uint8_t type);
+	int read_outbound_packet(void);
+	OutboundPacket* dequeue_outbound_packet(OutboundClass* frame_class);
+	int get_outbound_packet_count(void) const;
+	int get_outbound_data_frame_count(void) const;
+	int get_outbound_class_depth(OutboundClass frame_class) const;
+	bool frame_outbound(OutboundFrame& slot, uint8_t* frame, spinel_ssize_t frame_len);
+	bool enqueue_outbound_frame(uint8_t* frame, spinel_ssize_t frame_len, OutboundClass frame_class, cms_t queued_at,
+					const boost::function<void(int)>& callback);
+	ssize_t flush_outbound_queue(void);
+	void complete_outbound_frame(int status);
+	void drain_outbound_queue(int status);
+
+	Framing get_framing(void) const;
+	Framing resolve_framing(Framing framing) const;
+	static const char* framing_to_cstr(Framing framing);
+
+	bool handle_inbound_frame(void);
+	void handle_inbound_bad_crc_frame(uint16_t crc);
+
+	// Data-plane thread, main loop side
+	bool data_plane_can_bypass_filters(void);
+	void publish_data_plane_policy(void);
+	void update_data_plane(void);
+	void start_data_plane(void);
+	void stop_data_plane(void);
+	bool data_plane_has_work(void);
+	void data_plane_to_driver(void);
+	void driver_to_data_plane(void);
+	void send_to_data_plane(uint8_t* frame, spinel_ssize_t frame_len, const boost::function<void(int)>& callback);
+	void wake_data_plane(void);
+	void reap_data_plane_frames(void);
+	void drain_data_plane_records(void);
+
+	// Data-plane thread, thread side
+	static void* data_plane_thread_entry(void* context);
+	void data_plane_main(void);
+	void notify_data_plane_owner(void);
+	int data_plane_read_ncp(bool* notify);
+	int data_plane_read_host(bool* notify);
+	int data_plane_write_ncp(bool* notify);
+	bool data_plane_forward_to_host(const uint8_t* frame, spinel_size_t frame_len, bool* notify);
+	void data_plane_record_packet(bool inbound, const uint8_t* packet, size_t len, bool* notify);
+
+	uint8_t get_next_tid(void);
+	bool has_free_tid(void) const;
+
+	// Response routing: a response (a frame with a non-zero TID) only
+	// wakes whoever sent the command, rather than every task.
+	void route_response_to(uint8_t header, EventHandler* waiter);
+	void expire_response_route(uint8_t header);
+	void forget_response_routes(EventHandler* waiter);
+	void begin_response_routing(void);
+	void end_response_routing(void);
+	int dispatch_routed_response(int event, va_list args);
+	int process_event_for_command(uint8_t header, int event);
+	int dispatch_routed_event(int event, ...);
+
 	SpinelNCPControlInterface mControlInterface;
 
 	uint8_t mLastTID;
 
+	// Bit `n` is set while a task is waiting for the response to a
+	// command sent with TID `n`.
+	uint16_t mReservedTIDs;
+
 	uint8_t mLastHeader;
 
+	struct ResponseRoute {
+		EventHandler* mWaiter;  // NULL once the waiter gave up or went away
+		uint8_t mHeader;        // Zero if nothing was sent with this TID
+	};
+
+	ResponseRoute mResponseRoutes[SPINEL_HEADER_TID_MASK + 1];
+	bool mRoutingResponse;
+	EventHandler* mRoutedResponseWaiter;
+	uint32_t mResponseRoutedCount;
+	uint32_t mResponseOrphanedCount;
+	uint32_t mResponseLateCount;
+
 	uint8_t mInboundFrame[SPINEL_FRAME_BUFFER_SIZE];
 	uint8_t mInboundHeader;
 	spinel_size_t mInboundFrameSize;
 	uint8_t mInboundFrameDataType;
 	const uint8_t* mInboundFrameDataPtr;
 	spinel_size_t mInboundFrameDataLen;
-	uint16_t mInboundFrameHDLCCRC;
-
-	uint8_t mOutboundBufferHeader[3];
+	struct hdlc_decoder mInboundFrameDecoder;
+
+	// Raw bytes read from the serial adapter that have not been
+	// de-framed yet.
+	uint8_t mInboundChunk[kInboundChunkSize];
+	size_t mInboundChunkLen;
+	size_t mInboundChunkOffset;
+
+	// As configured by `Config:NCP:Framing`; see `get_framing()` for
+	// the framing in effect.
+	Framing mFraming;
+
+	// Number of inbound frames the pump may handle per run through
+	// the main loop before yielding.
+	int mMaxInboundFramesPerIteration;
+	int mInboundFramesThisIteration;
+	uint32_t mInboundPumpIterationCount;
+	uint32_t mInboundPumpFrameCount;
+	uint32_t mInboundFrameBudgetHitCount;
+
+	// Staging area for the next outbound frame. The driver-to-NCP
+	// pump moves it into `mOutboundQueue` as soon as a slot is free.
 	uint8_t mOutboundBuffer[SPINEL_FRAME_BUFFER_SIZE];
-	uint8_t mOutboundBufferType;
 	spinel_ssize_t mOutboundBufferLen;
-	spinel_ssize_t mOutboundBufferSent;
-	uint8_t mOutboundBufferEscaped[SPINEL_FRAME_BUFFER_SIZE*2];
-	spinel_ssize_t mOutboundBufferEscapedLen;
 	boost::function<void(int)> mOutboundCallback;
 
+	// Ring of frames waiting to be written, oldest first.
+	OutboundFrame mOutboundQueue[kOutboundQueueSlots];
+	int mOutboundQueueHead;
+	int mOutboundQueueCount;
+
+	// IPv6 packets waiting for the outbound queue, by traffic class.
+	// Control frames are staged in `mOutboundBuffer` instead.
+	ObjectPool<OutboundPacket, kOutboundPacketPoolSize> mOutboundPacketPool;
+	RingBuffer<OutboundPacket*, kOutboundPacketPoolSize> mOutboundPacketQueue[kOutboundClassCount];
+	int mOutboundNetControlCredit;
+
+	OutboundClassStats mOutboundClassStats[kOutboundClassCount];
+
+	// Data-plane thread. Apart from the rings, the thread only touches
+	// the members below marked as its own, the serial adapter and the
+	// primary interface (and `mDropFirewall`, which never changes).
+	bool mDataPlaneThreadEnabled;
+	bool mDataPlaneRunning;
+#if HAVE_PTHREAD_H
+	pthread_t mDataPlaneThread;
+#endif
+	int mDataPlaneWakeFD[2];     // Main loop -> thread
+	int mDataPlaneNotifyFD[2];   // Thread -> main loop
+
+	// Accessed atomically from both sides.
+	bool mDataPlaneStop;
+	bool mDataPlaneBypassFilters;
+	bool mDataPlaneWakePending;
+	bool mDataPlaneNotifyPending;
+	int mDataPlaneError;
+	uint32_t mDataPlaneToHostCount;
+	uint32_t mDataPlaneToNCPCount;
+	uint32_t mDataPlaneHandoffCount;
+	uint32_t mDataPlaneRecordDropCount;
+
+	SPSCRing<DataPlaneFrame, kDataPlaneFromNCPSlots> mDataPlaneFromNCP;
+	SPSCRing<OutboundPacket, kDataPlaneFromHostSlots> mDataPlaneFromHost;
+	SPSCRing<OutboundFrame, kDataPlaneToNCPSlots> mDataPlaneToNCP;
+	SPSCRing<DataPlaneRecord, kDataPlaneRecordSlots> mDataPlaneRecords;
+
+	// Main loop only: frames in `mDataPlaneToNCP`, oldest first.
+	DataPlaneSent mDataPlaneSent[kDataPlaneToNCPSlots];
+	int mDataPlaneSentHead;
+	int mDataPlaneSentCount;
+
+	// Data-plane thread only.
+	struct hdlc_decoder mDataPlaneDecoder;
+	uint8_t mDataPlaneChunk[kInboundChunkSize];
+	size_t mDataPlaneChunkLen;
+	size_t mDataPlaneChunkOffset;
+	OutboundFrame mDataPlaneDataFrame;
+	bool mDataPlaneDataFramePending;
+	OutboundFrame* mDataPlaneTXFrame;
+	bool mDataPlaneTXHalted;
+
 	int mTXPower;
 	uint8_t mThreadMode;
 	bool mIsCommissioned;
@@ -494,8 +798,25 @@ private:
 
 	bool mIsPcapInProgress;
 
+	std::map<spinel_prop_key_t, PropertyCacheEntry> mPropertyCache;
+	uint32_t mPropertyCacheHitCount;
+	uint32_t mPropertyCacheMissCount;
+	uint32_t mPropertyCacheInvalidationCount;
+
 	// Task management
+	struct TaskWaitStats {
+		uint32_t mTaskCount;
+		uint64_t mWaitSum;
+		cms_t mWaitMax;
+	};
+
+	bool can_start_shared_task(void) const;
+	void collect_runnable_tasks(std::vector<boost::shared_ptr<SpinelNCPTask> >& tasks) const;
+	void note_task_started(SpinelNCPTask& task);
+
 	std::list<boost::shared_ptr<SpinelNCPTask> > mTaskQueue;
+	uint32_t mTaskDispatchSerial;
+	TaskWaitStats mTaskWaitStats[2];  // Indexed by `SpinelNCPTask::is_shareable()`
 
 	// The vendor custom class needs to
 	// remain as the last thing in this class.
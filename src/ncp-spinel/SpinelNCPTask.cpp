@@ -24,6 +24,7 @@
 #include "assert-macros.h"
 #include <syslog.h>
 #include <errno.h>
+#include <algorithm>
 #include "SpinelNCPTask.h"
 #include "SpinelNCPInstance.h"
 #include "any-to.h"
@@ -32,15 +33,63 @@ using namespace nl;
 using namespace nl::wpantund;
 
 SpinelNCPTask::SpinelNCPTask(SpinelNCPInstance* _instance, CallbackWithStatusArg1 cb):
-	mInstance(_instance), mCB(cb), mNextCommandTimeout(NCP_DEFAULT_COMMAND_RESPONSE_TIMEOUT)
+	mInstance(_instance), mQueuedAt(0), mStarted(false), mDispatchSerial(0),
+	mCB(cb), mNextCommandTimeout(NCP_DEFAULT_COMMAND_RESPONSE_TIMEOUT), mNextCommandHoldsTID(false),
+	mPipelineNextToSend(0), mPipelineInFlight(0), mPipelineDepth(kDefaultPipelineDepth),
+	mPipelineRet(kWPANTUNDStatus_Ok), mPipelineLastSend(0)
 {
+	memset(mPipelineIndexForTID, kPipelineNoIndex, sizeof(mPipelineIndexForTID));
 }
 
 SpinelNCPTask::~SpinelNCPTask()
 {
+	// Give back any TIDs we still hold.
+	release_command_tid();
+	pipeline_abort(kWPANTUNDStatus_Canceled);
+	mInstance->forget_response_routes(this);
+
 	finish(kWPANTUNDStatus_Canceled);
 }
 
+cms_t
+SpinelNCPTask::get_ms_to_next_event(void)
+{
+	// Don't let the main loop sleep while a pipeline has a command
+	// ready to stage.
+	if (pipeline_can_send()) {
+		return 0;
+	}
+
+	return EventHandler::get_ms_to_next_event();
+}
+
+bool
+SpinelNCPTask::is_shareable(void) const
+{
+	return false;
+}
+
+bool
+SpinelNCPTask::allows_concurrent_reads(void) const
+{
+	return false;
+}
+
+bool
+SpinelNCPTask::may_change_property(spinel_prop_key_t prop_key) const
+{
+	return !is_shareable();
+}
+
+void
+SpinelNCPTask::release_command_tid(void)
+{
+	if (mNextCommandHoldsTID) {
+		GetInstance(this)->mReservedTIDs &= ~(1 << SPINEL_HEADER_GET_TID(mLastHeader));
+		mNextCommandHoldsTID = false;
+	}
+}
+
 void
 SpinelNCPTask::finish(int status, const boost::any& value)
 {
@@ -66,6 +115,11 @@ SpinelNCPTask::vprocess_send_command(int event, va_list args)
 	require(mNextCommand.size() < sizeof(GetInstance(this)->mOutboundBuffer), on_error);
 
 	CONTROL_REQUIRE_PREP_TO_SEND_COMMAND_WITHIN(NCP_DEFAULT_COMMAND_SEND_TIMEOUT, on_error);
+
+	// Keep other tasks from reusing our TID until we have our answer.
+	GetInstance(this)->mReservedTIDs |= (1 << SPINEL_HEADER_GET_TID(mLastHeader));
+	mNextCommandHoldsTID = true;
+
 	memcpy(GetInstance(this)->mOutboundBuffer, mNextCommand.data(), mNextCommand.size());
 	GetInstance(this)->mOutboundBufferLen = static_cast<spinel_ssize_t>(mNextCommand.size());
 	CONTROL_REQUIRE_OUTBOUND_BUFFER_FLUSHED_WITHIN(NCP_DEFAULT_COMMAND_SEND_TIMEOUT, on_error);
@@ -91,14 +145,229 @@ SpinelNCPTask::vprocess_send_command(int event, va_list args)
 		mNextCommandRet = spinel_status_to_wpantund_status(mNextCommandRet);
 	}
 
+	release_command_tid();
+
 	EH_EXIT();
 
 on_error:
+	GetInstance(this)->expire_response_route(mLastHeader);
+	release_command_tid();
 	mNextCommandRet = kWPANTUNDStatus_Timeout;
 
 	EH_END();
 }
 
+SpinelNCPTask::PipelinedCommand::PipelinedCommand(const Data& command):
+	mCommand(command), mHeader(0), mSentAt(0), mStatus(kWPANTUNDStatus_InProgress),
+	mHasReply(false), mReplyKey(0)
+{
+}
+
+static const int kEventPipelineSendFinished = 0xFF000000 | __LINE__;
+static const int kEventPipelineSendFailed = 0xFE000000 | __LINE__;
+
+bool
+SpinelNCPTask::pipeline_can_send(void) const
+{
+	return (mPipelineRet == kWPANTUNDStatus_Ok)
+	    && (mPipelineNextToSend < mPipeline.size())
+	    && (mPipelineInFlight < std::min<int>(mPipelineDepth, kPipelineDepthMax))
+	    && (GetInstance(this)->mOutboundBufferLen <= 0)
+	    && GetInstance(this)->mOutboundCallback.empty()
+	    && GetInstance(this)->has_free_tid();
+}
+
+void
+SpinelNCPTask::pipeline_send_next(void)
+{
+	SpinelNCPInstance* instance = GetInstance(this);
+	const uint8_t tid = instance->get_next_tid();
+	size_t index;
+
+	if (tid == 0) {
+		// Every TID is held; `pipeline_can_send()` waits for one.
+		return;
+	}
+
+	index = mPipelineNextToSend++;
+	PipelinedCommand& command = mPipeline[index];
+
+	if ((command.mCommand.size() < 2) || (command.mCommand.size() >= sizeof(instance->mOutboundBuffer))) {
+		pipeline_complete(index, kWPANTUNDStatus_InvalidArgument);
+		return;
+	}
+
+	instance->mLastTID = tid;
+	instance->mReservedTIDs |= (1 << tid);
+
+	command.mHeader = (SPINEL_HEADER_FLAG | SPINEL_HEADER_IID_0 | (tid << SPINEL_HEADER_TID_SHIFT));
+	command.mSentAt = mPipelineLastSend = time_ms();
+
+	memcpy(instance->mOutboundBuffer, command.mCommand.data(), command.mCommand.size());
+	instance->mOutboundBuffer[0] = command.mHeader;
+	instance->mOutboundBufferLen = static_cast<spinel_ssize_t>(command.mCommand.size());
+
+	// We only care about failures here, successful sends are
+	// confirmed by the response. A failure only concerns the task
+	// that sent the command, so it goes to nobody else.
+	instance->mOutboundCallback = CALLBACK_FUNC_SPLIT(
+		boost::bind(&NCPInstanceBase::process_event_helper, instance, kEventPipelineSendFinished),
+		boost::bind(&SpinelNCPInstance::process_event_for_command, instance, command.mHeader, kEventPipelineSendFailed)
+	);
+
+	instance->route_response_to(command.mHeader, this);
+
+	mPipelineIndexForTID[tid] = static_cast<uint8_t>(index);
+	mPipelineInFlight++;
+}
+
+void
+SpinelNCPTask::pipeline_handle_response(int event, va_list args)
+{
+	const uint8_t header = GetInstance(this)->mInboundHeader;
+	const spinel_tid_t tid = SPINEL_HEADER_GET_TID(header);
+	const uint8_t index = mPipelineIndexForTID[tid];
+	int status;
+
+	if ((tid == 0) || (index == kPipelineNoIndex) || (mPipeline[index].mHeader != header)) {
+		// Unsolicited, or the response to somebody else's command.
+		return;
+	}
+
+	status = peek_ncp_callback_status(event, args);
+
+	if (status) {
+		status = spinel_status_to_wpantund_status(status);
+	}
+
+	if (static_cast<int>(EVENT_NCP_PROP_VALUE_IS) == event) {
+		PipelinedCommand& command = mPipeline[index];
+		va_list tmp;
+
+		va_copy(tmp, args);
+		command.mReplyKey = va_arg(tmp, unsigned int);
+		const uint8_t* data_in = va_arg(tmp, const uint8_t*);
+		spinel_size_t data_len = va_arg_small(tmp, spinel_size_t);
+		va_end(tmp);
+
+		command.mReply = Data(data_in, data_len);
+		command.mHasReply = true;
+	}
+
+	pipeline_complete(index, status);
+}
+
+void
+SpinelNCPTask::pipeline_complete(size_t index, int status)
+{
+	PipelinedCommand& command = mPipeline[index];
+	const spinel_tid_t tid = SPINEL_HEADER_GET_TID(command.mHeader);
+
+	if (command.mHeader != 0) {
+		GetInstance(this)->expire_response_route(command.mHeader);
+		GetInstance(this)->mReservedTIDs &= ~(1 << tid);
+		mPipelineIndexForTID[tid] = kPipelineNoIndex;
+		mPipelineInFlight--;
+	}
+
+	command.mStatus = status;
+
+	if (status != kWPANTUNDStatus_Ok) {
+		syslog(LOG_INFO, "Pipelined command %d of %d failed: %d", (int)index + 1, (int)mPipeline.size(), status);
+
+		if (mPipelineRet == kWPANTUNDStatus_Ok) {
+			mPipelineRet = status;
+		}
+	}
+}
+
+void
+SpinelNCPTask::pipeline_abort(int status)
+{
+	size_t index;
+
+	for (index = 0; index < mPipelineNextToSend; index++) {
+		if (mPipeline[index].mStatus == kWPANTUNDStatus_InProgress) {
+			pipeline_complete(index, status);
+		}
+	}
+
+	for (; index < mPipeline.size(); index++) {
+		mPipeline[index].mStatus = kWPANTUNDStatus_Canceled;
+	}
+
+	mPipelineNextToSend = mPipeline.size();
+}
+
+cms_t
+SpinelNCPTask::pipeline_ms_to_timeout(void) const
+{
+	cms_t deadline = mPipelineLastSend + NCP_DEFAULT_COMMAND_SEND_TIMEOUT * MSEC_PER_SEC;
+	cms_t ret;
+	size_t index;
+
+	// Commands are answered in order, so the oldest outstanding
+	// command is the one that times out first.
+	for (index = 0; index < mPipelineNextToSend; index++) {
+		if (mPipeline[index].mStatus == kWPANTUNDStatus_InProgress) {
+			deadline = mPipeline[index].mSentAt + mNextCommandTimeout * MSEC_PER_SEC;
+			break;
+		}
+	}
+
+	ret = deadline - time_ms();
+
+	return (ret > 0) ? ret : 0;
+}
+
+int
+SpinelNCPTask::vprocess_send_commands(int event, va_list args)
+{
+	EH_BEGIN_SUB(&mSubPT);
+
+	mPipelineNextToSend = 0;
+	mPipelineInFlight = 0;
+	mPipelineRet = kWPANTUNDStatus_Ok;
+	mPipelineLastSend = time_ms();
+
+	while ( (mPipelineInFlight > 0)
+	     || ( (mPipelineRet == kWPANTUNDStatus_Ok)
+	       && (mPipelineNextToSend < mPipeline.size())
+	        )
+	) {
+		if (pipeline_can_send()) {
+			pipeline_send_next();
+		}
+
+		// The staged command goes out on this main loop pass, so the
+		// next one can be staged as soon as we get the following event.
+		schedule_next_event(pipeline_ms_to_timeout() / static_cast<float>(MSEC_PER_SEC));
+		EH_YIELD_UNTIL(
+			IS_EVENT_FROM_NCP(event)
+			|| (event == kEventPipelineSendFailed)
+			|| pipeline_can_send()
+			|| (EventHandler::get_ms_to_next_event() == 0)
+		);
+		unschedule_next_event();
+
+		if (IS_EVENT_FROM_NCP(event)) {
+			pipeline_handle_response(event, args);
+
+		} else if (event == kEventPipelineSendFailed) {
+			syslog(LOG_ERR, "Failure while trying to send pipelined command");
+			pipeline_abort(kWPANTUNDStatus_Failure);
+
+		} else if (pipeline_ms_to_timeout() == 0) {
+			syslog(LOG_ERR, "Timed out waiting for pipelined command");
+			pipeline_abort(kWPANTUNDStatus_Timeout);
+		}
+	}
+
+	pipeline_abort(kWPANTUNDStatus_Canceled);
+
+	EH_END();
+}
+
 nl::Data
 nl::wpantund::SpinelPackData(const char* pack_format, ...)
 {
@@ -29,6 +29,7 @@
 #include <queue>
 #include <set>
 #include <map>
+#include <vector>
 #include <errno.h>
 #include "spinel.h"
 
@@ -48,21 +49,90 @@ public:
 
 	virtual int vprocess_event(int event, va_list args) = 0;
 
+	virtual cms_t get_ms_to_next_event(void);
+
+	// Exclusive tasks run one at a time, in the order they were
+	// started. Shareable tasks only read from the NCP, so they may run
+	// alongside each other, and alongside an exclusive task which
+	// allows concurrent reads.
+	virtual bool is_shareable(void) const;
+
+	// Whether shareable tasks may start while this (exclusive) task is
+	// running. Tasks which take the NCP through intermediate states,
+	// or put it to sleep, must not allow it.
+	virtual bool allows_concurrent_reads(void) const;
+
+	// Whether the task may change the value of `prop_key` on the NCP,
+	// in which case a cached value can't be trusted until it finishes.
+	virtual bool may_change_property(spinel_prop_key_t prop_key) const;
+
 	virtual void finish(int status, const boost::any& value = boost::any());
 
 	bool peek_callback_is_prop_value_is(int event, va_list args, spinel_prop_key_t);
 
 	SpinelNCPInstance* mInstance;
 
+	// Bookkeeping for the task scheduler in `SpinelNCPInstance::vprocess_event()`.
+	cms_t mQueuedAt;
+	bool mStarted;
+	uint32_t mDispatchSerial;
+
 	int vprocess_send_command(int event, va_list args);
 
+	// Sends every command in `mPipeline` without waiting for the
+	// previous response, keeping up to `mPipelineDepth` of them
+	// outstanding. Responses are matched back to their command by TID.
+	// Each command's status (and property value, if the response was
+	// a `PROP_VALUE_IS`) is stored in its `mPipeline` entry, and the
+	// first error is stored in `mPipelineRet`. No new commands are sent
+	// once an error has occurred.
+	int vprocess_send_commands(int event, va_list args);
+
 protected:
+	enum {
+		kPipelineTIDCount = SPINEL_HEADER_TID_MASK + 1,
+		kPipelineNoIndex = 0xFF,
+
+		// One TID is always left for commands sent outside of a pipeline.
+		kPipelineDepthMax = kPipelineTIDCount - 2,
+		kDefaultPipelineDepth = 4,
+	};
+
+	struct PipelinedCommand {
+		PipelinedCommand(const Data& command = Data());
+
+		Data mCommand;
+		uint8_t mHeader;
+		cms_t mSentAt;
+		int mStatus;
+		bool mHasReply;
+		unsigned int mReplyKey;
+		Data mReply;
+	};
+
+	bool pipeline_can_send(void) const;
+	void pipeline_send_next(void);
+	void pipeline_handle_response(int event, va_list args);
+	void pipeline_complete(size_t index, int status);
+	void pipeline_abort(int status);
+	cms_t pipeline_ms_to_timeout(void) const;
+	void release_command_tid(void);
+
 	CallbackWithStatusArg1 mCB;
 	uint8_t mLastHeader;
 	PT mSubPT;
 	Data mNextCommand;
 	int mNextCommandRet;
 	int mNextCommandTimeout;
+	bool mNextCommandHoldsTID;
+
+	std::vector<PipelinedCommand> mPipeline;
+	size_t mPipelineNextToSend;
+	int mPipelineInFlight;
+	int mPipelineDepth;
+	int mPipelineRet;
+	cms_t mPipelineLastSend;
+	uint8_t mPipelineIndexForTID[kPipelineTIDCount];
 };
 
 nl::Data SpinelPackData(const char* pack_format, ...);
@@ -39,6 +39,13 @@ nl::wpantund::SpinelNCPTaskGetMsgBufferCounters::SpinelNCPTaskGetMsgBufferCounte
 {
 }
 
+bool
+nl::wpantund::SpinelNCPTaskGetMsgBufferCounters::is_shareable(void) const
+{
+	// Only reads properties from the NCP.
+	return true;
+}
+
 int
 nl::wpantund::SpinelNCPTaskGetMsgBufferCounters::vprocess_event(int event, va_list args)
 {
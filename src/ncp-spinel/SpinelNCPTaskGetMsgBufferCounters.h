@@ -49,6 +49,8 @@ public:
 	);
 	virtual int vprocess_event(int event, va_list args);
 
+	virtual bool is_shareable(void) const;
+
 private:
 
 	struct MsgBufferCounters
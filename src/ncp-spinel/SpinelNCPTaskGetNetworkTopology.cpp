@@ -462,6 +462,13 @@ nl::wpantund::SpinelNCPTaskGetNetworkTopology::property_key_for_type(Type type)
 	return prop_key;
 }
 
+bool
+nl::wpantund::SpinelNCPTaskGetNetworkTopology::is_shareable(void) const
+{
+	// Only reads properties from the NCP.
+	return true;
+}
+
 int
 nl::wpantund::SpinelNCPTaskGetNetworkTopology::vprocess_event(int event, va_list args)
 {
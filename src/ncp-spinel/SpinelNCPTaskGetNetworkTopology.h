@@ -124,6 +124,8 @@ public:
 	);
 	virtual int vprocess_event(int event, va_list args);
 
+	virtual bool is_shareable(void) const;
+
 	// Parse a single child/neighbor/router entry and update the passed-in `TableEntry`
 	static int parse_child_entry(const uint8_t *data_in, spinel_size_t data_len, TableEntry& child_info);
 	static int parse_child_addresses_entry(const uint8_t *data_in, spinel_size_t data_len, TableEntry& child_addr_info);
@@ -58,6 +58,14 @@ nl::wpantund::SpinelNCPTaskScan::finish(int status, const boost::any& value)
 	SpinelNCPTask::finish(status, value);
 }
 
+bool
+nl::wpantund::SpinelNCPTaskScan::allows_concurrent_reads(void) const
+{
+	// A scan takes a while, and only changes the scan settings and
+	// whether the interface is up.
+	return true;
+}
+
 
 int
 nl::wpantund::SpinelNCPTaskScan::vprocess_event(int event, va_list args)
@@ -54,6 +54,7 @@ public:
 	);
 	virtual int vprocess_event(int event, va_list args);
 	virtual void finish(int status, const boost::any& value = boost::any());
+	virtual bool allows_concurrent_reads(void) const;
 
 private:
 	uint8_t mChannelMaskData[32];
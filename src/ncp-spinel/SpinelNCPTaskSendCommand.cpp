@@ -74,7 +74,7 @@ SpinelNCPTaskSendCommand::Factory::set_timeout(int timeout)
 SpinelNCPTaskSendCommand::Factory&
 SpinelNCPTaskSendCommand::Factory::set_reply_format(const std::string& packed_format)
 {
-	mReplyUnpacker = boost::bind(simple_unpacker, _1, _2, packed_format, _3);
+	mReplyUnpacker = make_simple_unpacker(packed_format);
 	return *this;
 }
 
@@ -287,6 +287,12 @@ spinel_packed_to_any(const uint8_t* data_in, spinel_size_t data_len, const char*
 	return spinel_iter_to_any(&spinel_iter);
 }
 
+SpinelNCPTaskSendCommand::ReplyUnpacker
+SpinelNCPTaskSendCommand::make_simple_unpacker(const std::string& packed_format)
+{
+	return boost::bind(simple_unpacker, _1, _2, packed_format, _3);
+}
+
 static int
 simple_unpacker(const uint8_t* data_in, spinel_size_t data_len, const std::string& pack_format, boost::any& result)
 {
@@ -302,6 +308,76 @@ simple_unpacker(const uint8_t* data_in, spinel_size_t data_len, const std::strin
 	return retval;
 }
 
+bool
+nl::wpantund::SpinelNCPTaskSendCommand::is_shareable(void) const
+{
+	std::list<Data>::const_iterator iter;
+
+	if ((mLockProperty != 0) || (mCheckTimeout != 0) || mCommandList.empty()) {
+		return false;
+	}
+
+	// Plain property gets don't change anything on the NCP, so they
+	// don't need to wait for whatever else is going on.
+	for (iter = mCommandList.begin(); iter != mCommandList.end(); ++iter) {
+		if ((iter->size() < 2) || ((*iter)[1] != SPINEL_CMD_PROP_VALUE_GET)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool
+nl::wpantund::SpinelNCPTaskSendCommand::may_change_property(spinel_prop_key_t prop_key) const
+{
+	std::list<Data>::const_iterator iter;
+
+	for (iter = mCommandList.begin(); iter != mCommandList.end(); ++iter) {
+		unsigned int command = 0;
+		spinel_prop_key_t key = SPINEL_PROP_LAST_STATUS;
+
+		if (spinel_datatype_unpack(iter->data(), iter->size(), "Cii", NULL, &command, &key) <= 0) {
+			return true;
+		}
+
+		switch (command) {
+		case SPINEL_CMD_PROP_VALUE_GET:
+			break;
+
+		case SPINEL_CMD_PROP_VALUE_SET:
+		case SPINEL_CMD_PROP_VALUE_INSERT:
+		case SPINEL_CMD_PROP_VALUE_REMOVE:
+			if (key == prop_key) {
+				return true;
+			}
+			break;
+
+		default:
+			// Resets, `NET_CLEAR` and the like may change anything.
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool
+nl::wpantund::SpinelNCPTaskSendCommand::can_pipeline_commands(void) const
+{
+	std::list<Data>::const_iterator iter;
+
+	// A reset is answered by whatever reset status the NCP comes back
+	// with rather than by its TID, so it always goes out on its own.
+	for (iter = mCommandList.begin(); iter != mCommandList.end(); ++iter) {
+		if ((iter->size() < 2) || ((*iter)[1] == SPINEL_CMD_RESET)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 int
 nl::wpantund::SpinelNCPTaskSendCommand::vprocess_event(int event, va_list args)
 {
@@ -336,32 +412,53 @@ nl::wpantund::SpinelNCPTaskSendCommand::vprocess_event(int event, va_list args)
 
 	mRetVal = kWPANTUNDStatus_Ok;
 
-	mCommandIter = mCommandList.begin();
+	if (can_pipeline_commands()) {
+		// Send the whole list back-to-back rather than waiting
+		// for each response before sending the next command.
+		mPipeline.assign(mCommandList.begin(), mCommandList.end());
 
-	while ( (mRetVal == kWPANTUNDStatus_Ok)
-	     && (mCommandList.end() != mCommandIter)
-	) {
-		mNextCommand = *mCommandIter++;
+		EH_SPAWN(&mSubPT, vprocess_send_commands(event, args));
 
-		EH_SPAWN(&mSubPT, vprocess_send_command(event, args));
-	}
+		mRetVal = mPipelineRet;
+
+		require_noerr(mRetVal, on_error);
+
+		if ( mReplyUnpacker
+		  && !mPipeline.empty()
+		  && mPipeline.back().mHasReply
+		) {
+			// Handle the packed response from the last command
+			mRetVal = mReplyUnpacker(mPipeline.back().mReply.data(), mPipeline.back().mReply.size(), mReturnValue);
+		}
+
+	} else {
+		mCommandIter = mCommandList.begin();
 
-	mRetVal = mNextCommandRet;
+		while ( (mRetVal == kWPANTUNDStatus_Ok)
+		     && (mCommandList.end() != mCommandIter)
+		) {
+			mNextCommand = *mCommandIter++;
 
-	require_noerr(mRetVal, on_error);
+			EH_SPAWN(&mSubPT, vprocess_send_command(event, args));
+		}
+
+		mRetVal = mNextCommandRet;
 
-	if ( mReplyUnpacker
-	  && (kWPANTUNDStatus_Ok == mRetVal)
-	  && (EVENT_NCP_PROP_VALUE_IS == event)
-	) {
-		// Handle the packed response from the last command
+		require_noerr(mRetVal, on_error);
 
-		unsigned int key = va_arg(args, unsigned int);
-		const uint8_t* data_in = va_arg(args, const uint8_t*);
-		spinel_size_t data_len = va_arg_small(args, spinel_size_t);
-		(void) key; // Ignored
+		if ( mReplyUnpacker
+		  && (kWPANTUNDStatus_Ok == mRetVal)
+		  && (static_cast<int>(EVENT_NCP_PROP_VALUE_IS) == event)
+		) {
+			// Handle the packed response from the last command
 
-		mRetVal = mReplyUnpacker(data_in, data_len, mReturnValue);
+			unsigned int key = va_arg(args, unsigned int);
+			const uint8_t* data_in = va_arg(args, const uint8_t*);
+			spinel_size_t data_len = va_arg_small(args, spinel_size_t);
+			(void) key; // Ignored
+
+			mRetVal = mReplyUnpacker(data_in, data_len, mReturnValue);
+		}
 	}
 
 	if (mCheckTimeout != 0) {
@@ -82,9 +82,18 @@ public:
 
 	SpinelNCPTaskSendCommand(const Factory& factory);
 
+	// Returns the unpacker `Factory::set_reply_format()` would use.
+	static ReplyUnpacker make_simple_unpacker(const std::string& packed_format);
+
 	virtual int vprocess_event(int event, va_list args);
 
+	virtual bool is_shareable(void) const;
+
+	virtual bool may_change_property(spinel_prop_key_t prop_key) const;
+
 private:
+	bool can_pipeline_commands(void) const;
+
 
 	std::list<Data> mCommandList;
 	std::list<Data>::const_iterator mCommandIter;
@@ -0,0 +1,428 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Starts and stops the data-plane thread of `SpinelNCPInstance`
+ *      over and over while commands and unsolicited frames go back and
+ *      forth with a simulated NCP, checking that no frame is corrupted
+ *      or lost, and that the thread stops when the instance goes away
+ *      with commands still in flight.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdexcept>
+#include <boost/bind.hpp>
+
+#include "SpinelNCPInstance.h"
+#include "EventBackend.h"
+#include "Timer.h"
+#include "time-utils.h"
+#include "hdlc.h"
+#include "nlpt.h"
+#include "wpan-properties.h"
+#include "wpantund.h"
+#include "test-utils.h"
+
+using namespace nl;
+using namespace nl::wpantund;
+
+// Exit status telling the test harness that the test was skipped.
+
+static int sFatalErrors;
+static EventBackend* sEventBackend;
+
+std::string
+nl::wpantund::get_wpantund_version_string(void)
+{
+	return "data_plane_test";
+}
+
+bool
+nlpt_hook_check_read_fd_source(struct nlpt* nlpt, int fd)
+{
+	return (sEventBackend != NULL)
+		&& (sEventBackend->take_ready(fd, EventBackend::kEventRead) != 0);
+}
+
+bool
+nlpt_hook_check_write_fd_source(struct nlpt* nlpt, int fd)
+{
+	return (sEventBackend != NULL)
+		&& (sEventBackend->take_ready(fd, EventBackend::kEventWrite) != 0);
+}
+
+// Just enough of an NCP to get through initialization: everything it
+// doesn't know about is answered with `PROP_NOT_FOUND`. It also keeps
+// sending debug output, so that there are always frames coming in.
+class SimulatedNCP
+{
+public:
+	SimulatedNCP(int fd)
+		:mFD(fd), mFrameCount(0), mBadFrameCount(0), mSentCount(0)
+	{
+		hdlc_decoder_init(&mDecoder, mFrame, sizeof(mFrame));
+		fcntl(mFD, F_SETFL, fcntl(mFD, F_GETFL) | O_NONBLOCK);
+	}
+
+	~SimulatedNCP()
+	{
+		close(mFD);
+	}
+
+	void process(void)
+	{
+		uint8_t buffer[512];
+		ssize_t len;
+
+		while ((len = read(mFD, buffer, sizeof(buffer))) > 0) {
+			size_t offset = 0;
+
+			while (offset < static_cast<size_t>(len)) {
+				size_t consumed = 0;
+				hdlc_decode_status_t status;
+
+				status = hdlc_decoder_feed(&mDecoder, buffer + offset, len - offset, &consumed);
+				offset += consumed;
+
+				if (status == HDLC_DECODE_FRAME) {
+					mFrameCount++;
+					handle_frame(mFrame, mDecoder.frame_len);
+
+				} else if (status != HDLC_DECODE_NEED_MORE) {
+					mBadFrameCount++;
+				}
+			}
+		}
+
+		if ((mSentCount++ % 4) == 0) {
+			send("CiiU", SPINEL_HEADER_FLAG, SPINEL_CMD_PROP_VALUE_IS, SPINEL_PROP_STREAM_DEBUG, "data-plane-test\n");
+		}
+	}
+
+	int mFD;
+	unsigned int mFrameCount;
+	unsigned int mBadFrameCount;
+
+private:
+	void handle_frame(const uint8_t* frame, size_t frame_len)
+	{
+		uint8_t header = 0;
+		unsigned int command = 0;
+		spinel_prop_key_t key = SPINEL_PROP_LAST_STATUS;
+
+		if (spinel_datatype_unpack(frame, frame_len, "Ci", &header, &command) <= 0) {
+			mBadFrameCount++;
+			return;
+		}
+
+		switch (command) {
+		case SPINEL_CMD_NOOP:
+			send("Ciii", header, SPINEL_CMD_PROP_VALUE_IS, SPINEL_PROP_LAST_STATUS, SPINEL_STATUS_OK);
+			break;
+
+		case SPINEL_CMD_RESET:
+			send("Ciii", SPINEL_HEADER_FLAG, SPINEL_CMD_PROP_VALUE_IS, SPINEL_PROP_LAST_STATUS, SPINEL_STATUS_RESET_SOFTWARE);
+			break;
+
+		case SPINEL_CMD_PROP_VALUE_GET:
+			spinel_datatype_unpack(frame, frame_len, "Cii", NULL, NULL, &key);
+
+			if (key == SPINEL_PROP_PROTOCOL_VERSION) {
+				send("Ciiii", header, SPINEL_CMD_PROP_VALUE_IS, key,
+					SPINEL_PROTOCOL_VERSION_THREAD_MAJOR, SPINEL_PROTOCOL_VERSION_THREAD_MINOR);
+			} else if (key == SPINEL_PROP_NET_STACK_UP) {
+				send("Ciib", header, SPINEL_CMD_PROP_VALUE_IS, key, false);
+			} else {
+				send("Ciii", header, SPINEL_CMD_PROP_VALUE_IS, SPINEL_PROP_LAST_STATUS, SPINEL_STATUS_PROP_NOT_FOUND);
+			}
+			break;
+
+		default:
+			send("Ciii", header, SPINEL_CMD_PROP_VALUE_IS, SPINEL_PROP_LAST_STATUS, SPINEL_STATUS_INVALID_COMMAND);
+			break;
+		}
+	}
+
+	void send(const char* pack_format, ...)
+	{
+		uint8_t frame[128];
+		uint8_t encoded[HDLC_ENCODED_FRAME_SIZE_MAX(sizeof(frame))];
+		spinel_ssize_t frame_len;
+		size_t encoded_len;
+		va_list args;
+
+		va_start(args, pack_format);
+		frame_len = spinel_datatype_vpack(frame, sizeof(frame), pack_format, args);
+		va_end(args);
+
+		if ((frame_len <= 0) || (frame_len > static_cast<spinel_ssize_t>(sizeof(frame)))) {
+			mBadFrameCount++;
+			return;
+		}
+
+		encoded_len = hdlc_encode_frame(encoded, frame, frame_len, true);
+
+		// The socket buffer is far larger than anything the instance
+		// leaves unread, so a short write is a failure.
+		test_check(write(mFD, encoded, encoded_len) == static_cast<ssize_t>(encoded_len), "Write to instance");
+	}
+
+	struct hdlc_decoder mDecoder;
+	uint8_t mFrame[2048];
+	unsigned int mSentCount;
+};
+
+struct GetRecord {
+	GetRecord(): mIssued(0), mAnswered(0), mCanceled(0) { }
+
+	unsigned int mIssued;
+	unsigned int mAnswered;
+	unsigned int mCanceled;
+};
+
+static void
+record_get(GetRecord* record, int status, const boost::any& value)
+{
+	record->mAnswered++;
+
+	if (status == kWPANTUNDStatus_Canceled) {
+		record->mCanceled++;
+	}
+}
+
+static void
+record_fatal_error(int err)
+{
+	sFatalErrors++;
+}
+
+static void
+record_status(int* out, int status)
+{
+	*out = status;
+}
+
+static void
+copy_list(std::list<std::string>* out, int status, const boost::any& value)
+{
+	if (status == kWPANTUNDStatus_Ok) {
+		*out = boost::any_cast< std::list<std::string> >(value);
+	}
+}
+
+static bool
+data_plane_is_running(SpinelNCPInstance* instance)
+{
+	std::list<std::string> counters;
+	std::list<std::string>::const_iterator iter;
+
+	instance->property_get_value(kWPANTUNDProperty_DaemonNCPDataPlaneCounters, boost::bind(&copy_list, &counters, _1, _2));
+
+	for (iter = counters.begin(); iter != counters.end(); ++iter) {
+		if ((iter->compare(0, strlen("Running"), "Running") == 0) && (iter->find("true") != std::string::npos)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+set_data_plane_enabled(SpinelNCPInstance* instance, bool enabled)
+{
+	int status = -1;
+
+	instance->property_set_value(kWPANTUNDProperty_DaemonNCPDataPlaneThread, enabled, boost::bind(&record_status, &status, _1));
+	test_check(status == kWPANTUNDStatus_Ok, "Set DataPlaneThread");
+}
+
+// Runs one pass of the main loop, followed by the simulated NCP.
+static void
+run_once(SpinelNCPInstance* instance, SimulatedNCP* ncp)
+{
+	cms_t timeout = 5;
+
+	sEventBackend->begin_update();
+	instance->update_fd_interest(sEventBackend, &timeout);
+	Timer::update_timeout(&timeout);
+
+	if ((timeout < 0) || (timeout > 5)) {
+		timeout = (timeout < 0) ? 0 : 5;
+	}
+
+	sEventBackend->wait(timeout);
+	Timer::process();
+	instance->process();
+	ncp->process();
+}
+
+static void
+run_for(SpinelNCPInstance* instance, SimulatedNCP* ncp, cms_t duration)
+{
+	const cms_t start = time_ms();
+
+	while (time_ms() - start < duration) {
+		run_once(instance, ncp);
+	}
+}
+
+static int
+listen_unix(const char* path)
+{
+	struct sockaddr_un addr;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+
+	if ((fd < 0) || (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(fd, 1) < 0)) {
+		perror("listen_unix");
+		exit(EXIT_FAILURE);
+	}
+
+	return fd;
+}
+
+int
+main(void)
+{
+#if WPANTUND_SPINEL_DATA_PLANE_THREAD
+	static const char* const kGetProperties[] = {
+		kWPANTUNDProperty_NCPTXPower,
+		kWPANTUNDProperty_NCPCCAThreshold,
+		kWPANTUNDProperty_NCPFrequency,
+	};
+	static const int kCycles = 20;
+	char path[64];
+	SpinelNCPInstance* instance = NULL;
+	SimulatedNCP* ncp = NULL;
+	NCPInstance::Settings settings;
+	GetRecord record;
+	int listen_fd;
+	int starts = 0;
+	int stops = 0;
+	bool was_running = false;
+
+	snprintf(path, sizeof(path), "/tmp/data-plane-test-%d.sock", (int)getpid());
+	listen_fd = listen_unix(path);
+
+	settings[kWPANTUNDProperty_ConfigNCPSocketPath] = std::string("unix:") + path;
+	settings[kWPANTUNDProperty_ConfigTUNInterfaceName] = "dptest%d";
+
+	sEventBackend = EventBackend::create();
+	sEventBackend->set_active();
+
+	try {
+		instance = new SpinelNCPInstance(settings);
+	} catch (const std::exception& x) {
+		printf("Unable to create an NCP instance (%s), skipping\n", x.what());
+		unlink(path);
+		return EXIT_SKIPPED;
+	}
+
+	instance->mOnFatalError.connect(&record_fatal_error);
+	ncp = new SimulatedNCP(accept(listen_fd, NULL, NULL));
+	close(listen_fd);
+	unlink(path);
+
+	test_check(ncp->mFD >= 0, "Accept");
+
+	// Initialization sends a reset and a few dozen property gets.
+	run_for(instance, ncp, 3000);
+	test_check(ncp->mFrameCount > 0, "Initialization");
+
+	// Keep commands going out while the thread is started and stopped.
+	for (int cycle = 0; cycle < kCycles; cycle++) {
+		set_data_plane_enabled(instance, (cycle % 2) == 0);
+
+		for (int i = 0; i < 50; i++) {
+			const bool running = data_plane_is_running(instance);
+
+			if (running && !was_running) {
+				starts++;
+			} else if (!running && was_running) {
+				stops++;
+			}
+
+			was_running = running;
+
+			if ((record.mIssued - record.mAnswered) < 4) {
+				record.mIssued++;
+				instance->property_get_value(kGetProperties[record.mIssued % 3], boost::bind(&record_get, &record, _1, _2));
+			}
+
+			run_once(instance, ncp);
+		}
+	}
+
+	// Let everything in flight finish.
+	set_data_plane_enabled(instance, false);
+	run_for(instance, ncp, 500);
+
+	test_check(!data_plane_is_running(instance), "Thread stopped when disabled");
+	test_check(starts >= kCycles / 4, "Thread started");
+	test_check(stops >= kCycles / 4, "Thread stopped");
+	test_check(record.mIssued == record.mAnswered, "Every get answered");
+	test_check(record.mCanceled == 0, "No get canceled");
+
+	// Tear down the instance while the thread is running and commands
+	// are still waiting for their answer.
+	set_data_plane_enabled(instance, true);
+
+	for (int i = 0; (i < 1000) && !data_plane_is_running(instance); i++) {
+		run_once(instance, ncp);
+	}
+
+	test_check(data_plane_is_running(instance), "Thread restarted");
+
+	for (int i = 0; i < 4; i++) {
+		record.mIssued++;
+		instance->property_get_value(kGetProperties[i % 3], boost::bind(&record_get, &record, _1, _2));
+		run_once(instance, ncp);
+	}
+
+	delete instance;
+
+	test_check(record.mIssued == record.mAnswered, "Every get answered after teardown");
+	test_check(ncp->mBadFrameCount == 0, "No corrupted frames");
+	test_check(sFatalErrors == 0, "No fatal errors");
+
+	printf("%d starts, %d stops, %u gets, %u frames to the NCP\n", starts, stops, record.mIssued, ncp->mFrameCount);
+
+	delete ncp;
+	delete sEventBackend;
+
+	return test_exit_status();
+#else
+	printf("No data-plane thread on this platform, skipping\n");
+	return EXIT_SKIPPED;
+#endif
+}
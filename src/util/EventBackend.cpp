@@ -0,0 +1,640 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Event backends for the main loop.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "EventBackend.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <unistd.h>
+#include "nlpt.h"
+#include "assert-macros.h"
+
+using namespace nl;
+
+EventBackend* EventBackend::sActive = NULL;
+
+EventBackend::EventBackend()
+{
+}
+
+EventBackend::~EventBackend()
+{
+	if (sActive == this) {
+		sActive = NULL;
+	}
+}
+
+EventBackend*
+EventBackend::create(const std::string& name)
+{
+	EventBackend* ret = NULL;
+
+#if __linux__
+	if (name.empty() || (strcasecmp(name.c_str(), "epoll") == 0)) {
+		ret = EpollEventBackend::create();
+
+		if ((ret == NULL) && name.empty()) {
+			syslog(LOG_WARNING, "Unable to set up epoll, falling back to select: %s", strerror(errno));
+		}
+	}
+#endif
+
+	if ((ret == NULL) && (name.empty() || (strcasecmp(name.c_str(), "select") == 0))) {
+		ret = new SelectEventBackend();
+	}
+
+	return ret;
+}
+
+void
+EventBackend::set_active(void)
+{
+	sActive = this;
+}
+
+EventBackend*
+EventBackend::get_active(void)
+{
+	return sActive;
+}
+
+void
+EventBackend::fd_closed(int fd)
+{
+	if ((sActive != NULL) && (fd >= 0)) {
+		sActive->forget(fd);
+	}
+}
+
+void
+EventBackend::watch(const struct nlpt* nlpt)
+{
+	int i;
+
+	// Taken from the list rather than the fd_sets, so that descriptors
+	// numbered `FD_SETSIZE` and up reach the backend too. The select
+	// backend then fails its `wait()` instead of never waking up for them.
+	for (i = 0; i < NLPT_MAX_FD_SOURCES; i++) {
+		const struct nlpt_fd_source& source = nlpt->fd_sources[i];
+		int events = 0;
+
+		if ((source.poll_flags & POLLIN) != 0) {
+			events |= kEventRead;
+		}
+
+		if ((source.poll_flags & POLLOUT) != 0) {
+			events |= kEventWrite;
+		}
+
+		if (events != 0) {
+			watch(source.fd, events | kEventError);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// MARK: select(2)
+
+SelectEventBackend::SelectEventBackend()
+	:mMaxFD(-1), mWatchCount(0), mOverflow(false)
+{
+	begin_update();
+}
+
+const char*
+SelectEventBackend::get_name(void) const
+{
+	return "select";
+}
+
+void
+SelectEventBackend::begin_update(void)
+{
+	FD_ZERO(&mReadFDs);
+	FD_ZERO(&mWriteFDs);
+	FD_ZERO(&mErrorFDs);
+	mMaxFD = -1;
+	mWatchCount = 0;
+	mOverflow = false;
+}
+
+void
+SelectEventBackend::watch(int fd, int events)
+{
+	if (fd < 0) {
+		return;
+	}
+
+	if (fd >= FD_SETSIZE) {
+		syslog(LOG_ERR, "BUG: Too many file descriptors: %d (max %d)", fd, FD_SETSIZE);
+		mOverflow = true;
+		return;
+	}
+
+	if (!FD_ISSET(fd, &mReadFDs) && !FD_ISSET(fd, &mWriteFDs) && !FD_ISSET(fd, &mErrorFDs)) {
+		mWatchCount++;
+	}
+
+	if ((events & kEventRead) != 0) {
+		FD_SET(fd, &mReadFDs);
+	}
+
+	if ((events & kEventWrite) != 0) {
+		FD_SET(fd, &mWriteFDs);
+	}
+
+	if ((events & kEventError) != 0) {
+		FD_SET(fd, &mErrorFDs);
+	}
+
+	if (fd > mMaxFD) {
+		mMaxFD = fd;
+	}
+}
+
+int
+SelectEventBackend::wait(cms_t timeout)
+{
+	struct timeval tv;
+
+	if (mOverflow) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	tv.tv_sec = timeout / MSEC_PER_SEC;
+	tv.tv_usec = (timeout % MSEC_PER_SEC) * USEC_PER_MSEC;
+
+	return select(mMaxFD + 1, &mReadFDs, &mWriteFDs, &mErrorFDs, &tv);
+}
+
+int
+SelectEventBackend::take_ready(int fd, int events)
+{
+	int ret = 0;
+
+	if ((fd >= 0) && (fd < FD_SETSIZE)) {
+		if (((events & kEventRead) != 0) && FD_ISSET(fd, &mReadFDs)) {
+			ret |= kEventRead;
+			FD_CLR(fd, &mReadFDs);
+		}
+
+		if (((events & kEventWrite) != 0) && FD_ISSET(fd, &mWriteFDs)) {
+			ret |= kEventWrite;
+			FD_CLR(fd, &mWriteFDs);
+		}
+
+		if (FD_ISSET(fd, &mErrorFDs)) {
+			ret |= kEventError;
+			FD_CLR(fd, &mErrorFDs);
+		}
+	}
+
+	return ret;
+}
+
+int
+SelectEventBackend::get_watch_count(void) const
+{
+	return mWatchCount;
+}
+
+void
+SelectEventBackend::forget(int fd)
+{
+	if ((fd >= 0) && (fd < FD_SETSIZE)) {
+		FD_CLR(fd, &mReadFDs);
+		FD_CLR(fd, &mWriteFDs);
+		FD_CLR(fd, &mErrorFDs);
+	}
+}
+
+static void
+dump_fd_set(int loglevel, const char* name, const fd_set* x, int fd_count)
+{
+	std::string buffer;
+	int i;
+
+	for (i = 0; i < fd_count; i++) {
+		char str[12];
+
+		if (!FD_ISSET(i, x)) {
+			continue;
+		}
+
+		if (buffer.size() != 0) {
+			buffer += ", ";
+		}
+
+		snprintf(str, sizeof(str), "%d", i);
+		buffer += str;
+	}
+
+	syslog(loglevel, "SELECT:     %s: %s", name, buffer.c_str());
+}
+
+void
+SelectEventBackend::dump(int loglevel, cms_t timeout) const
+{
+	int logmask = setlogmask(0);
+	setlogmask(logmask);
+
+	// Check the log level preemptively to avoid wasted CPU.
+	if ((logmask & LOG_MASK(loglevel))) {
+		syslog(loglevel, "SELECT: fd_count=%d cms_timeout=%d", mMaxFD + 1, timeout);
+
+		dump_fd_set(loglevel, "read_fd_set", &mReadFDs, mMaxFD + 1);
+		dump_fd_set(loglevel, "write_fd_set", &mWriteFDs, mMaxFD + 1);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// MARK: epoll(7)
+
+#if __linux__
+
+// Set in `mRegistered` for descriptors epoll refuses to watch (such as
+// regular files). select() always reports those as ready, so we do too.
+#define EPOLL_ALWAYS_READY          (1 << 7)
+
+static uint32_t
+epoll_events_from_mask(int events)
+{
+	uint32_t ret = 0;
+
+	if ((events & EventBackend::kEventRead) != 0) {
+		ret |= EPOLLIN | EPOLLRDHUP;
+	}
+
+	if ((events & EventBackend::kEventWrite) != 0) {
+		ret |= EPOLLOUT;
+	}
+
+	if ((events & EventBackend::kEventError) != 0) {
+		ret |= EPOLLPRI;
+	}
+
+	return ret;
+}
+
+static int
+mask_from_epoll_events(uint32_t events)
+{
+	int ret = 0;
+
+	if ((events & (EPOLLIN | EPOLLRDHUP)) != 0) {
+		ret |= EventBackend::kEventRead;
+	}
+
+	if ((events & EPOLLOUT) != 0) {
+		ret |= EventBackend::kEventWrite;
+	}
+
+	if ((events & EPOLLPRI) != 0) {
+		ret |= EventBackend::kEventError;
+	}
+
+	if ((events & (EPOLLERR | EPOLLHUP)) != 0) {
+		// Like select(), a descriptor in error is both readable and
+		// writable, so whoever is waiting on it gets to see the error.
+		ret |= EventBackend::kEventRead | EventBackend::kEventWrite | EventBackend::kEventError;
+	}
+
+	return ret;
+}
+
+EpollEventBackend*
+EpollEventBackend::create(void)
+{
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	return new EpollEventBackend(fd);
+}
+
+EpollEventBackend::EpollEventBackend(int epoll_fd)
+	:mEpollFD(epoll_fd), mAlwaysReadyCount(0), mCtlCount(0)
+{
+}
+
+EpollEventBackend::~EpollEventBackend()
+{
+	close(mEpollFD);
+}
+
+const char*
+EpollEventBackend::get_name(void) const
+{
+	return "epoll";
+}
+
+void
+EpollEventBackend::grow(int fd)
+{
+	if (static_cast<size_t>(fd) >= mWanted.size()) {
+		size_t size = mWanted.size() ? mWanted.size() : 64;
+
+		while (size <= static_cast<size_t>(fd)) {
+			size *= 2;
+		}
+
+		mWanted.resize(size, 0);
+		mRegistered.resize(size, 0);
+		mReady.resize(size, 0);
+	}
+}
+
+void
+EpollEventBackend::begin_update(void)
+{
+	std::vector<int>::const_iterator iter;
+
+	for (iter = mWatchedFDs.begin(); iter != mWatchedFDs.end(); ++iter) {
+		mWanted[*iter] = 0;
+	}
+	mWatchedFDs.clear();
+
+	// Anything not consumed during the last iteration is stale now.
+	for (iter = mReadyFDs.begin(); iter != mReadyFDs.end(); ++iter) {
+		mReady[*iter] = 0;
+	}
+	mReadyFDs.clear();
+}
+
+void
+EpollEventBackend::watch(int fd, int events)
+{
+	events &= (kEventRead | kEventWrite | kEventError);
+
+	if ((fd < 0) || (events == 0)) {
+		return;
+	}
+
+	grow(fd);
+
+	if (mWanted[fd] == 0) {
+		mWatchedFDs.push_back(fd);
+	}
+
+	mWanted[fd] |= events;
+}
+
+int
+EpollEventBackend::ctl(int op, int fd, int events)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = epoll_events_from_mask(events);
+	event.data.fd = fd;
+
+	mCtlCount++;
+
+	return epoll_ctl(mEpollFD, op, fd, &event);
+}
+
+int
+EpollEventBackend::sync_registrations(void)
+{
+	std::vector<int>::iterator iter;
+
+	mAlwaysReadyCount = 0;
+
+	// Register new interest and update changed interest.
+	for (iter = mWatchedFDs.begin(); iter != mWatchedFDs.end(); ++iter) {
+		const int fd = *iter;
+		const uint8_t registered = mRegistered[fd];
+		int ret = 0;
+
+		if ((registered & EPOLL_ALWAYS_READY) != 0) {
+			mRegistered[fd] = EPOLL_ALWAYS_READY | mWanted[fd];
+			mAlwaysReadyCount++;
+			continue;
+		}
+
+		if (registered == mWanted[fd]) {
+			continue;
+		}
+
+		if (registered == 0) {
+			ret = ctl(EPOLL_CTL_ADD, fd, mWanted[fd]);
+
+			if ((ret < 0) && (errno == EEXIST)) {
+				// Registered through a descriptor we were not told was closed.
+				ret = ctl(EPOLL_CTL_MOD, fd, mWanted[fd]);
+			}
+
+			if ((ret < 0) && (errno == EPERM)) {
+				mRegistered[fd] = EPOLL_ALWAYS_READY | mWanted[fd];
+				mRegisteredFDs.push_back(fd);
+				mAlwaysReadyCount++;
+				continue;
+			}
+
+			if (ret == 0) {
+				mRegisteredFDs.push_back(fd);
+			}
+
+		} else {
+			ret = ctl(EPOLL_CTL_MOD, fd, mWanted[fd]);
+
+			if ((ret < 0) && (errno == ENOENT)) {
+				ret = ctl(EPOLL_CTL_ADD, fd, mWanted[fd]);
+			}
+		}
+
+		if (ret < 0) {
+			syslog(LOG_ERR, "epoll_ctl(%d) failed: %s (%d)", fd, strerror(errno), errno);
+			return -1;
+		}
+
+		mRegistered[fd] = mWanted[fd];
+	}
+
+	// Drop interest that nobody renewed this iteration.
+	for (iter = mRegisteredFDs.begin(); iter != mRegisteredFDs.end();) {
+		const int fd = *iter;
+
+		if (mWanted[fd] != 0) {
+			++iter;
+			continue;
+		}
+
+		if ((mRegistered[fd] & EPOLL_ALWAYS_READY) == 0) {
+			IGNORE_RETURN_VALUE(ctl(EPOLL_CTL_DEL, fd, 0));
+		}
+
+		mRegistered[fd] = 0;
+		*iter = mRegisteredFDs.back();
+		mRegisteredFDs.pop_back();
+	}
+
+	return 0;
+}
+
+int
+EpollEventBackend::wait(cms_t timeout)
+{
+	int ret;
+	int i;
+
+	ret = sync_registrations();
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (mAlwaysReadyCount != 0) {
+		timeout = 0;
+	}
+
+	if (mEvents.size() < mWatchedFDs.size() || mEvents.empty()) {
+		mEvents.resize(mWatchedFDs.size() + 1);
+	}
+
+	ret = epoll_wait(mEpollFD, &mEvents[0], static_cast<int>(mEvents.size()), timeout);
+
+	for (i = 0; i < ret; i++) {
+		const int fd = mEvents[i].data.fd;
+
+		if ((fd < 0) || (static_cast<size_t>(fd) >= mReady.size())) {
+			continue;
+		}
+
+		if (mReady[fd] == 0) {
+			mReadyFDs.push_back(fd);
+		}
+
+		mReady[fd] |= mask_from_epoll_events(mEvents[i].events);
+	}
+
+	if ((ret >= 0) && (mAlwaysReadyCount != 0)) {
+		std::vector<int>::const_iterator iter;
+
+		for (iter = mWatchedFDs.begin(); iter != mWatchedFDs.end(); ++iter) {
+			if ((mRegistered[*iter] & EPOLL_ALWAYS_READY) != 0) {
+				if (mReady[*iter] == 0) {
+					mReadyFDs.push_back(*iter);
+					ret++;
+				}
+				mReady[*iter] |= mWanted[*iter];
+			}
+		}
+	}
+
+	return ret;
+}
+
+int
+EpollEventBackend::take_ready(int fd, int events)
+{
+	int ret = 0;
+
+	if ((fd >= 0) && (static_cast<size_t>(fd) < mReady.size())) {
+		ret = mReady[fd] & (events | kEventError);
+		mReady[fd] &= ~(events | kEventError);
+	}
+
+	return ret;
+}
+
+int
+EpollEventBackend::get_watch_count(void) const
+{
+	return static_cast<int>(mWatchedFDs.size());
+}
+
+void
+EpollEventBackend::forget(int fd)
+{
+	std::vector<int>::iterator iter;
+
+	if (static_cast<size_t>(fd) >= mRegistered.size()) {
+		return;
+	}
+
+	mReady[fd] = 0;
+
+	if (mRegistered[fd] == 0) {
+		return;
+	}
+
+	if ((mRegistered[fd] & EPOLL_ALWAYS_READY) == 0) {
+		// Fails harmlessly if the descriptor is already closed.
+		IGNORE_RETURN_VALUE(ctl(EPOLL_CTL_DEL, fd, 0));
+	}
+
+	mRegistered[fd] = 0;
+
+	for (iter = mRegisteredFDs.begin(); iter != mRegisteredFDs.end(); ++iter) {
+		if (*iter == fd) {
+			*iter = mRegisteredFDs.back();
+			mRegisteredFDs.pop_back();
+			break;
+		}
+	}
+}
+
+void
+EpollEventBackend::dump(int loglevel, cms_t timeout) const
+{
+	int logmask = setlogmask(0);
+	setlogmask(logmask);
+
+	if ((logmask & LOG_MASK(loglevel))) {
+		std::string read_buffer;
+		std::string write_buffer;
+		std::vector<int>::const_iterator iter;
+
+		for (iter = mWatchedFDs.begin(); iter != mWatchedFDs.end(); ++iter) {
+			char str[12];
+
+			snprintf(str, sizeof(str), "%d", *iter);
+
+			if ((mWanted[*iter] & kEventRead) != 0) {
+				read_buffer += read_buffer.empty() ? "" : ", ";
+				read_buffer += str;
+			}
+
+			if ((mWanted[*iter] & kEventWrite) != 0) {
+				write_buffer += write_buffer.empty() ? "" : ", ";
+				write_buffer += str;
+			}
+		}
+
+		syslog(loglevel, "EPOLL: fd_count=%d registered=%d cms_timeout=%d",
+		       static_cast<int>(mWatchedFDs.size()), static_cast<int>(mRegisteredFDs.size()), timeout);
+		syslog(loglevel, "EPOLL:     read: %s", read_buffer.c_str());
+		syslog(loglevel, "EPOLL:     write: %s", write_buffer.c_str());
+	}
+}
+
+#endif // __linux__
@@ -0,0 +1,187 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Event backends for the main loop: epoll(7) on Linux, with
+ *      select(2) as the portable fallback.
+ *
+ */
+
+#ifndef __wpantund__EventBackend__
+#define __wpantund__EventBackend__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/select.h>
+#if __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "time-utils.h"
+
+struct nlpt;
+
+namespace nl {
+
+// Waits for file descriptor activity on behalf of the main loop.
+//
+// Every iteration the main loop calls `begin_update()`, lets each
+// component declare the descriptors it cares about with `watch()`, and
+// then calls `wait()`. Afterwards, `take_ready()` reports (and consumes)
+// what became ready.
+//
+// The epoll backend keeps its kernel registrations across iterations and
+// only calls `epoll_ctl()` for descriptors whose interest actually
+// changed, so the steady-state cost of an iteration does not grow with
+// the number of attached descriptors and there is no FD_SETSIZE limit.
+// Because the kernel silently drops registrations when a descriptor is
+// closed, code that closes a watched descriptor must call `fd_closed()`
+// so a later descriptor reusing the same number is registered again.
+class EventBackend {
+public:
+	enum {
+		kEventRead  = (1 << 0),
+		kEventWrite = (1 << 1),
+		kEventError = (1 << 2),
+	};
+
+	// Returns a new backend by name ("epoll" or "select"). An empty
+	// name picks the best backend available on this platform. Returns
+	// NULL if the named backend is unknown or could not be set up.
+	static EventBackend* create(const std::string& name = std::string());
+
+	// Tells the active backend that `fd` has been (or is about to be) closed.
+	static void fd_closed(int fd);
+
+	// The backend the main loop is waiting with, or NULL.
+	static EventBackend* get_active(void);
+
+	virtual ~EventBackend();
+
+	virtual const char* get_name(void) const = 0;
+
+	// Starts collecting interest for the next call to `wait()`.
+	virtual void begin_update(void) = 0;
+
+	// Adds `events` (a mask of `kEvent*` values) to the interest in `fd`
+	// for the next call to `wait()`.
+	virtual void watch(int fd, int events) = 0;
+
+	// Adds the descriptors a protothread is currently blocked on.
+	void watch(const struct nlpt* nlpt);
+
+	// Blocks until a watched descriptor is ready or `timeout` elapses.
+	// Returns the number of ready descriptors, or -1 with `errno` set.
+	virtual int wait(cms_t timeout) = 0;
+
+	// Returns which of `events` are ready on `fd` and clears them, so
+	// that each readiness report is only acted upon once. Error
+	// conditions are reported along with any requested event.
+	virtual int take_ready(int fd, int events) = 0;
+
+	// Number of descriptors watched during the last iteration.
+	virtual int get_watch_count(void) const = 0;
+
+	// Logs the current interest set at the given syslog level.
+	virtual void dump(int loglevel, cms_t timeout) const = 0;
+
+	// Makes this backend the target of `fd_closed()`.
+	void set_active(void);
+
+protected:
+	EventBackend();
+
+private:
+	static EventBackend* sActive;
+
+	virtual void forget(int fd) = 0;
+};
+
+// The historical select(2) backend. Descriptors must be below FD_SETSIZE.
+class SelectEventBackend : public EventBackend {
+public:
+	SelectEventBackend();
+
+	virtual const char* get_name(void) const;
+	virtual void begin_update(void);
+	virtual void watch(int fd, int events);
+	virtual int wait(cms_t timeout);
+	virtual int take_ready(int fd, int events);
+	virtual int get_watch_count(void) const;
+	virtual void dump(int loglevel, cms_t timeout) const;
+
+private:
+	virtual void forget(int fd);
+
+	fd_set mReadFDs;
+	fd_set mWriteFDs;
+	fd_set mErrorFDs;
+	int mMaxFD;
+	int mWatchCount;
+	bool mOverflow;
+};
+
+#if __linux__
+// Level-triggered epoll(7) backend with persistent registrations.
+class EpollEventBackend : public EventBackend {
+public:
+	static EpollEventBackend* create(void);
+
+	virtual ~EpollEventBackend();
+
+	virtual const char* get_name(void) const;
+	virtual void begin_update(void);
+	virtual void watch(int fd, int events);
+	virtual int wait(cms_t timeout);
+	virtual int take_ready(int fd, int events);
+	virtual int get_watch_count(void) const;
+	virtual void dump(int loglevel, cms_t timeout) const;
+
+	// Number of `epoll_ctl()` calls made so far.
+	unsigned int get_ctl_count(void) const { return mCtlCount; }
+
+private:
+	EpollEventBackend(int epoll_fd);
+
+	virtual void forget(int fd);
+
+	void grow(int fd);
+	int sync_registrations(void);
+	int ctl(int op, int fd, int events);
+
+	int mEpollFD;
+
+	// Per-descriptor state, indexed by descriptor number.
+	std::vector<uint8_t> mWanted;       // Interest for the upcoming wait
+	std::vector<uint8_t> mRegistered;   // Interest the kernel knows about
+	std::vector<uint8_t> mReady;        // Readiness from the last wait
+
+	std::vector<int> mWatchedFDs;       // Descriptors with `mWanted` set
+	std::vector<int> mRegisteredFDs;    // Descriptors with `mRegistered` set
+	std::vector<int> mReadyFDs;         // Descriptors with `mReady` set
+
+	std::vector<struct epoll_event> mEvents;
+	int mAlwaysReadyCount;
+
+	unsigned int mCtlCount;
+};
+#endif // __linux__
+
+}; // namespace nl
+
+#endif // __wpantund__EventBackend__
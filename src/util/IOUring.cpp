@@ -0,0 +1,534 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "IOUring.h"
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace nl;
+
+IOUring::Client::~Client()
+{
+}
+
+// MARK: IOUring
+
+IOUring::IOUring()
+	:mRingFD(-1)
+	,mSQRing(NULL)
+	,mSQRingSize(0)
+	,mCQRing(NULL)
+	,mCQRingSize(0)
+	,mSQEs(NULL)
+	,mSQEsSize(0)
+	,mSQHead(NULL)
+	,mSQTail(NULL)
+	,mSQMask(NULL)
+	,mSQArray(NULL)
+	,mSQEntries(0)
+	,mCQHead(NULL)
+	,mCQTail(NULL)
+	,mCQMask(NULL)
+	,mCQEs(NULL)
+	,mQueued(0)
+	,mEnterCount(0)
+	,mCompletionCount(0)
+{
+}
+
+IOUring*
+IOUring::get_shared(void)
+{
+	static IOUring* shared;
+	static int shared_errno;
+
+	if ((shared == NULL) && (shared_errno == 0)) {
+		shared = IOUring::create(16);
+
+		if (shared == NULL) {
+			shared_errno = errno;
+		}
+	}
+
+	if (shared == NULL) {
+		errno = shared_errno;
+	}
+
+	return shared;
+}
+
+int
+IOUring::get_fd(void) const
+{
+	return mRingFD;
+}
+
+#if HAVE_LINUX_IO_URING_H && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+
+IOUring*
+IOUring::create(unsigned int entries)
+{
+	IOUring* ring = new IOUring();
+	struct io_uring_params params;
+	uint8_t* sq_ring;
+	uint8_t* cq_ring;
+	int saved_errno;
+
+	memset(&params, 0, sizeof(params));
+
+	ring->mRingFD = (int)syscall(__NR_io_uring_setup, entries, &params);
+
+	if (ring->mRingFD < 0) {
+		goto bail;
+	}
+
+	ring->mSQRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->mCQRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	// Newer kernels map both rings with a single mmap().
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		if (ring->mCQRingSize > ring->mSQRingSize) {
+			ring->mSQRingSize = ring->mCQRingSize;
+		}
+		ring->mCQRingSize = 0;
+	}
+
+	ring->mSQRing = mmap(NULL, ring->mSQRingSize, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->mRingFD, IORING_OFF_SQ_RING);
+
+	if (ring->mSQRing == MAP_FAILED) {
+		ring->mSQRing = NULL;
+		goto bail;
+	}
+
+	if (ring->mCQRingSize == 0) {
+		cq_ring = (uint8_t*)ring->mSQRing;
+	} else {
+		ring->mCQRing = mmap(NULL, ring->mCQRingSize, PROT_READ | PROT_WRITE,
+		                     MAP_SHARED | MAP_POPULATE, ring->mRingFD, IORING_OFF_CQ_RING);
+
+		if (ring->mCQRing == MAP_FAILED) {
+			ring->mCQRing = NULL;
+			goto bail;
+		}
+
+		cq_ring = (uint8_t*)ring->mCQRing;
+	}
+
+	ring->mSQEsSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->mSQEs = (struct io_uring_sqe*)mmap(NULL, ring->mSQEsSize, PROT_READ | PROT_WRITE,
+	                                         MAP_SHARED | MAP_POPULATE, ring->mRingFD, IORING_OFF_SQES);
+
+	if ((void*)ring->mSQEs == MAP_FAILED) {
+		ring->mSQEs = NULL;
+		goto bail;
+	}
+
+	sq_ring = (uint8_t*)ring->mSQRing;
+
+	ring->mSQHead = (unsigned int*)(sq_ring + params.sq_off.head);
+	ring->mSQTail = (unsigned int*)(sq_ring + params.sq_off.tail);
+	ring->mSQMask = (unsigned int*)(sq_ring + params.sq_off.ring_mask);
+	ring->mSQArray = (unsigned int*)(sq_ring + params.sq_off.array);
+	ring->mSQEntries = params.sq_entries;
+
+	ring->mCQHead = (unsigned int*)(cq_ring + params.cq_off.head);
+	ring->mCQTail = (unsigned int*)(cq_ring + params.cq_off.tail);
+	ring->mCQMask = (unsigned int*)(cq_ring + params.cq_off.ring_mask);
+	ring->mCQEs = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+
+	return ring;
+
+bail:
+	saved_errno = errno;
+	delete ring;
+	errno = saved_errno;
+	return NULL;
+}
+
+IOUring::~IOUring()
+{
+	if (mSQEs != NULL) {
+		munmap(mSQEs, mSQEsSize);
+	}
+
+	if (mCQRing != NULL) {
+		munmap(mCQRing, mCQRingSize);
+	}
+
+	if (mSQRing != NULL) {
+		munmap(mSQRing, mSQRingSize);
+	}
+
+	if (mRingFD >= 0) {
+		close(mRingFD);
+	}
+}
+
+struct io_uring_sqe*
+IOUring::next_sqe(void)
+{
+	unsigned int head = __atomic_load_n(mSQHead, __ATOMIC_ACQUIRE);
+	unsigned int tail = *mSQTail;
+	struct io_uring_sqe* sqe;
+
+	if (tail - head >= mSQEntries) {
+		// The ring is full of requests we haven't submitted yet.
+		if (enter(0) < 0) {
+			return NULL;
+		}
+
+		head = __atomic_load_n(mSQHead, __ATOMIC_ACQUIRE);
+
+		if (tail - head >= mSQEntries) {
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+
+	sqe = &mSQEs[tail & *mSQMask];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+void
+IOUring::queue_sqe(void)
+{
+	unsigned int tail = *mSQTail;
+
+	mSQArray[tail & *mSQMask] = tail & *mSQMask;
+
+	// The kernel must not see the new tail before the entry it covers.
+	__atomic_store_n(mSQTail, tail + 1, __ATOMIC_RELEASE);
+
+	mQueued++;
+}
+
+int
+IOUring::enter(unsigned int min_complete)
+{
+	unsigned int flags = (min_complete != 0) ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	mEnterCount++;
+
+	ret = (int)syscall(__NR_io_uring_enter, mRingFD, mQueued, min_complete, flags, NULL, 0);
+
+	if (ret < 0) {
+		return -errno;
+	}
+
+	mQueued -= (unsigned int)ret;
+
+	return ret;
+}
+
+int
+IOUring::reap(Client* skip, bool* skipped)
+{
+	unsigned int head = *mCQHead;
+	int count = 0;
+
+	while (head != __atomic_load_n(mCQTail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe* cqe = &mCQEs[head & *mCQMask];
+		Client* client = (Client*)(uintptr_t)cqe->user_data;
+		int32_t result = cqe->res;
+
+		// Hand the slot back before calling out, in case the client
+		// posts its next read from inside the callback.
+		head++;
+		__atomic_store_n(mCQHead, head, __ATOMIC_RELEASE);
+
+		if (client == NULL) {
+			// Completion of a cancel request; nothing to report.
+			continue;
+		}
+
+		mCompletionCount++;
+
+		if (client == skip) {
+			*skipped = true;
+			continue;
+		}
+
+		client->handle_completion(result);
+		count++;
+	}
+
+	return count;
+}
+
+int
+IOUring::post_read(Client* client, int fd, void* buffer, size_t len)
+{
+	struct io_uring_sqe* sqe = next_sqe();
+
+	if (sqe == NULL) {
+		return -errno;
+	}
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buffer;
+	sqe->len = (uint32_t)len;
+	// Read from the current file position, like read(2).
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = (uintptr_t)client;
+
+	queue_sqe();
+
+	return 0;
+}
+
+int
+IOUring::cancel(Client* client)
+{
+	bool done = false;
+	int ret = 0;
+
+	while (!done) {
+		struct io_uring_sqe* sqe = next_sqe();
+
+		if (sqe == NULL) {
+			return -errno;
+		}
+
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t)client;
+		sqe->user_data = 0;
+
+		queue_sqe();
+
+		// Either the read is canceled or it completes on its own; in
+		// both cases its completion shows up here and we are done.
+		// Anything else that completes meanwhile is dispatched normally.
+		ret = enter(1);
+
+		if ((ret < 0) && (ret != -EINTR)) {
+			break;
+		}
+
+		reap(client, &done);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+int
+IOUring::process(void)
+{
+	int ret;
+
+	if (mQueued != 0) {
+		ret = enter(0);
+
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	return reap(NULL, NULL);
+}
+
+int
+IOUring::collect(void)
+{
+	return reap(NULL, NULL);
+}
+
+#else // if HAVE_LINUX_IO_URING_H
+
+IOUring*
+IOUring::create(unsigned int entries)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+IOUring::~IOUring()
+{
+}
+
+int
+IOUring::post_read(Client* client, int fd, void* buffer, size_t len)
+{
+	return -ENOSYS;
+}
+
+int
+IOUring::cancel(Client* client)
+{
+	return -ENOSYS;
+}
+
+int
+IOUring::process(void)
+{
+	return -ENOSYS;
+}
+
+int
+IOUring::collect(void)
+{
+	return -ENOSYS;
+}
+
+#endif // else HAVE_LINUX_IO_URING_H
+
+// MARK: IOUringReader
+
+IOUringReader::IOUringReader(IOUring* ring, size_t buffer_size)
+	:mRing(ring)
+	,mBuffer(new uint8_t[buffer_size])
+	,mBufferSize(buffer_size)
+	,mOffset(0)
+	,mLength(0)
+	,mError(0)
+	,mEOF(false)
+	,mReadHitEOF(false)
+	,mPosted(false)
+	,mCompleted(false)
+	,mUnsupported(false)
+	,mMessageMode(false)
+{
+}
+
+IOUringReader::~IOUringReader()
+{
+	cancel();
+	delete [] mBuffer;
+}
+
+void
+IOUringReader::handle_completion(int32_t result)
+{
+	mPosted = false;
+	mCompleted = (result != -ECANCELED);
+
+	if (result > 0) {
+		mOffset = 0;
+		mLength = (size_t)result;
+	} else if (result == 0) {
+		mEOF = true;
+	} else if ((result == -EAGAIN) || (result == -EINVAL) || (result == -EOPNOTSUPP)) {
+		// Kernels without async support for this kind of file hand the
+		// descriptor's non-blocking EAGAIN straight back to us.
+		mUnsupported = true;
+	} else if (result != -ECANCELED) {
+		mError = -result;
+	}
+}
+
+bool
+IOUringReader::poll(int fd)
+{
+	if (!mPosted && !has_data() && !mEOF && (mError == 0) && !mUnsupported && (fd >= 0)) {
+		if (mRing->post_read(this, fd, mBuffer, mBufferSize) == 0) {
+			mPosted = true;
+		}
+	}
+
+	// Submits our read along with anything else queued, so nothing is
+	// left sitting in the ring when the main loop goes to sleep.
+	mRing->process();
+
+	return has_data() || mEOF || (mError != 0) || mUnsupported;
+}
+
+ssize_t
+IOUringReader::read(int fd, void* data, size_t len)
+{
+	ssize_t ret = 0;
+
+	mReadHitEOF = false;
+
+	mRing->collect();
+
+	if (has_data()) {
+		ret = (ssize_t)std::min(len, mLength - mOffset);
+		memcpy(data, mBuffer + mOffset, (size_t)ret);
+		mOffset += (size_t)ret;
+
+		if (mMessageMode) {
+			mOffset = mLength;
+		}
+
+		if (!has_data()) {
+			// Whoever was waiting for it has it now.
+			mCompleted = false;
+		}
+	} else if (mError != 0) {
+		ret = -mError;
+		mError = 0;
+	} else if (mEOF) {
+		// Report end-of-file once, then look again.
+		mEOF = false;
+		mReadHitEOF = true;
+	}
+
+	// Queue the next read once the buffer is drained. It is submitted
+	// along with everything else on the next pass through `process()`.
+	if (!mPosted && !has_data() && !mUnsupported && (fd >= 0)) {
+		if (mRing->post_read(this, fd, mBuffer, mBufferSize) == 0) {
+			mPosted = true;
+		}
+	}
+
+	return ret;
+}
+
+bool
+IOUringReader::take_completed(void)
+{
+	bool ret = mCompleted;
+
+	mCompleted = false;
+
+	return ret;
+}
+
+void
+IOUringReader::cancel(void)
+{
+	if (mPosted) {
+		mRing->cancel(this);
+		mPosted = false;
+	}
+
+	mOffset = mLength = 0;
+	mError = 0;
+	mEOF = false;
+	mCompleted = false;
+}
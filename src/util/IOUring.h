@@ -0,0 +1,186 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      A minimal io_uring(7) wrapper for keeping reads posted on
+ *      descriptors, with completions collected from the main loop.
+ *
+ */
+
+#ifndef __wpantund__IOUring__
+#define __wpantund__IOUring__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace nl {
+
+// Submits reads to the kernel ahead of time and hands back their results.
+//
+// Requests are only queued by `post_read()`; nothing reaches the kernel
+// until `process()`, which submits everything queued and reaps every
+// completion with a single `io_uring_enter()`. The ring descriptor
+// becomes readable whenever a completion is waiting, so the main loop
+// can watch that one descriptor in place of all of the descriptors that
+// have reads posted on them.
+//
+// This talks to the kernel directly rather than through liburing. It is
+// only functional on Linux builds that found <linux/io_uring.h>;
+// elsewhere `create()` always fails with ENOSYS.
+class IOUring {
+public:
+	class Client {
+	public:
+		virtual ~Client();
+
+		// Called from `process()` or `cancel()` with the result of a
+		// posted read: a byte count, zero for end-of-file, or a
+		// negative errno value.
+		virtual void handle_completion(int32_t result) = 0;
+	};
+
+	// Returns a new ring with room for `entries` requests in flight, or
+	// NULL (with errno set) if io_uring is unavailable.
+	static IOUring* create(unsigned int entries);
+
+	// The ring shared by everything serviced from the main loop. It is
+	// created on first use. Returns NULL (with errno set) if io_uring is
+	// unavailable.
+	static IOUring* get_shared(void);
+
+	~IOUring();
+
+	int get_fd(void) const;
+
+	// Queues a read of up to `len` bytes from `fd` into `buffer`. At most
+	// one read may be posted per client at a time.
+	int post_read(Client* client, int fd, void* buffer, size_t len);
+
+	// Cancels the read posted by `client` and waits until the kernel is
+	// done with it. The client is not called back.
+	int cancel(Client* client);
+
+	// Submits queued requests and dispatches all available completions.
+	// Returns the number of completions dispatched, or a negative errno.
+	int process(void);
+
+	// Dispatches available completions without submitting anything.
+	// Never makes a system call.
+	int collect(void);
+
+	unsigned int get_enter_count(void) const { return mEnterCount; }
+	unsigned int get_completion_count(void) const { return mCompletionCount; }
+
+private:
+	IOUring();
+
+	struct io_uring_sqe* next_sqe(void);
+	void queue_sqe(void);
+	int enter(unsigned int min_complete);
+	int reap(Client* skip, bool* skipped);
+
+	int mRingFD;
+
+	void* mSQRing;
+	size_t mSQRingSize;
+	void* mCQRing;
+	size_t mCQRingSize;
+	struct io_uring_sqe* mSQEs;
+	size_t mSQEsSize;
+
+	unsigned int* mSQHead;
+	unsigned int* mSQTail;
+	unsigned int* mSQMask;
+	unsigned int* mSQArray;
+	unsigned int mSQEntries;
+
+	unsigned int* mCQHead;
+	unsigned int* mCQTail;
+	unsigned int* mCQMask;
+	struct io_uring_cqe* mCQEs;
+
+	unsigned int mQueued;
+	unsigned int mEnterCount;
+	unsigned int mCompletionCount;
+}; // class IOUring
+
+// Keeps one read posted on a descriptor and buffers what it returns, so
+// that a socket can serve `read()` from memory instead of the kernel.
+//
+// The descriptor is passed in on every call rather than stored, so the
+// owner is free to close and reopen it (after `cancel()`).
+class IOUringReader : public IOUring::Client {
+public:
+	IOUringReader(IOUring* ring, size_t buffer_size);
+	virtual ~IOUringReader();
+
+	int get_ring_fd(void) const { return mRing->get_fd(); }
+
+	// Collects completions and posts a read on `fd` if none is pending.
+	// Returns true if `read()` has something to report.
+	bool poll(int fd);
+
+	// Returns buffered data, or a negative errno from the last read.
+	// Returns zero if nothing is buffered; check `read_hit_eof()` to tell
+	// end-of-file apart from no data.
+	ssize_t read(int fd, void* data, size_t len);
+
+	// For descriptors that return one packet per read(2), such as a
+	// TUN interface: anything that doesn't fit in the buffer passed to
+	// `read()` is dropped, just as the kernel would truncate it.
+	void set_message_mode(bool message_mode) { mMessageMode = message_mode; }
+
+	bool has_data(void) const { return mOffset < mLength; }
+	bool read_hit_eof(void) const { return mReadHitEOF; }
+
+	// True once the kernel has refused to run reads on this descriptor
+	// from the ring. The owner should go back to reading it directly.
+	bool is_unsupported(void) const { return mUnsupported; }
+
+	// Returns true (once) if a completion has come in since the last
+	// call. Completions are often collected on behalf of other sockets
+	// sharing the ring, which leaves nothing on the ring descriptor
+	// itself to wake up whoever is waiting on this one.
+	bool take_completed(void);
+
+	// Cancels any posted read and discards buffered data.
+	void cancel(void);
+
+	virtual void handle_completion(int32_t result);
+
+private:
+	IOUring* mRing;
+	uint8_t* mBuffer;
+	size_t mBufferSize;
+	size_t mOffset;
+	size_t mLength;
+	int mError;
+	bool mEOF;
+	bool mReadHitEOF;
+	bool mPosted;
+	bool mCompleted;
+	bool mUnsupported;
+	bool mMessageMode;
+}; // class IOUringReader
+
+}; // namespace nl
+
+#endif /* defined(__wpantund__IOUring__) */
@@ -0,0 +1,320 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Bounded table of IPv6 flows with hashed lookup and idle expiry.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "IPv6FlowTable.h"
+#include <stdio.h>
+#include "murmur3.h"
+#include "sec-random.h"
+
+using namespace nl;
+
+IPv6FlowKey::IPv6FlowKey(const IPv6PacketMatcherRule& rule)
+{
+	memset(this, 0, sizeof(*this));
+
+	mLocalAddress = rule.local_address;
+	mRemoteAddress = rule.remote_address;
+	mLocalPort = rule.local_port;
+	mRemotePort = rule.remote_port;
+	mType = rule.type;
+	mSubtype = rule.subtype;
+	mLocalMatchMask = rule.local_match_mask;
+	mRemoteMatchMask = rule.remote_match_mask;
+	mPortMatch = (rule.local_port_match ? kLocalPortMatch : 0)
+		| (rule.remote_port_match ? kRemotePortMatch : 0);
+}
+
+IPv6FlowTable::IPv6FlowTable(size_t capacity, cms_t idle_timeout)
+	: mBucketMask(0), mFree(kNone), mNewest(kNone), mOldest(kNone), mCount(0), mIdleTimeout(idle_timeout)
+{
+	// The remote end of a flow picks most of its key, so the hash is
+	// seeded to keep anyone from lining up flows in one bucket.
+	if (sec_random_fill(reinterpret_cast<uint8_t*>(&mSeed), sizeof(mSeed)) < 0) {
+		mSeed = static_cast<uint32_t>(time_ms())
+			^ static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this));
+	}
+
+	reset_stats();
+	set_capacity(capacity);
+}
+
+void
+IPv6FlowTable::set_capacity(size_t capacity)
+{
+	size_t bucket_count = 2;
+
+	// Keep the chains short by having at least twice as many buckets
+	// as there can be flows.
+	while (bucket_count < 2 * capacity) {
+		bucket_count *= 2;
+	}
+
+	mEntries.assign(capacity, Entry());
+	mBuckets.assign(bucket_count, kNone);
+	mBucketMask = static_cast<uint32_t>(bucket_count - 1);
+
+	clear();
+}
+
+void
+IPv6FlowTable::clear(void)
+{
+	size_t i;
+
+	for (i = 0; i < mBuckets.size(); i++) {
+		mBuckets[i] = kNone;
+	}
+
+	mFree = kNone;
+
+	for (i = mEntries.size(); i > 0; i--) {
+		mEntries[i - 1].mNextInBucket = mFree;
+		mFree = static_cast<int32_t>(i - 1);
+	}
+
+	mNewest = kNone;
+	mOldest = kNone;
+	mCount = 0;
+}
+
+void
+IPv6FlowTable::reset_stats(void)
+{
+	memset(&mStats, 0, sizeof(mStats));
+	mStats.mHighWater = static_cast<uint32_t>(mCount);
+}
+
+// Murmur3 over the key's words.
+uint32_t
+IPv6FlowTable::hash(const IPv6FlowKey& key) const
+{
+	uint32_t words[sizeof(IPv6FlowKey) / sizeof(uint32_t)];
+
+	memcpy(words, &key, sizeof(words));
+
+	return murmur3_32(words, sizeof(words) / sizeof(words[0]), mSeed);
+}
+
+int32_t
+IPv6FlowTable::find(const IPv6FlowKey& key, uint32_t hash, uint32_t* probes) const
+{
+	int32_t index = mBuckets[hash & mBucketMask];
+
+	while (index != kNone) {
+		const Entry& entry = mEntries[index];
+
+		(*probes)++;
+
+		if ((entry.mHash == hash) && (entry.mKey == key)) {
+			break;
+		}
+
+		index = entry.mNextInBucket;
+	}
+
+	return index;
+}
+
+void
+IPv6FlowTable::unlink_lru(int32_t index)
+{
+	Entry& entry = mEntries[index];
+
+	if (entry.mNewer != kNone) {
+		mEntries[entry.mNewer].mOlder = entry.mOlder;
+	} else {
+		mNewest = entry.mOlder;
+	}
+
+	if (entry.mOlder != kNone) {
+		mEntries[entry.mOlder].mNewer = entry.mNewer;
+	} else {
+		mOldest = entry.mNewer;
+	}
+}
+
+void
+IPv6FlowTable::link_newest(int32_t index)
+{
+	Entry& entry = mEntries[index];
+
+	entry.mNewer = kNone;
+	entry.mOlder = mNewest;
+
+	if (mNewest != kNone) {
+		mEntries[mNewest].mNewer = index;
+	} else {
+		mOldest = index;
+	}
+
+	mNewest = index;
+}
+
+void
+IPv6FlowTable::remove(int32_t index)
+{
+	Entry& entry = mEntries[index];
+	int32_t* link = &mBuckets[entry.mHash & mBucketMask];
+
+	while (*link != index) {
+		link = &mEntries[*link].mNextInBucket;
+	}
+
+	*link = entry.mNextInBucket;
+
+	unlink_lru(index);
+
+	entry.mNextInBucket = mFree;
+	mFree = index;
+	mCount--;
+}
+
+void
+IPv6FlowTable::expire(cms_t now)
+{
+	// Flows are kept in the order they were last seen, so only the
+	// oldest ones need looking at.
+	while ((mOldest != kNone) && ((now - mEntries[mOldest].mLastSeen) >= mIdleTimeout)) {
+		remove(mOldest);
+		mStats.mExpirations++;
+	}
+}
+
+bool
+IPv6FlowTable::lookup(const IPv6PacketMatcherRule& rule, cms_t now)
+{
+	const IPv6FlowKey key(rule);
+	const uint32_t key_hash = hash(key);
+	int32_t index;
+
+	expire(now);
+
+	mStats.mLookups++;
+	index = find(key, key_hash, &mStats.mProbes);
+
+	if (index == kNone) {
+		return false;
+	}
+
+	mStats.mHits++;
+	mEntries[index].mLastSeen = now;
+
+	if (index != mNewest) {
+		unlink_lru(index);
+		link_newest(index);
+	}
+
+	return true;
+}
+
+void
+IPv6FlowTable::insert(const IPv6PacketMatcherRule& rule, cms_t now)
+{
+	const IPv6FlowKey key(rule);
+	const uint32_t key_hash = hash(key);
+	uint32_t probes = 0;
+	int32_t index;
+
+	if (mEntries.empty()) {
+		return;
+	}
+
+	expire(now);
+
+	index = find(key, key_hash, &probes);
+
+	if (index != kNone) {
+		unlink_lru(index);
+
+	} else {
+		if (mFree == kNone) {
+			remove(mOldest);
+			mStats.mEvictions++;
+		}
+
+		index = mFree;
+		mFree = mEntries[index].mNextInBucket;
+
+		mEntries[index].mKey = key;
+		mEntries[index].mHash = key_hash;
+		mEntries[index].mNextInBucket = mBuckets[key_hash & mBucketMask];
+		mBuckets[key_hash & mBucketMask] = index;
+
+		mCount++;
+		mStats.mInserts++;
+
+		if (mCount > mStats.mHighWater) {
+			mStats.mHighWater = static_cast<uint32_t>(mCount);
+		}
+	}
+
+	mEntries[index].mLastSeen = now;
+	link_newest(index);
+}
+
+bool
+IPv6FlowTable::erase(const IPv6PacketMatcherRule& rule)
+{
+	const IPv6FlowKey key(rule);
+	uint32_t probes = 0;
+	int32_t index = find(key, hash(key), &probes);
+
+	if (index == kNone) {
+		return false;
+	}
+
+	remove(index);
+
+	return true;
+}
+
+void
+IPv6FlowTable::get_summary(std::list<std::string>& result) const
+{
+	char c_string[80];
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Flows", static_cast<unsigned int>(mCount));
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Capacity", static_cast<unsigned int>(mEntries.size()));
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "HighWater", mStats.mHighWater);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %d", "IdleTimeoutMs", static_cast<int>(mIdleTimeout));
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Lookups", mStats.mLookups);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Hits", mStats.mHits);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %.2f", "ProbesPerLookup",
+		(mStats.mLookups != 0) ? static_cast<double>(mStats.mProbes) / mStats.mLookups : 0.0);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Inserts", mStats.mInserts);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Evictions", mStats.mEvictions);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Expirations", mStats.mExpirations);
+	result.push_back(c_string);
+}
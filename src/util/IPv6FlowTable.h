@@ -0,0 +1,157 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Bounded table of IPv6 flows with hashed lookup and idle expiry.
+ *
+ */
+
+#ifndef __wpantund__IPv6FlowTable__
+#define __wpantund__IPv6FlowTable__
+
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <vector>
+#include "IPv6PacketMatcher.h"
+#include "time-utils.h"
+
+namespace nl {
+
+// Everything an exact-match `IPv6PacketMatcherRule` compares, packed so
+// that it can be hashed and compared as plain memory.
+struct IPv6FlowKey {
+	struct in6_addr mLocalAddress;
+	struct in6_addr mRemoteAddress;
+	in_port_t mLocalPort;
+	in_port_t mRemotePort;
+	uint8_t mType;
+	uint8_t mSubtype;
+	uint8_t mLocalMatchMask;
+	uint8_t mRemoteMatchMask;
+	uint8_t mPortMatch;                     // kLocalPortMatch | kRemotePortMatch
+	uint8_t mPad[3];
+
+	enum {
+		kLocalPortMatch = (1 << 0),
+		kRemotePortMatch = (1 << 1),
+	};
+
+	IPv6FlowKey() { memset(this, 0, sizeof(*this)); }
+	explicit IPv6FlowKey(const IPv6PacketMatcherRule& rule);
+
+	bool operator==(const IPv6FlowKey& rhs) const { return memcmp(this, &rhs, sizeof(*this)) == 0; }
+};
+
+// Holds the flows that the insecure-commissioning firewall lets through,
+// in place of a `std::set` of rules which is searched on every packet.
+//
+// Lookups hash the flow's key, so they take the same time however many
+// joiners are being commissioned. Every flow remembers when a packet
+// last matched it and is dropped once it has been idle for longer than
+// the idle timeout. The table never holds more than its capacity: making
+// room for a new flow evicts the one which has been idle the longest.
+//
+// All of the storage is allocated up front, when the table is created
+// or its capacity changes.
+class IPv6FlowTable {
+public:
+	enum {
+		kDefaultCapacity = 256,
+		kDefaultIdleTimeout = 300 * MSEC_PER_SEC,
+	};
+
+	struct Stats {
+		uint32_t mLookups;
+		uint32_t mHits;
+		uint32_t mProbes;                   // Entries compared, over all lookups
+		uint32_t mInserts;
+		uint32_t mEvictions;                // Flows pushed out to make room
+		uint32_t mExpirations;              // Flows dropped for being idle
+		uint32_t mHighWater;                // Most flows held at once
+	};
+
+	IPv6FlowTable(size_t capacity = kDefaultCapacity, cms_t idle_timeout = kDefaultIdleTimeout);
+
+	//! Drops every flow and makes room for `capacity` of them.
+	void set_capacity(size_t capacity);
+	size_t get_capacity(void) const { return mEntries.size(); }
+
+	void set_idle_timeout(cms_t idle_timeout) { mIdleTimeout = idle_timeout; }
+	cms_t get_idle_timeout(void) const { return mIdleTimeout; }
+
+	//! True if the flow is in the table, in which case it is marked as
+	//! just seen.
+	bool lookup(const IPv6PacketMatcherRule& rule, cms_t now = time_ms());
+
+	//! Adds the flow, or marks it as just seen if it is already there.
+	void insert(const IPv6PacketMatcherRule& rule, cms_t now = time_ms());
+
+	//! Returns true if the flow was in the table.
+	bool erase(const IPv6PacketMatcherRule& rule);
+
+	//! Drops the flows which have been idle for too long.
+	void expire(cms_t now = time_ms());
+
+	void clear(void);
+
+	size_t size(void) const { return mCount; }
+	bool empty(void) const { return mCount == 0; }
+
+	const Stats& get_stats(void) const { return mStats; }
+	void reset_stats(void);
+
+	//! Appends one line per counter, for a property.
+	void get_summary(std::list<std::string>& result) const;
+
+private:
+	enum {
+		kNone = -1,
+	};
+
+	struct Entry {
+		IPv6FlowKey mKey;
+		uint32_t mHash;
+		cms_t mLastSeen;
+		int32_t mNextInBucket;              // Or the next free entry
+		int32_t mNewer;                     // Towards `mNewest`
+		int32_t mOlder;                     // Towards `mOldest`
+	};
+
+	uint32_t hash(const IPv6FlowKey& key) const;
+	int32_t find(const IPv6FlowKey& key, uint32_t hash, uint32_t* probes) const;
+	void remove(int32_t index);
+	void unlink_lru(int32_t index);
+	void link_newest(int32_t index);
+
+	std::vector<Entry> mEntries;
+	std::vector<int32_t> mBuckets;
+	uint32_t mBucketMask;
+	uint32_t mSeed;
+
+	int32_t mFree;
+	int32_t mNewest;
+	int32_t mOldest;
+	size_t mCount;
+
+	cms_t mIdleTimeout;
+	Stats mStats;
+}; // class IPv6FlowTable
+
+}; // namespace nl
+
+#endif /* defined(__wpantund__IPv6FlowTable__) */
@@ -0,0 +1,328 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Set of IPv6 packet matcher rules compiled for fast matching.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "IPv6PacketClassifier.h"
+
+using namespace nl;
+
+static void
+make_mask(uint8_t bits, uint64_t mask[2])
+{
+	uint8_t bytes[16] = { };
+
+	if (bits > 128) {
+		bits = 128;
+	}
+
+	memset(bytes, 0xFF, bits / 8);
+
+	if (bits % 8) {
+		bytes[bits / 8] = static_cast<uint8_t>(0xFF << (8 - bits % 8));
+	}
+
+	memcpy(mask, bytes, sizeof(bytes));
+}
+
+// Masks an address the way `in6_addr_apply_mask()` does. Returns false
+// if the address has bits set outside of the mask, in which case a rule
+// holding it can never match.
+static bool
+load_masked_address(const struct in6_addr& address, const uint64_t mask[2], uint64_t masked[2])
+{
+	uint64_t words[2];
+
+	memcpy(words, &address, sizeof(words));
+
+	masked[0] = words[0] & mask[0];
+	masked[1] = words[1] & mask[1];
+
+	return (masked[0] == words[0]) && (masked[1] == words[1]);
+}
+
+bool
+IPv6PacketClassifier::Shape::same_as(const Shape& rhs) const
+{
+	return (mMatchType == rhs.mMatchType)
+		&& (mMatchSubtype == rhs.mMatchSubtype)
+		&& (mMatchLocalPort == rhs.mMatchLocalPort)
+		&& (mMatchRemotePort == rhs.mMatchRemotePort)
+		&& (mLocalMatchMask == rhs.mLocalMatchMask)
+		&& (mRemoteMatchMask == rhs.mRemoteMatchMask);
+}
+
+IPv6PacketClassifier::IPv6PacketClassifier()
+{
+	memset(mTypes, 0, sizeof(mTypes));
+}
+
+IPv6PacketClassifier::Shape
+IPv6PacketClassifier::get_shape(const IPv6PacketMatcherRule& rule)
+{
+	Shape shape;
+
+	shape.mMatchType = (rule.type != IPv6PacketMatcherRule::TYPE_ALL);
+	shape.mMatchSubtype = shape.mMatchType && (rule.subtype != IPv6PacketMatcherRule::SUBTYPE_ALL);
+	shape.mMatchLocalPort = rule.local_port_match;
+	shape.mMatchRemotePort = rule.remote_port_match;
+	shape.mLocalMatchMask = (rule.local_match_mask > 128) ? 128 : rule.local_match_mask;
+	shape.mRemoteMatchMask = (rule.remote_match_mask > 128) ? 128 : rule.remote_match_mask;
+	make_mask(shape.mLocalMatchMask, shape.mLocalMask);
+	make_mask(shape.mRemoteMatchMask, shape.mRemoteMask);
+	shape.mCount = 0;
+
+	return shape;
+}
+
+bool
+IPv6PacketClassifier::get_key(const Shape& shape, const IPv6PacketMatcherRule& rule, Key& key)
+{
+	memset(&key, 0, sizeof(key));
+
+	if (rule.type == IPv6PacketMatcherRule::TYPE_NONE) {
+		return false;
+	}
+
+	if (shape.mMatchType) {
+		key.mType = rule.type;
+	}
+
+	if (shape.mMatchSubtype) {
+		key.mSubtype = rule.subtype;
+	}
+
+	if (shape.mMatchLocalPort) {
+		key.mLocalPort = rule.local_port;
+	}
+
+	if (shape.mMatchRemotePort) {
+		key.mRemotePort = rule.remote_port;
+	}
+
+	if ((shape.mLocalMatchMask != 0)
+		&& !load_masked_address(rule.local_address, shape.mLocalMask, key.mLocalAddress)
+	) {
+		return false;
+	}
+
+	if ((shape.mRemoteMatchMask != 0)
+		&& !load_masked_address(rule.remote_address, shape.mRemoteMask, key.mRemoteAddress)
+	) {
+		return false;
+	}
+
+	return true;
+}
+
+uint32_t
+IPv6PacketClassifier::hash(const Key& key)
+{
+	uint64_t words[sizeof(Key) / sizeof(uint64_t)];
+	uint64_t h = 0;
+	size_t i;
+
+	memcpy(words, &key, sizeof(words));
+
+	for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		h = (h ^ words[i]) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 32;
+	}
+
+	return static_cast<uint32_t>(h);
+}
+
+void
+IPv6PacketClassifier::rebuild(void)
+{
+	std::set<IPv6PacketMatcherRule>::const_iterator iter;
+	std::vector<size_t> rule_shapes;
+	size_t i;
+
+	mShapes.clear();
+	memset(mTypes, 0, sizeof(mTypes));
+
+	for (iter = mRules.begin(); iter != mRules.end(); ++iter) {
+		Shape shape(get_shape(*iter));
+		Key key;
+
+		if (!get_key(shape, *iter, key)) {
+			// Never matches anything.
+			rule_shapes.push_back(SIZE_MAX);
+			continue;
+		}
+
+		for (i = 0; i < mShapes.size(); i++) {
+			if (mShapes[i].same_as(shape)) {
+				break;
+			}
+		}
+
+		if (i == mShapes.size()) {
+			mShapes.push_back(shape);
+		}
+
+		mShapes[i].mCount++;
+		rule_shapes.push_back(i);
+
+		if (shape.mMatchType) {
+			mTypes[iter->type / 32] |= (1u << (iter->type % 32));
+		} else {
+			memset(mTypes, 0xFF, sizeof(mTypes));
+		}
+	}
+
+	for (i = 0; i < mShapes.size(); i++) {
+		size_t slot_count = 2;
+
+		while (slot_count < 2 * mShapes[i].mCount) {
+			slot_count *= 2;
+		}
+
+		mShapes[i].mSlots.assign(slot_count, Slot());
+	}
+
+	for (iter = mRules.begin(), i = 0; iter != mRules.end(); ++iter, i++) {
+		Shape* shape;
+		size_t slot_mask;
+		size_t index;
+		Key key;
+
+		if (rule_shapes[i] == SIZE_MAX) {
+			continue;
+		}
+
+		shape = &mShapes[rule_shapes[i]];
+		slot_mask = shape->mSlots.size() - 1;
+
+		get_key(*shape, *iter, key);
+
+		index = hash(key) & slot_mask;
+
+		while (shape->mSlots[index].mRule != NULL) {
+			index = (index + 1) & slot_mask;
+		}
+
+		shape->mSlots[index].mKey = key;
+		shape->mSlots[index].mRule = &*iter;
+	}
+}
+
+bool
+IPv6PacketClassifier::insert(const IPv6PacketMatcherRule& rule)
+{
+	if (!mRules.insert(rule).second) {
+		return false;
+	}
+
+	rebuild();
+
+	return true;
+}
+
+bool
+IPv6PacketClassifier::erase(const IPv6PacketMatcherRule& rule)
+{
+	if (mRules.erase(rule) == 0) {
+		return false;
+	}
+
+	rebuild();
+
+	return true;
+}
+
+void
+IPv6PacketClassifier::clear(void)
+{
+	mRules.clear();
+	mShapes.clear();
+	memset(mTypes, 0, sizeof(mTypes));
+}
+
+const IPv6PacketMatcherRule*
+IPv6PacketClassifier::match(const IPv6PacketFields& fields, bool inbound) const
+{
+	const struct in6_addr& local_address = inbound ? fields.destination : fields.source;
+	const struct in6_addr& remote_address = inbound ? fields.source : fields.destination;
+	const in_port_t local_port = inbound ? fields.destination_port : fields.source_port;
+	const in_port_t remote_port = inbound ? fields.source_port : fields.destination_port;
+	std::vector<Shape>::const_iterator shape;
+
+	if (!fields.is_ipv6 || !(mTypes[fields.type / 32] & (1u << (fields.type % 32)))) {
+		return NULL;
+	}
+
+	for (shape = mShapes.begin(); shape != mShapes.end(); ++shape) {
+		const size_t slot_mask = shape->mSlots.size() - 1;
+		size_t index;
+		Key key;
+
+		memset(&key, 0, sizeof(key));
+
+		if (shape->mMatchType) {
+			key.mType = fields.type;
+		}
+
+		if (shape->mMatchSubtype) {
+			key.mSubtype = fields.subtype;
+		}
+
+		if (shape->mMatchLocalPort) {
+			key.mLocalPort = local_port;
+		}
+
+		if (shape->mMatchRemotePort) {
+			key.mRemotePort = remote_port;
+		}
+
+		if (shape->mLocalMatchMask != 0) {
+			load_masked_address(local_address, shape->mLocalMask, key.mLocalAddress);
+		}
+
+		if (shape->mRemoteMatchMask != 0) {
+			load_masked_address(remote_address, shape->mRemoteMask, key.mRemoteAddress);
+		}
+
+		for (index = hash(key) & slot_mask; shape->mSlots[index].mRule != NULL; index = (index + 1) & slot_mask) {
+			if (shape->mSlots[index].mKey == key) {
+				return shape->mSlots[index].mRule;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+const IPv6PacketMatcherRule*
+IPv6PacketClassifier::match_inbound(const IPv6PacketFields& fields) const
+{
+	return match(fields, true);
+}
+
+const IPv6PacketMatcherRule*
+IPv6PacketClassifier::match_outbound(const IPv6PacketFields& fields) const
+{
+	return match(fields, false);
+}
@@ -0,0 +1,125 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Set of IPv6 packet matcher rules compiled for fast matching.
+ *
+ */
+
+#ifndef __wpantund__IPv6PacketClassifier__
+#define __wpantund__IPv6PacketClassifier__
+
+#include <stdint.h>
+#include <set>
+#include <vector>
+#include "IPv6PacketMatcher.h"
+
+namespace nl {
+
+// Matches packets against a set of `IPv6PacketMatcherRule`s with the
+// same results as `IPv6PacketMatcher`, without trying the rules one
+// at a time.
+//
+// Rules are grouped by shape: which fields they look at and how many
+// bits of each address. Within a shape, a rule is just the values of
+// those fields, so all of the rules of one shape are kept in a hash
+// table. Matching a packet masks its fields once per shape and does a
+// single lookup, so the cost grows with the number of shapes, which is
+// small, rather than with the number of rules.
+//
+// The tables are rebuilt whenever a rule is added or removed, which is
+// meant to be rare next to matching.
+class IPv6PacketClassifier {
+public:
+	typedef std::set<IPv6PacketMatcherRule>::const_iterator const_iterator;
+
+	IPv6PacketClassifier();
+
+	//! Returns false if the rule was already there.
+	bool insert(const IPv6PacketMatcherRule& rule);
+
+	//! Returns false if the rule wasn't there.
+	bool erase(const IPv6PacketMatcherRule& rule);
+
+	void clear(void);
+
+	size_t size(void) const { return mRules.size(); }
+	bool empty(void) const { return mRules.empty(); }
+
+	size_t get_shape_count(void) const { return mShapes.size(); }
+
+	const_iterator begin(void) const { return mRules.begin(); }
+	const_iterator end(void) const { return mRules.end(); }
+
+	//! Returns a rule which matches, or NULL if there isn't one.
+	const IPv6PacketMatcherRule* match_inbound(const IPv6PacketFields& fields) const;
+	const IPv6PacketMatcherRule* match_outbound(const IPv6PacketFields& fields) const;
+
+private:
+	// The fields of a rule or packet that a shape looks at, with the
+	// rest zeroed.
+	struct Key {
+		uint64_t mLocalAddress[2];
+		uint64_t mRemoteAddress[2];
+		in_port_t mLocalPort;
+		in_port_t mRemotePort;
+		uint8_t mType;
+		uint8_t mSubtype;
+		uint8_t mPad[2];
+
+		bool operator==(const Key& rhs) const { return memcmp(this, &rhs, sizeof(*this)) == 0; }
+	};
+
+	struct Slot {
+		Key mKey;
+		const IPv6PacketMatcherRule* mRule; // NULL if the slot is empty
+	};
+
+	struct Shape {
+		bool mMatchType;
+		bool mMatchSubtype;
+		bool mMatchLocalPort;
+		bool mMatchRemotePort;
+		uint8_t mLocalMatchMask;
+		uint8_t mRemoteMatchMask;
+		uint64_t mLocalMask[2];
+		uint64_t mRemoteMask[2];
+
+		size_t mCount;
+		std::vector<Slot> mSlots;           // Power of two, at most half full
+
+		bool same_as(const Shape& rhs) const;
+	};
+
+	static Shape get_shape(const IPv6PacketMatcherRule& rule);
+	static bool get_key(const Shape& shape, const IPv6PacketMatcherRule& rule, Key& key);
+	static uint32_t hash(const Key& key);
+
+	void rebuild(void);
+	const IPv6PacketMatcherRule* match(const IPv6PacketFields& fields, bool inbound) const;
+
+	std::set<IPv6PacketMatcherRule> mRules;
+	std::vector<Shape> mShapes;
+
+	// Bit per next-header type that some rule can match, so that most
+	// packets which match nothing are turned away without a lookup.
+	uint32_t mTypes[256 / 32];
+}; // class IPv6PacketClassifier
+
+}; // namespace nl
+
+#endif /* defined(__wpantund__IPv6PacketClassifier__) */
@@ -0,0 +1,502 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Kernel packet filters generated from IPv6 packet matcher rules.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "IPv6PacketFilter.h"
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#if __linux__
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+#include <linux/bpf.h>
+#endif
+
+using namespace nl;
+
+IPv6PacketFilter::IPv6PacketFilter()
+{
+}
+
+#if __linux__
+
+#define IPV6_HEADER_LENGTH          40
+#define IPV6_TYPE_OFFSET            6
+#define IPV6_SRC_ADDR_OFFSET        8
+#define IPV6_DEST_ADDR_OFFSET       24
+#define IPV6_SRC_PORT_OFFSET        (IPV6_HEADER_LENGTH + 0)
+#define IPV6_DEST_PORT_OFFSET       (IPV6_HEADER_LENGTH + 2)
+#define IPV6_ICMP_SUBTYPE_OFFSET    (IPV6_HEADER_LENGTH + 0)
+
+#define ACCEPT                      0xFFFFFFFF
+#define DROP                        0
+
+static IPv6PacketFilter::Instruction
+make_stmt(uint16_t code, uint32_t k)
+{
+	IPv6PacketFilter::Instruction insn = { code, 0, 0, k };
+	return insn;
+}
+
+static IPv6PacketFilter::Instruction
+make_jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf)
+{
+	IPv6PacketFilter::Instruction insn = { code, jt, jf, k };
+	return insn;
+}
+
+namespace {
+
+// One field compared by a rule: `(packet[offset] & mask) == value`.
+struct Check {
+	uint16_t mSize;                         // BPF_B, BPF_H or BPF_W
+	uint32_t mOffset;
+	uint32_t mMask;
+	uint32_t mValue;
+
+	Check(uint16_t size, uint32_t offset, uint32_t mask, uint32_t value)
+		: mSize(size), mOffset(offset), mMask(mask), mValue(value) { }
+
+	size_t length(void) const
+	{
+		const uint32_t full_mask = (mSize == BPF_B) ? 0xFF : (mSize == BPF_H) ? 0xFFFF : 0xFFFFFFFF;
+		return (mMask == full_mask) ? 2 : 3;
+	}
+};
+
+} // namespace
+
+// Adds the checks for one address. Returns false if the address has
+// bits set outside of its mask, which means the rule can never match.
+static bool
+add_address_checks(std::vector<Check>& checks, uint32_t offset, const struct in6_addr& address, uint8_t mask_bits)
+{
+	int i;
+
+	if (mask_bits == 0) {
+		return true;
+	}
+
+	if (mask_bits > 128) {
+		mask_bits = 128;
+	}
+
+	for (i = 0; i < 4; i++) {
+		const int bits = (mask_bits > 32 * i) ? ((mask_bits - 32 * i > 32) ? 32 : mask_bits - 32 * i) : 0;
+		const uint32_t mask = (bits == 0) ? 0 : (0xFFFFFFFF << (32 - bits));
+		uint32_t word;
+
+		memcpy(&word, &address.s6_addr[4 * i], sizeof(word));
+		word = ntohl(word);
+
+		if ((word & ~mask) != 0) {
+			return false;
+		}
+
+		if (bits != 0) {
+			checks.push_back(Check(BPF_W, offset + 4 * i, mask, word));
+		}
+	}
+
+	return true;
+}
+
+void
+IPv6PacketFilter::add_outbound_drop_rule(const IPv6PacketMatcherRule& rule)
+{
+	std::vector<Check> checks;
+	std::vector<Check>::const_iterator check;
+	size_t remaining = 1;
+
+	if (rule.type == IPv6PacketMatcherRule::TYPE_NONE) {
+		return;
+	}
+
+	if (rule.type != IPv6PacketMatcherRule::TYPE_ALL) {
+		checks.push_back(Check(BPF_B, IPV6_TYPE_OFFSET, 0xFF, rule.type));
+
+		if (rule.subtype != IPv6PacketMatcherRule::SUBTYPE_ALL) {
+			checks.push_back(Check(BPF_B, IPV6_ICMP_SUBTYPE_OFFSET, 0xFF, rule.subtype));
+		}
+	}
+
+	if (rule.local_port_match) {
+		checks.push_back(Check(BPF_H, IPV6_SRC_PORT_OFFSET, 0xFFFF, ntohs(rule.local_port)));
+	}
+
+	if (rule.remote_port_match) {
+		checks.push_back(Check(BPF_H, IPV6_DEST_PORT_OFFSET, 0xFFFF, ntohs(rule.remote_port)));
+	}
+
+	if (!add_address_checks(checks, IPV6_SRC_ADDR_OFFSET, rule.local_address, rule.local_match_mask)
+		|| !add_address_checks(checks, IPV6_DEST_ADDR_OFFSET, rule.remote_address, rule.remote_match_mask)
+	) {
+		return;
+	}
+
+	for (check = checks.begin(); check != checks.end(); ++check) {
+		remaining += check->length();
+	}
+
+	// Each failed check skips to the first instruction of the next rule,
+	// past the rest of this rule's checks and its final drop.
+	for (check = checks.begin(); check != checks.end(); ++check) {
+		remaining -= check->length();
+
+		mProgram.push_back(make_stmt(BPF_LD | check->mSize | BPF_ABS, check->mOffset));
+
+		if (check->length() == 3) {
+			mProgram.push_back(make_stmt(BPF_ALU | BPF_AND | BPF_K, check->mMask));
+		}
+
+		mProgram.push_back(make_jump(BPF_JMP | BPF_JEQ | BPF_K, check->mValue, 0, static_cast<uint8_t>(remaining)));
+	}
+
+	mProgram.push_back(make_stmt(BPF_RET | BPF_K, DROP));
+}
+
+bool
+IPv6PacketFilter::set_outbound_drop_rules(const IPv6PacketClassifier& rules)
+{
+	IPv6PacketClassifier::const_iterator iter;
+
+	mProgram.clear();
+
+	// Packets wpantund would drop for not being IPv6 at all.
+	mProgram.push_back(make_stmt(BPF_LD | BPF_W | BPF_LEN, 0));
+	mProgram.push_back(make_jump(BPF_JMP | BPF_JGT | BPF_K, IPV6_HEADER_LENGTH, 1, 0));
+	mProgram.push_back(make_stmt(BPF_RET | BPF_K, DROP));
+	mProgram.push_back(make_stmt(BPF_LD | BPF_B | BPF_ABS, 0));
+	mProgram.push_back(make_stmt(BPF_ALU | BPF_AND | BPF_K, 0xF0));
+	mProgram.push_back(make_jump(BPF_JMP | BPF_JEQ | BPF_K, 0x60, 1, 0));
+	mProgram.push_back(make_stmt(BPF_RET | BPF_K, DROP));
+
+	// Loading past the end of the packet would drop it, so leave
+	// anything too short to hold the port numbers to wpantund.
+	mProgram.push_back(make_stmt(BPF_LD | BPF_W | BPF_LEN, 0));
+	mProgram.push_back(make_jump(BPF_JMP | BPF_JGE | BPF_K, IPV6_HEADER_LENGTH + 4, 1, 0));
+	mProgram.push_back(make_stmt(BPF_RET | BPF_K, ACCEPT));
+
+	for (iter = rules.begin(); iter != rules.end(); ++iter) {
+		add_outbound_drop_rule(*iter);
+	}
+
+	mProgram.push_back(make_stmt(BPF_RET | BPF_K, ACCEPT));
+
+	if (mProgram.size() > kMaxInstructions) {
+		mProgram.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void
+IPv6PacketFilter::set_icmpv6_type_filter(uint8_t type)
+{
+	mProgram.clear();
+	mProgram.push_back(make_stmt(BPF_LD | BPF_B | BPF_ABS, 0));
+	mProgram.push_back(make_jump(BPF_JMP | BPF_JEQ | BPF_K, type, 0, 1));
+	mProgram.push_back(make_stmt(BPF_RET | BPF_K, ACCEPT));
+	mProgram.push_back(make_stmt(BPF_RET | BPF_K, DROP));
+}
+
+int
+IPv6PacketFilter::attach_to_socket(int fd) const
+{
+	struct sock_fprog fprog;
+
+	if (mProgram.empty()) {
+		return -EINVAL;
+	}
+
+	fprog.len = static_cast<unsigned short>(mProgram.size());
+	fprog.filter = reinterpret_cast<struct sock_filter*>(const_cast<Instruction*>(&mProgram[0]));
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+		return -errno;
+	}
+
+	return 0;
+}
+
+#if defined(__NR_bpf)
+
+static struct bpf_insn
+make_ebpf(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+	struct bpf_insn insn;
+
+	memset(&insn, 0, sizeof(insn));
+	insn.code = code;
+	insn.dst_reg = dst;
+	insn.src_reg = src;
+	insn.off = off;
+	insn.imm = imm;
+
+	return insn;
+}
+
+// Number of eBPF instructions a classic one becomes. When drops are
+// counted, dropping is a jump to the code that counts them.
+static size_t
+ebpf_length(const IPv6PacketFilter::Instruction& insn, bool count_drops)
+{
+	switch (BPF_CLASS(insn.code)) {
+	case BPF_JMP:
+		return ((insn.jt != 0) && (insn.jf != 0)) ? 2 : 1;
+
+	case BPF_RET:
+		return (count_drops && (insn.k == DROP)) ? 1 : 2;
+
+	default:
+		return 1;
+	}
+}
+
+static uint8_t
+invert_jump(uint8_t op)
+{
+	switch (op) {
+	case BPF_JEQ: return BPF_JNE;
+	case BPF_JGT: return BPF_JLE;
+	case BPF_JGE: return BPF_JLT;
+	default:      return op;
+	}
+}
+
+// Adds one to the first element of the array map `counter_fd`, then
+// drops the packet.
+static void
+add_drop_count(std::vector<struct bpf_insn>& insns, int counter_fd)
+{
+	insns.push_back(make_ebpf(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, counter_fd));
+	insns.push_back(make_ebpf(0, 0, 0, 0, 0));
+	insns.push_back(make_ebpf(BPF_ST | BPF_MEM | BPF_W, BPF_REG_10, 0, -4, 0));
+	insns.push_back(make_ebpf(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0));
+	insns.push_back(make_ebpf(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4));
+	insns.push_back(make_ebpf(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+	insns.push_back(make_ebpf(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 2, 0));
+	insns.push_back(make_ebpf(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1));
+	insns.push_back(make_ebpf(BPF_STX | BPF_XADD | BPF_DW, BPF_REG_0, BPF_REG_1, 0, 0));
+	insns.push_back(make_ebpf(BPF_ALU | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, DROP));
+	insns.push_back(make_ebpf(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+}
+
+// The usual translation of classic BPF: A lives in R0 and the packet is
+// read with the legacy absolute loads, which want the context in R6.
+// Jumps compare 32 bits, as classic BPF does.
+int
+IPv6PacketFilter::load_ebpf(int counter_fd) const
+{
+	static const char kLicense[] = "Apache-2.0";
+	const bool count_drops = (counter_fd >= 0);
+	std::vector<struct bpf_insn> insns;
+	std::vector<size_t> starts;
+	union bpf_attr attr;
+	size_t count_start;
+	size_t drops = 0;
+	size_t i;
+	int fd;
+
+	if (mProgram.empty()) {
+		return -EINVAL;
+	}
+
+	starts.push_back(1);
+
+	for (i = 0; i < mProgram.size(); i++) {
+		starts.push_back(starts.back() + ebpf_length(mProgram[i], count_drops));
+	}
+
+	count_start = starts.back();
+
+	insns.push_back(make_ebpf(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+
+	for (i = 0; i < mProgram.size(); i++) {
+		const Instruction& insn = mProgram[i];
+		const size_t jt_target = starts[i + 1 + insn.jt];
+		const size_t jf_target = starts[i + 1 + insn.jf];
+
+		switch (BPF_CLASS(insn.code)) {
+		case BPF_LD:
+			if (BPF_MODE(insn.code) == BPF_LEN) {
+				insns.push_back(make_ebpf(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_0, BPF_REG_6, offsetof(struct __sk_buff, len), 0));
+			} else {
+				insns.push_back(make_ebpf(insn.code, 0, 0, 0, static_cast<int32_t>(insn.k)));
+			}
+			break;
+
+		case BPF_ALU:
+			insns.push_back(make_ebpf(insn.code, BPF_REG_0, 0, 0, static_cast<int32_t>(insn.k)));
+			break;
+
+		case BPF_JMP:
+			if (insn.jt == 0) {
+				insns.push_back(make_ebpf(BPF_JMP32 | invert_jump(BPF_OP(insn.code)) | BPF_K, BPF_REG_0, 0,
+					static_cast<int16_t>(jf_target - (insns.size() + 1)), static_cast<int32_t>(insn.k)));
+			} else {
+				insns.push_back(make_ebpf(BPF_JMP32 | BPF_OP(insn.code) | BPF_K, BPF_REG_0, 0,
+					static_cast<int16_t>(jt_target - (insns.size() + 1)), static_cast<int32_t>(insn.k)));
+
+				if (insn.jf != 0) {
+					insns.push_back(make_ebpf(BPF_JMP | BPF_JA, 0, 0,
+						static_cast<int16_t>(jf_target - (insns.size() + 1)), 0));
+				}
+			}
+			break;
+
+		case BPF_RET:
+			if (count_drops && (insn.k == DROP)) {
+				insns.push_back(make_ebpf(BPF_JMP | BPF_JA, 0, 0,
+					static_cast<int16_t>(count_start - (insns.size() + 1)), 0));
+				drops++;
+			} else {
+				insns.push_back(make_ebpf(BPF_ALU | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, static_cast<int32_t>(insn.k)));
+				insns.push_back(make_ebpf(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+			}
+			break;
+
+		default:
+			return -EINVAL;
+		}
+	}
+
+	// The verifier refuses code it can't reach, so the counting is only
+	// there if something jumps to it.
+	if (drops != 0) {
+		add_drop_count(insns, counter_fd);
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insns = reinterpret_cast<uintptr_t>(&insns[0]);
+	attr.insn_cnt = static_cast<uint32_t>(insns.size());
+	attr.license = reinterpret_cast<uintptr_t>(kLicense);
+
+	fd = static_cast<int>(syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr)));
+
+	return (fd < 0) ? -errno : fd;
+}
+
+int
+IPv6PacketFilter::create_drop_counter(void)
+{
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_ARRAY;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint64_t);
+	attr.max_entries = 1;
+
+	fd = static_cast<int>(syscall(__NR_bpf, BPF_MAP_CREATE, &attr, sizeof(attr)));
+
+	return (fd < 0) ? -errno : fd;
+}
+
+int
+IPv6PacketFilter::read_drop_counter(int counter_fd, uint64_t& count)
+{
+	union bpf_attr attr;
+	uint32_t key = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = static_cast<uint32_t>(counter_fd);
+	attr.key = reinterpret_cast<uintptr_t>(&key);
+	attr.value = reinterpret_cast<uintptr_t>(&count);
+
+	if (syscall(__NR_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr)) < 0) {
+		return -errno;
+	}
+
+	return 0;
+}
+
+#else // if defined(__NR_bpf)
+
+int
+IPv6PacketFilter::load_ebpf(int counter_fd) const
+{
+	return -ENOSYS;
+}
+
+int
+IPv6PacketFilter::create_drop_counter(void)
+{
+	return -ENOSYS;
+}
+
+int
+IPv6PacketFilter::read_drop_counter(int counter_fd, uint64_t& count)
+{
+	return -ENOSYS;
+}
+
+#endif // else defined(__NR_bpf)
+
+#else // if __linux__
+
+bool
+IPv6PacketFilter::set_outbound_drop_rules(const IPv6PacketClassifier& rules)
+{
+	mProgram.clear();
+	return true;
+}
+
+void
+IPv6PacketFilter::set_icmpv6_type_filter(uint8_t type)
+{
+	mProgram.clear();
+}
+
+int
+IPv6PacketFilter::attach_to_socket(int fd) const
+{
+	return -ENOTSUP;
+}
+
+int
+IPv6PacketFilter::load_ebpf(int counter_fd) const
+{
+	return -ENOTSUP;
+}
+
+int
+IPv6PacketFilter::create_drop_counter(void)
+{
+	return -ENOTSUP;
+}
+
+int
+IPv6PacketFilter::read_drop_counter(int counter_fd, uint64_t& count)
+{
+	return -ENOTSUP;
+}
+
+#endif // else __linux__
@@ -0,0 +1,99 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Kernel packet filters generated from IPv6 packet matcher rules.
+ *
+ */
+
+#ifndef __wpantund__IPv6PacketFilter__
+#define __wpantund__IPv6PacketFilter__
+
+#include <stdint.h>
+#include <vector>
+#include "IPv6PacketClassifier.h"
+
+namespace nl {
+
+// A classic BPF program that drops the packets a set of
+// `IPv6PacketMatcherRule`s match, so that the kernel can throw them
+// away before they are ever copied to wpantund.
+//
+// The program is only ever used to drop packets that wpantund would
+// drop anyway: anything it can't decide on in the kernel, such as
+// packets too short to hold the port numbers, is let through.
+//
+// Classic BPF can be attached to sockets directly. TUN devices only
+// take eBPF, so `load_ebpf()` translates the same program for them.
+// Only Linux is supported; elsewhere the program is always empty.
+class IPv6PacketFilter {
+public:
+	// Same layout as `struct sock_filter`.
+	struct Instruction {
+		uint16_t code;
+		uint8_t jt;
+		uint8_t jf;
+		uint32_t k;
+	};
+
+	enum {
+		kMaxInstructions = 4096,            // BPF_MAXINSNS
+	};
+
+	IPv6PacketFilter();
+
+	//! Rebuilds the program to drop packets that aren't IPv6, and
+	//! those that any of `rules` matches as outbound packets. The
+	//! program is left empty, and false returned, if it would be too
+	//! long. Where the program is always empty, this returns true.
+	bool set_outbound_drop_rules(const IPv6PacketClassifier& rules);
+
+	//! Rebuilds the program to drop every ICMPv6 message but those of
+	//! `type`, for raw ICMPv6 sockets, which see messages without
+	//! their IPv6 header.
+	void set_icmpv6_type_filter(uint8_t type);
+
+	const std::vector<Instruction>& get_program(void) const { return mProgram; }
+	bool empty(void) const { return mProgram.empty(); }
+
+	//! Attaches the program to a socket with `SO_ATTACH_FILTER`.
+	//! Returns zero or a negative errno.
+	int attach_to_socket(int fd) const;
+
+	//! Loads the program as an eBPF socket filter. If `counter_fd` is
+	//! a map from `create_drop_counter()`, the program counts the
+	//! packets it drops in it. Returns the file descriptor of the
+	//! loaded program or a negative errno.
+	int load_ebpf(int counter_fd = -1) const;
+
+	//! Creates a map for `load_ebpf()` to count dropped packets in.
+	//! Returns its file descriptor or a negative errno.
+	static int create_drop_counter(void);
+
+	//! Reads how many packets were counted in `counter_fd`. Returns
+	//! zero or a negative errno.
+	static int read_drop_counter(int counter_fd, uint64_t& count);
+
+private:
+	void add_outbound_drop_rule(const IPv6PacketMatcherRule& rule);
+
+	std::vector<Instruction> mProgram;
+}; // class IPv6PacketFilter
+
+}; // namespace nl
+
+#endif /* defined(__wpantund__IPv6PacketFilter__) */
@@ -145,6 +145,93 @@ bail:
 }
 
 
+IPv6PacketFields&
+IPv6PacketFields::update_from_packet(const uint8_t* packet, size_t len)
+{
+	uint8_t padded[IPV6_HEADER_LENGTH + 4];
+	const uint8_t* header = packet;
+
+	if (len < sizeof(padded)) {
+		memset(padded, 0, sizeof(padded));
+		memcpy(padded, packet, len);
+		header = padded;
+	}
+
+	is_ipv6 = (len > 0) && PACKET_IS_IPV6(header);
+	type = IPV6_GET_TYPE(header);
+	subtype = IPV6_ICMP_GET_SUBTYPE(header);
+	IPV6_GET_SRC_ADDR(source, header);
+	IPV6_GET_DEST_ADDR(destination, header);
+	memcpy(&source_port, header + IPV6_HEADER_LENGTH, sizeof(source_port));
+	memcpy(&destination_port, header + IPV6_HEADER_LENGTH + 2, sizeof(destination_port));
+
+	return *this;
+}
+
+IPv6PacketMatcherRule&
+IPv6PacketMatcherRule::update_from_inbound_fields(const IPv6PacketFields& fields)
+{
+	clear();
+
+	if (!fields.is_ipv6) {
+		goto bail;
+	}
+
+	type = fields.type;
+
+	if (type == IPv6PacketMatcherRule::TYPE_TCP || type == IPv6PacketMatcherRule::TYPE_UDP) {
+		remote_port = fields.source_port;
+		remote_port_match = true;
+
+		local_port = fields.destination_port;
+		local_port_match = true;
+	} else if (type == IPv6PacketMatcherRule::TYPE_ICMP) {
+		subtype = fields.subtype;
+	}
+
+	if (!IN6_IS_ADDR_MULTICAST(&fields.destination)) {
+		local_address = fields.destination;
+		local_match_mask = 128;
+	}
+
+	remote_address = fields.source;
+	remote_match_mask = 128;
+
+bail:
+	return *this;
+}
+
+IPv6PacketMatcherRule&
+IPv6PacketMatcherRule::update_from_outbound_fields(const IPv6PacketFields& fields)
+{
+	clear();
+
+	if (!fields.is_ipv6) {
+		goto bail;
+	}
+
+	type = fields.type;
+
+	if (type == IPv6PacketMatcherRule::TYPE_TCP || type == IPv6PacketMatcherRule::TYPE_UDP) {
+		remote_port = fields.destination_port;
+		remote_port_match = true;
+
+		local_port = fields.source_port;
+		local_port_match = true;
+	} else if (type == IPv6PacketMatcherRule::TYPE_ICMP) {
+		subtype = fields.subtype;
+	}
+
+	local_address = fields.source;
+	local_match_mask = 128;
+
+	remote_address = fields.destination;
+	remote_match_mask = 128;
+
+bail:
+	return *this;
+}
+
 bool
 IPv6PacketMatcherRule::match_inbound(const uint8_t* packet) const
 {
@@ -32,6 +32,22 @@ namespace nl {
 void dump_outbound_ipv6_packet(const uint8_t* packet, ssize_t len, const char* extra, bool dropped = false);
 void dump_inbound_ipv6_packet(const uint8_t* packet, ssize_t len, const char* extra, bool dropped = false);
 
+// The parts of an IPv6 header which matcher rules look at, pulled out
+// of the packet once so that any number of rules can be checked
+// against them without going back to the packet.
+struct IPv6PacketFields {
+	struct in6_addr source;
+	struct in6_addr destination;
+	in_port_t source_port;          // Network byte order
+	in_port_t destination_port;     // Network byte order
+	uint8_t type;
+	uint8_t subtype;
+	bool is_ipv6;
+
+	//! Bytes past the end of a short packet read as zero.
+	IPv6PacketFields& update_from_packet(const uint8_t* packet, size_t len);
+};
+
 struct IPv6PacketMatcherRule {
 	static const uint8_t TYPE_ALL;
 	static const uint8_t TYPE_NONE;
@@ -63,6 +79,8 @@ struct IPv6PacketMatcherRule {
 	bool                            match_inbound(const uint8_t* packet) const;
 	IPv6PacketMatcherRule&        update_from_outbound_packet(const uint8_t* packet);
 	bool                            match_outbound(const uint8_t* packet) const;
+	IPv6PacketMatcherRule&        update_from_inbound_fields(const IPv6PacketFields& fields);
+	IPv6PacketMatcherRule&        update_from_outbound_fields(const IPv6PacketFields& fields);
 	bool operator==(const IPv6PacketMatcherRule& lhs) const;
 	bool operator<(const IPv6PacketMatcherRule& lhs) const;
 
@@ -0,0 +1,315 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Implementation of the main loop profiler.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "LoopProfiler.h"
+
+using namespace nl;
+
+bool LoopProfiler::sEnabled = false;
+uint64_t LoopProfiler::sEnabledAt = 0;
+LoopProfiler::PhaseStats LoopProfiler::sPhases[kPhaseCount];
+uint32_t LoopProfiler::sWakeups[kWakeupCount];
+
+static const char* const kPhaseNames[LoopProfiler::kPhaseCount] = {
+	"Iteration",
+	"Wait",
+	"Prepare",
+	"Timers",
+	"IPC",
+	"NCP",
+	"NCP:FirmwareUpgrade",
+	"NCP:Pcap",
+	"NCP:Interface",
+	"NCP:Serial",
+	"NCP:Pumps",
+	"NCP:Tasks",
+};
+
+static const char* const kWakeupNames[LoopProfiler::kWakeupCount] = {
+	"Descriptor",
+	"Timeout",
+	"Immediate",
+	"Interrupted",
+};
+
+// Formats a duration given in microseconds with a unit that keeps it short.
+static const char*
+format_us(uint64_t us, char* buffer, size_t len)
+{
+	if (us < 1000) {
+		snprintf(buffer, len, "%uus", static_cast<unsigned int>(us));
+	} else if (us < 1000000) {
+		snprintf(buffer, len, "%.1fms", us / 1000.0);
+	} else {
+		snprintf(buffer, len, "%.2fs", us / 1000000.0);
+	}
+
+	return buffer;
+}
+
+static void
+format_histogram(std::string& line, const char* name, const uint32_t histogram[LoopProfiler::kHistogramBuckets])
+{
+	char c_string[40];
+	char duration[16];
+	unsigned int i;
+
+	line += name;
+
+	for (i = 0; i < LoopProfiler::kHistogramBuckets; i++) {
+		if (histogram[i] == 0) {
+			continue;
+		}
+
+		if (i + 1 < LoopProfiler::kHistogramBuckets) {
+			format_us(static_cast<uint64_t>(1) << i, duration, sizeof(duration));
+			snprintf(c_string, sizeof(c_string), " <%s:%u", duration, histogram[i]);
+		} else {
+			format_us(static_cast<uint64_t>(1) << (i - 1), duration, sizeof(duration));
+			snprintf(c_string, sizeof(c_string), " >=%s:%u", duration, histogram[i]);
+		}
+
+		line += c_string;
+	}
+}
+
+LoopProfiler::Scope::Scope(Phase phase)
+	: mPhase(phase), mActive(sEnabled), mWallStart(0), mCPUStart(0)
+{
+	if (mActive) {
+		mWallStart = get_wall_time_us();
+		mCPUStart = get_cpu_time_us();
+	}
+}
+
+LoopProfiler::Scope::~Scope()
+{
+	// Profiling may have been switched on or off by the phase we were
+	// timing, in which case this sample is dropped.
+	if (mActive && sEnabled) {
+		add_sample(
+			mPhase,
+			get_wall_time_us() - mWallStart,
+			get_cpu_time_us() - mCPUStart
+		);
+	}
+}
+
+uint64_t
+LoopProfiler::get_wall_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t
+LoopProfiler::get_cpu_time_us(void)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+	}
+#endif
+
+	return 0;
+}
+
+void
+LoopProfiler::set_enabled(bool enabled)
+{
+	if (enabled && !sEnabled) {
+		reset();
+	}
+
+	sEnabled = enabled;
+}
+
+void
+LoopProfiler::reset(void)
+{
+	memset(sPhases, 0, sizeof(sPhases));
+	memset(sWakeups, 0, sizeof(sWakeups));
+	sEnabledAt = get_wall_time_us();
+}
+
+unsigned int
+LoopProfiler::get_bucket(uint64_t us)
+{
+	unsigned int bucket = 0;
+
+	while ((us != 0) && (bucket + 1 < kHistogramBuckets)) {
+		us >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+void
+LoopProfiler::add_sample(Phase phase, uint64_t wall_us, uint64_t cpu_us)
+{
+	PhaseStats& stats = sPhases[phase];
+
+	stats.mCount++;
+	stats.mWallTotal += wall_us;
+	stats.mCPUTotal += cpu_us;
+
+	if (wall_us > stats.mWallMax) {
+		stats.mWallMax = (wall_us > UINT32_MAX) ? UINT32_MAX : static_cast<uint32_t>(wall_us);
+	}
+
+	stats.mWallHistogram[get_bucket(wall_us)]++;
+	stats.mCPUHistogram[get_bucket(cpu_us)]++;
+}
+
+void
+LoopProfiler::note_wakeup(Wakeup wakeup)
+{
+	if (sEnabled) {
+		sWakeups[wakeup]++;
+	}
+}
+
+const LoopProfiler::PhaseStats&
+LoopProfiler::get_phase_stats(Phase phase)
+{
+	return sPhases[phase];
+}
+
+uint32_t
+LoopProfiler::get_wakeup_count(Wakeup wakeup)
+{
+	return sWakeups[wakeup];
+}
+
+const char*
+LoopProfiler::get_phase_name(Phase phase)
+{
+	return kPhaseNames[phase];
+}
+
+const char*
+LoopProfiler::get_wakeup_name(Wakeup wakeup)
+{
+	return kWakeupNames[wakeup];
+}
+
+void
+LoopProfiler::get_phase_summary(std::list<std::string>& lines)
+{
+	const uint64_t elapsed = get_wall_time_us() - sEnabledAt;
+	char c_string[160];
+	char total[16], average[16], max[16], cpu[16];
+	int i;
+
+	for (i = 0; i < kPhaseCount; i++) {
+		const PhaseStats& stats = sPhases[i];
+
+		snprintf(
+			c_string,
+			sizeof(c_string),
+			"%-20s count:%-8u wall:%s avg:%s max:%s cpu:%s (%.1f%%)",
+			kPhaseNames[i],
+			stats.mCount,
+			format_us(stats.mWallTotal, total, sizeof(total)),
+			format_us((stats.mCount != 0) ? stats.mWallTotal / stats.mCount : 0, average, sizeof(average)),
+			format_us(stats.mWallMax, max, sizeof(max)),
+			format_us(stats.mCPUTotal, cpu, sizeof(cpu)),
+			(elapsed != 0) ? (100.0 * stats.mCPUTotal / elapsed) : 0.0
+		);
+
+		lines.push_back(c_string);
+	}
+}
+
+void
+LoopProfiler::get_histograms(std::list<std::string>& lines)
+{
+	std::string line;
+	char c_string[40];
+	int i;
+
+	for (i = 0; i < kPhaseCount; i++) {
+		if (sPhases[i].mCount == 0) {
+			continue;
+		}
+
+		snprintf(c_string, sizeof(c_string), "%-20s ", kPhaseNames[i]);
+
+		line = c_string;
+		format_histogram(line, "wall", sPhases[i].mWallHistogram);
+		lines.push_back(line);
+
+		line = c_string;
+		format_histogram(line, "cpu ", sPhases[i].mCPUHistogram);
+		lines.push_back(line);
+	}
+}
+
+void
+LoopProfiler::get_wakeups(std::list<std::string>& lines)
+{
+	char c_string[80];
+	int i;
+
+	for (i = 0; i < kWakeupCount; i++) {
+		snprintf(c_string, sizeof(c_string), "%-20s = %u", kWakeupNames[i], sWakeups[i]);
+		lines.push_back(c_string);
+	}
+}
+
+void
+LoopProfiler::dump(int level)
+{
+	std::list<std::string> lines;
+	std::list<std::string>::const_iterator iter;
+	char elapsed[16];
+
+	if (!sEnabled) {
+		syslog(level, "Main loop profiling is disabled");
+		return;
+	}
+
+	get_phase_summary(lines);
+	get_wakeups(lines);
+	get_histograms(lines);
+
+	syslog(level, "Main loop profile for the last %s:", format_us(get_wall_time_us() - sEnabledAt, elapsed, sizeof(elapsed)));
+
+	for (iter = lines.begin(); iter != lines.end(); ++iter) {
+		syslog(level, "  %s", iter->c_str());
+	}
+}
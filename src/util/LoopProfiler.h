@@ -0,0 +1,134 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Per-phase wall-clock and CPU time accounting for the main loop.
+ *
+ */
+
+#ifndef __wpantund__LoopProfiler__
+#define __wpantund__LoopProfiler__
+
+#include <stdint.h>
+#include <list>
+#include <string>
+
+namespace nl {
+
+// Accounts for the time the main loop spends in each of its phases, so
+// that CPU spikes can be traced to the component responsible without
+// attaching a profiler.
+//
+// Each phase keeps totals and power-of-two histograms (in microseconds)
+// of both wall-clock time and the CPU time of the calling thread. Phases
+// nest: the time spent in a sub-stage is also counted in the phase that
+// encloses it. The main loop also notes what woke it up each time.
+//
+// Profiling is off until `set_enabled()` is called, and while it is off
+// a `Scope` costs no more than a test of a flag. Only the main loop's
+// thread may record into the profiler.
+class LoopProfiler {
+public:
+	enum Phase {
+		kPhaseIteration,            // All of the processing after a wakeup
+		kPhaseWait,                 // Blocked waiting for events
+		kPhasePrepare,              // Gathering descriptors and timeouts to wait on
+		kPhaseTimers,
+		kPhaseIPC,                  // One sample per IPC server
+		kPhaseNCP,                  // The whole of the NCP instance's processing
+		kPhaseNCPFirmwareUpgrade,
+		kPhaseNCPPcap,
+		kPhaseNCPInterface,         // Network interfaces and their addresses
+		kPhaseNCPSerial,
+		kPhaseNCPPumps,
+		kPhaseNCPTasks,             // Driver tasks and state machine
+		kPhaseCount
+	};
+
+	enum Wakeup {
+		kWakeupDescriptor,          // A watched descriptor became ready
+		kWakeupTimeout,             // The wait timed out (timers are due)
+		kWakeupImmediate,           // Work was pending, so the loop didn't block
+		kWakeupInterrupted,         // A signal or an error ended the wait
+		kWakeupCount
+	};
+
+	enum {
+		// Bucket 0 holds samples under 1us, bucket N those in
+		// [2^(N-1), 2^N) us, and the last bucket everything longer.
+		kHistogramBuckets = 20
+	};
+
+	struct PhaseStats {
+		uint32_t mCount;
+		uint64_t mWallTotal;        // Microseconds
+		uint64_t mCPUTotal;         // Microseconds
+		uint32_t mWallMax;          // Microseconds
+		uint32_t mWallHistogram[kHistogramBuckets];
+		uint32_t mCPUHistogram[kHistogramBuckets];
+	};
+
+	// Times the given phase from construction to destruction.
+	class Scope {
+	public:
+		Scope(Phase phase);
+		~Scope();
+
+	private:
+		Phase mPhase;
+		bool mActive;
+		uint64_t mWallStart;
+		uint64_t mCPUStart;
+	};
+
+	// Turns profiling on or off. Turning it back on after it was off
+	// discards whatever was collected before.
+	static void set_enabled(bool enabled);
+	static bool is_enabled(void) { return sEnabled; }
+	static void reset(void);
+
+	static void add_sample(Phase phase, uint64_t wall_us, uint64_t cpu_us);
+	static void note_wakeup(Wakeup wakeup);
+
+	static const PhaseStats& get_phase_stats(Phase phase);
+	static uint32_t get_wakeup_count(Wakeup wakeup);
+
+	static const char* get_phase_name(Phase phase);
+	static const char* get_wakeup_name(Wakeup wakeup);
+	static unsigned int get_bucket(uint64_t us);
+
+	// Human-readable reports, one line per phase (or wakeup cause).
+	static void get_phase_summary(std::list<std::string>& lines);
+	static void get_histograms(std::list<std::string>& lines);
+	static void get_wakeups(std::list<std::string>& lines);
+
+	// Logs all of the above with syslog().
+	static void dump(int level);
+
+private:
+	static uint64_t get_wall_time_us(void);
+	static uint64_t get_cpu_time_us(void);
+
+	static bool sEnabled;
+	static uint64_t sEnabledAt;
+	static PhaseStats sPhases[kPhaseCount];
+	static uint32_t sWakeups[kWakeupCount];
+}; // class LoopProfiler
+
+}; // namespace nl
+
+#endif  // ifndef __wpantund__LoopProfiler__
@@ -0,0 +1,216 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Ring-buffer over storage owned by someone else (not thread-safe)
+ *
+ */
+
+#ifndef wpantund_RingBufferView_h
+#define wpantund_RingBufferView_h
+
+#include <stddef.h>
+
+namespace nl {
+
+// A ring buffer like `RingBuffer<>`, except that its size is only known
+// at run time and it keeps its elements in storage it is handed, such
+// as a slice of one array shared by many rings. Writing to it never
+// allocates.
+//
+// NOTE: The below implementation of RingBufferView<> is NOT thread-safe.
+template <typename T>
+class RingBufferView
+{
+public:
+
+	typedef T value_type;
+	typedef int size_type;
+
+public:
+
+	RingBufferView(): mBuffer(NULL), mBufferSize(0)
+	{
+		clear();
+	}
+
+	// Uses `buffer_size` elements at `buffer` as storage, dropping any
+	// elements held so far. The storage must outlive the ring buffer.
+	void attach(value_type *buffer, size_type buffer_size)
+	{
+		mBuffer = buffer;
+		mBufferSize = (buffer != NULL) ? buffer_size : 0;
+		clear();
+	}
+
+	size_type size() const
+	{
+		return mCount;
+	}
+
+	bool empty() const
+	{
+		return (mCount == 0);
+	}
+
+	bool full() const
+	{
+		return (mCount == mBufferSize);
+	}
+
+	size_type max_size() const
+	{
+		return mBufferSize;
+	}
+
+	// Returns a pointer to the front (oldest) element, or NULL if empty.
+	const value_type *front() const
+	{
+		return (mCount == 0)? NULL : &mBuffer[mReadIdx];
+	}
+
+	// Returns a pointer to the back (newest) element, or NULL if empty.
+	const value_type *back() const
+	{
+		return (mCount == 0)? NULL : &mBuffer[index_of(mCount - 1)];
+	}
+
+	// Writes the new value, overwriting the oldest one if the ring buffer
+	// is full. Does nothing if the ring buffer has no storage.
+	void force_write(const value_type& value)
+	{
+		if (mBufferSize == 0) {
+			return;
+		}
+
+		mBuffer[index_of(mCount)] = value;
+
+		if (mCount == mBufferSize) {
+			mReadIdx = index_of(1);
+		} else {
+			mCount++;
+		}
+	}
+
+	// Clears the ring buffer.
+	void clear()
+	{
+		mReadIdx = 0;
+		mCount = 0;
+	}
+
+private:
+	// Index in `mBuffer` of the `n`th element from the front.
+	size_type index_of(size_type n) const
+	{
+		size_type index = mReadIdx + n;
+
+		return (index >= mBufferSize) ? index - mBufferSize : index;
+	}
+
+	class IteratorBase
+	{
+	protected:
+		IteratorBase(const RingBufferView *ring_buffer_ptr, size_type position)
+			: mRingBufferPtr(ring_buffer_ptr), mPosition(position) { }
+
+	public:
+		bool operator==(const IteratorBase &lhs) const
+		{
+			return (mPosition == lhs.mPosition) && (mRingBufferPtr == lhs.mRingBufferPtr);
+		}
+
+		bool operator!=(const IteratorBase &lhs) const
+		{
+			return !((*this) == lhs);
+		}
+
+		const value_type& operator* () const  { return mRingBufferPtr->mBuffer[mRingBufferPtr->index_of(mPosition)]; }
+		const value_type* operator-> () const { return &**this; }
+
+	protected:
+		const RingBufferView *mRingBufferPtr;
+		size_type mPosition;            // From the front; -1 or `size()` at the ends
+	};
+
+public:
+	// An iterator for going through the elements from front to back.
+	class Iterator : public IteratorBase
+	{
+	public:
+		Iterator() : IteratorBase(NULL, 0) { }
+
+		Iterator& operator++() {
+			this->mPosition++;
+			return *this;
+		}
+
+	private:
+		Iterator(const RingBufferView *ring_buffer_ptr, size_type position) :
+			IteratorBase(ring_buffer_ptr, position) { }
+
+		friend class RingBufferView;
+	};
+
+	// An iterator for going through the elements from back to front.
+	class ReverseIterator : public IteratorBase
+	{
+	public:
+		ReverseIterator() : IteratorBase(NULL, 0) { }
+
+		ReverseIterator& operator++() {
+			this->mPosition--;
+			return *this;
+		}
+
+	private:
+		ReverseIterator(const RingBufferView *ring_buffer_ptr, size_type position) :
+			IteratorBase(ring_buffer_ptr, position) { }
+
+		friend class RingBufferView;
+	};
+
+	Iterator begin() const
+	{
+		return Iterator(this, 0);
+	}
+
+	Iterator end() const
+	{
+		return Iterator(this, mCount);
+	}
+
+	ReverseIterator rbegin() const
+	{
+		return ReverseIterator(this, mCount - 1);
+	}
+
+	ReverseIterator rend() const
+	{
+		return ReverseIterator(this, -1);
+	}
+
+private:
+	value_type *mBuffer;
+	size_type mBufferSize;
+	size_type mReadIdx;
+	size_type mCount;
+};
+
+}; // namespace nl
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Lock-free single-producer/single-consumer ring.
+ *
+ */
+
+#ifndef wpantund_SPSCRing_h
+#define wpantund_SPSCRing_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace nl {
+
+// Hands elements from exactly one producer thread to exactly one
+// consumer thread without taking a lock. Elements are filled and
+// drained in place, so large frames are never copied through the ring:
+//
+//  *  The producer fills the slot returned by `back()` (which is NULL
+//     while the ring is full), then calls `push()` to publish it.
+//  *  The consumer reads the slot returned by `front()` (which is NULL
+//     while the ring is empty), then calls `pop()` to hand it back.
+//
+// `I` must be a power of two.
+template <typename T, unsigned int I>
+class SPSCRing
+{
+public:
+	typedef T value_type;
+
+	static const unsigned int buffer_size = I;
+
+public:
+	SPSCRing()
+		:mHead(0), mTail(0)
+	{
+		// Fails to compile unless `I` is a power of two, which
+		// keeps the slot index valid across counter wrap-around.
+		typedef char size_must_be_power_of_two[((I != 0) && ((I & (I - 1)) == 0)) ? 1 : -1];
+		(void)sizeof(size_must_be_power_of_two);
+	}
+
+	// ------------------------------------------------------------------------
+	// Producer side
+
+	value_type* back(void)
+	{
+		const uint32_t tail = __atomic_load_n(&mTail, __ATOMIC_RELAXED);
+
+		if (tail - __atomic_load_n(&mHead, __ATOMIC_ACQUIRE) >= buffer_size) {
+			return NULL;
+		}
+
+		return &mBuffer[tail % buffer_size];
+	}
+
+	void push(void)
+	{
+		__atomic_store_n(&mTail, __atomic_load_n(&mTail, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+	}
+
+	bool full(void) const
+	{
+		return size() >= buffer_size;
+	}
+
+	// ------------------------------------------------------------------------
+	// Consumer side
+
+	value_type* front(void)
+	{
+		const uint32_t head = __atomic_load_n(&mHead, __ATOMIC_RELAXED);
+
+		if (head == __atomic_load_n(&mTail, __ATOMIC_ACQUIRE)) {
+			return NULL;
+		}
+
+		return &mBuffer[head % buffer_size];
+	}
+
+	void pop(void)
+	{
+		__atomic_store_n(&mHead, __atomic_load_n(&mHead, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+	}
+
+	bool empty(void) const
+	{
+		return size() == 0;
+	}
+
+	// ------------------------------------------------------------------------
+	// Either side. Only a snapshot while the other side is active.
+
+	unsigned int size(void) const
+	{
+		return __atomic_load_n(&mTail, __ATOMIC_ACQUIRE) - __atomic_load_n(&mHead, __ATOMIC_ACQUIRE);
+	}
+
+	// Only safe while neither side is active.
+	void clear(void)
+	{
+		mHead = mTail = 0;
+	}
+
+private:
+	enum {
+		kCacheLineSize = 64
+	};
+
+	// Each counter is only ever written by one side, so they are kept
+	// on separate cache lines to keep the two threads from bouncing a
+	// shared line back and forth on every element.
+	uint32_t mHead;
+	uint8_t mHeadPad[kCacheLineSize - sizeof(uint32_t)];
+	uint32_t mTail;
+	uint8_t mTailPad[kCacheLineSize - sizeof(uint32_t)];
+
+	value_type mBuffer[I];
+};
+
+}; // namespace nl
+
+#endif
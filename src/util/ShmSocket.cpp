@@ -0,0 +1,513 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Implementation of the ShmSocket class.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "assert-macros.h"
+
+#include "ShmSocket.h"
+#include "socket-utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <new>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+using namespace nl;
+
+#if HAVE_SYS_EVENTFD_H
+
+// The shared memory, the host's eventfd and the NCP's eventfd.
+#define SHM_HANDOFF_FD_COUNT            3
+
+static int
+create_shm_fd(size_t size)
+{
+	int fd;
+
+#if HAVE_MEMFD_CREATE
+	fd = memfd_create("wpantund-shm", MFD_CLOEXEC);
+#else
+	char path[] = "/dev/shm/wpantund-shm-XXXXXX";
+
+	fd = mkstemp(path);
+
+	if (fd >= 0) {
+		unlink(path);
+	}
+#endif
+
+	require(fd >= 0, bail);
+
+	if (ftruncate(fd, static_cast<off_t>(size)) < 0) {
+		close(fd);
+		fd = -1;
+	}
+
+bail:
+	return fd;
+}
+
+static int
+send_fds(int socket_fd, const int* fds, int count)
+{
+	char byte = 0;
+	struct iovec iov = { &byte, 1 };
+	char control[CMSG_SPACE(sizeof(int) * SHM_HANDOFF_FD_COUNT)];
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+	return (sendmsg(socket_fd, &msg, MSG_NOSIGNAL) < 0) ? -errno : 0;
+}
+
+static int
+recv_fds(int socket_fd, int* fds, int count)
+{
+	char byte;
+	struct iovec iov = { &byte, 1 };
+	char control[CMSG_SPACE(sizeof(int) * SHM_HANDOFF_FD_COUNT)];
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+	do {
+		ret = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+	} while ((ret < 0) && (errno == EINTR));
+
+	if (ret <= 0) {
+		return (ret < 0) ? -errno : -ECONNRESET;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+
+	if ( (cmsg == NULL)
+	  || (cmsg->cmsg_level != SOL_SOCKET)
+	  || (cmsg->cmsg_type != SCM_RIGHTS)
+	  || (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count))
+	) {
+		return -EPROTO;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+
+	return 0;
+}
+
+#endif // if HAVE_SYS_EVENTFD_H
+
+ShmSocket::ShmSocket(Side side, int control_fd, int own_event_fd, int peer_event_fd, Segment* segment)
+	: mSide(side)
+	, mControlFD(control_fd)
+	, mOwnEventFD(own_event_fd)
+	, mPeerEventFD(peer_event_fd)
+	, mSegment(segment)
+	, mTxRing((side == kSideHost) ? &segment->mToNcp : &segment->mToHost)
+	, mRxRing((side == kSideHost) ? &segment->mToHost : &segment->mToNcp)
+	, mIsWaiting(false)
+	, mPeerClosed(false)
+	, mResetRequested(false)
+{
+}
+
+ShmSocket::~ShmSocket()
+{
+	munmap(mSegment, sizeof(*mSegment));
+
+	EventBackend::fd_closed(mControlFD);
+	close(mControlFD);
+
+	EventBackend::fd_closed(mOwnEventFD);
+	close(mOwnEventFD);
+
+	close(mPeerEventFD);
+}
+
+boost::shared_ptr<SocketWrapper>
+ShmSocket::create(const std::string& path)
+{
+	const std::string socket_path(path.c_str() + strlen(SOCKET_SHM_COMMAND_PREFIX));
+	struct sockaddr_un addr;
+	int fd = -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (socket_path.empty() || (socket_path.size() >= sizeof(addr.sun_path))) {
+		syslog(LOG_ERR, "ShmSocket: Bad socket path <%s>", path.c_str());
+		throw SocketError("Bad shared memory socket path");
+	}
+
+	memcpy(addr.sun_path, socket_path.c_str(), socket_path.size());
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if ((fd < 0) || (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)) {
+		syslog(LOG_ERR, "Unable to open socket with path <%s>, errno=%d (%s)", path.c_str(), errno, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		throw SocketError("Unable to connect shared memory socket");
+	}
+
+	return connect(fd);
+}
+
+boost::shared_ptr<ShmSocket>
+ShmSocket::connect(int control_fd)
+{
+#if HAVE_SYS_EVENTFD_H
+	int fds[SHM_HANDOFF_FD_COUNT] = { -1, -1, -1 };
+	void* memory = MAP_FAILED;
+	Segment* segment;
+	int ret;
+
+	fds[0] = create_shm_fd(sizeof(Segment));
+	require_string(fds[0] >= 0, bail, strerror(errno));
+
+	memory = mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	require_string(memory != MAP_FAILED, bail, strerror(errno));
+
+	memset(memory, 0, sizeof(Segment));
+	segment = new (memory) Segment;
+	segment->mMagic = kMagic;
+	segment->mSlotCount = kRingSlots;
+	segment->mMaxFrameSize = kMaxFrameSize;
+
+	fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	require_string((fds[1] >= 0) && (fds[2] >= 0), bail, strerror(errno));
+
+	ret = send_fds(control_fd, fds, SHM_HANDOFF_FD_COUNT);
+	require_string(ret == 0, bail, strerror(-ret));
+
+	close(fds[0]);
+
+	return boost::shared_ptr<ShmSocket>(new ShmSocket(kSideHost, control_fd, fds[1], fds[2], segment));
+
+bail:
+	if (memory != MAP_FAILED) {
+		munmap(memory, sizeof(Segment));
+	}
+
+	for (ret = 0; ret < SHM_HANDOFF_FD_COUNT; ret++) {
+		if (fds[ret] >= 0) {
+			close(fds[ret]);
+		}
+	}
+
+	close(control_fd);
+	throw SocketError("Unable to set up shared memory");
+#else
+	close(control_fd);
+	syslog(LOG_ERR, "ShmSocket: Shared memory sockets are not supported on this platform");
+	throw SocketError("Shared memory sockets are not supported on this platform");
+#endif
+}
+
+boost::shared_ptr<ShmSocket>
+ShmSocket::accept(int control_fd)
+{
+#if HAVE_SYS_EVENTFD_H
+	int fds[SHM_HANDOFF_FD_COUNT] = { -1, -1, -1 };
+	void* memory = MAP_FAILED;
+	Segment* segment;
+	struct stat st;
+	int ret;
+
+	ret = recv_fds(control_fd, fds, SHM_HANDOFF_FD_COUNT);
+	require_string(ret == 0, bail, strerror(-ret));
+
+	require_string(fstat(fds[0], &st) >= 0, bail, strerror(errno));
+	require_string(st.st_size >= static_cast<off_t>(sizeof(Segment)), bail, "Shared memory is too small");
+
+	memory = mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	require_string(memory != MAP_FAILED, bail, strerror(errno));
+
+	segment = static_cast<Segment*>(memory);
+
+	require_string(
+		(segment->mMagic == kMagic)
+		&& (segment->mSlotCount == kRingSlots)
+		&& (segment->mMaxFrameSize == kMaxFrameSize),
+		bail,
+		"Shared memory layout doesn't match"
+	);
+
+	close(fds[0]);
+
+	return boost::shared_ptr<ShmSocket>(new ShmSocket(kSideNcp, control_fd, fds[2], fds[1], segment));
+
+bail:
+	if (memory != MAP_FAILED) {
+		munmap(memory, sizeof(Segment));
+	}
+
+	for (ret = 0; ret < SHM_HANDOFF_FD_COUNT; ret++) {
+		if (fds[ret] >= 0) {
+			close(fds[ret]);
+		}
+	}
+
+	close(control_fd);
+	throw SocketError("Unable to take shared memory");
+#else
+	close(control_fd);
+	syslog(LOG_ERR, "ShmSocket: Shared memory sockets are not supported on this platform");
+	throw SocketError("Shared memory sockets are not supported on this platform");
+#endif
+}
+
+bool
+ShmSocket::is_framed(void)const
+{
+	return true;
+}
+
+bool
+ShmSocket::can_read(void)const
+{
+	// Once the peer is gone, `read()` has an error to hand back.
+	return !mRxRing->empty() || mPeerClosed;
+}
+
+bool
+ShmSocket::can_write(void)const
+{
+	return !mTxRing->full();
+}
+
+void
+ShmSocket::wake_peer(void)
+{
+	uint32_t* peer_waiting = &mSegment->mWaiting[(mSide == kSideHost) ? kSideNcp : kSideHost].mValue;
+
+	// Pairs with the fence in `update_fd_interest()`: either the peer
+	// sees what we just did to the ring, or we see that it is waiting.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(peer_waiting, __ATOMIC_RELAXED) != 0) {
+		const uint64_t one = 1;
+
+		__atomic_store_n(peer_waiting, 0, __ATOMIC_RELAXED);
+		IGNORE_RETURN_VALUE(::write(mPeerEventFD, &one, sizeof(one)));
+	}
+}
+
+ssize_t
+ShmSocket::write(const void* data, size_t len)
+{
+	Slot* slot;
+
+	if (mPeerClosed) {
+		return -EPIPE;
+	}
+
+	if (len > kMaxFrameSize) {
+		return -EMSGSIZE;
+	}
+
+	slot = mTxRing->back();
+
+	if (slot == NULL) {
+		return -EAGAIN;
+	}
+
+	memcpy(slot->mData, data, len);
+	slot->mLen = static_cast<uint16_t>(len);
+	mTxRing->push();
+
+	wake_peer();
+
+	return static_cast<ssize_t>(len);
+}
+
+ssize_t
+ShmSocket::writev(const struct iovec* iov, int iovcnt)
+{
+	ssize_t total = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		ssize_t ret = write(iov[i].iov_base, iov[i].iov_len);
+
+		if (ret < 0) {
+			return (total > 0) ? total : ret;
+		}
+
+		total += ret;
+	}
+
+	return total;
+}
+
+ssize_t
+ShmSocket::read(void* data, size_t len)
+{
+	const Slot* slot = mRxRing->front();
+
+	if (slot == NULL) {
+		return mPeerClosed ? -EPIPE : 0;
+	}
+
+	// A frame which doesn't fit is truncated, like a datagram would be.
+	len = std::min(len, static_cast<size_t>(std::min(slot->mLen, static_cast<uint16_t>(kMaxFrameSize))));
+	memcpy(data, slot->mData, len);
+	mRxRing->pop();
+
+	// The peer may be waiting for room.
+	wake_peer();
+
+	return static_cast<ssize_t>(len);
+}
+
+void
+ShmSocket::check_control(void)
+{
+	char command;
+	ssize_t ret;
+
+	while ((ret = recv(mControlFD, &command, 1, MSG_DONTWAIT)) > 0) {
+		if (command == kCommandReset) {
+			mResetRequested = true;
+		}
+	}
+
+	if ((ret == 0) || ((ret < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) {
+		if (!mPeerClosed) {
+			syslog(LOG_ERR, "ShmSocket: Peer went away");
+		}
+		mPeerClosed = true;
+	}
+}
+
+int
+ShmSocket::process(void)
+{
+	if (mIsWaiting) {
+		uint64_t count;
+
+		mIsWaiting = false;
+		__atomic_store_n(&mSegment->mWaiting[mSide].mValue, 0, __ATOMIC_RELAXED);
+
+		// Clear any wakeup, including one that came in after we
+		// stopped waiting for it.
+		IGNORE_RETURN_VALUE(::read(mOwnEventFD, &count, sizeof(count)));
+
+		check_control();
+	}
+
+	return 0;
+}
+
+int
+ShmSocket::update_fd_interest(EventBackend *backend, cms_t *timeout)
+{
+	const bool tx_was_full = mTxRing->full();
+	cms_t wait = CMS_DISTANT_FUTURE;
+
+	if (!mRxRing->empty()) {
+		wait = 0;
+
+	} else if (mPeerClosed) {
+		// Nothing more will happen. `can_read()` lets the reader
+		// find out.
+
+	} else if ((timeout != NULL) && (*timeout <= 0)) {
+		// The main loop isn't going to sleep, so there is no
+		// need to be woken up.
+
+	} else {
+		__atomic_store_n(&mSegment->mWaiting[mSide].mValue, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		mIsWaiting = true;
+
+		if (!mRxRing->empty() || (tx_was_full && !mTxRing->full())) {
+			// The peer got to the rings before it could have
+			// seen us waiting.
+			wait = 0;
+
+		} else if (backend != NULL) {
+			backend->watch(mOwnEventFD, EventBackend::kEventRead);
+			backend->watch(mControlFD, EventBackend::kEventRead);
+		}
+	}
+
+	if (timeout != NULL) {
+		*timeout = std::min(*timeout, wait);
+	}
+
+	return 0;
+}
+
+void
+ShmSocket::reset(void)
+{
+	const char command = kCommandReset;
+
+	if (mSide == kSideHost) {
+		IGNORE_RETURN_VALUE(send(mControlFD, &command, 1, MSG_DONTWAIT | MSG_NOSIGNAL));
+	}
+}
+
+bool
+ShmSocket::did_reset(void)
+{
+	const bool ret = mResetRequested;
+
+	mResetRequested = false;
+
+	return ret;
+}
@@ -0,0 +1,154 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      This file declares the ShmSocket class, which exchanges frames
+ *      with an NCP on the same host through shared memory.
+ *
+ */
+
+#ifndef __wpantund__ShmSocket__
+#define __wpantund__ShmSocket__
+
+#include "SocketWrapper.h"
+#include "SPSCRing.h"
+
+namespace nl {
+
+// Exchanges whole Spinel frames with an NCP running on the same host
+// (such as a simulated or POSIX NCP) through a pair of rings in shared
+// memory, without any framing, escaping or CRC.
+//
+// The host connects to a Unix domain socket the NCP listens on, and
+// passes it the shared memory (as a file descriptor to map) and one
+// eventfd for each side, all in a single SCM_RIGHTS message carrying
+// one byte. The connection then stays open so that either side can tell
+// when the other goes away, and carries single-byte commands.
+//
+// The memory holds a `Segment`. Each side only sleeps after setting its
+// `mWaiting` flag and checking the rings once more; the other side
+// writes to its eventfd after changing a ring only if the flag is set,
+// so a busy link makes no system calls at all.
+//
+// This is a framed socket, just like `SpiSocket`: `read()` hands back
+// one frame at a time and `write()` takes one frame at a time.
+class ShmSocket : public SocketWrapper {
+public:
+	enum {
+		kMagic = 0x77736D31,                    // "wsm1"
+		kMaxFrameSize = 2048,
+		kRingSlots = 16,                        // In each direction
+	};
+
+	enum Side {
+		kSideHost = 0,
+		kSideNcp = 1,
+	};
+
+	// Commands sent over the connection.
+	enum {
+		kCommandReset = 'R',
+	};
+
+	struct Slot {
+		uint16_t mLen;
+		uint8_t mData[kMaxFrameSize];
+	};
+
+	typedef SPSCRing<Slot, kRingSlots> Ring;
+
+	struct Segment {
+		uint32_t mMagic;
+		uint32_t mSlotCount;
+		uint32_t mMaxFrameSize;
+		uint32_t mReserved;
+
+		// Set by a side just before it waits on its eventfd. Indexed
+		// by `Side`, and kept apart so that each is only touched by
+		// one side most of the time.
+		struct {
+			uint32_t mValue;
+			uint8_t mPad[60];
+		} mWaiting[2];
+
+		Ring mToNcp;
+		Ring mToHost;
+	};
+
+	//! Connects to the NCP listening at the Unix domain socket given by
+	//! a "shm:" path: `shm:<socket-path>`.
+	static boost::shared_ptr<SocketWrapper> create(const std::string& path);
+
+	//! Sets up shared memory over an already connected `control_fd` as
+	//! the host, taking ownership of the descriptor.
+	static boost::shared_ptr<ShmSocket> connect(int control_fd);
+
+	//! Takes the shared memory handed over `control_fd` by `connect()`,
+	//! as the NCP. Takes ownership of the descriptor.
+	static boost::shared_ptr<ShmSocket> accept(int control_fd);
+
+	virtual ~ShmSocket();
+
+	//! Queues one frame to be sent. Returns -EAGAIN if the ring is full.
+	virtual ssize_t write(const void* data, size_t len);
+
+	//! Queues one frame per buffer, for as many as there is room for.
+	virtual ssize_t writev(const struct iovec* iov, int iovcnt);
+
+	//! Takes the oldest received frame. Returns 0 if there is none.
+	virtual ssize_t read(void* data, size_t len);
+
+	virtual bool is_framed(void)const;
+	virtual bool can_read(void)const;
+	virtual bool can_write(void)const;
+	virtual int process(void);
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout);
+
+	//! From the host, asks the NCP to reset.
+	virtual void reset(void);
+
+	//! On the NCP side, true once for each reset the host asked for.
+	virtual bool did_reset(void);
+
+	Side get_side(void)const { return mSide; }
+
+protected:
+	ShmSocket(Side side, int control_fd, int own_event_fd, int peer_event_fd, Segment* segment);
+
+private:
+	void wake_peer(void);
+	void check_control(void);
+
+	Side mSide;
+	int mControlFD;
+	int mOwnEventFD;
+	int mPeerEventFD;
+	Segment* mSegment;
+	Ring* mTxRing;
+	Ring* mRxRing;
+
+	// Set between `update_fd_interest()` deciding to wait and the next
+	// `process()`.
+	bool mIsWaiting;
+
+	bool mPeerClosed;
+	bool mResetRequested;
+}; // class ShmSocket
+
+}; // namespace nl
+
+#endif /* defined(__wpantund__ShmSocket__) */
@@ -60,6 +60,12 @@ SocketAdapter::write(const void* data, size_t len)
 	return mParent ? mParent->write(data, len) : -EINVAL;
 }
 
+ssize_t
+SocketAdapter::writev(const struct iovec* iov, int iovcnt)
+{
+	return mParent ? mParent->writev(iov, iovcnt) : -EINVAL;
+}
+
 off_t
 SocketAdapter::lseek(off_t offset, int whence)
 {
@@ -72,6 +78,12 @@ SocketAdapter::read(void* data, size_t len)
 	return mParent ? mParent->read(data, len) : -EINVAL;
 }
 
+bool
+SocketAdapter::is_framed(void)const
+{
+	return mParent ? mParent->is_framed() : false;
+}
+
 bool
 SocketAdapter::can_read(void)const
 {
@@ -129,7 +141,7 @@ SocketAdapter::get_ms_to_next_event(void)const
 }
 
 int
-SocketAdapter::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout)
+SocketAdapter::update_fd_interest(EventBackend *backend, cms_t *timeout)
 {
-	return mParent ? mParent->update_fd_set(read_fd_set, write_fd_set, error_fd_set, max_fd, timeout) : 0;
+	return mParent ? mParent->update_fd_interest(backend, timeout) : 0;
 }
@@ -36,7 +36,13 @@ public:
 
 	virtual ssize_t write(const void* data, size_t len);
 	virtual ssize_t read(void* data, size_t len);
+
+	//! Passes the buffers on to the parent in one piece. Adapters that
+	//! change what is written must override this along with `write()`.
+	virtual ssize_t writev(const struct iovec* iov, int iovcnt);
+
 	virtual off_t lseek(off_t offset, int whence);
+	virtual bool is_framed(void)const;
 	virtual bool can_read(void)const;
 	virtual bool can_write(void)const;
 	virtual int get_read_fd(void)const;
@@ -47,7 +53,7 @@ public:
 
 	virtual void reset();
 	virtual bool did_reset();
-	virtual int update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout);
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout);
 
 	virtual int hibernate(void);
 
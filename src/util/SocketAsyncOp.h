@@ -95,6 +95,67 @@ write_stream_pt(struct nlpt *pt, nl::SocketWrapper* socket, const void* data, si
 	PT_END(&pt->sub_pt);
 }
 
+static inline size_t
+iov_total_len(const struct iovec* iov, int iovcnt)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	return len;
+}
+
+// Writes out the given buffers in order. Whatever is left of a buffer
+// that was only partly written goes out on its own, after which the
+// rest are handed to `writev()` again.
+static inline int
+writev_stream_pt(struct nlpt *pt, nl::SocketWrapper* socket, const struct iovec* iov, int iovcnt)
+{
+	const int fd = socket->get_write_fd();
+	ssize_t bytes_written;
+	size_t offset;
+	int i;
+
+	PT_BEGIN(&pt->sub_pt);
+	pt->byte_count = 0;
+	pt->last_errno = 0;
+
+	while (pt->byte_count < iov_total_len(iov, iovcnt)) {
+		// Wait for the socket to become writable...
+		_nlpt_setup_write_fd_source(pt, fd);
+		PT_WAIT_UNTIL(&pt->sub_pt, nlpt_hook_check_write_fd_source(pt, fd) || socket->can_write());
+		_nlpt_cleanup_write_fd_source(pt, fd);
+
+		// Find the first buffer that hasn't been written out in full.
+		offset = pt->byte_count;
+
+		for (i = 0; offset >= iov[i].iov_len; i++) {
+			offset -= iov[i].iov_len;
+		}
+
+		if (offset != 0) {
+			bytes_written = socket->write(
+				static_cast<const void*>(static_cast<const uint8_t*>(iov[i].iov_base) + offset),
+				iov[i].iov_len - offset
+			);
+		} else {
+			bytes_written = socket->writev(iov + i, iovcnt - i);
+		}
+
+		if (0 > bytes_written) {
+			pt->last_errno = errno;
+			break;
+		}
+
+		pt->byte_count += bytes_written;
+	}
+
+	PT_END(&pt->sub_pt);
+}
+
 static inline int
 write_packet_pt(struct nlpt *pt, nl::SocketWrapper* socket, const void* data, size_t len)
 {
@@ -149,6 +210,18 @@ write_packet_pt(struct nlpt *pt, nl::SocketWrapper* socket, const void* data, si
 			) \
 		)
 
+#define NLPT_ASYNC_WRITEV_STREAM(pt, sock, iov, iovcnt) \
+		PT_SPAWN( \
+			&(pt)->pt, \
+			&(pt)->sub_pt, \
+			::nl::writev_stream_pt( \
+				(pt), \
+				(sock), \
+				(iov), \
+				(iovcnt) \
+			) \
+		)
+
 #define NLPT_ASYNC_WRITE_PACKET(pt, sock, data, len) \
 		PT_SPAWN( \
 			&(pt)->pt, \
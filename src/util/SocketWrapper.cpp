@@ -43,6 +43,35 @@ SocketWrapper::~SocketWrapper()
 {
 }
 
+ssize_t
+SocketWrapper::writev(const struct iovec* iov, int iovcnt)
+{
+	ssize_t total = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		ssize_t ret = write(iov[i].iov_base, iov[i].iov_len);
+
+		if (ret < 0) {
+			return (total > 0) ? total : ret;
+		}
+
+		total += ret;
+
+		if ((size_t)ret < iov[i].iov_len) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+bool
+SocketWrapper::is_framed(void)const
+{
+	return false;
+}
+
 bool
 SocketWrapper::can_read(void)const
 {
@@ -104,6 +133,24 @@ SocketWrapper::hibernate(void)
 	return -ENOTSUP;
 }
 
+int
+SocketWrapper::enable_posted_reads(void)
+{
+	errno = ENOTSUP;
+	return -ENOTSUP;
+}
+
+void
+SocketWrapper::disable_posted_reads(void)
+{
+}
+
+bool
+SocketWrapper::has_posted_reads(void)const
+{
+	return false;
+}
+
 bool
 SocketWrapper::did_reset(void)
 {
@@ -111,7 +158,7 @@ SocketWrapper::did_reset(void)
 }
 
 int
-SocketWrapper::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout)
+SocketWrapper::update_fd_interest(EventBackend *backend, cms_t *timeout)
 {
 	if (timeout != NULL) {
 		*timeout = std::min(*timeout, get_ms_to_next_event());
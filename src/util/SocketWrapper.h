@@ -31,7 +31,9 @@
 #include <climits>
 #include <string>
 #include <sys/select.h>
+#include <sys/uio.h>
 #include "time-utils.h"
+#include "EventBackend.h"
 #include <stdexcept>
 
 namespace nl {
@@ -46,7 +48,20 @@ public:
 	virtual ~SocketWrapper();
 	virtual ssize_t write(const void* data, size_t len) = 0;
 	virtual ssize_t read(void* data, size_t len) = 0;
+
+	//! Writes the given buffers out in order, as if by `write()` on each.
+	/*! Returns the total number of bytes written, which may be short. The
+	 *  default implementation calls `write()` until it comes up short.
+	 */
+	virtual ssize_t writev(const struct iovec* iov, int iovcnt);
+
 	virtual off_t lseek(off_t offset, int whence);
+
+	//! True if each `read()` returns exactly one whole frame and each
+	//! `write()` (or buffer passed to `writev()`) is taken as one, so
+	//! that frames need no delimiting on top of the socket.
+	virtual bool is_framed(void)const;
+
 	virtual bool can_read(void)const;
 	virtual bool can_write(void)const;
 	virtual int process(void) = 0;
@@ -61,13 +76,19 @@ public:
 	virtual void reset(void);
 	virtual bool did_reset(void);
 
-	//! Any ancilary file descriptors to update. Only really needed for adapters.
-	virtual int update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout);
+	//! Any ancilary file descriptors to watch. Only really needed for adapters.
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout);
 
 public:
 	//! Special function which closes the file descriptors. Not supported on all sockets. Call `reset()` to undo.
 	virtual int hibernate(void);
 
+	//! Keeps a read posted on the socket's descriptor with io_uring, so data is
+	//! already in memory when `read()` is called. Not supported on all sockets.
+	virtual int enable_posted_reads(void);
+	virtual void disable_posted_reads(void);
+	virtual bool has_posted_reads(void)const;
+
 }; // class SocketWrapper
 
 
@@ -0,0 +1,837 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Implementation of the SpiSocket class and of its Linux spidev
+ *      backend.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "assert-macros.h"
+
+#include "SpiSocket.h"
+#include "socket-utils.h"
+#include "string-utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <algorithm>
+
+#if HAVE_LINUX_SPI_SPIDEV_H
+#include <linux/spi/spidev.h>
+#endif
+
+using namespace nl;
+
+#define SPI_HEADER_RESET_FLAG           0x80
+#define SPI_HEADER_CRC_FLAG             0x40
+#define SPI_HEADER_PATTERN_VALUE        0x02
+#define SPI_HEADER_PATTERN_MASK         0x03
+
+// Backoff applied once the NCP starts refusing our frames, by how many
+// transactions in a row it has refused.
+#define SPI_IMMEDIATE_RETRY_COUNT       5
+#define SPI_FAST_RETRY_COUNT            15
+#define SPI_IMMEDIATE_RETRY_TIMEOUT_MS  1
+#define SPI_FAST_RETRY_TIMEOUT_MS       10
+#define SPI_SLOW_RETRY_TIMEOUT_MS       33
+
+#define SPI_DEFAULT_SPEED_HZ            1000000
+#define SPI_DEFAULT_CS_DELAY_US         20
+
+static uint16_t
+spi_header_get_accept_len(const uint8_t* header)
+{
+	return header[1] + static_cast<uint16_t>(header[2] << 8);
+}
+
+static uint16_t
+spi_header_get_data_len(const uint8_t* header)
+{
+	return header[3] + static_cast<uint16_t>(header[4] << 8);
+}
+
+static void
+spi_header_set(uint8_t* header, uint8_t flags, uint16_t accept_len, uint16_t data_len)
+{
+	header[0] = flags;
+	header[1] = (accept_len & 0xFF);
+	header[2] = (accept_len >> 8);
+	header[3] = (data_len & 0xFF);
+	header[4] = (data_len >> 8);
+}
+
+SpiSocket::Device::~Device()
+{
+}
+
+int
+SpiSocket::Device::get_interrupt_fd(void) const
+{
+	return -1;
+}
+
+bool
+SpiSocket::Device::interrupt_is_asserted(void)
+{
+	return false;
+}
+
+void
+SpiSocket::Device::reset(void)
+{
+}
+
+#if HAVE_LINUX_SPI_SPIDEV_H
+
+// The NCP on a spidev(4) device, with its interrupt and reset lines on
+// sysfs GPIOs. Both lines are active low.
+class SpidevDevice : public SpiSocket::Device {
+public:
+	SpidevDevice();
+	virtual ~SpidevDevice();
+
+	int open_spi(const char* path, uint8_t mode, uint32_t speed);
+	int open_interrupt_gpio(const std::string& path);
+	int open_reset_gpio(const std::string& path);
+	void set_cs_delay(uint16_t cs_delay) { mCSDelay = cs_delay; }
+
+	virtual int transfer(const uint8_t* tx, uint8_t* rx, size_t len);
+	virtual int get_interrupt_fd(void) const;
+	virtual bool interrupt_is_asserted(void);
+	virtual void reset(void);
+
+private:
+	int mSpiFD;
+	int mInterruptFD;
+	int mResetFD;
+	uint32_t mSpeed;
+	uint16_t mCSDelay;
+};
+
+static int
+write_sysfs_file(const std::string& path, const char* value)
+{
+	int fd = open(path.c_str(), O_WRONLY);
+	ssize_t ret;
+
+	// Not every GPIO lets its direction or edge be changed, and it may
+	// already have been set up for us, so a file that isn't there is fine.
+	if (fd < 0) {
+		return 0;
+	}
+
+	ret = ::write(fd, value, strlen(value));
+	close(fd);
+
+	return (ret < 0) ? -errno : 0;
+}
+
+SpidevDevice::SpidevDevice()
+	: mSpiFD(-1), mInterruptFD(-1), mResetFD(-1), mSpeed(0), mCSDelay(0)
+{
+}
+
+SpidevDevice::~SpidevDevice()
+{
+	if (mSpiFD >= 0) {
+		IGNORE_RETURN_VALUE(flock(mSpiFD, LOCK_UN));
+		close(mSpiFD);
+	}
+
+	if (mInterruptFD >= 0) {
+		EventBackend::fd_closed(mInterruptFD);
+		close(mInterruptFD);
+	}
+
+	if (mResetFD >= 0) {
+		close(mResetFD);
+	}
+}
+
+int
+SpidevDevice::open_spi(const char* path, uint8_t mode, uint32_t speed)
+{
+	const uint8_t word_bits = 8;
+
+	mSpeed = speed;
+	mSpiFD = open(path, O_RDWR | O_CLOEXEC);
+
+	require_string(mSpiFD >= 0, bail, strerror(errno));
+	require_string(ioctl(mSpiFD, SPI_IOC_WR_MODE, &mode) >= 0, bail, "SPI_IOC_WR_MODE");
+	require_string(ioctl(mSpiFD, SPI_IOC_WR_MAX_SPEED_HZ, &mSpeed) >= 0, bail, "SPI_IOC_WR_MAX_SPEED_HZ");
+	require_string(ioctl(mSpiFD, SPI_IOC_WR_BITS_PER_WORD, &word_bits) >= 0, bail, "SPI_IOC_WR_BITS_PER_WORD");
+
+	// Nobody else may talk to the NCP while we are.
+	if (flock(mSpiFD, LOCK_EX | LOCK_NB) < 0) {
+		syslog(LOG_ERR, "SPI device \"%s\" is locked by another process", path);
+		goto bail;
+	}
+
+	return 0;
+
+bail:
+	return -errno;
+}
+
+int
+SpidevDevice::open_interrupt_gpio(const std::string& path)
+{
+	int ret;
+
+	require_noerr(ret = write_sysfs_file(path + "/direction", "in"), bail);
+	require_noerr(ret = write_sysfs_file(path + "/edge", "falling"), bail);
+
+	mInterruptFD = open((path + "/value").c_str(), O_RDONLY | O_CLOEXEC);
+	require_action(mInterruptFD >= 0, bail, ret = -errno);
+
+bail:
+	return ret;
+}
+
+int
+SpidevDevice::open_reset_gpio(const std::string& path)
+{
+	int ret;
+
+	require_noerr(ret = write_sysfs_file(path + "/direction", "high"), bail);
+
+	mResetFD = open((path + "/value").c_str(), O_WRONLY | O_CLOEXEC);
+	require_action(mResetFD >= 0, bail, ret = -errno);
+
+bail:
+	return ret;
+}
+
+int
+SpidevDevice::transfer(const uint8_t* tx, uint8_t* rx, size_t len)
+{
+	struct spi_ioc_transfer xfer[2];
+	int ret;
+
+	memset(xfer, 0, sizeof(xfer));
+
+	// The first part only holds off the clock for a while after chip
+	// select is asserted. Not every driver supports it, so it is left
+	// out unless a delay was asked for.
+	xfer[0].delay_usecs = mCSDelay;
+	xfer[0].speed_hz = mSpeed;
+	xfer[0].bits_per_word = 8;
+
+	xfer[1].tx_buf = reinterpret_cast<uintptr_t>(tx);
+	xfer[1].rx_buf = reinterpret_cast<uintptr_t>(rx);
+	xfer[1].len = static_cast<uint32_t>(len);
+	xfer[1].speed_hz = mSpeed;
+	xfer[1].bits_per_word = 8;
+
+	if (mCSDelay > 0) {
+		ret = ioctl(mSpiFD, SPI_IOC_MESSAGE(2), &xfer[0]);
+	} else {
+		ret = ioctl(mSpiFD, SPI_IOC_MESSAGE(1), &xfer[1]);
+	}
+
+	if (ret < 0) {
+		ret = -errno;
+
+		if ((mCSDelay > 0) && (errno == EINVAL)) {
+			syslog(LOG_ERR, "SPI ioctl failed with EINVAL. Try adding `,cs-delay=0` to the socket path.");
+		}
+		return ret;
+	}
+
+	return 0;
+}
+
+int
+SpidevDevice::get_interrupt_fd(void) const
+{
+	return mInterruptFD;
+}
+
+bool
+SpidevDevice::interrupt_is_asserted(void)
+{
+	char value[5] = "";
+
+	// Reading the value also clears the edge that made the
+	// descriptor signal.
+	IGNORE_RETURN_VALUE(lseek(mInterruptFD, 0, SEEK_SET));
+
+	if (::read(mInterruptFD, value, sizeof(value) - 1) < 0) {
+		syslog(LOG_ERR, "SpiSocket: Unable to read interrupt GPIO: %s", strerror(errno));
+		return false;
+	}
+
+	return atoi(value) == 0;
+}
+
+void
+SpidevDevice::reset(void)
+{
+	if (mResetFD < 0) {
+		return;
+	}
+
+	IGNORE_RETURN_VALUE(lseek(mResetFD, 0, SEEK_SET));
+	IGNORE_RETURN_VALUE(::write(mResetFD, "0\n", 2));
+
+	usleep(10 * USEC_PER_MSEC);
+
+	IGNORE_RETURN_VALUE(lseek(mResetFD, 0, SEEK_SET));
+	IGNORE_RETURN_VALUE(::write(mResetFD, "1\n", 2));
+
+	syslog(LOG_NOTICE, "SpiSocket: Triggered hardware reset");
+}
+
+#endif // if HAVE_LINUX_SPI_SPIDEV_H
+
+SpiSocket::SpiSocket(Device* device, unsigned int align_allowance, unsigned int small_packet_size)
+	: mDevice(device)
+	, mLogLevel(-1)
+	, mAlignAllowance(std::min(align_allowance, static_cast<unsigned int>(kMaxAlignAllowance)))
+	, mAdaptive(true)
+	, mTxHead(0)
+	, mTxCount(0)
+	, mRxHead(0)
+	, mRxCount(0)
+	, mSlaveDataLen(0)
+	, mTxRefusedCount(0)
+	, mRetryAt(0)
+	, mNextPollAt(0)
+	, mInterruptAt(0)
+{
+	spi_xfer_sizer_init(
+		&mSizer,
+		static_cast<uint16_t>(std::min(small_packet_size, static_cast<unsigned int>(kMaxPayloadSize))),
+		kMaxPayloadSize,
+		spi_xfer_overhead_bytes(SPI_DEFAULT_SPEED_HZ, SPI_DEFAULT_CS_DELAY_US)
+	);
+	spi_xfer_poller_init(&mPoller, kMinPollPeriod, kMaxPollPeriod);
+
+	memset(&mStats, 0, sizeof(mStats));
+	memset(mTxBuffer, 0xFF, sizeof(mTxBuffer));
+}
+
+SpiSocket::~SpiSocket()
+{
+	delete mDevice;
+}
+
+boost::shared_ptr<SpiSocket>
+SpiSocket::create(Device* device, unsigned int align_allowance, unsigned int small_packet_size)
+{
+	return boost::shared_ptr<SpiSocket>(new SpiSocket(device, align_allowance, small_packet_size));
+}
+
+boost::shared_ptr<SocketWrapper>
+SpiSocket::create(const std::string& path)
+{
+#if HAVE_LINUX_SPI_SPIDEV_H
+	std::string options(path.c_str() + strlen(SOCKET_SPI_COMMAND_PREFIX));
+	std::string spi_path;
+	std::string int_path;
+	std::string reset_path;
+	unsigned long speed = SPI_DEFAULT_SPEED_HZ;
+	unsigned long mode = 0;
+	unsigned long cs_delay = SPI_DEFAULT_CS_DELAY_US;
+	bool adaptive = true;
+	unsigned long align_allowance = 0;
+	unsigned long small_packet_size = kDefaultSmallPacketSize;
+	SpidevDevice* device = NULL;
+	boost::shared_ptr<SpiSocket> ret;
+	size_t begin = 0;
+
+	while (begin <= options.size()) {
+		size_t end = options.find(',', begin);
+		std::string option;
+
+		if (end == std::string::npos) {
+			end = options.size();
+		}
+
+		option = options.substr(begin, end - begin);
+		begin = end + 1;
+
+		if (spi_path.empty()) {
+			spi_path = option;
+		} else if (strcasehasprefix(option.c_str(), "gpio-int=")) {
+			int_path = option.substr(strlen("gpio-int="));
+		} else if (strcasehasprefix(option.c_str(), "gpio-reset=")) {
+			reset_path = option.substr(strlen("gpio-reset="));
+		} else if (strcasehasprefix(option.c_str(), "speed=")) {
+			speed = strtoul(option.c_str() + strlen("speed="), NULL, 0);
+		} else if (strcasehasprefix(option.c_str(), "mode=")) {
+			mode = strtoul(option.c_str() + strlen("mode="), NULL, 0);
+		} else if (strcasehasprefix(option.c_str(), "cs-delay=")) {
+			cs_delay = strtoul(option.c_str() + strlen("cs-delay="), NULL, 0);
+		} else if (strcasehasprefix(option.c_str(), "align-allowance=")) {
+			align_allowance = strtoul(option.c_str() + strlen("align-allowance="), NULL, 0);
+		} else if (strcasehasprefix(option.c_str(), "small-packet=")) {
+			small_packet_size = strtoul(option.c_str() + strlen("small-packet="), NULL, 0);
+		} else if (strcasehasprefix(option.c_str(), "adaptive=")) {
+			adaptive = strtoul(option.c_str() + strlen("adaptive="), NULL, 0) != 0;
+		} else if (!option.empty()) {
+			syslog(LOG_WARNING, "SpiSocket: Ignoring unknown option \"%s\"", option.c_str());
+		}
+	}
+
+	if ((mode > 3) || (align_allowance > kMaxAlignAllowance) || (cs_delay > UINT16_MAX)) {
+		syslog(LOG_ERR, "SpiSocket: Bad options in socket path <%s>", path.c_str());
+		throw SocketError("Bad SPI socket options");
+	}
+
+	device = new SpidevDevice();
+	device->set_cs_delay(static_cast<uint16_t>(cs_delay));
+
+	if ( (device->open_spi(spi_path.c_str(), static_cast<uint8_t>(mode), static_cast<uint32_t>(speed)) < 0)
+	  || (!int_path.empty() && (device->open_interrupt_gpio(int_path) < 0))
+	  || (!reset_path.empty() && (device->open_reset_gpio(reset_path) < 0))
+	) {
+		syslog(LOG_ERR, "Unable to open socket with path <%s>, errno=%d (%s)", path.c_str(), errno, strerror(errno));
+		delete device;
+		throw SocketError("Unable to open SPI socket");
+	}
+
+	if (int_path.empty()) {
+		syslog(LOG_WARNING, "SpiSocket: No interrupt GPIO given, polling the NCP every %d-%dms", kMinPollPeriod, kMaxPollPeriod);
+	}
+
+	ret = create(device, static_cast<unsigned int>(align_allowance), static_cast<unsigned int>(small_packet_size));
+	ret->set_transaction_overhead(spi_xfer_overhead_bytes(static_cast<uint32_t>(speed), static_cast<uint32_t>(cs_delay)));
+	ret->set_adaptive(adaptive);
+
+	return ret;
+#else
+	syslog(LOG_ERR, "Unable to open socket with path <%s>: SPI is not supported on this platform", path.c_str());
+	throw SocketError("SPI is not supported on this platform");
+#endif
+}
+
+bool
+SpiSocket::is_framed(void)const
+{
+	return true;
+}
+
+bool
+SpiSocket::can_read(void)const
+{
+	return mRxCount > 0;
+}
+
+bool
+SpiSocket::can_write(void)const
+{
+	return mTxCount < kQueueFrames;
+}
+
+void
+SpiSocket::set_adaptive(bool adaptive)
+{
+	mAdaptive = adaptive;
+	spi_xfer_sizer_set_adaptive(&mSizer, adaptive);
+
+	if (!adaptive) {
+		mPoller.period_ms = mPoller.max_ms;
+	}
+}
+
+void
+SpiSocket::set_transaction_overhead(uint16_t overhead)
+{
+	mSizer.overhead = overhead;
+}
+
+int
+SpiSocket::set_log_level(int log_level)
+{
+	mLogLevel = log_level;
+	return 0;
+}
+
+ssize_t
+SpiSocket::write(const void* data, size_t len)
+{
+	Frame* frame;
+
+	if (len > kMaxPayloadSize) {
+		return -EMSGSIZE;
+	}
+
+	if (mTxCount >= kQueueFrames) {
+		return -EAGAIN;
+	}
+
+	frame = &mTxQueue[(mTxHead + mTxCount) % kQueueFrames];
+	memcpy(frame->mData, data, len);
+	frame->mLen = static_cast<uint16_t>(len);
+	frame->mQueuedAt = spi_xfer_time_us();
+	mTxCount++;
+
+	return static_cast<ssize_t>(len);
+}
+
+ssize_t
+SpiSocket::writev(const struct iovec* iov, int iovcnt)
+{
+	ssize_t total = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		ssize_t ret = write(iov[i].iov_base, iov[i].iov_len);
+
+		if (ret < 0) {
+			return (total > 0) ? total : ret;
+		}
+
+		total += ret;
+	}
+
+	return total;
+}
+
+ssize_t
+SpiSocket::read(void* data, size_t len)
+{
+	const Frame* frame;
+
+	if (mRxCount == 0) {
+		return 0;
+	}
+
+	frame = &mRxQueue[mRxHead];
+
+	// A frame which doesn't fit is truncated, like a datagram would be.
+	len = std::min(len, static_cast<size_t>(frame->mLen));
+	memcpy(data, frame->mData, len);
+
+	mRxHead = (mRxHead + 1) % kQueueFrames;
+	mRxCount--;
+
+	return static_cast<ssize_t>(len);
+}
+
+void
+SpiSocket::reset(void)
+{
+	syslog(LOG_DEBUG, "SpiSocket::reset()");
+
+	mTxHead = mTxCount = 0;
+	mRxHead = mRxCount = 0;
+	mSlaveDataLen = 0;
+	mTxRefusedCount = 0;
+	mInterruptAt = 0;
+
+	mDevice->reset();
+}
+
+void
+SpiSocket::log_header(const char* hint, const uint8_t* header)
+{
+	syslog(mLogLevel, "SpiSocket: %s H:%02X ACCEPT:%d DATA:%d",
+		hint,
+		header[0],
+		spi_header_get_accept_len(header),
+		spi_header_get_data_len(header)
+	);
+}
+
+bool
+SpiSocket::check_interrupt(void)
+{
+	if (!mDevice->interrupt_is_asserted()) {
+		return false;
+	}
+
+	if (mInterruptAt == 0) {
+		mInterruptAt = spi_xfer_time_us();
+	}
+
+	return true;
+}
+
+bool
+SpiSocket::should_transact(cms_t now)
+{
+	// A transaction might bring in a frame, which would have nowhere to go.
+	if (mRxCount >= kQueueFrames) {
+		return false;
+	}
+
+	if ((mTxRefusedCount != 0) && ((mRetryAt - now) > 0)) {
+		return false;
+	}
+
+	if (mTxCount > 0) {
+		return true;
+	}
+
+	if (mDevice->get_interrupt_fd() >= 0) {
+		return check_interrupt();
+	}
+
+	return (mNextPollAt - now) <= 0;
+}
+
+// Runs a single SPI transaction, which sends the frame at the head of
+// the TX queue (if any) and picks up whatever frame the NCP has for us.
+int
+SpiSocket::transact(void)
+{
+	const Frame* tx_frame = (mTxCount > 0) ? &mTxQueue[mTxHead] : NULL;
+	const uint16_t tx_len = (tx_frame != NULL) ? tx_frame->mLen : 0;
+	uint16_t xfer_len = tx_len;
+	uint64_t now;
+	const uint8_t* rx = mRxBuffer;
+	uint16_t slave_accept_len;
+	uint16_t slave_data_len;
+	uint16_t rx_len = 0;
+	uint16_t tx_done_len = 0;
+	int exchanges = 0;
+	int ret;
+	unsigned int i;
+
+	// Make sure that whatever the NCP last told us it has will fit, or
+	// else that a frame of the size it usually sends will, so that it
+	// doesn't take a second transaction to get it.
+	xfer_len = std::max(xfer_len, (mSlaveDataLen != 0) ? mSlaveDataLen : spi_xfer_sizer_get_len(&mSizer));
+
+	if ((tx_frame != NULL) && (mTxRefusedCount != 0)) {
+		mStats.mXfer.retries++;
+	}
+
+	// The reset flag tells the NCP that we are starting from scratch.
+	spi_header_set(
+		mTxBuffer,
+		SPI_HEADER_PATTERN_VALUE | ((mStats.mValidCount == 0) ? SPI_HEADER_RESET_FLAG : 0),
+		xfer_len,
+		tx_len
+	);
+
+	if (tx_frame != NULL) {
+		memcpy(&mTxBuffer[kHeaderLen], tx_frame->mData, tx_len);
+	}
+
+	ret = mDevice->transfer(mTxBuffer, mRxBuffer, xfer_len + kHeaderLen + mAlignAllowance);
+
+	if (ret < 0) {
+		syslog(LOG_ERR, "SpiSocket: Transfer failed: %s (%d)", strerror(-ret), -ret);
+		return ret;
+	}
+
+	mStats.mTransactionCount++;
+	now = spi_xfer_time_us();
+
+	// Some NCPs are late to start clocking out their header.
+	for (i = 0; (i < mAlignAllowance) && (rx[0] == 0xFF); i++) {
+		rx++;
+	}
+
+	if (mLogLevel != -1) {
+		log_header("TX", mTxBuffer);
+		log_header("RX", rx);
+	}
+
+	slave_accept_len = spi_header_get_accept_len(rx);
+	slave_data_len = spi_header_get_data_len(rx);
+
+	if ((rx[0] == 0xFF) || (rx[0] == 0x00)) {
+		if ((rx[1] == rx[0]) && (rx[2] == rx[0]) && (rx[3] == rx[0]) && (rx[4] == rx[0])) {
+			// The NCP is off, in a bad state, or holding us off.
+			syslog((mSlaveDataLen == 0) ? LOG_DEBUG : LOG_WARNING, "SpiSocket: NCP did not respond (header was all 0x%02X)", rx[0]);
+			mStats.mUnresponsiveCount++;
+		} else {
+			syslog(LOG_WARNING, "SpiSocket: Garbage in header: %02X %02X %02X %02X %02X", rx[0], rx[1], rx[2], rx[3], rx[4]);
+			mStats.mGarbageCount++;
+		}
+		mTxRefusedCount++;
+		goto bail;
+	}
+
+	if ( ((rx[0] & SPI_HEADER_PATTERN_MASK) != SPI_HEADER_PATTERN_VALUE)
+	  || (slave_accept_len > kMaxFrameSize)
+	  || (slave_data_len > kMaxPayloadSize)
+	) {
+		syslog(LOG_WARNING, "SpiSocket: Garbage in header: %02X %02X %02X %02X %02X", rx[0], rx[1], rx[2], rx[3], rx[4]);
+		mStats.mGarbageCount++;
+		mTxRefusedCount++;
+		mSlaveDataLen = 0;
+		goto bail;
+	}
+
+	mStats.mValidCount++;
+
+	if ((rx[0] & SPI_HEADER_RESET_FLAG) == SPI_HEADER_RESET_FLAG) {
+		mStats.mSlaveResetCount++;
+		syslog(LOG_NOTICE, "SpiSocket: NCP did reset (%u resets so far)", mStats.mSlaveResetCount);
+	}
+
+	mSlaveDataLen = slave_data_len;
+
+	// The NCP only sends its frame if we made room for all of it.
+	if ((slave_data_len != 0) && (slave_data_len <= xfer_len)) {
+		Frame* frame = &mRxQueue[(mRxHead + mRxCount) % kQueueFrames];
+
+		memcpy(frame->mData, &rx[kHeaderLen], slave_data_len);
+		frame->mLen = slave_data_len;
+		mRxCount++;
+
+		mSlaveDataLen = 0;
+		mStats.mRxFrameCount++;
+		exchanges++;
+		rx_len = slave_data_len;
+
+		spi_xfer_sizer_note_frame(&mSizer, slave_data_len);
+
+		if (mInterruptAt != 0) {
+			spi_xfer_stats_note_latency(&mStats.mXfer, now - mInterruptAt);
+			mInterruptAt = 0;
+		}
+
+	} else if (slave_data_len != 0) {
+		mStats.mXfer.short_reads++;
+	}
+
+	if (tx_frame == NULL) {
+		mTxRefusedCount = 0;
+
+	} else if (tx_len <= slave_accept_len) {
+		spi_xfer_stats_note_latency(&mStats.mXfer, now - tx_frame->mQueuedAt);
+		tx_done_len = tx_len;
+
+		mTxHead = (mTxHead + 1) % kQueueFrames;
+		mTxCount--;
+
+		mTxRefusedCount = 0;
+		mStats.mTxFrameCount++;
+		exchanges++;
+
+	} else {
+		// The NCP wasn't ready for our frame. Backing off keeps us
+		// from burning CPU on transactions it will refuse anyway.
+		mTxRefusedCount++;
+		mStats.mTxRefusedCount++;
+	}
+
+	if (exchanges == 2) {
+		mStats.mDuplexCount++;
+	}
+
+bail:
+	spi_xfer_stats_note_transaction(&mStats.mXfer, xfer_len + kHeaderLen + mAlignAllowance, rx_len, tx_done_len);
+
+	if (mTxRefusedCount != 0) {
+		cms_t backoff = SPI_SLOW_RETRY_TIMEOUT_MS;
+
+		if (mTxRefusedCount < SPI_IMMEDIATE_RETRY_COUNT) {
+			backoff = SPI_IMMEDIATE_RETRY_TIMEOUT_MS;
+		} else if (mTxRefusedCount < SPI_FAST_RETRY_COUNT) {
+			backoff = SPI_FAST_RETRY_TIMEOUT_MS;
+		}
+
+		mRetryAt = time_ms() + backoff;
+
+		if (mTxRefusedCount == 30) {
+			syslog(LOG_WARNING, "SpiSocket: NCP seems stuck");
+		} else if (mTxRefusedCount == 100) {
+			syslog(LOG_ERR, "SpiSocket: NCP seems REALLY stuck");
+		}
+	}
+
+	return 0;
+}
+
+int
+SpiSocket::process(void)
+{
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < kMaxTransactionsPerProcess; i++) {
+		const cms_t now = time_ms();
+		const uint32_t rx_frame_count = mStats.mRxFrameCount;
+
+		if (!should_transact(now)) {
+			break;
+		}
+
+		ret = transact();
+
+		if (ret < 0) {
+			break;
+		}
+
+		// Without an interrupt line, an NCP that just sent us
+		// something is asked for more right away, and is polled
+		// less and less often the longer it stays quiet.
+		if (mAdaptive) {
+			spi_xfer_poller_note(&mPoller, mStats.mRxFrameCount != rx_frame_count);
+		}
+
+		if (mStats.mRxFrameCount != rx_frame_count) {
+			mNextPollAt = now;
+		} else {
+			mNextPollAt = now + mPoller.period_ms;
+		}
+	}
+
+	return ret;
+}
+
+int
+SpiSocket::update_fd_interest(EventBackend *backend, cms_t *timeout)
+{
+	const cms_t now = time_ms();
+	const int interrupt_fd = mDevice->get_interrupt_fd();
+	cms_t wait = CMS_DISTANT_FUTURE;
+
+	if (mRxCount >= kQueueFrames) {
+		// Nothing more can happen until the pump takes a frame.
+
+	} else if ((mTxRefusedCount != 0) && ((mRetryAt - now) > 0)) {
+		wait = mRetryAt - now;
+
+	} else if (mTxCount > 0) {
+		wait = 0;
+
+	} else if (interrupt_fd >= 0) {
+		if (check_interrupt()) {
+			wait = 0;
+		} else if (backend != NULL) {
+			// The GPIO's value file signals an edge as an
+			// exceptional condition rather than as readable.
+			backend->watch(interrupt_fd, EventBackend::kEventError);
+		}
+
+	} else {
+		wait = std::max(mNextPollAt - now, static_cast<cms_t>(0));
+	}
+
+	if (timeout != NULL) {
+		*timeout = std::min(*timeout, wait);
+	}
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      This file declares the SpiSocket class, which talks to an NCP
+ *      over SPI directly, speaking the same framing as spi-hdlc-adapter.
+ *
+ */
+
+#ifndef __wpantund__SpiSocket__
+#define __wpantund__SpiSocket__
+
+#include "SocketWrapper.h"
+#include "spi-xfer.h"
+
+namespace nl {
+
+// Exchanges whole Spinel frames with an NCP attached over SPI, without
+// an spi-hdlc-adapter process (and HDLC encoding) in between.
+//
+// Every SPI transaction starts with a 5-byte header in each direction:
+// a flag byte, the number of bytes the sender is willing to accept, and
+// the number of bytes of frame that follow. The NCP asserts its
+// interrupt line whenever it has something for us; without one, it is
+// polled instead, more often while it has been busy.
+//
+// How much room to make for a frame from the NCP is learned from the
+// sizes of the frames it recently sent (see `spi_xfer_sizer`), so that
+// a typical frame arrives in one transaction.
+//
+// This is a framed socket: `read()` hands back one frame at a time and
+// `write()` takes one frame at a time. Transactions are run from
+// `process()`.
+class SpiSocket : public SocketWrapper {
+public:
+	enum {
+		kHeaderLen = 5,
+		kMaxFrameSize = 2048,                   // Including the header
+		kMaxPayloadSize = kMaxFrameSize - kHeaderLen,
+		kMaxAlignAllowance = 16,
+		kDefaultSmallPacketSize = 32,
+		kMinPollPeriod = 2,                     // In ms, without an interrupt line
+		kMaxPollPeriod = 1000 / 30,
+
+		kQueueFrames = 4,                       // In each direction
+		kMaxTransactionsPerProcess = 8,
+	};
+
+	// The SPI bus and GPIO lines the NCP is attached to, which are
+	// swapped out for a simulated NCP by the unit tests.
+	class Device {
+	public:
+		virtual ~Device();
+
+		// Clocks out `len` bytes from `tx` while clocking in `len`
+		// bytes to `rx`, as a single transaction. Returns zero or a
+		// negative errno value.
+		virtual int transfer(const uint8_t* tx, uint8_t* rx, size_t len) = 0;
+
+		// A descriptor which signals an exceptional condition when the
+		// interrupt line is asserted, or -1 if there is no such line.
+		virtual int get_interrupt_fd(void) const;
+
+		// True while the NCP holds the interrupt line asserted.
+		virtual bool interrupt_is_asserted(void);
+
+		// Pulses the NCP's reset line, if it has one.
+		virtual void reset(void);
+	};
+
+	struct Stats {
+		uint32_t mTransactionCount;
+		uint32_t mValidCount;
+		uint32_t mDuplexCount;
+		uint32_t mUnresponsiveCount;
+		uint32_t mGarbageCount;
+		uint32_t mSlaveResetCount;
+		uint32_t mRxFrameCount;
+		uint32_t mTxFrameCount;
+		uint32_t mTxRefusedCount;
+
+		// Wasted transactions, retries, bytes clocked and latency.
+		struct spi_xfer_stats mXfer;
+	};
+
+	//! Opens the spidev device and GPIOs described by an "spi:" path:
+	//! `spi:<spidev>[,gpio-int=<dir>][,gpio-reset=<dir>][,speed=<hz>]`
+	//! `[,mode=<n>][,cs-delay=<us>][,align-allowance=<n>][,small-packet=<n>]`
+	//! `[,adaptive=<0|1>]`
+	//! where the GPIOs are given as their sysfs directories.
+	static boost::shared_ptr<SocketWrapper> create(const std::string& path);
+
+	//! Takes ownership of `device`.
+	static boost::shared_ptr<SpiSocket> create(
+		Device* device,
+		unsigned int align_allowance = 0,
+		unsigned int small_packet_size = kDefaultSmallPacketSize
+	);
+
+	virtual ~SpiSocket();
+
+	//! Queues one frame to be sent. Returns -EAGAIN if the queue is full.
+	virtual ssize_t write(const void* data, size_t len);
+
+	//! Queues one frame per buffer, for as many as there is room for.
+	virtual ssize_t writev(const struct iovec* iov, int iovcnt);
+
+	//! Takes the oldest received frame. Returns 0 if there is none.
+	virtual ssize_t read(void* data, size_t len);
+
+	virtual bool is_framed(void)const;
+	virtual bool can_read(void)const;
+	virtual bool can_write(void)const;
+	virtual int process(void);
+	virtual int set_log_level(int log_level);
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout);
+
+	//! Discards anything queued and resets the NCP.
+	virtual void reset(void);
+
+	//! When disabled, every transaction makes room for a small packet
+	//! and the NCP is polled at the slowest rate.
+	void set_adaptive(bool adaptive);
+
+	//! Sets the fixed cost of a transaction, in byte times, which the
+	//! transaction length is chosen to make up for.
+	void set_transaction_overhead(uint16_t overhead);
+
+	const Stats& get_stats(void)const { return mStats; }
+
+protected:
+	SpiSocket(Device* device, unsigned int align_allowance, unsigned int small_packet_size);
+
+private:
+	struct Frame {
+		uint64_t mQueuedAt;                     // In us, for latency
+		uint16_t mLen;
+		uint8_t mData[kMaxPayloadSize];
+	};
+
+	bool check_interrupt(void);
+	bool should_transact(cms_t now);
+	int transact(void);
+	void log_header(const char* hint, const uint8_t* header);
+
+	Device* mDevice;
+	int mLogLevel;
+	unsigned int mAlignAllowance;
+	struct spi_xfer_sizer mSizer;
+	struct spi_xfer_poller mPoller;
+	bool mAdaptive;
+
+	Frame mTxQueue[kQueueFrames];
+	int mTxHead;
+	int mTxCount;
+
+	Frame mRxQueue[kQueueFrames];
+	int mRxHead;
+	int mRxCount;
+
+	// What the NCP last said it had waiting for us.
+	uint16_t mSlaveDataLen;
+
+	// Consecutive transactions in which the NCP didn't take our frame.
+	// Retries are backed off based on this.
+	uint32_t mTxRefusedCount;
+	cms_t mRetryAt;
+	cms_t mNextPollAt;
+
+	// When the interrupt line was first seen asserted for the frame the
+	// NCP has waiting, or zero.
+	uint64_t mInterruptAt;
+
+	Stats mStats;
+
+	uint8_t mTxBuffer[kMaxFrameSize + kMaxAlignAllowance];
+	uint8_t mRxBuffer[kMaxFrameSize + kMaxAlignAllowance];
+}; // class SpiSocket
+
+}; // namespace nl
+
+#endif /* defined(__wpantund__SpiSocket__) */
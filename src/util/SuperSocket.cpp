@@ -29,7 +29,10 @@
 #include "assert-macros.h"
 
 #include "SuperSocket.h"
+#include "SpiSocket.h"
+#include "ShmSocket.h"
 #include "socket-utils.h"
+#include "string-utils.h"
 #include "time-utils.h"
 #include <syslog.h>
 #include <errno.h>
@@ -85,6 +88,14 @@ SuperSocket::~SuperSocket()
 boost::shared_ptr<SocketWrapper>
 SuperSocket::create(const std::string& path)
 {
+	if (strcasehasprefix(path.c_str(), SOCKET_SPI_COMMAND_PREFIX)) {
+		return SpiSocket::create(path);
+	}
+
+	if (strcasehasprefix(path.c_str(), SOCKET_SHM_COMMAND_PREFIX)) {
+		return ShmSocket::create(path);
+	}
+
 	return boost::shared_ptr<SocketWrapper>(new SuperSocket(path));
 }
 
@@ -92,10 +103,13 @@ int
 SuperSocket::hibernate(void)
 {
 	if (mFDRead >= 0) {
+		cancel_posted_read();
+
 		// Unlock the FD.
 		IGNORE_RETURN_VALUE(flock(mFDRead, LOCK_UN));
 
 		// Close the existing FD.
+		EventBackend::fd_closed(mFDRead);
 		IGNORE_RETURN_VALUE(close_super_socket(mFDRead));
 	}
 
@@ -189,6 +203,8 @@ SuperSocket::reset()
 		throw SocketError("Unable to reopen socket");
 	}
 
+	update_framing();
+
 	// Lock the file descriptor. It does not make sense to allow someone else
 	// to use this file descriptor at the same time, or to use the device
 	// while someone else is using it.
@@ -35,8 +35,8 @@ const Timer::Interval Timer::kOneMinute      = Timer::kOneSecond * 60;
 const Timer::Interval Timer::kOneHour        = Timer::kOneMinute * 60;
 const Timer::Interval Timer::kOneDay         = Timer::kOneHour * 24;
 
-Timer *const Timer::kListEndMarker = (Timer *)(&Timer::mListHead);
-Timer *Timer::mListHead = kListEndMarker;
+std::vector<Timer::HeapEntry> Timer::sHeap;
+uint32_t Timer::sNextSequence = 0;
 
 static void
 null_timer_callback(Timer *timer)
@@ -49,7 +49,8 @@ Timer::Timer() :
 {
 	mType = kOneShot;
 	mInterval = 0;
-	mNext = NULL;
+	mSlack = 0;
+	mHeapIndex = kNotScheduled;
 	mCallback = &null_timer_callback;
 }
 
@@ -101,69 +102,119 @@ Timer::get_type(void) const
 }
 
 void
-Timer::add(Timer *timer)
+Timer::set_slack(Interval slack)
 {
-	Timer *cur;
+	mSlack = (slack > 0) ? slack : 0;
+}
 
-	// If the list is empty, insert the new timer as the new head of the list.
-	if (mListHead == kListEndMarker) {
-		timer->mNext = kListEndMarker;
-		mListHead = timer;
-		return;
-	}
+Timer::Interval
+Timer::get_slack(void) const
+{
+	return mSlack;
+}
 
-	// If the new timer fire-time is before the head timer's fire-time, insert it as the new head.
-	if (timer->mFireTime < mListHead->mFireTime) {
-		timer->mNext = mListHead;
-		mListHead = timer;
-		return;
+size_t
+Timer::get_scheduled_count(void)
+{
+	return sHeap.size();
+}
+
+void
+Timer::heap_set(size_t index, const HeapEntry& entry)
+{
+	sHeap[index] = entry;
+	entry.mTimer->mHeapIndex = index;
+}
+
+void
+Timer::sift_up(size_t index)
+{
+	const HeapEntry entry = sHeap[index];
+
+	while (index > 0) {
+		size_t parent = (index - 1) / 2;
+
+		if (!(entry < sHeap[parent])) {
+			break;
+		}
+
+		heap_set(index, sHeap[parent]);
+		index = parent;
 	}
 
-	// Go through the list and find the proper place to insert the new timer.
-	for (cur = mListHead; cur->mNext != kListEndMarker; cur = cur->mNext) {
-		if (timer->mFireTime < cur->mNext->mFireTime) {
-			// Inset the new timer in between cur and cur->next
-			timer->mNext = cur->mNext;
-			cur->mNext = timer;
-			return;
+	heap_set(index, entry);
+}
+
+void
+Timer::sift_down(size_t index)
+{
+	const HeapEntry entry = sHeap[index];
+	const size_t count = sHeap.size();
+
+	while (true) {
+		size_t child = 2 * index + 1;
+
+		if (child >= count) {
+			break;
+		}
+
+		if ((child + 1 < count) && (sHeap[child + 1] < sHeap[child])) {
+			child++;
 		}
+
+		if (!(sHeap[child] < entry)) {
+			break;
+		}
+
+		heap_set(index, sHeap[child]);
+		index = child;
 	}
 
-	// New timer's fire-time is after all other timers in the list, so insert it at the end.
-	timer->mNext = kListEndMarker;
-	cur->mNext = timer;
+	heap_set(index, entry);
+}
+
+void
+Timer::add(Timer *timer)
+{
+	HeapEntry entry;
+
+	entry.mDeadline.set(timer->mFireTime.get() + timer->mSlack);
+	// Timers with equal deadlines fire in the order they were added.
+	entry.mSequence = sNextSequence++;
+	entry.mTimer = timer;
+
+	sHeap.push_back(entry);
+	sift_up(sHeap.size() - 1);
 }
 
 void
 Timer::remove(Timer *timer)
 {
-	Timer *cur;
+	size_t index = timer->mHeapIndex;
 
-	// If timer is not on the list, there is nothing to do.
-	if (timer->mNext == NULL) {
+	// If timer is not on the heap, there is nothing to do.
+	if (index == kNotScheduled) {
 		goto bail;
 	}
 
-	// If timer is the head of the list, remove it and update the head.
-	if (mListHead == timer) {
-		mListHead = timer->mNext;
-		timer->mNext = NULL;
-		goto bail;
-	}
+	require_string(index < sHeap.size() && sHeap[index].mTimer == timer, bail, "Timer::remove() - Timer was not found on the heap.");
+
+	timer->mHeapIndex = kNotScheduled;
 
-	// Go through the list and find the timer.
-	for (cur = mListHead; cur != kListEndMarker; cur = cur->mNext) {
-		if (cur->mNext == timer) {
-			cur->mNext = timer->mNext;
-			timer->mNext = NULL;
-			goto bail;
+	if (index + 1 < sHeap.size()) {
+		// Move the last entry into the hole and restore the heap order.
+		heap_set(index, sHeap.back());
+		sHeap.pop_back();
+
+		if ((index > 0) && (sHeap[index] < sHeap[(index - 1) / 2])) {
+			sift_up(index);
+		} else {
+			sift_down(index);
 		}
+	} else {
+		sHeap.pop_back();
 	}
 
-	// We should never get here, as the timer with a non-null mNext should be on the list
-	// If we get here, assert and bail.
-	require_string(false, bail, "Timer::remove() - Timer was not found on the list.");
-
 bail:
 	return;
 }
@@ -171,13 +222,13 @@ bail:
 int
 Timer::process(void)
 {
-	Timer *timer;
+	// Process all expired timers. The heap is ordered by deadline, so
+	// stop at the first timer that isn't allowed to fire yet; anything
+	// behind it will be picked up no later than its own deadline.
+	while (!sHeap.empty() && sHeap.front().mTimer->is_expired()) {
+		Timer *timer = sHeap.front().mTimer;
 
-	// Process all expired timers
-	for (timer = mListHead; (timer != kListEndMarker) && timer->is_expired(); timer = mListHead) {
-		// Remove the timer from the list and update the head.
-		mListHead = timer->mNext;
-		timer->mNext = NULL;
+		remove(timer);
 
 		// Restart the timer if it is periodic.
 		if (timer->mType == kPeriodicFixedRate) {
@@ -216,8 +267,8 @@ Timer::get_ms_to_next_event(void)
 {
 	cms_t cms = CMS_DISTANT_FUTURE;
 
-	if (mListHead != kListEndMarker) {
-		cms = mListHead->mFireTime.get_ms_till_time();
+	if (!sHeap.empty()) {
+		cms = sHeap.front().mDeadline.get_ms_till_time();
 		if (cms < 0) {
 			cms = 0;
 		}
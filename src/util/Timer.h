@@ -23,7 +23,8 @@
 #ifndef __wpantund__Timer__
 #define __wpantund__Timer__
 
-#include <list>
+#include <vector>
+#include <stdint.h>
 #include <boost/function.hpp>
 
 #include "time-utils.h"
@@ -78,6 +79,17 @@ public:
 	// Returns the type of the timer.
 	Type get_type(void) const;
 
+	// Allows the timer to fire up to `slack` ms after its fire time, so
+	// that it can be handled together with other timers (or other main
+	// loop wakeups) instead of waking the process on its own. Takes effect
+	// the next time the timer is scheduled. Default is zero (no slack).
+	void set_slack(Interval slack);
+
+	// Returns the slack of the timer.
+	Interval get_slack(void) const;
+
+	// Returns the number of currently scheduled timers.
+	static size_t get_scheduled_count(void);
 
 public:
 	static int process(void);
@@ -107,20 +119,46 @@ private:
 		cms_t mTime;
 	};
 
-	ClockTime mFireTime;
+	ClockTime mFireTime;    // Earliest time the timer may fire
 	cms_t mInterval;
+	cms_t mSlack;
 	Callback mCallback;
 	Type mType;
-	Timer *mNext;       // for linked-list
+	size_t mHeapIndex;      // Position in `sHeap`, or `kNotScheduled`
+
+	enum {
+		kNotScheduled = ~static_cast<size_t>(0)
+	};
+
+	// Heap entries carry their own sort key, so that sifting does not
+	// have to touch the timers themselves.
+	struct HeapEntry {
+		ClockTime mDeadline;    // Latest time the timer may fire (fire time + slack)
+		uint32_t mSequence;     // Keeps timers with equal deadlines in FIFO order
+		Timer *mTimer;
+
+		bool operator<(const HeapEntry& rhs) const {
+			if (mDeadline == rhs.mDeadline) {
+				return static_cast<int32_t>(mSequence - rhs.mSequence) < 0;
+			}
+			return mDeadline < rhs.mDeadline;
+		}
+	};
 
 private:
-	static void remove(Timer *timer);       // Removes timer from linked-list
-	static void add(Timer *timer);          // Adds timer to list (list sorted based on fire-time)
+	static void remove(Timer *timer);       // Removes timer from the heap
+	static void add(Timer *timer);          // Adds timer to the heap (ordered by deadline)
+
+	static void heap_set(size_t index, const HeapEntry& entry);
+	static void sift_up(size_t index);
+	static void sift_down(size_t index);
 
 	static cms_t get_ms_to_next_event(void);
 
-	static Timer * mListHead;   			// Head of the LinkedList
-	static Timer * const kListEndMarker;	// Marker for end of list
+	// Binary min-heap of scheduled timers, keyed on deadline. Scheduling
+	// and cancelling are O(log n) regardless of how many are armed.
+	static std::vector<HeapEntry> sHeap;
+	static uint32_t sNextSequence;
 };
 
 }; // namespace nl
@@ -29,6 +29,7 @@
 #include "TunnelIPv6Interface.h"
 #include <syslog.h>
 #include "IPv6Helpers.h"
+#include "IOUring.h"
 
 #if __linux__
 #include <asm/types.h>
@@ -38,6 +39,8 @@
 #include <linux/rtnetlink.h>
 #include <fcntl.h>
 #include <ifaddrs.h>
+#include <sys/ioctl.h>
+#include <linux/if_tun.h>
 #endif
 
 #include <sys/select.h>
@@ -98,6 +101,11 @@ TunnelIPv6Interface::TunnelIPv6Interface(const std::string& interface_name, int
 	mNetifMgmtFD(netif_mgmt_open()),
 #endif
 	mMLDMonitorFD(-1),
+	mMLDFilterAttached(false),
+	mMLDDropCounterFD(-1),
+	mMLDQueueOverflows(0),
+	mOutboundFilterLength(0),
+	mOutboundDropBaseline(0),
 	mIsRunning(false),
 	mIsUp(false)
 {
@@ -133,10 +141,15 @@ TunnelIPv6Interface::TunnelIPv6Interface(const std::string& interface_name, int
 
 TunnelIPv6Interface::~TunnelIPv6Interface()
 {
+	nl::EventBackend::fd_closed(mNetlinkFD);
 	close(mNetlinkFD);
 	if (mMLDMonitorFD >= 0) {
+		nl::EventBackend::fd_closed(mMLDMonitorFD);
 		close(mMLDMonitorFD);
 	}
+	if (mMLDDropCounterFD >= 0) {
+		close(mMLDDropCounterFD);
+	}
 	netif_mgmt_close(mNetifMgmtFD);
 }
 
@@ -292,6 +305,14 @@ TunnelIPv6Interface::setup_mld_listener(void)
 	unsigned interfaceIndex = netif_mgmt_get_ifindex(mNetifMgmtFD, mInterfaceName.c_str());
 	bool success = false;
 	struct ipv6_mreq mreq6;
+	nl::IPv6PacketFilter filter;
+	int prog_fd = -1;
+	int enable = 1;
+	int ret;
+
+	// Only MLDv2 reports are of any interest, so have the kernel drop
+	// all other ICMPv6 rather than waking us up for it.
+	filter.set_icmpv6_type_filter(kICMPv6MLDv2Type);
 
 	mMLDMonitorFD = socket(AF_INET6, SOCK_RAW | SOCK_NONBLOCK, IPPROTO_ICMPV6);
 	mreq6.ipv6mr_interface = interfaceIndex;
@@ -300,12 +321,47 @@ TunnelIPv6Interface::setup_mld_listener(void)
 	require(setsockopt(mMLDMonitorFD, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq6, sizeof(mreq6)) == 0, bail);
 	require(setsockopt(mMLDMonitorFD, SOL_SOCKET, SO_BINDTODEVICE, mInterfaceName.c_str(), mInterfaceName.size()) == 0, bail);
 
+	// Loaded as eBPF, the filter can count what it drops. Without
+	// that, fall back to the classic program, which can't.
+	mMLDDropCounterFD = nl::IPv6PacketFilter::create_drop_counter();
+
+	if (mMLDDropCounterFD >= 0) {
+		prog_fd = filter.load_ebpf(mMLDDropCounterFD);
+	}
+
+	if ((prog_fd >= 0) && (setsockopt(mMLDMonitorFD, SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd)) == 0)) {
+		mMLDFilterAttached = true;
+
+	} else {
+		if (mMLDDropCounterFD >= 0) {
+			close(mMLDDropCounterFD);
+			mMLDDropCounterFD = -1;
+		}
+
+		ret = filter.attach_to_socket(mMLDMonitorFD);
+
+		if (ret == 0) {
+			mMLDFilterAttached = true;
+		} else {
+			syslog(LOG_WARNING, "Unable to filter MLD messages in the kernel (%s)", strerror(-ret));
+		}
+	}
+
+	if (prog_fd >= 0) {
+		close(prog_fd);
+	}
+
+	// Have each message carry the count of messages lost to a full
+	// receive queue.
+	setsockopt(mMLDMonitorFD, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+
 	success = true;
 
 bail:
 	if (!success) {
 		if (mMLDMonitorFD >= 0) {
 			close(mMLDMonitorFD);
+			mMLDMonitorFD = -1;
 		}
 		syslog(LOG_ERR, "listen to MLD messages on interface failed\n");
 	}
@@ -416,20 +472,37 @@ void
 TunnelIPv6Interface::processMLDMonitorFD(void)
 {
 	uint8_t buffer[4096];
+	uint8_t control[CMSG_SPACE(sizeof(uint32_t))];
 	ssize_t bufferLen(-1);
 	struct sockaddr_in6 srcAddr;
-	socklen_t addrLen;
+	struct iovec iov = { buffer, sizeof(buffer) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
 	bool fromSelf = false;
 	MLDv2Header* hdr = reinterpret_cast<MLDv2Header *>(buffer);
 	ssize_t offset;
 	uint8_t type;
 	struct ifaddrs *ifAddrs = NULL;
 
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &srcAddr;
+	msg.msg_namelen = sizeof(srcAddr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
 	if (mNetlinkFD >= 0) {
-		bufferLen = recvfrom(mMLDMonitorFD, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr *>(&srcAddr), &addrLen);
+		bufferLen = recvmsg(mMLDMonitorFD, &msg, 0);
 	}
 	require_quiet(bufferLen > 0, bail);
 
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&mMLDQueueOverflows, CMSG_DATA(cmsg), sizeof(mMLDQueueOverflows));
+		}
+	}
+
 	type = buffer[0];
 	require_quiet(type == kICMPv6MLDv2Type && bufferLen >= sizeof(MLDv2Header), bail);
 
@@ -475,6 +548,67 @@ bail:
 	return;
 }
 
+int
+TunnelIPv6Interface::set_outbound_filter(const nl::IPv6PacketFilter& filter)
+{
+	int ret = 0;
+
+#if defined(TUNSETFILTEREBPF)
+	int prog_fd = -1;
+
+	if (!filter.empty()) {
+		prog_fd = filter.load_ebpf();
+		require_action(prog_fd >= 0, bail, ret = prog_fd);
+	}
+
+	// The interface keeps its own reference to the program.
+	if (ioctl(mFDRead, TUNSETFILTEREBPF, &prog_fd) < 0) {
+		ret = -errno;
+	}
+
+	if (prog_fd >= 0) {
+		close(prog_fd);
+	}
+
+	require_noerr(ret, bail);
+
+	mOutboundFilterLength = filter.get_program().size();
+	mOutboundDropBaseline = 0;
+	get_tx_dropped(mOutboundDropBaseline);
+
+bail:
+#else
+	ret = -ENOTSUP;
+#endif
+
+	return ret;
+}
+
+bool
+TunnelIPv6Interface::get_tx_dropped(uint32_t& dropped)
+{
+	struct ifaddrs *ifAddrs = NULL;
+	bool found = false;
+
+	require(getifaddrs(&ifAddrs) == 0, bail);
+
+	for (struct ifaddrs* ifAddr = ifAddrs; ifAddr != NULL; ifAddr = ifAddr->ifa_next) {
+		if (ifAddr->ifa_addr != NULL && ifAddr->ifa_addr->sa_family == AF_PACKET &&
+				ifAddr->ifa_data != NULL && mInterfaceName == std::string(ifAddr->ifa_name)) {
+			dropped = static_cast<const struct rtnl_link_stats *>(ifAddr->ifa_data)->tx_dropped;
+			found = true;
+			break;
+		}
+	}
+
+bail:
+	if (ifAddrs) {
+		freeifaddrs(ifAddrs);
+	}
+
+	return found;
+}
+
 #else // ----------------------------------------------------------------------
 
 void
@@ -483,6 +617,18 @@ TunnelIPv6Interface::setup_signals(void)
 	// Unknown platform.
 }
 
+int
+TunnelIPv6Interface::set_outbound_filter(const nl::IPv6PacketFilter& filter)
+{
+	return -ENOTSUP;
+}
+
+bool
+TunnelIPv6Interface::get_tx_dropped(uint32_t& dropped)
+{
+	return false;
+}
+
 int
 TunnelIPv6Interface::process(void)
 {
@@ -501,25 +647,49 @@ TunnelIPv6Interface::processMLDMonitorFD(void)
 
 #endif // ---------------------------------------------------------------------
 
+void
+TunnelIPv6Interface::get_filter_counters(std::list<std::string>& result)
+{
+	char c_string[128];
+	uint32_t dropped = 0;
+	uint64_t mld_dropped = 0;
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "TUN:Instructions", static_cast<unsigned int>(mOutboundFilterLength));
+	result.push_back(c_string);
+
+	if ((mOutboundFilterLength != 0) && get_tx_dropped(dropped)) {
+		dropped -= mOutboundDropBaseline;
+	}
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "TUN:Dropped", dropped);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %s", "MLD:Filtered", mMLDFilterAttached ? "true" : "false");
+	result.push_back(c_string);
+
+	// Only the eBPF filter counts what it drops.
+	if ((mMLDDropCounterFD >= 0) && (nl::IPv6PacketFilter::read_drop_counter(mMLDDropCounterFD, mld_dropped) == 0)) {
+		snprintf(c_string, sizeof(c_string), "%-20s = %llu", "MLD:Dropped", static_cast<unsigned long long>(mld_dropped));
+		result.push_back(c_string);
+	}
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "MLD:QueueOverflows", mMLDQueueOverflows);
+	result.push_back(c_string);
+}
+
 int
-TunnelIPv6Interface::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout)
+TunnelIPv6Interface::update_fd_interest(nl::EventBackend *backend, cms_t *timeout)
 {
-	if (read_fd_set) {
+	if (backend) {
 		if (mNetlinkFD >= 0)  {
-			FD_SET(mNetlinkFD, read_fd_set);
+			backend->watch(mNetlinkFD, nl::EventBackend::kEventRead);
 		}
 
 		if (mMLDMonitorFD >= 0) {
-			FD_SET(mMLDMonitorFD, read_fd_set);
-		}
-
-		if ((max_fd != NULL)) {
-			*max_fd = std::max(*max_fd, mNetlinkFD);
-			*max_fd = std::max(*max_fd, mMLDMonitorFD);
+			backend->watch(mMLDMonitorFD, nl::EventBackend::kEventRead);
 		}
 	}
 
-	return nl::UnixSocket::update_fd_set(read_fd_set, write_fd_set, error_fd_set, max_fd, timeout);
+	return nl::UnixSocket::update_fd_interest(backend, timeout);
 }
 
 const std::string&
@@ -758,6 +928,19 @@ bail:
 	return ret;
 }
 
+int
+TunnelIPv6Interface::enable_posted_reads(void)
+{
+	int ret = nl::UnixSocket::enable_posted_reads();
+
+	if (ret == 0) {
+		// Every read from the tunnel is one packet.
+		mPostedReader->set_message_mode(true);
+	}
+
+	return ret;
+}
+
 ssize_t
 TunnelIPv6Interface::read(void* data, size_t len)
 {
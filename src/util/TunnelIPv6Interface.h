@@ -33,7 +33,9 @@
 #include <net/if.h>
 #include "UnixSocket.h"
 #include <set>
+#include <list>
 #include "IPv6Helpers.h"
+#include "IPv6PacketFilter.h"
 #include <boost/signals2/signal.hpp>
 
 class TunnelIPv6Interface : public nl::UnixSocket
@@ -70,12 +72,20 @@ public:
 	bool join_multicast_address(const struct in6_addr *addr);
 	bool leave_multicast_address(const struct in6_addr *addr);
 
+	//! Has the kernel drop the packets `filter` drops before they are
+	//! read from the interface. An empty filter removes the current one.
+	//! Returns zero or a negative errno.
+	int set_outbound_filter(const nl::IPv6PacketFilter& filter);
+
+	void get_filter_counters(std::list<std::string>& result);
+
 	virtual void reset(void);
 	virtual ssize_t write(const void* data, size_t len);
 	virtual ssize_t read(void* data, size_t len);
 
 	virtual int process(void);
-	virtual int update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout);
+	virtual int update_fd_interest(nl::EventBackend *backend, cms_t *timeout);
+	virtual int enable_posted_reads(void);
 
 public: // Signals
 
@@ -100,6 +110,8 @@ private:
 	void on_address_removed(const struct in6_addr &address, uint8_t prefix_len);
 	void on_multicast_address_left(const struct in6_addr &address);
 
+	bool get_tx_dropped(uint32_t& dropped);
+
 private:
 	std::string mInterfaceName;
 	int mLastError;
@@ -108,6 +120,19 @@ private:
 	int mNetifMgmtFD;
 	int mMLDMonitorFD;
 
+	// Packets dropped in the kernel, either by the socket filter on
+	// `mMLDMonitorFD` or by the outbound filter on the interface. The
+	// socket filter counts its drops in `mMLDDropCounterFD` when it
+	// could be loaded as eBPF. The interface only counts its drops
+	// along with its other transmit drops, so those are counted from
+	// when the filter was attached. MLD reports lost to a full receive
+	// queue are counted apart, in `mMLDQueueOverflows`.
+	bool mMLDFilterAttached;
+	int mMLDDropCounterFD;
+	uint32_t mMLDQueueOverflows;
+	size_t mOutboundFilterLength;
+	uint32_t mOutboundDropBaseline;
+
 	bool mIsRunning;
 	bool mIsUp;
 
@@ -22,6 +22,7 @@
 #endif
 
 #include "UnixSocket.h"
+#include "IOUring.h"
 #include <errno.h>
 #include "socket-utils.h"
 #include <termios.h>
@@ -35,22 +36,34 @@ using namespace nl;
 
 #define SOCKET_DEBUG_BYTES_PER_LINE			16
 
+// Large enough for any frame from the NCP or packet from the TUN
+// interface, so that one completion usually carries a whole one.
+#define SOCKET_POSTED_READ_SIZE				2048
+
 UnixSocket::UnixSocket(int rfd, int wfd, bool should_close)
-	:mShouldClose(should_close), mFDRead(rfd), mFDWrite(wfd), mLogLevel(-1)
+	:mShouldClose(should_close), mFDRead(rfd), mFDWrite(wfd), mLogLevel(-1), mPostedReader(NULL)
 {
+	update_framing();
 }
 
 UnixSocket::UnixSocket(int fd, bool should_close)
-	:mShouldClose(should_close), mFDRead(fd), mFDWrite(fd), mLogLevel(-1)
+	:mShouldClose(should_close), mFDRead(fd), mFDWrite(fd), mLogLevel(-1), mPostedReader(NULL)
 {
+	update_framing();
 }
 
 UnixSocket::~UnixSocket()
 {
+	// The kernel must be done writing into the reader's buffer
+	// before it goes away.
+	disable_posted_reads();
+
 	if (mShouldClose) {
+		EventBackend::fd_closed(mFDRead);
 		close(mFDRead);
 
 		if(mFDWrite != mFDRead) {
+			EventBackend::fd_closed(mFDWrite);
 			close(mFDWrite);
 		}
 	}
@@ -96,10 +109,50 @@ UnixSocket::write(const void* data, size_t len)
 	return ret;
 }
 
+ssize_t
+UnixSocket::writev(const struct iovec* iov, int iovcnt)
+{
+	ssize_t ret;
+
+	if (mIsFramed) {
+		// A single writev() would send all of the buffers as one
+		// message.
+		return SocketWrapper::writev(iov, iovcnt);
+	}
+
+#if DEBUG
+	if (mLogLevel != -1) {
+		// Go through write() so that every buffer gets dumped.
+		return SocketWrapper::writev(iov, iovcnt);
+	}
+#endif
+
+	ret = ::writev(mFDWrite, iov, iovcnt);
+
+	if(ret<0) {
+		ret = -errno;
+	} else if(ret == 0) {
+		ret = fd_has_error(mFDWrite);
+	}
+	return ret;
+}
+
 ssize_t
 UnixSocket::read(void* data, size_t len)
 {
-	ssize_t ret = ::read(mFDRead, data, len);
+	ssize_t ret;
+
+	if ((mPostedReader != NULL) && mPostedReader->is_unsupported()) {
+		syslog(LOG_WARNING, "UnixSocket: io_uring cannot read FD%d, reading it directly", mFDRead);
+		disable_posted_reads();
+	}
+
+	if (mPostedReader != NULL) {
+		ret = read_posted(data, len);
+	} else {
+		ret = ::read(mFDRead, data, len);
+	}
+
 	if(ret<0) {
 		if(EAGAIN == errno) {
 			ret = 0;
@@ -124,13 +177,47 @@ UnixSocket::read(void* data, size_t len)
 #endif
 	}
 
-	if(ret==0) {
+	if((ret==0) && (mPostedReader == NULL)) {
+		ret = fd_has_error(mFDRead);
+	}
+
+	return ret;
+}
+
+ssize_t
+UnixSocket::read_posted(void* data, size_t len)
+{
+	ssize_t ret = mPostedReader->read(mFDRead, data, len);
+
+	if (ret < 0) {
+		errno = (int)-ret;
+		ret = -1;
+	} else if ((ret == 0) && mPostedReader->read_hit_eof()) {
+		// Same as a zero-byte read(2) on the descriptor itself.
 		ret = fd_has_error(mFDRead);
+		if (ret < 0) {
+			errno = (int)-ret;
+			ret = -1;
+		}
 	}
 
 	return ret;
 }
 
+void
+UnixSocket::update_framing(void)
+{
+	mIsFramed = (mFDRead >= 0)
+		&& fd_keeps_message_boundaries(mFDRead)
+		&& ((mFDWrite == mFDRead) || fd_keeps_message_boundaries(mFDWrite));
+}
+
+bool
+UnixSocket::is_framed(void)const
+{
+	return mIsFramed;
+}
+
 off_t
 UnixSocket::lseek(off_t offset, int whence)
 {
@@ -140,6 +227,10 @@ UnixSocket::lseek(off_t offset, int whence)
 bool
 UnixSocket::can_read(void)const
 {
+	if (mPostedReader != NULL) {
+		return mPostedReader->poll(mFDRead);
+	}
+
 	bool ret = false;
 	const int flags = POLLRDNORM|POLLERR|POLLNVAL|POLLHUP;
 	struct pollfd pollfd = { mFDRead, flags, 0 };
@@ -171,6 +262,10 @@ UnixSocket::send_break()
 int
 UnixSocket::get_read_fd(void)const
 {
+	if (mPostedReader != NULL) {
+		return mPostedReader->get_ring_fd();
+	}
+
 	return mFDRead;
 }
 
@@ -193,3 +288,71 @@ UnixSocket::set_log_level(int log_level)
 
 	return 0;
 }
+
+int
+UnixSocket::update_fd_interest(EventBackend *backend, cms_t *timeout)
+{
+	if (mPostedReader != NULL) {
+		// Submits the reads queued since the last iteration; every
+		// socket sharing the ring is taken care of by the first call.
+		mPostedReader->poll(mFDRead);
+
+		// Give whoever reads this socket one pass to notice data that
+		// was reaped while servicing another socket on the ring. Data
+		// that is left sitting (because of backpressure) must not keep
+		// the main loop spinning, just as an unwatched fd wouldn't.
+		if (mPostedReader->take_completed() && (timeout != NULL)) {
+			*timeout = 0;
+		}
+	}
+
+	return SocketWrapper::update_fd_interest(backend, timeout);
+}
+
+int
+UnixSocket::enable_posted_reads(void)
+{
+	IOUring* ring;
+
+	if (mPostedReader != NULL) {
+		return 0;
+	}
+
+	if (mIsFramed) {
+		// Posted reads are taken as a byte stream, which could
+		// split or join messages.
+		errno = ENOTSUP;
+		return -errno;
+	}
+
+	ring = IOUring::get_shared();
+
+	if (ring == NULL) {
+		return -errno;
+	}
+
+	mPostedReader = new IOUringReader(ring, SOCKET_POSTED_READ_SIZE);
+
+	return 0;
+}
+
+bool
+UnixSocket::has_posted_reads(void)const
+{
+	return mPostedReader != NULL;
+}
+
+void
+UnixSocket::cancel_posted_read(void)
+{
+	if (mPostedReader != NULL) {
+		mPostedReader->cancel();
+	}
+}
+
+void
+UnixSocket::disable_posted_reads(void)
+{
+	delete mPostedReader;
+	mPostedReader = NULL;
+}
@@ -25,6 +25,8 @@
 #include <unistd.h>
 
 namespace nl {
+class IOUringReader;
+
 class UnixSocket : public SocketWrapper {
 protected:
 	UnixSocket(int rfd, int wfd, bool should_close);
@@ -35,8 +37,10 @@ public:
 	static boost::shared_ptr<SocketWrapper> create(int rfd, int wfd, bool should_close = false);
 	virtual ~UnixSocket();
 	virtual ssize_t write(const void* data, size_t len);
+	virtual ssize_t writev(const struct iovec* iov, int iovcnt);
 	virtual ssize_t read(void* data, size_t len);
 	virtual off_t lseek(off_t offset, int whence);
+	virtual bool is_framed(void)const;
 	virtual bool can_read(void)const;
 	virtual bool can_write(void)const;
 	virtual int get_read_fd(void)const;
@@ -44,12 +48,31 @@ public:
 	virtual int process(void);
 	virtual void send_break();
 	virtual int set_log_level(int log_level);
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout);
+	virtual int enable_posted_reads(void);
+	virtual void disable_posted_reads(void);
+	virtual bool has_posted_reads(void)const;
 
 protected:
+	//! Must be called before `mFDRead` is closed out from under us.
+	void cancel_posted_read(void);
+	ssize_t read_posted(void* data, size_t len);
+
+	//! Must be called whenever the descriptors change.
+	void update_framing(void);
+
 	bool mShouldClose;
 	int mFDRead;
 	int mFDWrite;
 	int mLogLevel;
+
+	//! True if the descriptors keep message boundaries, in which case
+	//! every buffer is written out with its own `write()`.
+	bool mIsFramed;
+
+	//! Non-NULL while reads are posted to io_uring; `get_read_fd()` then
+	//! returns the ring descriptor.
+	IOUringReader* mPostedReader;
 }; // class UnixSocket
 
 }; // namespace nl
@@ -0,0 +1,185 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Per-iteration overhead of the main loop event backends.
+ *
+ *      Each iteration mirrors what `MainLoop::block_until_ready()` does:
+ *      every attached descriptor re-declares its interest, the backend
+ *      waits, and the one busy descriptor (standing in for the NCP) is
+ *      serviced. The rest are idle, like attached pcap streams or IPC
+ *      connections.
+ *
+ *      Usage: event_backend_bench [iterations]
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "EventBackend.h"
+
+using namespace nl;
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+// Returns the number of iterations that completed, which is less than
+// `iterations` if the backend could not handle the descriptors.
+static size_t
+run(EventBackend* backend, const std::vector<int>& idle_fds, const int busy_fds[2], size_t iterations)
+{
+	size_t i;
+
+	for (i = 0; i < iterations; i++) {
+		std::vector<int>::const_iterator iter;
+		char byte = 0;
+
+		if (write(busy_fds[1], &byte, 1) != 1) {
+			break;
+		}
+
+		backend->begin_update();
+
+		for (iter = idle_fds.begin(); iter != idle_fds.end(); ++iter) {
+			backend->watch(*iter, EventBackend::kEventRead | EventBackend::kEventError);
+		}
+
+		backend->watch(busy_fds[0], EventBackend::kEventRead | EventBackend::kEventError);
+
+		if (backend->wait(1000) <= 0) {
+			break;
+		}
+
+		if (backend->take_ready(busy_fds[0], EventBackend::kEventRead) == 0) {
+			break;
+		}
+
+		if (read(busy_fds[0], &byte, 1) != 1) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+static void
+bench(const char* name, size_t idle_count, size_t iterations)
+{
+	EventBackend* backend = EventBackend::create(name);
+	std::vector<int> idle_fds;
+	std::vector<int> peer_fds;
+	int busy_fds[2];
+	size_t completed;
+	double start, elapsed;
+	size_t i;
+
+	if (backend == NULL) {
+		printf("%-8s %6zu fds  unavailable\n", name, idle_count);
+		return;
+	}
+
+	for (i = 0; i < idle_count; i++) {
+		int fds[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+			perror("socketpair");
+			exit(EXIT_FAILURE);
+		}
+
+		idle_fds.push_back(fds[0]);
+		peer_fds.push_back(fds[1]);
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, busy_fds) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	// Warm up, so one-time registration costs are not counted.
+	run(backend, idle_fds, busy_fds, 10);
+
+	start = now_sec();
+	completed = run(backend, idle_fds, busy_fds, iterations);
+	elapsed = now_sec() - start;
+
+	if (completed != iterations) {
+		printf("%-8s %6zu fds  failed after %zu iterations\n", name, idle_count + 1, completed);
+	} else {
+		printf("%-8s %6zu fds  %8.2f us/iteration",
+		       name, idle_count + 1, elapsed * 1.0e6 / iterations);
+#if __linux__
+		if (EpollEventBackend* epoll_backend = dynamic_cast<EpollEventBackend*>(backend)) {
+			printf("  %u epoll_ctl calls", epoll_backend->get_ctl_count());
+		}
+#endif
+		printf("\n");
+	}
+
+	for (i = 0; i < idle_count; i++) {
+		close(idle_fds[i]);
+		close(peer_fds[i]);
+	}
+
+	close(busy_fds[0]);
+	close(busy_fds[1]);
+
+	delete backend;
+}
+
+int
+main(int argc, char* argv[])
+{
+	static const size_t idle_counts[] = { 4, 32, 128, 400, 2000 };
+	size_t iterations = 20000;
+	struct rlimit limit;
+	size_t i;
+
+	if (argc > 1) {
+		iterations = strtoul(argv[1], NULL, 0);
+	}
+
+	// The larger runs need more descriptors than the usual soft limit.
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	printf("%zu iterations, one busy descriptor and the rest idle\n", iterations);
+
+	for (i = 0; i < sizeof(idle_counts) / sizeof(idle_counts[0]); i++) {
+		bench("select", idle_counts[i], iterations);
+		bench("epoll", idle_counts[i], iterations);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Checks that the epoll and select event backends report the same
+ *      readiness, including across changes of interest and descriptors
+ *      being closed and their numbers reused, and that protothreads can
+ *      wait on descriptors numbered `FD_SETSIZE` and up.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "EventBackend.h"
+#include "nlpt.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+static int
+wait_for(EventBackend* backend, int fd, int events)
+{
+	backend->begin_update();
+	backend->watch(fd, events);
+	backend->wait(0);
+	return backend->take_ready(fd, events);
+}
+
+static void
+test_backend(const char* name)
+{
+	EventBackend* backend = EventBackend::create(name);
+	int fds[2];
+	char byte = 0;
+
+	if (backend == NULL) {
+		printf("%s: unavailable, skipping\n", name);
+		return;
+	}
+
+	backend->set_active();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	test_checkf(wait_for(backend, fds[0], EventBackend::kEventRead) == 0, "%s: Idle descriptor failed", name);
+	test_checkf(wait_for(backend, fds[0], EventBackend::kEventWrite) == EventBackend::kEventWrite, "%s: Writable descriptor failed", name);
+
+	test_checkf(write(fds[1], &byte, 1) == 1, "%s: Write failed", name);
+	test_checkf(wait_for(backend, fds[0], EventBackend::kEventRead) == EventBackend::kEventRead, "%s: Readable descriptor failed", name);
+	test_checkf(backend->take_ready(fds[0], EventBackend::kEventRead) == 0, "%s: Readiness consumed failed", name);
+
+	// Interest that is not renewed must not be reported.
+	backend->begin_update();
+	backend->watch(fds[1], EventBackend::kEventRead);
+	backend->wait(0);
+	test_checkf(backend->take_ready(fds[0], EventBackend::kEventRead) == 0, "%s: Dropped interest failed", name);
+
+	test_checkf(read(fds[0], &byte, 1) == 1, "%s: Read failed", name);
+	test_checkf(wait_for(backend, fds[0], EventBackend::kEventRead) == 0, "%s: Idle after read failed", name);
+
+	// Close the still-registered descriptor and reuse its number.
+	EventBackend::fd_closed(fds[0]);
+	close(fds[0]);
+	close(fds[1]);
+
+	{
+		const int old_fd = fds[0];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+			perror("socketpair");
+			exit(EXIT_FAILURE);
+		}
+
+		test_checkf(fds[0] == old_fd, "%s: Descriptor number reused failed", name);
+	}
+
+	test_checkf(write(fds[1], &byte, 1) == 1, "%s: Write after reuse failed", name);
+	test_checkf(wait_for(backend, fds[0], EventBackend::kEventRead) == EventBackend::kEventRead, "%s: Readable after reuse failed", name);
+
+	// Hang-ups are reported to readers.
+	close(fds[1]);
+	test_checkf((wait_for(backend, fds[0], EventBackend::kEventRead) & EventBackend::kEventRead) != 0, "%s: Hang-up failed", name);
+
+	EventBackend::fd_closed(fds[0]);
+	close(fds[0]);
+
+	delete backend;
+}
+
+// A protothread waiting on a descriptor numbered `FD_SETSIZE` or up
+// must either be woken up for it, or make `wait()` fail.
+static void
+test_nlpt_high_fd(const char* name)
+{
+	EventBackend* backend = EventBackend::create(name);
+	const int high_fd = FD_SETSIZE + 1;
+	struct rlimit limit;
+	struct nlpt nlpt;
+	int fds[2];
+	int ret;
+	char byte = 0;
+
+	if (backend == NULL) {
+		printf("%s: unavailable, skipping\n", name);
+		return;
+	}
+
+	if ((getrlimit(RLIMIT_NOFILE, &limit) < 0) || (limit.rlim_max <= static_cast<rlim_t>(high_fd))) {
+		printf("%s: can't open descriptor %d, skipping\n", name, high_fd);
+		delete backend;
+		return;
+	}
+
+	if (limit.rlim_cur <= static_cast<rlim_t>(high_fd)) {
+		limit.rlim_cur = high_fd + 1;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	backend->set_active();
+
+	if ((socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) || (dup2(fds[0], high_fd) < 0)) {
+		perror("socketpair/dup2");
+		exit(EXIT_FAILURE);
+	}
+
+	_nlpt_init(&nlpt);
+	_nlpt_setup_read_fd_source(&nlpt, high_fd);
+
+	test_checkf(write(fds[1], &byte, 1) == 1, "%s: Write to high descriptor failed", name);
+
+	backend->begin_update();
+	backend->watch(&nlpt);
+	ret = backend->wait(0);
+
+	if (strcmp(name, "select") == 0) {
+		test_checkf((ret < 0) && (errno == EMFILE), "%s: High descriptor rejected failed", name);
+	} else {
+		test_checkf((ret > 0) && (backend->take_ready(high_fd, EventBackend::kEventRead) == EventBackend::kEventRead), "%s: High descriptor readable failed", name);
+
+		_nlpt_cleanup_read_fd_source(&nlpt, high_fd);
+		backend->begin_update();
+		backend->watch(&nlpt);
+		backend->wait(0);
+		test_checkf(backend->take_ready(high_fd, EventBackend::kEventRead) == 0, "%s: High descriptor no longer watched failed", name);
+	}
+
+	EventBackend::fd_closed(high_fd);
+	close(high_fd);
+	close(fds[0]);
+	close(fds[1]);
+
+	delete backend;
+}
+
+int
+main(void)
+{
+	test_backend("select");
+	test_backend("epoll");
+	test_nlpt_high_fd("select");
+	test_nlpt_high_fd("epoll");
+
+	return test_exit_status();
+}
@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      HDLC-lite framing helpers, as used on the serial link to the NCP.
+ *
+ */
+
+#ifndef wpantund_hdlc_h
+#define wpantund_hdlc_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HDLC_BYTE_FLAG             0x7E
+#define HDLC_BYTE_ESC              0x7D
+#define HDLC_BYTE_XON              0x11
+#define HDLC_BYTE_XOFF             0x13
+#define HDLC_BYTE_SPECIAL          0xF8
+#define HDLC_ESCAPE_XFORM          0x20
+
+#define HDLC_CRC_INIT              0xFFFF
+#define HDLC_CRC_XOROUT            0xFFFF
+#define HDLC_CRC_SIZE              2
+
+//! Largest possible encoded size of a `len` byte frame, including
+//! the CRC and both flags.
+#define HDLC_ENCODED_FRAME_SIZE_MAX(len)  (2 * ((len) + HDLC_CRC_SIZE) + 2)
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum {
+	//! All of the given bytes were consumed without completing a frame.
+	HDLC_DECODE_NEED_MORE = 0,
+
+	//! A complete frame with a valid CRC is in the decoder buffer.
+	//! `frame_len` excludes the CRC.
+	HDLC_DECODE_FRAME,
+
+	//! A complete frame was received, but its CRC did not match.
+	//! `frame_len` includes the two trailing CRC bytes, so that the
+	//! caller can inspect the raw frame contents.
+	HDLC_DECODE_BAD_CRC,
+
+	//! The frame didn't fit in the decoder buffer and was dropped.
+	HDLC_DECODE_OVERFLOW,
+} hdlc_decode_status_t;
+
+//! Resumable HDLC-lite de-framing state machine.
+/*! The decoder can be fed arbitrarily sized chunks of the received
+ *  byte stream and picks up where it left off on the next call. Decoded
+ *  frames are written to the caller-supplied buffer and remain valid
+ *  until the next call to `hdlc_decoder_feed()`.
+ */
+struct hdlc_decoder {
+	uint8_t* buffer;
+	size_t buffer_size;
+	size_t length;
+	bool escaped;
+	bool overflow;
+
+	//! If set, unescaped XON, XOFF and 0xF8 bytes are dropped from the
+	//! stream, and an escape byte is only applied to the next byte that
+	//! isn't one of those.
+	bool drop_control_bytes;
+
+	//! Length of the last completed frame.
+	size_t frame_len;
+
+	//! CRC computed over the last completed frame.
+	uint16_t crc;
+};
+
+extern void hdlc_decoder_init(struct hdlc_decoder* decoder, uint8_t* buffer, size_t buffer_size);
+extern void hdlc_decoder_reset(struct hdlc_decoder* decoder);
+
+//! Feeds received bytes to the decoder.
+/*! Stops right after the first frame completes so that the caller can
+ *  handle it before feeding the remaining bytes. The number of bytes
+ *  consumed is stored in `consumed`.
+ */
+extern hdlc_decode_status_t hdlc_decoder_feed(
+	struct hdlc_decoder* decoder,
+	const uint8_t* data,
+	size_t data_len,
+	size_t* consumed
+);
+
+extern bool hdlc_byte_needs_escape(uint8_t byte);
+
+//! Returns the number of leading bytes of `data` that don't need escaping.
+extern size_t hdlc_escape_span(const uint8_t* data, size_t len);
+
+//! Escapes `len` bytes of `data` into `out`, which must have room for
+//! `2 * len` bytes. Returns the number of bytes written.
+extern size_t hdlc_escape(uint8_t* out, const uint8_t* data, size_t len);
+
+//! HDLC encodes a whole frame: the escaped data, its CRC and a closing
+//! flag, optionally preceded by an opening flag. `out` must have room
+//! for `HDLC_ENCODED_FRAME_SIZE_MAX(len)` bytes. Returns the number of
+//! bytes written.
+extern size_t hdlc_encode_frame(uint8_t* out, const uint8_t* data, size_t len, bool leading_flag);
+
+//! CRC-16/KERMIT over `len` bytes, starting from `crc`.
+extern uint16_t hdlc_crc16_update(uint16_t crc, const uint8_t* data, size_t len);
+
+//! CRC-16/KERMIT of a single byte, starting from `crc`.
+extern uint16_t hdlc_crc16(uint16_t crc, uint8_t byte);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Throughput benchmarks for the HDLC codec.
+ *
+ *      The receive-path benchmark compares reading the stream one byte
+ *      per `read()` call (the historical behavior of the NCP data pump)
+ *      against reading large chunks and running them through
+ *      `hdlc_decoder_feed()`.
+ *
+ *      The codec microbenchmarks compare the per-byte escape, unescape
+ *      and CRC loops against the library kernels, entirely in memory.
+ *
+ *      Usage: hdlc_bench [frame-count] [frame-size]
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "hdlc.h"
+
+#define BENCH_FRAME_BUFFER_SIZE    1300
+#define BENCH_CHUNK_SIZE           4096
+
+static uint8_t sFrame[BENCH_FRAME_BUFFER_SIZE];
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+// Builds `frame_count` HDLC encoded frames of `frame_size` pseudo-random
+// bytes each, returning the encoded stream and the raw frame data.
+static uint8_t*
+build_stream(size_t frame_count, size_t frame_size, size_t* stream_len, uint8_t** raw)
+{
+	uint8_t* stream = malloc(frame_count * HDLC_ENCODED_FRAME_SIZE_MAX(frame_size));
+	size_t len = 0;
+	uint32_t seed = 1;
+	size_t i, j;
+
+	*raw = malloc(frame_count * frame_size);
+
+	for (i = 0; i < frame_count; i++) {
+		uint8_t* frame = *raw + i * frame_size;
+
+		for (j = 0; j < frame_size; j++) {
+			seed = seed * 1103515245 + 12345;
+			frame[j] = (uint8_t)(seed >> 16);
+		}
+
+		len += hdlc_encode_frame(stream + len, frame, frame_size, (i == 0));
+	}
+
+	*stream_len = len;
+	return stream;
+}
+
+static pid_t
+start_writer(const uint8_t* stream, size_t stream_len, int* read_fd)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid == 0) {
+		size_t offset = 0;
+
+		close(fds[0]);
+
+		while (offset < stream_len) {
+			ssize_t ret = write(fds[1], stream + offset, stream_len - offset);
+			if (ret < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				_exit(EXIT_FAILURE);
+			}
+			offset += ret;
+		}
+
+		close(fds[1]);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	*read_fd = fds[0];
+	return pid;
+}
+
+// The historical receive path: one `read()` per byte, with the CRC
+// accumulated as bytes arrive.
+static size_t
+run_bytewise(int fd, size_t* frames, size_t* syscalls)
+{
+	size_t total = 0;
+	size_t len = 0;
+	uint16_t crc = HDLC_CRC_INIT;
+	uint8_t byte;
+
+	while (1) {
+		ssize_t ret = read(fd, &byte, 1);
+
+		(*syscalls)++;
+
+		if (ret <= 0) {
+			break;
+		}
+
+		total++;
+
+		if (byte == HDLC_BYTE_ESC) {
+			if (read(fd, &byte, 1) != 1) {
+				break;
+			}
+			(*syscalls)++;
+			total++;
+			if (byte != HDLC_BYTE_FLAG) {
+				byte ^= HDLC_ESCAPE_XFORM;
+				goto append;
+			}
+		}
+
+		if (byte == HDLC_BYTE_FLAG) {
+			if (len > 2) {
+				crc ^= HDLC_CRC_XOROUT;
+				if (crc == (sFrame[len - 2] | (sFrame[len - 1] << 8))) {
+					(*frames)++;
+				}
+			}
+			len = 0;
+			crc = HDLC_CRC_INIT;
+			continue;
+		}
+
+append:
+		if (len >= 2) {
+			crc = hdlc_crc16(crc, sFrame[len - 2]);
+		}
+		if (len < sizeof(sFrame)) {
+			sFrame[len++] = byte;
+		}
+	}
+
+	return total;
+}
+
+static size_t
+run_chunked(int fd, size_t* frames, size_t* syscalls)
+{
+	static uint8_t chunk[BENCH_CHUNK_SIZE];
+	struct hdlc_decoder decoder;
+	size_t total = 0;
+
+	hdlc_decoder_init(&decoder, sFrame, sizeof(sFrame));
+
+	while (1) {
+		ssize_t ret = read(fd, chunk, sizeof(chunk));
+		size_t offset = 0;
+
+		(*syscalls)++;
+
+		if (ret <= 0) {
+			break;
+		}
+
+		total += ret;
+
+		while (offset < (size_t)ret) {
+			size_t consumed = 0;
+			hdlc_decode_status_t status = hdlc_decoder_feed(&decoder, chunk + offset, ret - offset, &consumed);
+
+			offset += consumed;
+
+			if (status == HDLC_DECODE_FRAME) {
+				(*frames)++;
+			}
+		}
+	}
+
+	return total;
+}
+
+// ----------------------------------------------------------------------------
+// MARK: Codec microbenchmarks
+
+static const uint16_t*
+ref_crc_table(void)
+{
+	static uint16_t table[256];
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		table[i] = hdlc_crc16(0, (uint8_t)i);
+	}
+
+	return table;
+}
+
+// The per-byte loops the codec replaced.
+static size_t
+ref_encode(uint8_t* out, const uint8_t* data, size_t len, const uint16_t* table)
+{
+	size_t out_len = 0;
+	uint16_t crc = HDLC_CRC_INIT;
+	size_t i;
+
+	out[out_len++] = HDLC_BYTE_FLAG;
+
+	for (i = 0; i < len; i++) {
+		uint8_t byte = data[i];
+		crc = (crc >> 8) ^ table[(crc ^ byte) & 0xff];
+		if (byte == HDLC_BYTE_FLAG || byte == HDLC_BYTE_ESC || byte == HDLC_BYTE_XON
+		 || byte == HDLC_BYTE_XOFF || byte == HDLC_BYTE_SPECIAL) {
+			out[out_len++] = HDLC_BYTE_ESC;
+			out[out_len++] = byte ^ HDLC_ESCAPE_XFORM;
+		} else {
+			out[out_len++] = byte;
+		}
+	}
+
+	crc ^= HDLC_CRC_XOROUT;
+	out[out_len++] = crc & 0xFF;
+	out[out_len++] = crc >> 8;
+	out[out_len++] = HDLC_BYTE_FLAG;
+
+	return out_len;
+}
+
+static size_t
+ref_decode(const uint8_t* stream, size_t stream_len, const uint16_t* table)
+{
+	size_t frames = 0;
+	size_t len = 0;
+	uint16_t crc = HDLC_CRC_INIT;
+	size_t i;
+
+	for (i = 0; i < stream_len; i++) {
+		uint8_t byte = stream[i];
+
+		if (byte == HDLC_BYTE_FLAG) {
+			if (len > 2) {
+				crc ^= HDLC_CRC_XOROUT;
+				if (crc == (sFrame[len - 2] | (sFrame[len - 1] << 8))) {
+					frames++;
+				}
+			}
+			len = 0;
+			crc = HDLC_CRC_INIT;
+			continue;
+		}
+
+		if (byte == HDLC_BYTE_ESC && ++i < stream_len) {
+			byte = stream[i] ^ HDLC_ESCAPE_XFORM;
+		}
+
+		if (len >= 2) {
+			crc = (crc >> 8) ^ table[(crc ^ sFrame[len - 2]) & 0xff];
+		}
+		if (len < sizeof(sFrame)) {
+			sFrame[len++] = byte;
+		}
+	}
+
+	return frames;
+}
+
+static void
+report(const char* name, size_t bytes, double elapsed)
+{
+	printf("  %-24s %8.3f s %9.2f MB/s\n", name, elapsed, bytes / elapsed / (1024.0 * 1024.0));
+}
+
+static void
+microbench(const uint8_t* raw, size_t frame_count, size_t frame_size, const uint8_t* stream, size_t stream_len)
+{
+	const uint16_t* table = ref_crc_table();
+	uint8_t* out = malloc(HDLC_ENCODED_FRAME_SIZE_MAX(frame_size));
+	const size_t raw_len = frame_count * frame_size;
+	volatile size_t sink = 0;
+	struct hdlc_decoder decoder;
+	double start;
+	size_t i;
+
+	printf("codec microbenchmarks (in memory):\n");
+
+	start = now_sec();
+	for (i = 0; i < frame_count; i++) {
+		const uint8_t* data = raw + i * frame_size;
+		uint16_t crc = HDLC_CRC_INIT;
+		size_t j;
+
+		for (j = 0; j < frame_size; j++) {
+			crc = (crc >> 8) ^ table[(crc ^ data[j]) & 0xff];
+		}
+		sink += crc;
+	}
+	report("crc16 per-byte table", raw_len, now_sec() - start);
+
+	start = now_sec();
+	for (i = 0; i < frame_count; i++) {
+		sink += hdlc_crc16_update(HDLC_CRC_INIT, raw + i * frame_size, frame_size);
+	}
+	report("crc16 slicing-by-8", raw_len, now_sec() - start);
+
+	start = now_sec();
+	for (i = 0; i < frame_count; i++) {
+		sink += ref_encode(out, raw + i * frame_size, frame_size, table);
+	}
+	report("encode per-byte", raw_len, now_sec() - start);
+
+	start = now_sec();
+	for (i = 0; i < frame_count; i++) {
+		sink += hdlc_encode_frame(out, raw + i * frame_size, frame_size, true);
+	}
+	report("encode hdlc_encode_frame", raw_len, now_sec() - start);
+
+	start = now_sec();
+	sink += ref_decode(stream, stream_len, table);
+	report("decode per-byte", stream_len, now_sec() - start);
+
+	start = now_sec();
+	hdlc_decoder_init(&decoder, sFrame, sizeof(sFrame));
+	for (i = 0; i < stream_len;) {
+		size_t consumed = 0;
+		sink += hdlc_decoder_feed(&decoder, stream + i, stream_len - i, &consumed);
+		i += consumed;
+	}
+	report("decode hdlc_decoder_feed", stream_len, now_sec() - start);
+
+	(void)sink;
+	free(out);
+}
+
+static void
+bench(const char* name, size_t (*run)(int, size_t*, size_t*), const uint8_t* stream, size_t stream_len, size_t expected_frames)
+{
+	size_t frames = 0;
+	size_t syscalls = 0;
+	size_t total;
+	double start, elapsed;
+	int fd = -1;
+	pid_t pid;
+
+	pid = start_writer(stream, stream_len, &fd);
+
+	start = now_sec();
+	total = (*run)(fd, &frames, &syscalls);
+	elapsed = now_sec() - start;
+
+	close(fd);
+	waitpid(pid, NULL, 0);
+
+	printf("%-10s %10zu bytes %8zu frames %10zu reads %8.3f s %8.2f MB/s%s\n",
+	       name, total, frames, syscalls, elapsed,
+	       total / elapsed / (1024.0 * 1024.0),
+	       (frames == expected_frames) ? "" : "  (FRAME COUNT MISMATCH)");
+}
+
+int
+main(int argc, char* argv[])
+{
+	size_t frame_count = 20000;
+	size_t frame_size = 127;
+	size_t stream_len = 0;
+	uint8_t* stream;
+	uint8_t* raw = NULL;
+
+	if (argc > 1) {
+		frame_count = strtoul(argv[1], NULL, 0);
+	}
+
+	if (argc > 2) {
+		frame_size = strtoul(argv[2], NULL, 0);
+	}
+
+	if (frame_size < 1 || frame_size + HDLC_CRC_SIZE > BENCH_FRAME_BUFFER_SIZE) {
+		fprintf(stderr, "Frame size must be between 1 and %d\n", BENCH_FRAME_BUFFER_SIZE - HDLC_CRC_SIZE);
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	stream = build_stream(frame_count, frame_size, &stream_len, &raw);
+
+	printf("%zu frames of %zu bytes, %zu bytes encoded\n", frame_count, frame_size, stream_len);
+
+	bench("bytewise", &run_bytewise, stream, stream_len, frame_count);
+	bench("chunked", &run_chunked, stream, stream_len, frame_count);
+
+	microbench(raw, frame_count, frame_size, stream, stream_len);
+
+	free(stream);
+	free(raw);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,424 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Checks the HDLC codec byte for byte against the per-byte
+ *      implementations it replaced in the NCP data pump and in
+ *      spi-hdlc-adapter.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdlc.h"
+#include "test-utils.h"
+
+#define TEST_FRAME_SIZE_MAX        1300
+#define TEST_ITERATIONS            2000
+
+static uint32_t sSeed = 1;
+
+static uint32_t
+test_random(void)
+{
+	sSeed = sSeed * 1103515245 + 12345;
+	return (sSeed >> 8) & 0xFFFFFF;
+}
+
+// Fills `data` with bytes that are special about a quarter of the time,
+// so that the escaping paths get a real workout.
+static void
+test_fill(uint8_t* data, size_t len)
+{
+	static const uint8_t specials[] = {
+		HDLC_BYTE_FLAG, HDLC_BYTE_ESC, HDLC_BYTE_XON, HDLC_BYTE_XOFF, HDLC_BYTE_SPECIAL
+	};
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (test_random() % 4 == 0) {
+			data[i] = specials[test_random() % sizeof(specials)];
+		} else {
+			data[i] = (uint8_t)test_random();
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// MARK: Reference implementations
+
+static uint16_t
+ref_crc16(uint16_t aFcs, uint8_t aByte)
+{
+	// Bit-at-a-time CRC-16/KERMIT, independent of any lookup table.
+	int i;
+
+	aFcs ^= aByte;
+	for (i = 0; i < 8; i++) {
+		aFcs = (aFcs & 1) ? ((aFcs >> 1) ^ 0x8408) : (aFcs >> 1);
+	}
+	return aFcs;
+}
+
+static bool
+ref_needs_escape(uint8_t byte)
+{
+	switch(byte) {
+	case HDLC_BYTE_SPECIAL:
+	case HDLC_BYTE_ESC:
+	case HDLC_BYTE_FLAG:
+	case HDLC_BYTE_XOFF:
+	case HDLC_BYTE_XON:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Encoder from `SpinelNCPInstance::driver_to_ncp_pump()`.
+static size_t
+ref_encode(uint8_t* out, const uint8_t* data, size_t len)
+{
+	size_t out_len = 0;
+	size_t i;
+	uint8_t byte;
+	uint16_t crc = 0xFFFF;
+
+	out[out_len++] = HDLC_BYTE_FLAG;
+
+	for (i = 0; i < len; i++) {
+		byte = data[i];
+		crc = ref_crc16(crc, byte);
+		if (ref_needs_escape(byte)) {
+			out[out_len++] = HDLC_BYTE_ESC;
+			out[out_len++] = byte ^ HDLC_ESCAPE_XFORM;
+		} else {
+			out[out_len++] = byte;
+		}
+	}
+	crc ^= 0xFFFF;
+	byte = (crc & 0xFF);
+	if (ref_needs_escape(byte)) {
+		out[out_len++] = HDLC_BYTE_ESC;
+		out[out_len++] = byte ^ HDLC_ESCAPE_XFORM;
+	} else {
+		out[out_len++] = byte;
+	}
+	byte = ((crc >> 8) & 0xFF);
+	if (ref_needs_escape(byte)) {
+		out[out_len++] = HDLC_BYTE_ESC;
+		out[out_len++] = byte ^ HDLC_ESCAPE_XFORM;
+	} else {
+		out[out_len++] = byte;
+	}
+	out[out_len++] = HDLC_BYTE_FLAG;
+
+	return out_len;
+}
+
+struct ref_frame {
+	hdlc_decode_status_t status;
+	size_t len;
+	uint8_t data[TEST_FRAME_SIZE_MAX + HDLC_CRC_SIZE];
+};
+
+// Decoder from `SpinelNCPInstance::ncp_to_driver_pump()`. Returns the
+// first frame found in `stream`, and how many bytes it took.
+static size_t
+ref_decode_ncp(const uint8_t* stream, size_t stream_len, struct ref_frame* frame)
+{
+	size_t i = 0;
+	size_t size = 0;
+	uint16_t crc = 0xffff;
+
+	frame->status = HDLC_DECODE_NEED_MORE;
+
+	while (i < stream_len) {
+		uint8_t byte = stream[i++];
+		bool end_of_frame = (byte == HDLC_BYTE_FLAG);
+
+		if (byte == HDLC_BYTE_ESC) {
+			if (i >= stream_len) {
+				break;
+			}
+			byte = stream[i++];
+			if (byte == HDLC_BYTE_FLAG) {
+				end_of_frame = true;
+			} else {
+				byte ^= HDLC_ESCAPE_XFORM;
+			}
+		}
+
+		if (end_of_frame) {
+			if (size <= 2) {
+				size = 0;
+				crc = 0xffff;
+				continue;
+			}
+			size -= 2;
+			crc ^= 0xFFFF;
+			if (crc == (frame->data[size] | (frame->data[size + 1] << 8))) {
+				frame->status = HDLC_DECODE_FRAME;
+				frame->len = size;
+			} else {
+				frame->status = HDLC_DECODE_BAD_CRC;
+				frame->len = size + 2;
+			}
+			break;
+		}
+
+		if (size >= 2) {
+			crc = ref_crc16(crc, frame->data[size - 2]);
+		}
+
+		frame->data[size++] = byte;
+	}
+
+	return i;
+}
+
+// Decoder from `pull_hdlc()` in spi-hdlc-adapter. Frames with a bad
+// CRC are dropped there, so they aren't reported here either.
+static size_t
+ref_decode_adapter(const uint8_t* stream, size_t stream_len, struct ref_frame* frame)
+{
+	static const uint16_t kHdlcCrcCheckValue = 0xf0b8;
+	size_t i = 0;
+	size_t size = 0;
+	uint16_t fcs = 0xffff;
+	bool unescape_next_byte = false;
+
+	frame->status = HDLC_DECODE_NEED_MORE;
+
+	while (i < stream_len) {
+		uint8_t byte = stream[i++];
+
+		if (byte == HDLC_BYTE_FLAG) {
+			if (size <= 2 || fcs != kHdlcCrcCheckValue) {
+				unescape_next_byte = false;
+				size = 0;
+				fcs = 0xffff;
+				continue;
+			}
+			frame->status = HDLC_DECODE_FRAME;
+			frame->len = size - 2;
+			break;
+
+		} else if (byte == HDLC_BYTE_ESC) {
+			unescape_next_byte = true;
+			continue;
+
+		} else if (ref_needs_escape(byte)) {
+			continue;
+
+		} else if (unescape_next_byte) {
+			byte = byte ^ HDLC_ESCAPE_XFORM;
+			unescape_next_byte = false;
+		}
+
+		fcs = ref_crc16(fcs, byte);
+		frame->data[size++] = byte;
+	}
+
+	return i;
+}
+
+// ----------------------------------------------------------------------------
+// MARK: Tests
+
+static void
+test_crc(void)
+{
+	static const uint8_t check[] = "123456789";
+	static uint8_t data[TEST_FRAME_SIZE_MAX];
+	int iteration;
+
+	// Catalogue check value for CRC-16/KERMIT.
+	test_checkf(hdlc_crc16_update(0, check, 9) == 0x2189, "CRC check value failed (iteration %d)", 0);
+
+	for (iteration = 0; iteration < TEST_ITERATIONS; iteration++) {
+		size_t offset = test_random() % 8;
+		size_t len = test_random() % (sizeof(data) - offset);
+		uint16_t expected = 0xFFFF;
+		uint16_t byte_by_byte = 0xFFFF;
+		size_t i;
+
+		test_fill(data, sizeof(data));
+
+		for (i = 0; i < len; i++) {
+			expected = ref_crc16(expected, data[offset + i]);
+			byte_by_byte = hdlc_crc16(byte_by_byte, data[offset + i]);
+		}
+
+		test_checkf(hdlc_crc16_update(0xFFFF, data + offset, len) == expected, "CRC failed (iteration %d)", iteration);
+		test_checkf(byte_by_byte == expected, "Single byte CRC failed (iteration %d)", iteration);
+	}
+}
+
+static void
+test_encode(void)
+{
+	static uint8_t data[TEST_FRAME_SIZE_MAX];
+	static uint8_t expected[HDLC_ENCODED_FRAME_SIZE_MAX(TEST_FRAME_SIZE_MAX)];
+	static uint8_t actual[HDLC_ENCODED_FRAME_SIZE_MAX(TEST_FRAME_SIZE_MAX)];
+	int iteration;
+
+	for (iteration = 0; iteration < TEST_ITERATIONS; iteration++) {
+		size_t len = test_random() % sizeof(data);
+		size_t expected_len;
+		size_t actual_len;
+
+		test_fill(data, len);
+
+		expected_len = ref_encode(expected, data, len);
+
+		actual_len = hdlc_encode_frame(actual, data, len, true);
+		test_checkf(actual_len == expected_len && memcmp(actual, expected, expected_len) == 0, "%s failed (iteration %d)",
+		            "Encode with leading flag", iteration);
+
+		actual_len = hdlc_encode_frame(actual, data, len, false);
+		test_checkf(actual_len == expected_len - 1 && memcmp(actual, expected + 1, expected_len - 1) == 0, "%s failed (iteration %d)",
+		            "Encode without leading flag", iteration);
+	}
+}
+
+// Builds a stream of good frames mixed with corrupted ones, runt frames,
+// stray control bytes and aborted frames.
+static size_t
+test_build_stream(uint8_t* stream, size_t frame_count)
+{
+	static uint8_t data[TEST_FRAME_SIZE_MAX];
+	size_t len = 0;
+	size_t i;
+
+	for (i = 0; i < frame_count; i++) {
+		size_t frame_len = test_random() % 300;
+		size_t start = len;
+
+		test_fill(data, frame_len);
+		len += hdlc_encode_frame(stream + len, data, frame_len, (test_random() % 2) == 0);
+
+		switch (test_random() % 8) {
+		case 0:
+			// Corrupt a byte in the middle of the frame.
+			if (len - start > 4) {
+				stream[start + 1 + test_random() % (len - start - 3)] ^= 0x01;
+			}
+			break;
+		case 1:
+			// Stray flow control byte.
+			stream[len++] = HDLC_BYTE_XON;
+			break;
+		case 2:
+			// Abort sequence.
+			stream[len++] = HDLC_BYTE_ESC;
+			stream[len++] = HDLC_BYTE_FLAG;
+			break;
+		case 3:
+			// Runt frame.
+			stream[len++] = 0x42;
+			stream[len++] = HDLC_BYTE_FLAG;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return len;
+}
+
+static void
+test_decode(bool adapter_mode)
+{
+	static uint8_t stream[64 * HDLC_ENCODED_FRAME_SIZE_MAX(300)];
+	static uint8_t buffer[TEST_FRAME_SIZE_MAX + HDLC_CRC_SIZE];
+	static struct ref_frame expected;
+	struct hdlc_decoder decoder;
+	int iteration;
+
+	for (iteration = 0; iteration < TEST_ITERATIONS / 20; iteration++) {
+		size_t stream_len = test_build_stream(stream, 64);
+		size_t ref_offset = 0;
+		size_t offset = 0;
+		int frames = 0;
+
+		hdlc_decoder_init(&decoder, buffer, sizeof(buffer));
+		decoder.drop_control_bytes = adapter_mode;
+
+		while (ref_offset < stream_len) {
+			hdlc_decode_status_t status = HDLC_DECODE_NEED_MORE;
+
+			if (adapter_mode) {
+				ref_offset += ref_decode_adapter(stream + ref_offset, stream_len - ref_offset, &expected);
+			} else {
+				ref_offset += ref_decode_ncp(stream + ref_offset, stream_len - ref_offset, &expected);
+			}
+
+			if (expected.status == HDLC_DECODE_NEED_MORE) {
+				break;
+			}
+
+			// Feed the decoder in randomly sized pieces until it
+			// reports something worth comparing.
+			while (offset < stream_len) {
+				size_t consumed = 0;
+				size_t chunk = 1 + test_random() % 64;
+
+				if (chunk > stream_len - offset) {
+					chunk = stream_len - offset;
+				}
+
+				status = hdlc_decoder_feed(&decoder, stream + offset, chunk, &consumed);
+				offset += consumed;
+
+				if (adapter_mode && status == HDLC_DECODE_BAD_CRC) {
+					continue;
+				}
+
+				if (status != HDLC_DECODE_NEED_MORE) {
+					break;
+				}
+			}
+
+			test_checkf(status == expected.status, "%s failed (iteration %d)", adapter_mode ? "Adapter decode status" : "Decode status", iteration);
+			test_checkf(decoder.frame_len == expected.len
+			            && memcmp(decoder.buffer, expected.data, expected.len) == 0, "%s failed (iteration %d)",
+			            adapter_mode ? "Adapter decode contents" : "Decode contents", iteration);
+			frames++;
+		}
+
+		test_checkf(frames > 0, "Decoded any frames failed (iteration %d)", iteration);
+	}
+}
+
+int
+main(void)
+{
+	test_crc();
+	test_encode();
+	test_decode(false);
+	test_decode(true);
+
+	return test_exit_status();
+}
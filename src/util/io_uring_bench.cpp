@@ -0,0 +1,321 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Cost of receiving from the NCP and the TUN interface with reads
+ *      posted to io_uring, compared to waiting with select() and then
+ *      calling read() on each descriptor.
+ *
+ *      The NCP is a pty loopback: each iteration writes a frame to the
+ *      master side and a packet to a pipe standing in for the TUN
+ *      interface, and the loop runs until both have been read back in
+ *      full, the way `UnixSocket` would read them.
+ *
+ *      Usage: io_uring_bench [iterations] [frame-size]
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+
+#include "EventBackend.h"
+#include "IOUring.h"
+
+using namespace nl;
+
+#define BENCH_TUN_PACKET_SIZE      80
+
+struct BenchStats {
+	size_t mWakeups;
+	size_t mSyscalls;
+	double mElapsed;
+};
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static void
+set_nonblocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Opens a pty pair in raw mode, so bytes pass through unchanged.
+static bool
+open_pty_loopback(int* master_fd, int* slave_fd)
+{
+	struct termios tios;
+
+	*master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if ( (*master_fd < 0)
+	  || (grantpt(*master_fd) < 0)
+	  || (unlockpt(*master_fd) < 0)
+	) {
+		return false;
+	}
+
+	*slave_fd = open(ptsname(*master_fd), O_RDWR | O_NOCTTY);
+
+	if (*slave_fd < 0) {
+		return false;
+	}
+
+	tcgetattr(*slave_fd, &tios);
+	cfmakeraw(&tios);
+	tcsetattr(*slave_fd, TCSANOW, &tios);
+
+	set_nonblocking(*slave_fd);
+
+	return true;
+}
+
+static bool
+send_iteration(int ncp_fd, int tun_fd, size_t frame_size)
+{
+	static const uint8_t frame[2048] = { 0x7E };
+	static const uint8_t packet[BENCH_TUN_PACKET_SIZE] = { 0x60 };
+
+	return (write(ncp_fd, frame, frame_size) == (ssize_t)frame_size)
+		&& (write(tun_fd, packet, sizeof(packet)) == (ssize_t)sizeof(packet));
+}
+
+static size_t
+run_select(EventBackend* backend, const int fds[2], int ncp_master_fd, int tun_write_fd,
+           size_t frame_size, size_t iterations, BenchStats* stats)
+{
+	const size_t expected[2] = { frame_size, BENCH_TUN_PACKET_SIZE };
+	uint8_t buffer[2048];
+	size_t i;
+
+	for (i = 0; i < iterations; i++) {
+		size_t received[2] = { 0, 0 };
+
+		if (!send_iteration(ncp_master_fd, tun_write_fd, frame_size)) {
+			break;
+		}
+
+		while ((received[0] < expected[0]) || (received[1] < expected[1])) {
+			int j;
+
+			backend->begin_update();
+			backend->watch(fds[0], EventBackend::kEventRead | EventBackend::kEventError);
+			backend->watch(fds[1], EventBackend::kEventRead | EventBackend::kEventError);
+
+			stats->mWakeups++;
+			stats->mSyscalls++;
+
+			if (backend->wait(1000) <= 0) {
+				return i;
+			}
+
+			for (j = 0; j < 2; j++) {
+				if (backend->take_ready(fds[j], EventBackend::kEventRead) != 0) {
+					ssize_t len = read(fds[j], buffer, sizeof(buffer));
+
+					stats->mSyscalls++;
+
+					if (len > 0) {
+						received[j] += (size_t)len;
+					}
+				}
+			}
+		}
+	}
+
+	return i;
+}
+
+static size_t
+run_io_uring(EventBackend* backend, IOUring* ring, const int fds[2], int ncp_master_fd, int tun_write_fd,
+             size_t frame_size, size_t iterations, BenchStats* stats)
+{
+	const size_t expected[2] = { frame_size, BENCH_TUN_PACKET_SIZE };
+	IOUringReader reader_ncp(ring, 2048);
+	IOUringReader reader_tun(ring, 2048);
+	IOUringReader* readers[2] = { &reader_ncp, &reader_tun };
+	const unsigned int enter_count = ring->get_enter_count();
+	uint8_t buffer[2048];
+	size_t i;
+
+	for (i = 0; i < iterations; i++) {
+		size_t received[2] = { 0, 0 };
+
+		if (!send_iteration(ncp_master_fd, tun_write_fd, frame_size)) {
+			break;
+		}
+
+		while ((received[0] < expected[0]) || (received[1] < expected[1])) {
+			bool ready = false;
+			int j;
+
+			for (j = 0; j < 2; j++) {
+				ready |= readers[j]->poll(fds[j]);
+			}
+
+			if (!ready) {
+				backend->begin_update();
+				backend->watch(ring->get_fd(), EventBackend::kEventRead | EventBackend::kEventError);
+
+				stats->mWakeups++;
+				stats->mSyscalls++;
+
+				if (backend->wait(1000) <= 0) {
+					return i;
+				}
+
+				backend->take_ready(ring->get_fd(), EventBackend::kEventRead);
+				continue;
+			}
+
+			for (j = 0; j < 2; j++) {
+				ssize_t len;
+
+				while ((len = readers[j]->read(fds[j], buffer, sizeof(buffer))) > 0) {
+					received[j] += (size_t)len;
+				}
+			}
+		}
+	}
+
+	reader_ncp.cancel();
+	reader_tun.cancel();
+
+	stats->mSyscalls += ring->get_enter_count() - enter_count;
+
+	return i;
+}
+
+static void
+bench(const char* name, size_t frame_size, size_t iterations)
+{
+	EventBackend* backend = EventBackend::create("select");
+	IOUring* ring = NULL;
+	int ncp_master_fd = -1;
+	int fds[2] = { -1, -1 };
+	int tun_fds[2] = { -1, -1 };
+	BenchStats stats;
+	BenchStats warmup;
+	size_t completed;
+	double start;
+
+	memset(&stats, 0, sizeof(stats));
+	memset(&warmup, 0, sizeof(warmup));
+
+	if (strcmp(name, "io_uring") == 0) {
+		ring = IOUring::create(16);
+
+		if (ring == NULL) {
+			printf("%-8s %5zu bytes  unavailable (%s)\n", name, frame_size, strerror(errno));
+			delete backend;
+			return;
+		}
+	}
+
+	if (!open_pty_loopback(&ncp_master_fd, &fds[0]) || (pipe(tun_fds) < 0)) {
+		perror("pty");
+		exit(EXIT_FAILURE);
+	}
+
+	set_nonblocking(tun_fds[0]);
+	fds[1] = tun_fds[0];
+
+	// Warm up, so one-time setup costs are not counted.
+	if (ring != NULL) {
+		run_io_uring(backend, ring, fds, ncp_master_fd, tun_fds[1], frame_size, 10, &warmup);
+	} else {
+		run_select(backend, fds, ncp_master_fd, tun_fds[1], frame_size, 10, &warmup);
+	}
+
+	start = now_sec();
+
+	if (ring != NULL) {
+		completed = run_io_uring(backend, ring, fds, ncp_master_fd, tun_fds[1], frame_size, iterations, &stats);
+	} else {
+		completed = run_select(backend, fds, ncp_master_fd, tun_fds[1], frame_size, iterations, &stats);
+	}
+
+	stats.mElapsed = now_sec() - start;
+
+	if (completed != iterations) {
+		printf("%-8s %5zu bytes  failed after %zu iterations\n", name, frame_size, completed);
+	} else {
+		printf("%-8s %5zu bytes  %8.2f us/iteration  %5.2f wakeups/iteration  %5.2f syscalls/iteration\n",
+		       name, frame_size,
+		       stats.mElapsed * 1.0e6 / iterations,
+		       (double)stats.mWakeups / iterations,
+		       (double)stats.mSyscalls / iterations);
+	}
+
+	close(fds[0]);
+	close(ncp_master_fd);
+	close(tun_fds[0]);
+	close(tun_fds[1]);
+
+	delete ring;
+	delete backend;
+}
+
+int
+main(int argc, char* argv[])
+{
+	static const size_t frame_sizes[] = { 16, 127, 1280 };
+	size_t iterations = 20000;
+	size_t i;
+
+	if (argc > 1) {
+		iterations = strtoul(argv[1], NULL, 0);
+	}
+
+	printf("%zu iterations, one NCP frame (pty) and one TUN packet (pipe) each\n", iterations);
+	printf("(syscalls counts only the waits, reads and io_uring_enter calls, not the writes)\n");
+
+	if (argc > 2) {
+		const size_t frame_size = strtoul(argv[2], NULL, 0);
+
+		if ((frame_size == 0) || (frame_size > 2048)) {
+			fprintf(stderr, "frame-size must be between 1 and 2048\n");
+			return EXIT_FAILURE;
+		}
+
+		bench("select", frame_size, iterations);
+		bench("io_uring", frame_size, iterations);
+
+	} else {
+		for (i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+			bench("select", frame_sizes[i], iterations);
+			bench("io_uring", frame_sizes[i], iterations);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Checks that `nl::IOUringReader` hands back what was written to
+ *      a pipe in order, that completions for several descriptors are
+ *      collected together, and that canceled reads don't eat data.
+ *      Skipped when the kernel has no io_uring.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "IOUring.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+// Tells automake that the test was skipped.
+#define TEST_SKIP_EXIT_CODE        77
+
+static void
+open_pipe(int fds[2])
+{
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	// Like the NCP socket and the TUN interface.
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+}
+
+static bool
+wait_for_ring(IOUring* ring)
+{
+	struct pollfd pollfd = { ring->get_fd(), POLLIN, 0 };
+
+	return poll(&pollfd, 1, 1000) == 1;
+}
+
+// The kernel may complete a read as soon as it is submitted, in which
+// case it is reaped by `poll()` itself and the ring never looks readable.
+static bool
+wait_for_reader(IOUring* ring, IOUringReader& reader, int fd)
+{
+	if (reader.poll(fd)) {
+		return true;
+	}
+
+	return wait_for_ring(ring) && reader.poll(fd);
+}
+
+static void
+test_in_order(IOUring* ring)
+{
+	IOUringReader reader(ring, 8);
+	int fds[2];
+	char buffer[16];
+	ssize_t len;
+
+	open_pipe(fds);
+
+	test_check(!reader.poll(fds[0]), "Idle reader has nothing");
+	test_check(reader.read(fds[0], buffer, sizeof(buffer)) == 0, "Idle read returns zero");
+	test_check(!reader.read_hit_eof(), "Idle read isn't end-of-file");
+
+	// More than fits in the reader's buffer, so it takes two reads.
+	test_check(write(fds[1], "0123456789", 10) == 10, "Write");
+
+	test_check(wait_for_ring(ring), "Ring readable after write");
+	test_check(reader.poll(fds[0]), "Reader has data");
+
+	len = reader.read(fds[0], buffer, 3);
+	test_check((len == 3) && (memcmp(buffer, "012", 3) == 0), "Partial read");
+
+	len = reader.read(fds[0], buffer, sizeof(buffer));
+	test_check((len == 5) && (memcmp(buffer, "34567", 5) == 0), "Rest of first completion");
+
+	test_check(wait_for_reader(ring, reader, fds[0]), "Reader has remainder");
+
+	len = reader.read(fds[0], buffer, sizeof(buffer));
+	test_check((len == 2) && (memcmp(buffer, "89", 2) == 0), "Remainder");
+
+	// The writer going away reads as end-of-file.
+	close(fds[1]);
+
+	test_check(wait_for_reader(ring, reader, fds[0]), "Reader reports end-of-file");
+
+	len = reader.read(fds[0], buffer, sizeof(buffer));
+	test_check((len == 0) && reader.read_hit_eof(), "End-of-file");
+
+	reader.cancel();
+	close(fds[0]);
+}
+
+static void
+test_message_mode(IOUring* ring)
+{
+	IOUringReader reader(ring, 64);
+	int fds[2];
+	char buffer[16];
+
+	open_pipe(fds);
+	reader.set_message_mode(true);
+
+	reader.poll(fds[0]);
+	test_check(write(fds[1], "packet", 6) == 6, "Write");
+	test_check(wait_for_reader(ring, reader, fds[0]), "Reader has packet");
+
+	// Too short a buffer truncates the packet instead of splitting it.
+	test_check(reader.read(fds[0], buffer, 4) == 4, "Truncated read");
+	test_check(!reader.has_data(), "Rest of packet dropped");
+
+	reader.cancel();
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void
+test_batching(IOUring* ring)
+{
+	IOUringReader reader_a(ring, 64);
+	IOUringReader reader_b(ring, 64);
+	int fds_a[2];
+	int fds_b[2];
+	char buffer[16];
+	unsigned int enter_count;
+
+	open_pipe(fds_a);
+	open_pipe(fds_b);
+
+	reader_a.poll(fds_a[0]);
+	reader_b.poll(fds_b[0]);
+
+	test_check(write(fds_a[1], "a", 1) == 1, "Write");
+	test_check(write(fds_b[1], "b", 1) == 1, "Write");
+
+	test_check(wait_for_ring(ring), "Ring readable");
+
+	enter_count = ring->get_enter_count();
+	test_check(ring->process() == 2, "Both completions in one pass");
+	test_check(ring->get_enter_count() == enter_count, "No system call to collect completions");
+	test_check(reader_a.has_data() && reader_b.has_data(), "Both readers have data");
+
+	// Draining the readers queues their next reads, which then go to
+	// the kernel together.
+	test_check(reader_a.read(fds_a[0], buffer, sizeof(buffer)) == 1, "Read a");
+	test_check(reader_b.read(fds_b[0], buffer, sizeof(buffer)) == 1, "Read b");
+	test_check(ring->get_enter_count() == enter_count, "Reads are queued, not submitted");
+
+	ring->process();
+	test_check(ring->get_enter_count() == enter_count + 1, "Both reads submitted with one call");
+
+	test_check(write(fds_b[1], "b", 1) == 1, "Write");
+	test_check(wait_for_reader(ring, reader_b, fds_b[0]), "Resubmitted read completes");
+
+	reader_a.cancel();
+	reader_b.cancel();
+
+	close(fds_a[0]);
+	close(fds_a[1]);
+	close(fds_b[0]);
+	close(fds_b[1]);
+}
+
+static void
+test_cancel(IOUring* ring)
+{
+	IOUringReader* reader = new IOUringReader(ring, 64);
+	int fds[2];
+	char buffer[16];
+
+	open_pipe(fds);
+
+	reader->poll(fds[0]);
+	reader->cancel();
+	delete reader;
+
+	// Nothing may be left to call back the reader we just deleted.
+	test_check(ring->process() == 0, "Canceled read is not dispatched");
+
+	test_check(write(fds[1], "x", 1) == 1, "Write");
+
+	test_check(read(fds[0], buffer, sizeof(buffer)) == 1, "Data written after cancel is still there");
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main(void)
+{
+	IOUring* ring = IOUring::create(8);
+
+	if (ring == NULL) {
+		printf("SKIP: io_uring unavailable (%s)\n", strerror(errno));
+		return TEST_SKIP_EXIT_CODE;
+	}
+
+	test_in_order(ring);
+	test_message_mode(ring);
+	test_batching(ring);
+	test_cancel(ring);
+
+	delete ring;
+
+	return test_exit_status();
+}
@@ -0,0 +1,184 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Unit tests for `nl::IPv6FlowTable`.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "IPv6FlowTable.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+static IPv6PacketMatcherRule
+make_rule(int joiner, in_port_t port)
+{
+	IPv6PacketMatcherRule rule;
+
+	memset(&rule, 0, sizeof(rule));
+
+	rule.type = IPPROTO_UDP;
+	rule.local_port = htons(port);
+	rule.local_port_match = true;
+	rule.remote_port = htons(49152 + joiner);
+	rule.remote_port_match = true;
+	rule.remote_address.s6_addr[0] = 0xfe;
+	rule.remote_address.s6_addr[1] = 0x80;
+	rule.remote_address.s6_addr[14] = static_cast<uint8_t>(joiner >> 8);
+	rule.remote_address.s6_addr[15] = static_cast<uint8_t>(joiner);
+	rule.remote_match_mask = 128;
+
+	return rule;
+}
+
+static void
+test_basic(void)
+{
+	IPv6FlowTable table(8, 1000);
+	IPv6PacketMatcherRule rule = make_rule(1, 1000);
+	IPv6PacketMatcherRule other = rule;
+
+	test_check(table.empty() && table.get_capacity() == 8, "Starts empty");
+	test_check(!table.lookup(rule, 0), "Miss on empty table");
+
+	table.insert(rule, 0);
+	table.insert(rule, 0);
+	test_check(table.size() == 1, "Inserting twice keeps one flow");
+	test_check(table.lookup(rule, 10), "Hit after insert");
+
+	other.remote_port_match = false;
+	test_check(!table.lookup(other, 10), "Port matching is part of the key");
+
+	other = rule;
+	other.subtype = 0xff;
+	test_check(!table.lookup(other, 10), "Subtype is part of the key");
+
+	test_check(table.erase(rule), "Erase finds the flow");
+	test_check(!table.erase(rule), "Erase only once");
+	test_check(table.empty() && !table.lookup(rule, 10), "Gone after erase");
+
+	test_check(table.get_stats().mLookups == 5, "Lookups counted");
+	test_check(table.get_stats().mHits == 1, "Hits counted");
+	test_check(table.get_stats().mInserts == 1, "Inserts counted");
+}
+
+static void
+test_idle_expiry(void)
+{
+	IPv6FlowTable table(8, 1000);
+	IPv6PacketMatcherRule a = make_rule(1, 1000);
+	IPv6PacketMatcherRule b = make_rule(2, 1000);
+
+	table.insert(a, 0);
+	table.insert(b, 500);
+
+	test_check(table.lookup(a, 900), "Not idle yet");
+	test_check(table.lookup(a, 1800), "Lookups keep a flow alive");
+	test_check(!table.lookup(b, 1800), "Idle flow expired");
+	test_check(table.size() == 1, "Only the idle flow expired");
+
+	table.expire(2800);
+	test_check(table.empty(), "Explicit expiry");
+	test_check(table.get_stats().mExpirations == 2, "Expirations counted");
+
+	// Times wrap around along with `time_ms()`.
+	table.insert(a, 0x7FFFFF00);
+	test_check(table.lookup(a, static_cast<cms_t>(0x7FFFFF00 + 500u)), "Survives the clock wrapping");
+}
+
+static void
+test_lru_eviction(void)
+{
+	IPv6FlowTable table(4, 1000);
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		table.insert(make_rule(i, 1000), i);
+	}
+
+	// Touch the oldest flow, so that the second one is evicted.
+	test_check(table.lookup(make_rule(0, 1000), 10), "Oldest flow present");
+
+	table.insert(make_rule(4, 1000), 11);
+	test_check(table.size() == 4, "Never holds more than capacity");
+	test_check(table.get_stats().mEvictions == 1, "Eviction counted");
+	test_check(!table.lookup(make_rule(1, 1000), 12), "Least recently seen flow evicted");
+	test_check(table.lookup(make_rule(0, 1000), 12), "Recently seen flow kept");
+	test_check(table.lookup(make_rule(4, 1000), 12), "New flow present");
+
+	for (i = 100; i < 200; i++) {
+		table.insert(make_rule(i, 1000), 20);
+	}
+
+	test_check(table.size() == 4 && table.get_stats().mHighWater == 4, "Bounded under churn");
+
+	for (i = 196; i < 200; i++) {
+		test_check(table.lookup(make_rule(i, 1000), 21), "Newest flows survive churn");
+	}
+
+	table.set_capacity(0);
+	table.insert(make_rule(0, 1000), 30);
+	test_check(table.empty() && !table.lookup(make_rule(0, 1000), 30), "Zero capacity holds nothing");
+}
+
+static void
+test_many_flows(void)
+{
+	IPv6FlowTable table;
+	const int count = IPv6FlowTable::kDefaultCapacity;
+	bool all_found = true;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		table.insert(make_rule(i, 5684), 0);
+	}
+
+	table.reset_stats();
+
+	for (i = 0; i < count; i++) {
+		all_found &= table.lookup(make_rule(i, 5684), 1);
+	}
+
+	test_check(all_found && table.size() == static_cast<size_t>(count), "A full table finds every flow");
+	test_check(table.get_stats().mProbes < 2u * count, "Short chains");
+
+	table.clear();
+	test_check(table.empty() && !table.lookup(make_rule(0, 5684), 2), "Clear");
+	table.insert(make_rule(0, 5684), 2);
+	test_check(table.size() == 1, "Usable after clear");
+}
+
+int
+main(void)
+{
+	test_basic();
+	test_idle_expiry();
+	test_lru_eviction();
+	test_many_flows();
+
+	return test_exit_status();
+}
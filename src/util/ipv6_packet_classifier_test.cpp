@@ -0,0 +1,244 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Unit tests for `nl::IPv6PacketClassifier`, checked against the
+ *      rule-at-a-time matching of `nl::IPv6PacketMatcher`.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "IPv6PacketClassifier.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+// Small pools, so that random rules and packets often line up.
+static const uint8_t kTypes[] = { 0, 6, 17, 58 };
+static const uint8_t kSubtypes[] = { 128, 133, 134, 135, 136 };
+static const uint16_t kPorts[] = { 1000, 5684, 49152, 49153 };
+static const uint8_t kMasks[] = { 0, 8, 10, 64, 127, 128, 200 };
+
+static struct in6_addr
+random_address(void)
+{
+	static const uint8_t prefixes[][2] = { { 0xfe, 0x80 }, { 0xfd, 0x00 }, { 0xff, 0x02 } };
+	struct in6_addr address;
+	int prefix = rand() % 3;
+
+	memset(&address, 0, sizeof(address));
+	address.s6_addr[0] = prefixes[prefix][0];
+	address.s6_addr[1] = prefixes[prefix][1];
+	address.s6_addr[8] = static_cast<uint8_t>(rand() % 2);
+	address.s6_addr[15] = static_cast<uint8_t>(1 + rand() % 3);
+
+	return address;
+}
+
+static IPv6PacketMatcherRule
+random_rule(void)
+{
+	IPv6PacketMatcherRule rule;
+
+	rule.clear();
+
+	switch (rand() % 8) {
+	case 0:
+		break;
+	case 1:
+		rule.type = IPv6PacketMatcherRule::TYPE_NONE;
+		break;
+	default:
+		rule.type = kTypes[rand() % sizeof(kTypes)];
+		break;
+	}
+
+	if (rand() % 2) {
+		rule.subtype = kSubtypes[rand() % sizeof(kSubtypes)];
+	}
+
+	if ((rule.local_port_match = (rand() % 2))) {
+		rule.local_port = htons(kPorts[rand() % (sizeof(kPorts) / sizeof(kPorts[0]))]);
+	}
+
+	if ((rule.remote_port_match = (rand() % 2))) {
+		rule.remote_port = htons(kPorts[rand() % (sizeof(kPorts) / sizeof(kPorts[0]))]);
+	}
+
+	rule.local_match_mask = kMasks[rand() % sizeof(kMasks)];
+	rule.local_address = random_address();
+
+	// Usually keep the address within the mask, sometimes not.
+	if (rand() % 4) {
+		in6_addr_apply_mask(rule.local_address, rule.local_match_mask);
+	}
+
+	rule.remote_match_mask = kMasks[rand() % sizeof(kMasks)];
+	rule.remote_address = random_address();
+
+	if (rand() % 4) {
+		in6_addr_apply_mask(rule.remote_address, rule.remote_match_mask);
+	}
+
+	return rule;
+}
+
+static void
+random_packet(uint8_t packet[48])
+{
+	struct in6_addr address;
+	uint16_t port;
+
+	memset(packet, 0, 48);
+	packet[0] = 0x60;
+	packet[6] = kTypes[rand() % sizeof(kTypes)];
+
+	address = random_address();
+	memcpy(packet + 8, &address, 16);
+	address = random_address();
+	memcpy(packet + 24, &address, 16);
+
+	if (packet[6] == IPv6PacketMatcherRule::TYPE_ICMP) {
+		packet[40] = kSubtypes[rand() % sizeof(kSubtypes)];
+	} else {
+		port = htons(kPorts[rand() % (sizeof(kPorts) / sizeof(kPorts[0]))]);
+		memcpy(packet + 40, &port, 2);
+	}
+
+	port = htons(kPorts[rand() % (sizeof(kPorts) / sizeof(kPorts[0]))]);
+	memcpy(packet + 42, &port, 2);
+}
+
+static int
+compare_with_matcher(const IPv6PacketMatcher& matcher, const IPv6PacketClassifier& classifier, int packet_count)
+{
+	uint8_t packet[48];
+	int matches = 0;
+	int i;
+
+	for (i = 0; i < packet_count; i++) {
+		IPv6PacketFields fields;
+		const IPv6PacketMatcherRule* rule;
+		bool expected;
+
+		random_packet(packet);
+		fields.update_from_packet(packet, sizeof(packet));
+
+		expected = (matcher.match_inbound(packet) != matcher.end());
+		rule = classifier.match_inbound(fields);
+		test_check(expected == (rule != NULL), "Inbound result agrees with IPv6PacketMatcher");
+		test_check((rule == NULL) || rule->match_inbound(packet), "Inbound match is a real match");
+		matches += expected;
+
+		expected = (matcher.match_outbound(packet) != matcher.end());
+		rule = classifier.match_outbound(fields);
+		test_check(expected == (rule != NULL), "Outbound result agrees with IPv6PacketMatcher");
+		test_check((rule == NULL) || rule->match_outbound(packet), "Outbound match is a real match");
+		matches += expected;
+	}
+
+	return matches;
+}
+
+static void
+test_random_rules(void)
+{
+	IPv6PacketMatcher matcher;
+	IPv6PacketClassifier classifier;
+	int i;
+
+	for (i = 0; i < 300; i++) {
+		IPv6PacketMatcherRule rule(random_rule());
+
+		test_check(classifier.insert(rule) == matcher.insert(rule).second, "Insert agrees");
+	}
+
+	test_check(classifier.size() == matcher.size(), "Same size");
+	test_check(classifier.get_shape_count() < classifier.size(), "Rules share shapes");
+	test_check(compare_with_matcher(matcher, classifier, 20000) > 0, "Some packets match");
+
+	while (matcher.size() > 20) {
+		IPv6PacketMatcherRule rule(*matcher.begin());
+
+		matcher.erase(matcher.begin());
+		test_check(classifier.erase(rule), "Erase");
+		test_check(!classifier.erase(rule), "Erase only once");
+	}
+
+	compare_with_matcher(matcher, classifier, 20000);
+
+	classifier.clear();
+	matcher.clear();
+	test_check(classifier.empty() && compare_with_matcher(matcher, classifier, 100) == 0, "Clear");
+}
+
+static void
+test_fields(void)
+{
+	uint8_t packet[48];
+	IPv6PacketClassifier classifier;
+	IPv6PacketMatcherRule rule;
+	IPv6PacketFields fields;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		IPv6PacketMatcherRule from_packet;
+		IPv6PacketMatcherRule from_fields;
+
+		random_packet(packet);
+		fields.update_from_packet(packet, sizeof(packet));
+
+		from_packet.update_from_inbound_packet(packet);
+		from_fields.update_from_inbound_fields(fields);
+		test_check(from_packet == from_fields, "Inbound rule from fields");
+
+		from_packet.update_from_outbound_packet(packet);
+		from_fields.update_from_outbound_fields(fields);
+		test_check(from_packet == from_fields, "Outbound rule from fields");
+	}
+
+	rule.clear();
+	classifier.insert(rule);
+
+	test_check(classifier.match_inbound(fields) != NULL, "Empty rule matches everything");
+
+	packet[0] = 0x45;
+	fields.update_from_packet(packet, sizeof(packet));
+	test_check(classifier.match_inbound(fields) == NULL, "Non-IPv6 never matches");
+
+	packet[0] = 0x60;
+	fields.update_from_packet(packet, 1);
+	test_check(fields.is_ipv6 && fields.type == 0 && fields.source_port == 0, "Short packets read as zeros");
+}
+
+int
+main(void)
+{
+	srand(1);
+
+	test_fields();
+	test_random_rules();
+
+	return test_exit_status();
+}
@@ -0,0 +1,327 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Unit tests for `nl::IPv6PacketFilter`. The generated programs are
+ *      run by the kernel on a datagram socket pair and checked against
+ *      `nl::IPv6PacketClassifier`.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "IPv6PacketFilter.h"
+#include "test-utils.h"
+
+#ifndef SO_ATTACH_BPF
+#define SO_ATTACH_BPF 50
+#endif
+
+using namespace nl;
+
+static const uint8_t kTypes[] = { 0, 6, 17, 58 };
+static const uint8_t kSubtypes[] = { 128, 133, 134, 135, 136 };
+static const uint16_t kPorts[] = { 1000, 5684, 49152 };
+static const uint8_t kMasks[] = { 0, 10, 64, 100, 128 };
+static const size_t kLengths[] = { 20, 40, 41, 43, 44, 64 };
+
+#define COUNT_OF(x) (sizeof(x) / sizeof((x)[0]))
+
+static struct in6_addr
+random_address(void)
+{
+	static const uint8_t prefixes[][2] = { { 0xfe, 0x80 }, { 0xfd, 0x00 }, { 0xff, 0x02 } };
+	struct in6_addr address;
+	int prefix = rand() % 3;
+
+	memset(&address, 0, sizeof(address));
+	address.s6_addr[0] = prefixes[prefix][0];
+	address.s6_addr[1] = prefixes[prefix][1];
+	address.s6_addr[13] = static_cast<uint8_t>(rand() % 2);
+	address.s6_addr[15] = static_cast<uint8_t>(1 + rand() % 2);
+
+	return address;
+}
+
+static IPv6PacketMatcherRule
+random_rule(void)
+{
+	IPv6PacketMatcherRule rule;
+
+	rule.clear();
+
+	if (rand() % 4) {
+		rule.type = kTypes[rand() % COUNT_OF(kTypes)];
+	}
+
+	if (rand() % 2) {
+		rule.subtype = kSubtypes[rand() % COUNT_OF(kSubtypes)];
+	}
+
+	if ((rule.local_port_match = (rand() % 3 == 0))) {
+		rule.local_port = htons(kPorts[rand() % COUNT_OF(kPorts)]);
+	}
+
+	if ((rule.remote_port_match = (rand() % 3 == 0))) {
+		rule.remote_port = htons(kPorts[rand() % COUNT_OF(kPorts)]);
+	}
+
+	rule.local_match_mask = kMasks[rand() % COUNT_OF(kMasks)];
+	rule.local_address = random_address();
+	in6_addr_apply_mask(rule.local_address, rule.local_match_mask);
+
+	rule.remote_match_mask = kMasks[rand() % COUNT_OF(kMasks)];
+	rule.remote_address = random_address();
+	in6_addr_apply_mask(rule.remote_address, rule.remote_match_mask);
+
+	return rule;
+}
+
+static size_t
+random_packet(uint8_t packet[64])
+{
+	struct in6_addr address;
+	uint16_t port;
+
+	memset(packet, 0, 64);
+	packet[0] = (rand() % 8) ? 0x60 : 0x45;
+	packet[6] = kTypes[rand() % COUNT_OF(kTypes)];
+
+	address = random_address();
+	memcpy(packet + 8, &address, 16);
+	address = random_address();
+	memcpy(packet + 24, &address, 16);
+
+	if (packet[6] == IPv6PacketMatcherRule::TYPE_ICMP) {
+		packet[40] = kSubtypes[rand() % COUNT_OF(kSubtypes)];
+	} else {
+		port = htons(kPorts[rand() % COUNT_OF(kPorts)]);
+		memcpy(packet + 40, &port, 2);
+	}
+
+	port = htons(kPorts[rand() % COUNT_OF(kPorts)]);
+	memcpy(packet + 42, &port, 2);
+
+	return kLengths[rand() % COUNT_OF(kLengths)];
+}
+
+// What the filter should let through: everything wpantund wouldn't
+// drop, plus short packets it leaves for wpantund to decide on.
+static bool
+expect_accepted(const IPv6PacketClassifier& rules, const uint8_t* packet, size_t len)
+{
+	IPv6PacketFields fields;
+
+	if (!is_valid_ipv6_packet(packet, len)) {
+		return false;
+	}
+
+	if (len < 44) {
+		return true;
+	}
+
+	return rules.match_outbound(fields.update_from_packet(packet, len)) == NULL;
+}
+
+// Returns how many of the packets should have been dropped.
+static uint64_t
+check_filter(const IPv6PacketClassifier& rules, int fd[2], int packet_count, const char* what)
+{
+	uint8_t packet[64];
+	uint8_t buffer[64];
+	uint64_t dropped = 0;
+	int mismatches = 0;
+	int i;
+
+	for (i = 0; i < packet_count; i++) {
+		size_t len = random_packet(packet);
+		bool accepted;
+
+		test_check(send(fd[0], packet, len, 0) == (ssize_t)len, "send");
+		accepted = (recv(fd[1], buffer, sizeof(buffer), MSG_DONTWAIT) == (ssize_t)len);
+		mismatches += (accepted != expect_accepted(rules, packet, len));
+		dropped += !expect_accepted(rules, packet, len);
+	}
+
+	if (mismatches != 0) {
+		printf("%s: %d of %d packets filtered wrongly\n", what, mismatches, packet_count);
+		sErrors++;
+	}
+
+	return dropped;
+}
+
+static void
+test_filters(void)
+{
+	IPv6PacketClassifier rules;
+	IPv6PacketFilter filter;
+	int round;
+
+	for (round = 0; round < 20; round++) {
+		int fd[2];
+		int prog_fd;
+		int counter_fd;
+		uint64_t dropped;
+		uint64_t count = 0;
+		int i;
+
+		rules.clear();
+
+		for (i = 0; i < round; i++) {
+			rules.insert(random_rule());
+		}
+
+		test_check(filter.set_outbound_drop_rules(rules), "Rules fit");
+		test_check(!filter.empty(), "Program generated");
+
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fd) < 0) {
+			perror("socketpair");
+			exit(EXIT_FAILURE);
+		}
+
+		test_check(filter.attach_to_socket(fd[1]) == 0, "SO_ATTACH_FILTER");
+		check_filter(rules, fd, 2000, "Classic BPF");
+
+		prog_fd = filter.load_ebpf();
+
+		if (prog_fd >= 0) {
+			test_check(setsockopt(fd[1], SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd)) == 0, "SO_ATTACH_BPF");
+			check_filter(rules, fd, 2000, "eBPF");
+			close(prog_fd);
+
+			counter_fd = IPv6PacketFilter::create_drop_counter();
+			test_check(counter_fd >= 0, "Drop counter created");
+			prog_fd = filter.load_ebpf(counter_fd);
+			test_check(prog_fd >= 0, "eBPF with drop counter loaded");
+			test_check(setsockopt(fd[1], SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd)) == 0, "SO_ATTACH_BPF with drop counter");
+			dropped = check_filter(rules, fd, 2000, "eBPF with drop counter");
+			test_check(IPv6PacketFilter::read_drop_counter(counter_fd, count) == 0, "Drop counter read");
+			test_check(count == dropped, "Dropped packets counted");
+			close(prog_fd);
+			close(counter_fd);
+
+		} else if (round == 0) {
+			// Loading eBPF needs privileges or a recent kernel.
+			printf("Skipping eBPF: %s\n", strerror(-prog_fd));
+		}
+
+		close(fd[0]);
+		close(fd[1]);
+	}
+}
+
+static void
+test_too_long(void)
+{
+	IPv6PacketClassifier rules;
+	IPv6PacketFilter filter;
+	IPv6PacketMatcherRule rule;
+	int i;
+
+	for (i = 0; i < 400; i++) {
+		rule.clear();
+		rule.type = IPv6PacketMatcherRule::TYPE_UDP;
+		rule.local_port = htons(static_cast<uint16_t>(i));
+		rule.local_port_match = true;
+		rule.local_address.s6_addr[0] = 0xfe;
+		rule.local_address.s6_addr[1] = 0x80;
+		rule.local_address.s6_addr[15] = static_cast<uint8_t>(i);
+		rule.local_match_mask = 128;
+		rules.insert(rule);
+	}
+
+	test_check(!filter.set_outbound_drop_rules(rules), "Too many rules reported");
+	test_check(filter.empty(), "Program too long to load is left empty");
+	test_check(filter.attach_to_socket(-1) == -EINVAL, "Nothing to attach");
+}
+
+static void
+test_icmpv6_type_filter(void)
+{
+	static const uint8_t kMessageTypes[] = { 143, 128, 143, 135, 130 };
+	IPv6PacketFilter filter;
+	uint8_t message[8];
+	uint8_t buffer[8];
+	uint64_t count = 0;
+	int counter_fd;
+	int prog_fd;
+	int pass;
+	size_t i;
+	int fd[2];
+
+	filter.set_icmpv6_type_filter(143);
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fd) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	test_check(filter.attach_to_socket(fd[1]) == 0, "ICMPv6 type filter attached");
+
+	counter_fd = IPv6PacketFilter::create_drop_counter();
+	prog_fd = (counter_fd >= 0) ? filter.load_ebpf(counter_fd) : counter_fd;
+
+	// Once as classic BPF, then as eBPF, if that can be loaded.
+	for (pass = 0; pass < ((prog_fd >= 0) ? 2 : 1); pass++) {
+		if (pass == 1) {
+			test_check(setsockopt(fd[1], SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd)) == 0, "ICMPv6 type filter attached as eBPF");
+		}
+
+		for (i = 0; i < COUNT_OF(kMessageTypes); i++) {
+			memset(message, 0, sizeof(message));
+			message[0] = kMessageTypes[i];
+
+			test_check(send(fd[0], message, sizeof(message), 0) == (ssize_t)sizeof(message), "send");
+			test_check((recv(fd[1], buffer, sizeof(buffer), MSG_DONTWAIT) == (ssize_t)sizeof(message)) == (kMessageTypes[i] == 143), "ICMPv6 type filtered");
+		}
+	}
+
+	if (prog_fd >= 0) {
+		test_check(IPv6PacketFilter::read_drop_counter(counter_fd, count) == 0, "ICMPv6 drop counter read");
+		test_check(count == 3, "Dropped ICMPv6 messages counted");
+		close(prog_fd);
+	}
+
+	if (counter_fd >= 0) {
+		close(counter_fd);
+	}
+
+	close(fd[0]);
+	close(fd[1]);
+}
+
+int
+main(void)
+{
+	srand(1);
+
+	test_filters();
+	test_too_long();
+	test_icmpv6_type_filter();
+
+	return test_exit_status();
+}
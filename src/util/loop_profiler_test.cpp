@@ -0,0 +1,153 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Checks histogram bucketing, nested scopes and enabling and
+ *      disabling of `nl::LoopProfiler`.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "LoopProfiler.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+static void
+test_buckets(void)
+{
+	test_check(LoopProfiler::get_bucket(0) == 0, "Zero in first bucket");
+	test_check(LoopProfiler::get_bucket(1) == 1, "1us in second bucket");
+	test_check(LoopProfiler::get_bucket(3) == 2, "3us in [2,4) bucket");
+	test_check(LoopProfiler::get_bucket(4) == 3, "4us in [4,8) bucket");
+	test_check(LoopProfiler::get_bucket(1000) == 10, "1ms in [512,1024) bucket");
+	test_check(LoopProfiler::get_bucket(UINT64_MAX) == LoopProfiler::kHistogramBuckets - 1, "Huge values in last bucket");
+}
+
+static void
+test_disabled(void)
+{
+	LoopProfiler::set_enabled(false);
+
+	{
+		LoopProfiler::Scope scope(LoopProfiler::kPhaseTimers);
+	}
+	LoopProfiler::note_wakeup(LoopProfiler::kWakeupTimeout);
+
+	LoopProfiler::set_enabled(true);
+
+	test_check(LoopProfiler::get_phase_stats(LoopProfiler::kPhaseTimers).mCount == 0, "Nothing recorded while disabled");
+	test_check(LoopProfiler::get_wakeup_count(LoopProfiler::kWakeupTimeout) == 0, "No wakeups recorded while disabled");
+}
+
+static void
+test_samples(void)
+{
+	LoopProfiler::set_enabled(false);
+	LoopProfiler::set_enabled(true);
+
+	LoopProfiler::add_sample(LoopProfiler::kPhaseIPC, 3, 1);
+	LoopProfiler::add_sample(LoopProfiler::kPhaseIPC, 1000, 0);
+
+	const LoopProfiler::PhaseStats& stats = LoopProfiler::get_phase_stats(LoopProfiler::kPhaseIPC);
+
+	test_check(stats.mCount == 2, "Sample count");
+	test_check(stats.mWallTotal == 1003, "Wall total");
+	test_check(stats.mCPUTotal == 1, "CPU total");
+	test_check(stats.mWallMax == 1000, "Wall maximum");
+	test_check(stats.mWallHistogram[2] == 1 && stats.mWallHistogram[10] == 1, "Wall histogram");
+	test_check(stats.mCPUHistogram[0] == 1 && stats.mCPUHistogram[1] == 1, "CPU histogram");
+
+	// Turning it on while it is already on keeps what was collected.
+	LoopProfiler::set_enabled(true);
+	test_check(LoopProfiler::get_phase_stats(LoopProfiler::kPhaseIPC).mCount == 2, "Enabling twice keeps data");
+}
+
+static void
+test_nested_scopes(void)
+{
+	LoopProfiler::set_enabled(false);
+	LoopProfiler::set_enabled(true);
+
+	{
+		LoopProfiler::Scope outer(LoopProfiler::kPhaseNCP);
+
+		{
+			LoopProfiler::Scope inner(LoopProfiler::kPhaseNCPTasks);
+			usleep(2000);
+		}
+	}
+
+	const LoopProfiler::PhaseStats& outer = LoopProfiler::get_phase_stats(LoopProfiler::kPhaseNCP);
+	const LoopProfiler::PhaseStats& inner = LoopProfiler::get_phase_stats(LoopProfiler::kPhaseNCPTasks);
+
+	test_check(outer.mCount == 1 && inner.mCount == 1, "One sample each");
+	test_check(inner.mWallTotal >= 2000, "Inner scope includes the sleep");
+	test_check(outer.mWallTotal >= inner.mWallTotal, "Outer scope includes the inner one");
+	test_check(inner.mCPUTotal < inner.mWallTotal, "Sleeping doesn't count as CPU time");
+
+	// A scope that was open when profiling was switched off is dropped.
+	{
+		LoopProfiler::Scope scope(LoopProfiler::kPhaseWait);
+		LoopProfiler::set_enabled(false);
+	}
+
+	test_check(LoopProfiler::get_phase_stats(LoopProfiler::kPhaseWait).mCount == 0, "Scope spanning disable is dropped");
+}
+
+static void
+test_reports(void)
+{
+	std::list<std::string> lines;
+
+	LoopProfiler::set_enabled(true);
+	LoopProfiler::add_sample(LoopProfiler::kPhaseTimers, 10, 10);
+	LoopProfiler::note_wakeup(LoopProfiler::kWakeupDescriptor);
+
+	LoopProfiler::get_phase_summary(lines);
+	test_check(lines.size() == LoopProfiler::kPhaseCount, "One summary line per phase");
+
+	lines.clear();
+	LoopProfiler::get_wakeups(lines);
+	test_check(lines.size() == LoopProfiler::kWakeupCount, "One line per wakeup cause");
+
+	lines.clear();
+	LoopProfiler::get_histograms(lines);
+	test_check(lines.size() == 2, "Histograms only for phases with samples");
+	test_check(lines.front().find("<16us:1") != std::string::npos, "Histogram bucket label");
+
+	LoopProfiler::set_enabled(false);
+}
+
+int
+main(void)
+{
+	test_buckets();
+	test_disabled();
+	test_samples();
+	test_nested_scopes();
+	test_reports();
+
+	return test_exit_status();
+}
@@ -0,0 +1,62 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Seeded 32-bit MurmurHash3 over whole words, for hash tables
+ *      keyed by addresses.
+ *
+ */
+
+#ifndef MURMUR3_HEADER_INCLUDED
+#define MURMUR3_HEADER_INCLUDED 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+static inline uint32_t
+murmur3_rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+/* Hashes the `count` words at `words`. Callers whose keys come from the
+ * network should pick `seed` at random, so that nobody can line up keys
+ * in one bucket. */
+static inline uint32_t
+murmur3_32(const uint32_t* words, size_t count, uint32_t seed)
+{
+	uint32_t h = seed;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		uint32_t k = words[i] * 0xcc9e2d51;
+
+		k = murmur3_rotl32(k, 15) * 0x1b873593;
+		h = murmur3_rotl32(h ^ k, 13) * 5 + 0xe6546b64;
+	}
+
+	h ^= (uint32_t)(count * sizeof(uint32_t));
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+#endif // MURMUR3_HEADER_INCLUDED
@@ -91,18 +91,66 @@ _nlpt_checkpoll(int fd, short poll_flags)
 	return ret;
 }
 
+static void
+fd_source_add(struct nlpt* nlpt, int fd, short poll_flags)
+{
+	struct nlpt_fd_source* unused = NULL;
+	int i;
+
+	for (i = 0; i < NLPT_MAX_FD_SOURCES; i++) {
+		if (nlpt->fd_sources[i].poll_flags == 0) {
+			if (unused == NULL) {
+				unused = &nlpt->fd_sources[i];
+			}
+		} else if (nlpt->fd_sources[i].fd == fd) {
+			nlpt->fd_sources[i].poll_flags |= poll_flags;
+			return;
+		}
+	}
+
+	assert(unused != NULL);
+
+	if (unused != NULL) {
+		unused->fd = fd;
+		unused->poll_flags = poll_flags;
+	}
+}
+
+static void
+fd_source_remove(struct nlpt* nlpt, int fd, short poll_flags)
+{
+	int i;
+
+	for (i = 0; i < NLPT_MAX_FD_SOURCES; i++) {
+		if ((nlpt->fd_sources[i].poll_flags != 0) && (nlpt->fd_sources[i].fd == fd)) {
+			nlpt->fd_sources[i].poll_flags &= ~poll_flags;
+		}
+	}
+}
+
 void
 _nlpt_cleanup_all(struct nlpt* nlpt)
 {
+	int i;
+
 	nlpt->max_fd = -1;
 	FD_ZERO(&nlpt->read_fds);
 	FD_ZERO(&nlpt->write_fds);
 	FD_ZERO(&nlpt->error_fds);
+
+	for (i = 0; i < NLPT_MAX_FD_SOURCES; i++) {
+		nlpt->fd_sources[i].fd = -1;
+		nlpt->fd_sources[i].poll_flags = 0;
+	}
 }
 
 void
 _nlpt_cleanup_read_fd_source(struct nlpt* nlpt, int fd)
 {
+	if (fd >= 0) {
+		fd_source_remove(nlpt, fd, POLLIN);
+	}
+
 	if ((fd >= 0) && (fd < FD_SETSIZE)) {
 		FD_CLR(fd, &nlpt->read_fds);
 		FD_CLR(fd, &nlpt->error_fds);
@@ -112,6 +160,10 @@ _nlpt_cleanup_read_fd_source(struct nlpt* nlpt, int fd)
 void
 _nlpt_cleanup_write_fd_source(struct nlpt* nlpt, int fd)
 {
+	if (fd >= 0) {
+		fd_source_remove(nlpt, fd, POLLOUT);
+	}
+
 	if ((fd >= 0) && (fd < FD_SETSIZE)) {
 		FD_CLR(fd, &nlpt->write_fds);
 		FD_CLR(fd, &nlpt->error_fds);
@@ -121,6 +173,10 @@ _nlpt_cleanup_write_fd_source(struct nlpt* nlpt, int fd)
 void
 _nlpt_setup_read_fd_source(struct nlpt* nlpt, int fd)
 {
+	if (fd >= 0) {
+		fd_source_add(nlpt, fd, POLLIN);
+	}
+
 	if ((fd >= 0) && (fd < FD_SETSIZE)) {
 		if (fd > nlpt->max_fd) {
 			nlpt->max_fd = fd;
@@ -133,6 +189,10 @@ _nlpt_setup_read_fd_source(struct nlpt* nlpt, int fd)
 void
 _nlpt_setup_write_fd_source(struct nlpt* nlpt, int fd)
 {
+	if (fd >= 0) {
+		fd_source_add(nlpt, fd, POLLOUT);
+	}
+
 	if ((fd >= 0) && (fd < FD_SETSIZE)) {
 		if (fd > nlpt->max_fd) {
 			nlpt->max_fd = fd;
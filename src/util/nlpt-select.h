@@ -31,6 +31,14 @@
 extern "C" {
 #endif
 
+/* Most descriptors a protothread waits on at once. */
+#define NLPT_MAX_FD_SOURCES 4
+
+struct nlpt_fd_source {
+	int fd;
+	short poll_flags;   /* POLLIN and/or POLLOUT, 0 if unused */
+};
+
 struct nlpt {
 	struct pt pt;
 	struct pt sub_pt;
@@ -41,6 +49,10 @@ struct nlpt {
 	fd_set write_fds;
 	fd_set error_fds;
 	int max_fd;
+
+	/* The same descriptors as a list, which, unlike the sets above, can
+	 * hold descriptors numbered `FD_SETSIZE` and up. */
+	struct nlpt_fd_source fd_sources[NLPT_MAX_FD_SOURCES];
 };
 
 /* ========================================================================= */
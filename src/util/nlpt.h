@@ -101,6 +101,22 @@
 		_nlpt_cleanup_write_fd_source(nlpt, fd_); \
 	} while (0)
 
+//! Waits until `wfd_` is writable, one of `rfd_` or `rfd2_` is readable, or the condition is satisfied.
+#define NLPT_WAIT_UNTIL_WRITABLE_OR_READABLE2_OR_COND(nlpt, wfd_, rfd_, rfd2_, c) \
+	do {                                                     \
+		_nlpt_setup_write_fd_source(nlpt, wfd_); \
+		_nlpt_setup_read_fd_source(nlpt, rfd_); \
+		_nlpt_setup_read_fd_source(nlpt, rfd2_); \
+		NLPT_WAIT_UNTIL(nlpt, \
+						 nlpt_hook_check_write_fd_source(nlpt, wfd_) \
+						 || nlpt_hook_check_read_fd_source(nlpt, rfd_) \
+						 || nlpt_hook_check_read_fd_source(nlpt, rfd2_) \
+						 || (c)); \
+		_nlpt_cleanup_read_fd_source(nlpt, rfd2_); \
+		_nlpt_cleanup_read_fd_source(nlpt, rfd_); \
+		_nlpt_cleanup_write_fd_source(nlpt, wfd_); \
+	} while (0)
+
 #define NLPT_WAIT_UNTIL_READABLE(nlpt, fd) \
 	NLPT_WAIT_UNTIL_READABLE_OR_COND( \
 	    nlpt, \
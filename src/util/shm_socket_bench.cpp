@@ -0,0 +1,289 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Measures frames per second through `nl::ShmSocket` against an
+ *      echoing NCP in another process, next to the same exchange over a
+ *      Unix socket with HDLC-lite framing on both ends.
+ *
+ *      The host keeps up to `window` frames outstanding, so a window of
+ *      one measures round trips and larger ones measure throughput.
+ *
+ *      Usage: shm_socket_bench [frame-count] [frame-len]
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "ShmSocket.h"
+#include "hdlc.h"
+
+using namespace nl;
+
+#define BENCH_MAX_FRAME_LEN        1280
+
+static const int kWindows[] = { 1, 8, ShmSocket::kRingSlots };
+
+static double
+now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1.0e6;
+}
+
+static void
+make_socketpair(int sv[2])
+{
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+write_all(int fd, const uint8_t* data, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret = write(fd, data, len);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			_exit(EXIT_FAILURE);
+		}
+
+		data += ret;
+		len -= static_cast<size_t>(ret);
+	}
+}
+
+static void
+run_shm_echo(int control_fd)
+{
+	EventBackend* backend = EventBackend::create();
+	boost::shared_ptr<ShmSocket> ncp = ShmSocket::accept(control_fd);
+	char buffer[ShmSocket::kMaxFrameSize];
+
+	while (true) {
+		cms_t timeout = 1000;
+
+		backend->begin_update();
+		ncp->update_fd_interest(backend, &timeout);
+		backend->wait(timeout);
+		ncp->process();
+
+		while (ncp->can_read() && ncp->can_write()) {
+			ssize_t len = ncp->read(buffer, sizeof(buffer));
+
+			if (len < 0) {
+				_exit(EXIT_SUCCESS);
+			}
+
+			ncp->write(buffer, static_cast<size_t>(len));
+		}
+	}
+}
+
+static double
+bench_shm(int frame_count, size_t frame_len, int window)
+{
+	EventBackend* backend = EventBackend::create();
+	boost::shared_ptr<ShmSocket> host;
+	char buffer[ShmSocket::kMaxFrameSize];
+	int sent = 0;
+	int received = 0;
+	int sv[2];
+	double start;
+	pid_t pid;
+
+	make_socketpair(sv);
+	pid = fork();
+
+	if (pid == 0) {
+		close(sv[0]);
+		run_shm_echo(sv[1]);
+	}
+
+	close(sv[1]);
+	host = ShmSocket::connect(sv[0]);
+	memset(buffer, 0x7E, frame_len);
+	start = now_sec();
+
+	while (received < frame_count) {
+		cms_t timeout = 1000;
+
+		while ((sent < frame_count) && (sent - received < window) && host->can_write()) {
+			host->write(buffer, frame_len);
+			sent++;
+		}
+
+		backend->begin_update();
+		host->update_fd_interest(backend, &timeout);
+		backend->wait(timeout);
+		host->process();
+
+		while (host->can_read()) {
+			if (host->read(buffer, sizeof(buffer)) < 0) {
+				fprintf(stderr, "Lost the echo process\n");
+				exit(EXIT_FAILURE);
+			}
+			received++;
+		}
+	}
+
+	start = now_sec() - start;
+
+	host.reset();
+	waitpid(pid, NULL, 0);
+	delete backend;
+
+	return frame_count / start;
+}
+
+static void
+run_hdlc_echo(int fd)
+{
+	static uint8_t frame[BENCH_MAX_FRAME_LEN + HDLC_CRC_SIZE];
+	static uint8_t encoded[HDLC_ENCODED_FRAME_SIZE_MAX(BENCH_MAX_FRAME_LEN)];
+	uint8_t buffer[4096];
+	struct hdlc_decoder decoder;
+	ssize_t len;
+
+	hdlc_decoder_init(&decoder, frame, sizeof(frame));
+
+	while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+		size_t offset = 0;
+
+		while (offset < static_cast<size_t>(len)) {
+			size_t consumed = 0;
+
+			if (hdlc_decoder_feed(&decoder, buffer + offset, len - offset, &consumed) == HDLC_DECODE_FRAME) {
+				write_all(fd, encoded, hdlc_encode_frame(encoded, frame, decoder.frame_len, true));
+			}
+
+			offset += consumed;
+		}
+	}
+
+	_exit(EXIT_SUCCESS);
+}
+
+static double
+bench_hdlc(int frame_count, size_t frame_len, int window)
+{
+	static uint8_t frame[BENCH_MAX_FRAME_LEN + HDLC_CRC_SIZE];
+	static uint8_t encoded[HDLC_ENCODED_FRAME_SIZE_MAX(BENCH_MAX_FRAME_LEN)];
+	uint8_t buffer[4096];
+	struct hdlc_decoder decoder;
+	int sent = 0;
+	int received = 0;
+	int sv[2];
+	double start;
+	pid_t pid;
+
+	make_socketpair(sv);
+	pid = fork();
+
+	if (pid == 0) {
+		close(sv[0]);
+		run_hdlc_echo(sv[1]);
+	}
+
+	close(sv[1]);
+	hdlc_decoder_init(&decoder, frame, sizeof(frame));
+	memset(buffer, 0x7E, frame_len);
+	start = now_sec();
+
+	while (received < frame_count) {
+		ssize_t len;
+		size_t offset = 0;
+
+		while ((sent < frame_count) && (sent - received < window)) {
+			write_all(sv[0], encoded, hdlc_encode_frame(encoded, buffer, frame_len, true));
+			sent++;
+		}
+
+		len = read(sv[0], buffer, sizeof(buffer));
+
+		if (len <= 0) {
+			fprintf(stderr, "Lost the echo process\n");
+			exit(EXIT_FAILURE);
+		}
+
+		while (offset < static_cast<size_t>(len)) {
+			size_t consumed = 0;
+
+			if (hdlc_decoder_feed(&decoder, buffer + offset, len - offset, &consumed) == HDLC_DECODE_FRAME) {
+				received++;
+			}
+
+			offset += consumed;
+		}
+
+		// The read buffer doubles as the frame to send.
+		memset(buffer, 0x7E, frame_len);
+	}
+
+	start = now_sec() - start;
+
+	close(sv[0]);
+	waitpid(pid, NULL, 0);
+
+	return frame_count / start;
+}
+
+int
+main(int argc, char* argv[])
+{
+	const int frame_count = (argc > 1) ? atoi(argv[1]) : 200000;
+	size_t frame_len = (argc > 2) ? static_cast<size_t>(atoi(argv[2])) : 100;
+	size_t i;
+
+	if ((frame_len == 0) || (frame_len > BENCH_MAX_FRAME_LEN)) {
+		fprintf(stderr, "frame-len must be between 1 and %d\n", BENCH_MAX_FRAME_LEN);
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%d frames of %d bytes, echoed by another process\n\n", frame_count, static_cast<int>(frame_len));
+	printf("%-7s %14s %14s %8s\n", "window", "hdlc frames/s", "shm frames/s", "speedup");
+
+	for (i = 0; i < sizeof(kWindows) / sizeof(kWindows[0]); i++) {
+		const double hdlc = bench_hdlc(frame_count, frame_len, kWindows[i]);
+		const double shm = bench_shm(frame_count, frame_len, kWindows[i]);
+
+		printf("%-7d %14.0f %14.0f %7.2fx\n", kWindows[i], hdlc, shm, shm / hdlc);
+	}
+
+	return EXIT_SUCCESS;
+}
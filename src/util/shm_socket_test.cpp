@@ -0,0 +1,303 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Unit tests for `nl::ShmSocket`: frame exchange, flow control,
+ *      wakeups, commands, and a peer in another process.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <string>
+
+#include "ShmSocket.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+#define TEST_PROCESS_FRAME_COUNT   2000
+
+static void
+make_pair(boost::shared_ptr<ShmSocket>* host, boost::shared_ptr<ShmSocket>* ncp)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	*host = ShmSocket::connect(sv[0]);
+	*ncp = ShmSocket::accept(sv[1]);
+}
+
+// Runs one main loop iteration for `socket`, waiting at most `timeout`.
+// Returns the number of ready descriptors.
+static int
+run_once(EventBackend* backend, boost::shared_ptr<ShmSocket> socket, cms_t timeout)
+{
+	int ret;
+
+	backend->begin_update();
+	socket->update_fd_interest(backend, &timeout);
+	ret = backend->wait(timeout);
+	socket->process();
+
+	return ret;
+}
+
+static bool
+read_equals(boost::shared_ptr<ShmSocket> socket, const std::string& expected)
+{
+	char buffer[ShmSocket::kMaxFrameSize];
+	ssize_t len = socket->read(buffer, sizeof(buffer));
+
+	return (len == static_cast<ssize_t>(expected.size())) && (memcmp(buffer, expected.data(), len) == 0);
+}
+
+static void
+test_exchange(void)
+{
+	boost::shared_ptr<ShmSocket> host, ncp;
+	const std::string big(ShmSocket::kMaxFrameSize, 'b');
+	char small[4];
+
+	make_pair(&host, &ncp);
+
+	test_check(host->is_framed() && ncp->is_framed(), "Framed");
+	test_check(host->get_side() == ShmSocket::kSideHost && ncp->get_side() == ShmSocket::kSideNcp, "Sides");
+	test_check(!host->can_read() && !ncp->can_read(), "Nothing to read at first");
+	test_check(host->read(small, sizeof(small)) == 0, "Empty read");
+
+	test_check(host->write("to-ncp", 6) == 6, "Host write");
+	test_check(ncp->write("to-host", 7) == 7, "NCP write");
+	test_check(ncp->can_read() && read_equals(ncp, "to-ncp"), "NCP got the frame");
+	test_check(host->can_read() && read_equals(host, "to-host"), "Host got the frame");
+
+	test_check(host->write(big.data(), big.size()) == static_cast<ssize_t>(big.size()), "Biggest frame");
+	test_check(read_equals(ncp, big), "Biggest frame contents");
+	test_check(host->write(big.data(), big.size() + 1) == -EMSGSIZE, "Oversized frame rejected");
+
+	ncp->write("truncated", 9);
+	test_check(host->read(small, sizeof(small)) == sizeof(small) && memcmp(small, "trun", 4) == 0, "Truncated like a datagram");
+	test_check(!host->can_read(), "Rest of a truncated frame is dropped");
+}
+
+static void
+test_flow_control(void)
+{
+	boost::shared_ptr<ShmSocket> host, ncp;
+	struct iovec iov[ShmSocket::kRingSlots + 1];
+	int i;
+
+	make_pair(&host, &ncp);
+
+	for (i = 0; i < ShmSocket::kRingSlots + 1; i++) {
+		iov[i].iov_base = const_cast<char*>("abc");
+		iov[i].iov_len = 3;
+	}
+
+	test_check(host->writev(iov, ShmSocket::kRingSlots + 1) == 3 * ShmSocket::kRingSlots, "writev stops when the ring is full");
+	test_check(!host->can_write(), "Full ring isn't writable");
+	test_check(host->write("abc", 3) == -EAGAIN, "Write to a full ring");
+
+	test_check(read_equals(ncp, "abc"), "NCP took one");
+	test_check(host->can_write(), "Writable again");
+}
+
+static void
+test_wakeups(void)
+{
+	EventBackend* backend = EventBackend::create("select");
+	boost::shared_ptr<ShmSocket> host, ncp;
+	cms_t timeout;
+	char byte;
+
+	make_pair(&host, &ncp);
+
+	// Nothing happens while nobody is waiting.
+	test_check(run_once(backend, host, 0) == 0, "Not woken while busy");
+
+	// A frame from the NCP wakes the host up.
+	backend->begin_update();
+	timeout = 1000;
+	host->update_fd_interest(backend, &timeout);
+	test_check(timeout == 1000, "Host goes to sleep");
+	ncp->write("x", 1);
+	test_check(backend->wait(timeout) == 1, "Host woken by a frame");
+	host->process();
+	test_check(read_equals(host, "x"), "Frame after wakeup");
+
+	// The wakeup was consumed.
+	test_check(run_once(backend, host, 10) == 0, "Wakeup consumed");
+
+	// A frame that arrives while the host is busy is picked up
+	// without a wakeup.
+	ncp->write("y", 1);
+	timeout = 1000;
+	host->update_fd_interest(backend, &timeout);
+	test_check(timeout == 0, "Pending frame means no sleep");
+	test_check(read_equals(host, "y"), "Frame while busy");
+
+	// A host waiting for room is woken once the NCP makes some.
+	while (host->can_write()) {
+		host->write("z", 1);
+	}
+	backend->begin_update();
+	timeout = 1000;
+	host->update_fd_interest(backend, &timeout);
+	ncp->read(&byte, 1);
+	test_check(backend->wait(timeout) == 1, "Host woken by room to write");
+	host->process();
+	test_check(host->can_write(), "Room after wakeup");
+
+	delete backend;
+}
+
+static void
+test_control(void)
+{
+	EventBackend* backend = EventBackend::create("select");
+	boost::shared_ptr<ShmSocket> host, ncp;
+	char byte;
+
+	make_pair(&host, &ncp);
+
+	host->reset();
+	test_check(run_once(backend, ncp, 1000) == 1, "NCP woken by a command");
+	test_check(ncp->did_reset(), "Reset asked for");
+	test_check(!ncp->did_reset(), "Reset only reported once");
+
+	ncp.reset();
+	run_once(backend, host, 1000);
+	test_check(host->can_read(), "Lost peer is readable");
+	test_check(host->read(&byte, 1) == -EPIPE, "Read from a lost peer");
+	test_check(host->write("x", 1) == -EPIPE, "Write to a lost peer");
+
+	delete backend;
+}
+
+// Echoes frames back to the host from another process.
+static void
+run_echo_ncp(int control_fd)
+{
+	EventBackend* backend = EventBackend::create();
+	boost::shared_ptr<ShmSocket> ncp = ShmSocket::accept(control_fd);
+	char buffer[ShmSocket::kMaxFrameSize];
+	ssize_t len;
+
+	while (true) {
+		run_once(backend, ncp, 1000);
+
+		while (ncp->can_read() && ncp->can_write()) {
+			len = ncp->read(buffer, sizeof(buffer));
+
+			if (len < 0) {
+				_exit(EXIT_SUCCESS);
+			}
+
+			ncp->write(buffer, static_cast<size_t>(len));
+		}
+	}
+}
+
+static void
+test_other_process(void)
+{
+	EventBackend* backend = EventBackend::create();
+	boost::shared_ptr<ShmSocket> host;
+	char buffer[ShmSocket::kMaxFrameSize];
+	int sent = 0;
+	int received = 0;
+	int sv[2];
+	int status = 0;
+	cms_t deadline;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	pid = fork();
+
+	if (pid == 0) {
+		close(sv[0]);
+		run_echo_ncp(sv[1]);
+	}
+
+	close(sv[1]);
+	host = ShmSocket::connect(sv[0]);
+	deadline = time_ms() + 10 * MSEC_PER_SEC;
+
+	while ((received < TEST_PROCESS_FRAME_COUNT) && ((deadline - time_ms()) > 0)) {
+		while ((sent < TEST_PROCESS_FRAME_COUNT) && host->can_write()) {
+			snprintf(buffer, sizeof(buffer), "frame %d", sent);
+			host->write(buffer, strlen(buffer) + 1 + (sent % 300));
+			sent++;
+		}
+
+		run_once(backend, host, 1000);
+
+		while (host->can_read()) {
+			char expected[32];
+			ssize_t len = host->read(buffer, sizeof(buffer));
+
+			snprintf(expected, sizeof(expected), "frame %d", received);
+
+			if ((len != static_cast<ssize_t>(strlen(expected) + 1 + (received % 300))) || (strcmp(buffer, expected) != 0)) {
+				test_check(false, "Echoed frame");
+				break;
+			}
+
+			received++;
+		}
+	}
+
+	test_check(received == TEST_PROCESS_FRAME_COUNT, "Every frame came back from the other process");
+
+	host.reset();
+	waitpid(pid, &status, 0);
+	test_check(WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS), "Other process saw us go");
+
+	delete backend;
+}
+
+int
+main(void)
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	test_exchange();
+	test_flow_control();
+	test_wakeups();
+	test_control();
+	test_other_process();
+
+	return test_exit_status();
+}
@@ -236,6 +236,20 @@ fd_has_error(int fd)
 	return 0;
 }
 
+bool
+fd_keeps_message_boundaries(int fd)
+{
+	int type = 0;
+	socklen_t len = sizeof(type);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0) {
+		// Not a socket at all.
+		return false;
+	}
+
+	return (type == SOCK_SEQPACKET) || (type == SOCK_DGRAM);
+}
+
 int gSocketWrapperBaud = 115200;
 
 static bool
@@ -640,6 +654,60 @@ open_system_socket(const char* command)
 	return ret_fd;
 }
 
+// Connects to a Unix domain socket, preferring `SOCK_SEQPACKET` so that
+// the listener can keep frames apart without any framing. Listeners
+// which only take a byte stream get a `SOCK_STREAM` connection.
+static int
+open_unix_socket(const char* path)
+{
+	int fd = -1;
+#if HAVE_SYS_UN_H
+	static const int types[] = { SOCK_SEQPACKET, SOCK_STREAM };
+	struct sockaddr_un addr;
+	size_t i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	for (i = 0; i < sizeof(types)/sizeof(types[0]); i++) {
+		fd = socket(AF_UNIX, types[i], 0);
+
+		if (fd < 0) {
+			continue;
+		}
+
+		if (0 == connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+			break;
+		}
+
+		{
+			int prevErrno = errno;
+
+			close(fd);
+			fd = -1;
+
+			errno = prevErrno;
+		}
+
+		// Only a listener of the other type is worth another try.
+		if (errno != EPROTOTYPE) {
+			break;
+		}
+	}
+#else
+	errno = ENOTSUP;
+#endif
+
+	return fd;
+}
+
 int
 get_super_socket_type_from_path(const char* socket_name)
 {
@@ -659,6 +727,8 @@ get_super_socket_type_from_path(const char* socket_name)
 		socket_type = SUPER_SOCKET_TYPE_DEVICE;
 	} else if (strcasehasprefix(socket_name, SOCKET_TCP_COMMAND_PREFIX)) {
 		socket_type = SUPER_SOCKET_TYPE_TCP;
+	} else if (strcasehasprefix(socket_name, SOCKET_UNIX_COMMAND_PREFIX)) {
+		socket_type = SUPER_SOCKET_TYPE_UNIX;
 	} else if (socket_name_is_inet(socket_name) || socket_name_is_port(socket_name)) {
 		socket_type = SUPER_SOCKET_TYPE_TCP;
 	} else if (socket_name_is_device(socket_name)) {
@@ -877,6 +947,8 @@ open_super_socket(const char* socket_name)
 			fd = -1;
 			goto bail;
 		}
+	} else if (SUPER_SOCKET_TYPE_UNIX == socket_type) {
+		fd = open_unix_socket(filename);
 	} else {
 		syslog(LOG_ERR, "I don't know how to open \"%s\" (socket type %d)", socket_name, (int)socket_type);
 	}
@@ -33,6 +33,9 @@
 #define SOCKET_TCP_COMMAND_PREFIX	"tcp:"
 #define SOCKET_SYSTEM_FORKPTY_COMMAND_PREFIX	"system-forkpty:"
 #define SOCKET_SYSTEM_SOCKETPAIR_COMMAND_PREFIX	"system-socketpair:"
+#define SOCKET_SPI_COMMAND_PREFIX	"spi:"
+#define SOCKET_SHM_COMMAND_PREFIX	"shm:"
+#define SOCKET_UNIX_COMMAND_PREFIX	"unix:"
 
 #ifndef SOCKET_UTILS_DEFAULT_SHELL
 #define SOCKET_UTILS_DEFAULT_SHELL         "/bin/sh"
@@ -47,6 +50,11 @@ int lookup_sockaddr_from_host_and_port( struct sockaddr_in6* outaddr, const char
 int open_super_socket(const char* socket_name);
 int close_super_socket(int fd);
 int fd_has_error(int fd);
+
+//! True if `fd` is a socket which keeps message boundaries, such as a
+//! `SOCK_SEQPACKET` or `SOCK_DGRAM` socket, so that each read returns
+//! exactly what one write on the other end sent.
+bool fd_keeps_message_boundaries(int fd);
 int checkpoll(int fd, int poll_flags);
 
 enum {
@@ -56,7 +64,8 @@ enum {
 	SUPER_SOCKET_TYPE_SYSTEM_SOCKETPAIR,
 	SUPER_SOCKET_TYPE_FD,
 	SUPER_SOCKET_TYPE_TCP,
-	SUPER_SOCKET_TYPE_DEVICE
+	SUPER_SOCKET_TYPE_DEVICE,
+	SUPER_SOCKET_TYPE_UNIX
 };
 
 int get_super_socket_type_from_path(const char* path);
@@ -0,0 +1,271 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Unit tests for `NLPT_ASYNC_WRITEV_STREAM()`, on a socket which
+ *      only takes a few bytes per write.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+
+#include "SocketAsyncOp.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+bool
+nlpt_hook_check_read_fd_source(struct nlpt* nlpt, int fd)
+{
+	return false;
+}
+
+bool
+nlpt_hook_check_write_fd_source(struct nlpt* nlpt, int fd)
+{
+	return false;
+}
+
+// Takes at most `chunk` bytes per call to `write()` or `writev()`, like a
+// stream socket whose send buffer is nearly full, and is only writable
+// on every other check.
+class ShortWriteSocket : public SocketWrapper {
+public:
+	ShortWriteSocket(size_t chunk, int fail_at_call = -1)
+		: mChunk(chunk), mFailAtCall(fail_at_call), mCalls(0), mWritevCalls(0), mChecks(0) { }
+
+	virtual ssize_t
+	write(const void* data, size_t len)
+	{
+		struct iovec iov;
+
+		iov.iov_base = const_cast<void*>(data);
+		iov.iov_len = len;
+
+		return take(&iov, 1);
+	}
+
+	virtual ssize_t
+	writev(const struct iovec* iov, int iovcnt)
+	{
+		mWritevCalls++;
+		return take(iov, iovcnt);
+	}
+
+	virtual ssize_t
+	read(void* data, size_t len)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+
+	virtual bool
+	can_write(void)const
+	{
+		return (++mChecks % 2) == 0;
+	}
+
+	virtual int
+	process(void)
+	{
+		return 0;
+	}
+
+	std::vector<uint8_t> mData;
+	size_t mChunk;
+	int mFailAtCall;
+	int mCalls;
+	int mWritevCalls;
+	mutable int mChecks;
+
+private:
+	ssize_t
+	take(const struct iovec* iov, int iovcnt)
+	{
+		size_t len = 0;
+		int i;
+
+		if (mCalls++ == mFailAtCall) {
+			errno = EPIPE;
+			return -1;
+		}
+
+		for (i = 0; i < iovcnt && len < mChunk; i++) {
+			const uint8_t* base = static_cast<const uint8_t*>(iov[i].iov_base);
+			size_t n = iov[i].iov_len;
+
+			if (n > mChunk - len) {
+				n = mChunk - len;
+			}
+
+			mData.insert(mData.end(), base, base + n);
+			len += n;
+		}
+
+		return len;
+	}
+};
+
+struct writer_pt {
+	struct nlpt nlpt;
+	ShortWriteSocket* socket;
+	const struct iovec* iov;
+	int iovcnt;
+};
+
+static int
+writer_thread(struct writer_pt* writer)
+{
+	struct nlpt* const pt = &writer->nlpt;
+
+	PT_BEGIN(&pt->pt);
+
+	NLPT_ASYNC_WRITEV_STREAM(pt, writer->socket, writer->iov, writer->iovcnt);
+
+	PT_END(&pt->pt);
+}
+
+// Runs the writer until it ends, returning how many times it yielded.
+static int
+run_writer(struct writer_pt* writer)
+{
+	int yields = 0;
+
+	memset(&writer->nlpt, 0, sizeof(writer->nlpt));
+	_nlpt_init(&writer->nlpt);
+	PT_INIT(&writer->nlpt.pt);
+
+	while (PT_SCHEDULE(writer_thread(writer))) {
+		if (++yields > 1000) {
+			printf("Writer never finished\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return yields;
+}
+
+// Buffers of odd sizes, including an empty one, so that short writes end
+// both inside a buffer and on a boundary between two.
+static uint8_t sBufA[] = { 0x00, 0x01, 0x02 };
+static uint8_t sBufB[] = { 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c };
+static uint8_t sBufC[] = { 0x0d };
+static uint8_t sBufD[] = { 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14 };
+
+static const struct iovec sIov[] = {
+	{ sBufA, sizeof(sBufA) },
+	{ NULL, 0 },
+	{ sBufB, sizeof(sBufB) },
+	{ sBufC, sizeof(sBufC) },
+	{ sBufD, sizeof(sBufD) },
+};
+
+static const int sIovCnt = sizeof(sIov) / sizeof(sIov[0]);
+
+static bool
+wrote_in_order(const ShortWriteSocket& socket)
+{
+	size_t i;
+
+	for (i = 0; i < socket.mData.size(); i++) {
+		if (socket.mData[i] != i) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+test_partial_writes(size_t chunk)
+{
+	const size_t total = iov_total_len(sIov, sIovCnt);
+	ShortWriteSocket socket(chunk);
+	struct writer_pt writer;
+	int yields;
+	char what[64];
+
+	writer.socket = &socket;
+	writer.iov = sIov;
+	writer.iovcnt = sIovCnt;
+
+	yields = run_writer(&writer);
+
+	snprintf(what, sizeof(what), "Chunk %d: all bytes written", (int)chunk);
+	test_check(socket.mData.size() == total, what);
+
+	snprintf(what, sizeof(what), "Chunk %d: bytes written in order", (int)chunk);
+	test_check(wrote_in_order(socket), what);
+
+	snprintf(what, sizeof(what), "Chunk %d: byte count", (int)chunk);
+	test_check(writer.nlpt.byte_count == total, what);
+
+	snprintf(what, sizeof(what), "Chunk %d: no error", (int)chunk);
+	test_check(writer.nlpt.last_errno == 0, what);
+
+	snprintf(what, sizeof(what), "Chunk %d: waited while not writable", (int)chunk);
+	test_check(yields >= socket.mCalls, what);
+
+	if (chunk >= total) {
+		test_check(socket.mCalls == 1 && socket.mWritevCalls == 1, "Single writev for everything");
+	} else {
+		snprintf(what, sizeof(what), "Chunk %d: resumed after short write", (int)chunk);
+		test_check(socket.mCalls > 1, what);
+	}
+}
+
+static void
+test_write_error(void)
+{
+	ShortWriteSocket socket(4, 2);
+	struct writer_pt writer;
+
+	writer.socket = &socket;
+	writer.iov = sIov;
+	writer.iovcnt = sIovCnt;
+
+	run_writer(&writer);
+
+	test_check(writer.nlpt.last_errno == EPIPE, "Error reported in last_errno");
+	test_check(writer.nlpt.byte_count == 8, "Byte count stops at the error");
+	test_check(socket.mCalls == 3, "No writes after the error");
+	test_check(wrote_in_order(socket), "Bytes before the error in order");
+}
+
+int
+main(void)
+{
+	const size_t total = iov_total_len(sIov, sIovCnt);
+	size_t chunk;
+
+	for (chunk = 1; chunk <= total; chunk++) {
+		test_partial_writes(chunk);
+	}
+
+	test_partial_writes(total + 1);
+	test_write_error();
+
+	return test_exit_status();
+}
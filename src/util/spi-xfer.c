@@ -0,0 +1,185 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Transaction sizing, polling and statistics for the SPI link to
+ *      the NCP.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#include "spi-xfer.h"
+
+// Rough cost of getting an `SPI_IOC_MESSAGE` ioctl in and out of the
+// kernel, on top of the chip select delay.
+#define SPI_XFER_SYSCALL_USEC      50
+
+void
+spi_xfer_sizer_init(struct spi_xfer_sizer* sizer, uint16_t min_len, uint16_t max_len, uint16_t overhead)
+{
+	memset(sizer, 0, sizeof(*sizer));
+
+	sizer->min_len = (min_len < max_len) ? min_len : max_len;
+	sizer->max_len = max_len;
+	sizer->overhead = overhead;
+	sizer->adaptive = true;
+	sizer->len = sizer->min_len;
+}
+
+void
+spi_xfer_sizer_set_adaptive(struct spi_xfer_sizer* sizer, bool adaptive)
+{
+	sizer->adaptive = adaptive;
+
+	if (!adaptive) {
+		sizer->len = sizer->min_len;
+	}
+}
+
+// Total cost, in byte times, of receiving every frame in the history
+// if each transaction made room for `len` bytes.
+static uint32_t
+sizer_cost(const struct spi_xfer_sizer* sizer, uint16_t len)
+{
+	const uint32_t per_xfer = sizer->overhead + SPI_XFER_HEADER_LEN;
+	uint32_t cost = 0;
+	unsigned int i;
+
+	for (i = 0; i < sizer->history_count; i++) {
+		cost += per_xfer + len;
+
+		if (sizer->history[i] > len) {
+			// The frame is only sent by a second transaction
+			// sized to fit it.
+			cost += per_xfer + sizer->history[i];
+		}
+	}
+
+	return cost;
+}
+
+void
+spi_xfer_sizer_note_frame(struct spi_xfer_sizer* sizer, uint16_t data_len)
+{
+	uint32_t best_cost;
+	uint16_t best_len;
+	unsigned int i;
+
+	if (data_len > sizer->max_len) {
+		data_len = sizer->max_len;
+	}
+
+	sizer->history[sizer->history_next] = data_len;
+	sizer->history_next = (sizer->history_next + 1) % SPI_XFER_HISTORY_LEN;
+
+	if (sizer->history_count < SPI_XFER_HISTORY_LEN) {
+		sizer->history_count++;
+	}
+
+	if (!sizer->adaptive) {
+		return;
+	}
+
+	// The cheapest length is always either the minimum or the length
+	// of one of the frames, since anything in between costs more than
+	// the next shorter of those without fitting any more frames.
+	best_len = sizer->min_len;
+	best_cost = sizer_cost(sizer, best_len);
+
+	for (i = 0; i < sizer->history_count; i++) {
+		const uint16_t len = sizer->history[i];
+		uint32_t cost;
+
+		if (len <= sizer->min_len) {
+			continue;
+		}
+
+		cost = sizer_cost(sizer, len);
+
+		if ((cost < best_cost) || ((cost == best_cost) && (len < best_len))) {
+			best_cost = cost;
+			best_len = len;
+		}
+	}
+
+	sizer->len = best_len;
+}
+
+uint16_t
+spi_xfer_overhead_bytes(uint32_t speed_hz, uint32_t cs_delay_us)
+{
+	const uint64_t bytes = ((uint64_t)speed_hz * (cs_delay_us + SPI_XFER_SYSCALL_USEC)) / (8 * 1000000);
+
+	return (bytes > UINT16_MAX) ? UINT16_MAX : (uint16_t)bytes;
+}
+
+void
+spi_xfer_poller_init(struct spi_xfer_poller* poller, uint16_t min_ms, uint16_t max_ms)
+{
+	poller->min_ms = (min_ms != 0) ? min_ms : 1;
+	poller->max_ms = (max_ms > poller->min_ms) ? max_ms : poller->min_ms;
+	poller->period_ms = poller->max_ms;
+}
+
+void
+spi_xfer_poller_note(struct spi_xfer_poller* poller, bool got_frame)
+{
+	if (got_frame) {
+		poller->period_ms = poller->min_ms;
+	} else if (poller->period_ms < poller->max_ms) {
+		poller->period_ms = (poller->period_ms * 2 < poller->max_ms) ? poller->period_ms * 2 : poller->max_ms;
+	}
+}
+
+void
+spi_xfer_stats_note_transaction(struct spi_xfer_stats* stats, size_t clocked, size_t rx_len, size_t tx_len)
+{
+	stats->transactions++;
+	stats->clocked_bytes += clocked;
+	stats->payload_bytes += rx_len + tx_len;
+
+	if ((rx_len == 0) && (tx_len == 0)) {
+		stats->wasted++;
+	}
+}
+
+void
+spi_xfer_stats_note_latency(struct spi_xfer_stats* stats, uint64_t latency_us)
+{
+	stats->latency_count++;
+	stats->latency_sum_us += latency_us;
+
+	if (latency_us > stats->latency_max_us) {
+		stats->latency_max_us = (latency_us > UINT32_MAX) ? UINT32_MAX : (uint32_t)latency_us;
+	}
+}
+
+uint64_t
+spi_xfer_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
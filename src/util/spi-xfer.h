@@ -0,0 +1,134 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Transaction sizing, polling and statistics for the SPI link to
+ *      the NCP, shared by spi-hdlc-adapter and "spi:" sockets.
+ *
+ */
+
+#ifndef wpantund_spi_xfer_h
+#define wpantund_spi_xfer_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPI_XFER_HEADER_LEN        5
+
+//! Number of recently received frame sizes the sizer bases its
+//! choice on.
+#define SPI_XFER_HISTORY_LEN       16
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//! Picks how much room to make for the NCP's next frame.
+/*! Until the NCP's header tells us how long its frame is, we have to
+ *  guess. A guess that is too short costs a whole extra transaction,
+ *  and one that is too long clocks bytes for nothing. The sizer picks
+ *  the length that would have been cheapest for the last
+ *  `SPI_XFER_HISTORY_LEN` frames, counting each transaction as its
+ *  length plus a fixed overhead.
+ */
+struct spi_xfer_sizer {
+	uint16_t history[SPI_XFER_HISTORY_LEN];
+	uint8_t history_count;
+	uint8_t history_next;
+
+	//! Never make less room than this (the "small packet" size).
+	uint16_t min_len;
+	uint16_t max_len;
+
+	//! The cost of a transaction besides its bytes (system call, chip
+	//! select delay), in byte times. See `spi_xfer_overhead_bytes()`.
+	uint16_t overhead;
+
+	//! When false, the sizer always picks `min_len`.
+	bool adaptive;
+
+	//! The current choice, updated as frames are noted.
+	uint16_t len;
+};
+
+void spi_xfer_sizer_init(struct spi_xfer_sizer* sizer, uint16_t min_len, uint16_t max_len, uint16_t overhead);
+void spi_xfer_sizer_set_adaptive(struct spi_xfer_sizer* sizer, bool adaptive);
+
+//! Records the length of a frame received from the NCP.
+void spi_xfer_sizer_note_frame(struct spi_xfer_sizer* sizer, uint16_t data_len);
+
+static inline uint16_t
+spi_xfer_sizer_get_len(const struct spi_xfer_sizer* sizer)
+{
+	return sizer->len;
+}
+
+//! Converts the fixed cost of a transaction at the given clock speed
+//! into the number of bytes that could have been clocked meanwhile.
+uint16_t spi_xfer_overhead_bytes(uint32_t speed_hz, uint32_t cs_delay_us);
+
+//! Polling period for NCPs without an interrupt line.
+/*! Polls come quickly while the NCP has been sending, and back off
+ *  exponentially to `max_ms` once it goes quiet.
+ */
+struct spi_xfer_poller {
+	uint16_t min_ms;
+	uint16_t max_ms;
+	uint16_t period_ms;
+};
+
+void spi_xfer_poller_init(struct spi_xfer_poller* poller, uint16_t min_ms, uint16_t max_ms);
+
+//! Records the outcome of a poll.
+void spi_xfer_poller_note(struct spi_xfer_poller* poller, bool got_frame);
+
+struct spi_xfer_stats {
+	uint64_t transactions;
+
+	//! Transactions which moved no frame in either direction, including
+	//! those which came up short.
+	uint64_t wasted;
+
+	//! Transactions which re-sent a frame the NCP had refused.
+	uint64_t retries;
+
+	//! Transactions which found out the NCP's frame was too big for
+	//! the room we made, so that it took another one.
+	uint64_t short_reads;
+
+	uint64_t clocked_bytes;
+	uint64_t payload_bytes;
+
+	//! From when a frame was known to be waiting (the NCP's interrupt or
+	//! a frame from the host) to the transaction that moved it.
+	uint64_t latency_count;
+	uint64_t latency_sum_us;
+	uint32_t latency_max_us;
+};
+
+void spi_xfer_stats_note_transaction(struct spi_xfer_stats* stats, size_t clocked, size_t rx_len, size_t tx_len);
+void spi_xfer_stats_note_latency(struct spi_xfer_stats* stats, uint64_t latency_us);
+
+//! Microseconds on the monotonic clock.
+uint64_t spi_xfer_time_us(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // wpantund_spi_xfer_h
@@ -0,0 +1,212 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Measures how efficiently `nl::SpiSocket` uses the SPI bus against
+ *      a simulated NCP, with fixed small-packet transactions and with
+ *      transactions sized from recent traffic.
+ *
+ *      For several mixes of frame sizes, it reports transactions per
+ *      frame, how many transactions were wasted or came up short, how
+ *      many bytes were clocked per byte of frame, and the throughput
+ *      the bus would reach given the cost of each transaction.
+ *
+ *      Usage: spi_socket_bench [frame-count] [speed-hz]
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <list>
+#include <string>
+
+#include "SpiSocket.h"
+
+using namespace nl;
+
+#define BENCH_CS_DELAY_US          20
+#define BENCH_SYSCALL_US           50
+
+struct FrameMix {
+	const char* mName;
+
+	// A frame is `mBigPercent` percent likely to be between
+	// `mBigMin` and `mBigMax` bytes, and otherwise between
+	// `mSmallMin` and `mSmallMax` bytes.
+	int mSmallMin, mSmallMax;
+	int mBigMin, mBigMax;
+	int mBigPercent;
+
+	// Percent chance that the host has a frame to send alongside.
+	int mHostPercent;
+};
+
+static const FrameMix kMixes[] = {
+	{ "small",   8,  30,   8,  30,   0, 50 },
+	{ "802154", 10,  30, 100, 127,  80, 20 },
+	{ "mixed",  10,  30, 100, 127,  30, 50 },
+	{ "ip6",    10,  30, 200, 1280, 50, 20 },
+};
+
+static uint32_t sSeed = 1;
+
+static int
+bench_random(int min, int max)
+{
+	sSeed = sSeed * 1103515245 + 12345;
+	return min + static_cast<int>((sSeed >> 8) % static_cast<uint32_t>(max - min + 1));
+}
+
+// An NCP which always answers, and counts what went over the bus.
+class BenchNcp : public SpiSocket::Device {
+public:
+	BenchNcp() : mTransferCount(0), mClockedBytes(0)
+	{
+		if (pipe(mInterruptFDs) < 0) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	virtual ~BenchNcp()
+	{
+		close(mInterruptFDs[0]);
+		close(mInterruptFDs[1]);
+	}
+
+	virtual int
+	transfer(const uint8_t* tx, uint8_t* rx, size_t len)
+	{
+		const uint16_t host_accept_len = tx[1] | (tx[2] << 8);
+		const uint16_t data_len = mToHost.empty() ? 0 : static_cast<uint16_t>(mToHost.front().size());
+
+		mTransferCount++;
+		mClockedBytes += len;
+
+		memset(rx, 0xFF, len);
+		rx[0] = 0x02;
+		rx[1] = SpiSocket::kMaxPayloadSize & 0xFF;
+		rx[2] = SpiSocket::kMaxPayloadSize >> 8;
+		rx[3] = data_len & 0xFF;
+		rx[4] = data_len >> 8;
+
+		if ((data_len != 0) && (data_len <= host_accept_len)) {
+			memcpy(rx + SpiSocket::kHeaderLen, mToHost.front().data(), data_len);
+			mToHost.pop_front();
+		}
+
+		return 0;
+	}
+
+	virtual int
+	get_interrupt_fd(void) const
+	{
+		return mInterruptFDs[0];
+	}
+
+	virtual bool
+	interrupt_is_asserted(void)
+	{
+		return !mToHost.empty();
+	}
+
+	unsigned long mTransferCount;
+	unsigned long long mClockedBytes;
+	std::list<std::string> mToHost;
+
+private:
+	int mInterruptFDs[2];
+};
+
+static void
+bench_mix(const FrameMix& mix, bool adaptive, int frame_count, uint32_t speed_hz)
+{
+	BenchNcp* ncp = new BenchNcp();
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+	uint8_t buffer[SpiSocket::kMaxPayloadSize];
+	unsigned long long payload_bytes = 0;
+	double bus_sec;
+	int i;
+
+	socket->set_adaptive(adaptive);
+	socket->set_transaction_overhead(spi_xfer_overhead_bytes(speed_hz, BENCH_CS_DELAY_US));
+	sSeed = 1;
+
+	for (i = 0; i < frame_count; i++) {
+		const bool big = bench_random(1, 100) <= mix.mBigPercent;
+		const int len = big ? bench_random(mix.mBigMin, mix.mBigMax) : bench_random(mix.mSmallMin, mix.mSmallMax);
+
+		ncp->mToHost.push_back(std::string(static_cast<size_t>(len), 'x'));
+		payload_bytes += len;
+
+		if (bench_random(1, 100) <= mix.mHostPercent) {
+			const int host_len = bench_random(mix.mSmallMin, mix.mSmallMax);
+
+			socket->write(buffer, static_cast<size_t>(host_len));
+			payload_bytes += host_len;
+		}
+
+		while (ncp->interrupt_is_asserted() || !socket->can_write() || socket->can_read()) {
+			socket->process();
+
+			while (socket->read(buffer, sizeof(buffer)) > 0) {
+			}
+		}
+	}
+
+	// Flush anything the host still has queued.
+	socket->process();
+
+	const SpiSocket::Stats& stats = socket->get_stats();
+
+	bus_sec = (ncp->mTransferCount * (BENCH_CS_DELAY_US + BENCH_SYSCALL_US)) / 1.0e6
+		+ (ncp->mClockedBytes * 8.0) / speed_hz;
+
+	printf("%-8s %-9s %8.3f %8.2f%% %8.2f%% %8.2f %10.1f\n",
+		mix.mName,
+		adaptive ? "adaptive" : "fixed",
+		static_cast<double>(stats.mXfer.transactions) / (stats.mRxFrameCount + stats.mTxFrameCount),
+		100.0 * stats.mXfer.wasted / stats.mXfer.transactions,
+		100.0 * stats.mXfer.short_reads / stats.mXfer.transactions,
+		static_cast<double>(stats.mXfer.clocked_bytes) / payload_bytes,
+		payload_bytes / bus_sec / 1024.0
+	);
+}
+
+int
+main(int argc, char* argv[])
+{
+	const int frame_count = (argc > 1) ? atoi(argv[1]) : 20000;
+	const uint32_t speed_hz = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], NULL, 0)) : 1000000;
+	size_t i;
+
+	printf("%d frames from the NCP per mix, at %u Hz\n\n", frame_count, speed_hz);
+	printf("%-8s %-9s %8s %9s %9s %8s %10s\n", "mix", "sizing", "xfer/frm", "wasted", "short", "clk/byte", "KiB/s");
+
+	for (i = 0; i < sizeof(kMixes) / sizeof(kMixes[0]); i++) {
+		bench_mix(kMixes[i], false, frame_count, speed_hz);
+		bench_mix(kMixes[i], true, frame_count, speed_hz);
+	}
+
+	return EXIT_SUCCESS;
+}
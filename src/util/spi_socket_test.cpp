@@ -0,0 +1,396 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Runs `nl::SpiSocket` against a simulated NCP to check frame
+ *      exchange, adaptive transaction sizing, flow control, header alignment
+ *      and the handling of misbehaving NCPs.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <list>
+#include <string>
+
+#include "SpiSocket.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+// The NCP's side of the SPI framing, with knobs for misbehaving.
+class SimulatedNcp : public SpiSocket::Device {
+public:
+	enum Behavior {
+		kNormal,
+		kSilent,            // Clocks out nothing but 0xFF
+		kGarbage,
+	};
+
+	SimulatedNcp(bool has_interrupt)
+		: mBehavior(kNormal)
+		, mAcceptLen(SpiSocket::kMaxPayloadSize)
+		, mLeadingFF(0)
+		, mResetFlag(false)
+		, mHostResetFlagSeen(false)
+		, mTransferCount(0)
+		, mResetCount(0)
+	{
+		mInterruptFDs[0] = mInterruptFDs[1] = -1;
+
+		if (has_interrupt && (pipe(mInterruptFDs) < 0)) {
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	virtual ~SimulatedNcp()
+	{
+		close(mInterruptFDs[0]);
+		close(mInterruptFDs[1]);
+	}
+
+	virtual int
+	transfer(const uint8_t* tx, uint8_t* rx, size_t len)
+	{
+		const uint16_t host_accept_len = tx[1] | (tx[2] << 8);
+		const uint16_t host_data_len = tx[3] | (tx[4] << 8);
+		const uint16_t data_len = mToHost.empty() ? 0 : static_cast<uint16_t>(mToHost.front().size());
+		uint8_t* header = rx + mLeadingFF;
+
+		mTransferCount++;
+
+		if (mTransferCount == 1) {
+			mHostResetFlagSeen = ((tx[0] & 0x80) != 0);
+		}
+
+		memset(rx, 0xFF, len);
+
+		if (mBehavior == kSilent) {
+			return 0;
+		}
+
+		if (mBehavior == kGarbage) {
+			header[0] = 0x55;
+			return 0;
+		}
+
+		header[0] = 0x02 | (mResetFlag ? 0x80 : 0);
+		header[1] = mAcceptLen & 0xFF;
+		header[2] = mAcceptLen >> 8;
+		header[3] = data_len & 0xFF;
+		header[4] = data_len >> 8;
+		mResetFlag = false;
+
+		if ((host_data_len != 0) && (host_data_len <= mAcceptLen)) {
+			mFromHost.push_back(std::string(reinterpret_cast<const char*>(tx + SpiSocket::kHeaderLen), host_data_len));
+		}
+
+		if ((data_len != 0) && (data_len <= host_accept_len)) {
+			memcpy(header + SpiSocket::kHeaderLen, mToHost.front().data(), data_len);
+			mToHost.pop_front();
+		}
+
+		return 0;
+	}
+
+	virtual int
+	get_interrupt_fd(void) const
+	{
+		return mInterruptFDs[0];
+	}
+
+	virtual bool
+	interrupt_is_asserted(void)
+	{
+		return !mToHost.empty();
+	}
+
+	virtual void
+	reset(void)
+	{
+		mResetCount++;
+	}
+
+	Behavior mBehavior;
+	uint16_t mAcceptLen;
+	unsigned int mLeadingFF;
+	bool mResetFlag;
+	bool mHostResetFlagSeen;
+	unsigned int mTransferCount;
+	unsigned int mResetCount;
+	std::list<std::string> mToHost;
+	std::list<std::string> mFromHost;
+
+private:
+	int mInterruptFDs[2];
+};
+
+static bool
+read_equals(boost::shared_ptr<SpiSocket> socket, const std::string& expected)
+{
+	char buffer[SpiSocket::kMaxPayloadSize];
+	ssize_t len = socket->read(buffer, sizeof(buffer));
+
+	return (len == static_cast<ssize_t>(expected.size())) && (memcmp(buffer, expected.data(), len) == 0);
+}
+
+static void
+test_exchange(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(true);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+	char buffer[16];
+	cms_t timeout = CMS_DISTANT_FUTURE;
+
+	test_check(socket->is_framed(), "SPI socket is framed");
+	test_check(!socket->can_read(), "Nothing to read at first");
+	test_check(socket->read(buffer, sizeof(buffer)) == 0, "Empty read returns zero");
+
+	// Idle with the interrupt line deasserted, nothing happens.
+	socket->update_fd_interest(NULL, &timeout);
+	test_check(timeout == CMS_DISTANT_FUTURE, "Idle socket waits for the interrupt");
+	test_check(socket->process() == 0 && ncp->mTransferCount == 0, "No transaction while idle");
+
+	test_check(socket->write("\x81\x02\x00", 3) == 3, "Write frame");
+
+	timeout = CMS_DISTANT_FUTURE;
+	socket->update_fd_interest(NULL, &timeout);
+	test_check(timeout == 0, "Pending frame wants a transaction");
+
+	test_check(socket->process() == 0, "Process");
+	test_check(ncp->mHostResetFlagSeen, "First header carries the reset flag");
+	test_check(ncp->mFromHost.size() == 1 && ncp->mFromHost.front() == std::string("\x81\x02\x00", 3), "NCP got the frame");
+
+	ncp->mToHost.push_back(std::string("\x80\x06\x00\x70", 4));
+	test_check(socket->process() == 0, "Process");
+	test_check(socket->can_read(), "Frame received");
+	test_check(read_equals(socket, std::string("\x80\x06\x00\x70", 4)), "Received frame contents");
+	test_check(!socket->can_read(), "Only one frame");
+}
+
+static void
+test_large_frame(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(true);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+	const std::string frame(200, 'x');
+
+	// More than a small packet, so the first transaction only tells us
+	// how much room the second one needs.
+	ncp->mToHost.push_back(frame);
+	socket->process();
+
+	test_check(ncp->mTransferCount == 2, "Large frame takes two transactions");
+	test_check(read_equals(socket, frame), "Large frame contents");
+}
+
+static void
+test_adaptive_sizing(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(true);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+	const std::string frame(200, 'x');
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		ncp->mToHost.push_back(frame);
+		socket->process();
+		test_check(read_equals(socket, frame), "Adaptive frame contents");
+	}
+
+	// After the first, the NCP's frames were expected to be this big.
+	test_check(ncp->mTransferCount == 5, "Transactions sized for the usual frame");
+	test_check(socket->get_stats().mXfer.short_reads == 1, "Only the first frame didn't fit");
+	test_check(socket->get_stats().mXfer.wasted == 1, "Only the short transaction was wasted");
+
+	socket->set_adaptive(false);
+	ncp->mToHost.push_back(frame);
+	socket->process();
+	test_check(ncp->mTransferCount == 7, "Small packets when not adaptive");
+}
+
+static void
+test_duplex(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(true);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+
+	ncp->mToHost.push_back("in");
+	socket->write("out", 3);
+	socket->process();
+
+	test_check(ncp->mTransferCount == 1, "One transaction each way");
+	test_check(socket->get_stats().mDuplexCount == 1, "Counted as duplex");
+	test_check(read_equals(socket, "in") && ncp->mFromHost.front() == "out", "Both frames made it");
+}
+
+static void
+test_refused(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(true);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+	cms_t timeout = CMS_DISTANT_FUTURE;
+
+	ncp->mAcceptLen = 0;
+	socket->write("frame", 5);
+	socket->process();
+
+	test_check(ncp->mFromHost.empty(), "Refused frame not taken");
+	test_check(ncp->mTransferCount == 1, "No retries within the backoff");
+	test_check(socket->get_stats().mTxRefusedCount == 1, "Refusal counted");
+
+	socket->update_fd_interest(NULL, &timeout);
+	test_check(timeout <= 1, "Retries as soon as the backoff is up");
+
+	ncp->mAcceptLen = SpiSocket::kMaxPayloadSize;
+	usleep(2000);
+	socket->process();
+
+	test_check(ncp->mFromHost.size() == 1, "Retried frame taken");
+}
+
+static void
+test_queue_limits(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(true);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+	struct iovec iov[SpiSocket::kQueueFrames + 1];
+	char big[SpiSocket::kMaxPayloadSize + 1];
+	int i;
+
+	memset(big, 0, sizeof(big));
+	test_check(socket->write(big, sizeof(big)) == -EMSGSIZE, "Oversized frame rejected");
+
+	for (i = 0; i < SpiSocket::kQueueFrames + 1; i++) {
+		iov[i].iov_base = const_cast<char*>("abc");
+		iov[i].iov_len = 3;
+	}
+
+	test_check(socket->writev(iov, SpiSocket::kQueueFrames + 1) == 3 * SpiSocket::kQueueFrames, "writev stops when the queue is full");
+	test_check(!socket->can_write(), "Full queue isn't writable");
+	test_check(socket->write("abc", 3) == -EAGAIN, "Write to full queue");
+
+	socket->process();
+	test_check(ncp->mFromHost.size() == SpiSocket::kQueueFrames, "Whole queue sent");
+	test_check(socket->can_write(), "Writable again");
+
+	// Frames stay with the NCP while we have nowhere to put them.
+	for (i = 0; i < SpiSocket::kQueueFrames + 2; i++) {
+		ncp->mToHost.push_back(std::string(1, 'a' + i));
+	}
+
+	socket->process();
+	test_check(ncp->mToHost.size() == 2, "Receiving stops when the queue is full");
+
+	test_check(read_equals(socket, "a"), "Oldest frame first");
+	socket->process();
+	test_check(ncp->mToHost.size() == 1, "Room for one more");
+}
+
+static void
+test_alignment(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(true);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp, 4);
+
+	ncp->mLeadingFF = 3;
+	ncp->mToHost.push_back("late");
+	socket->process();
+
+	test_check(read_equals(socket, "late"), "Late header found");
+}
+
+static void
+test_misbehaving(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(true);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+
+	ncp->mBehavior = SimulatedNcp::kSilent;
+	socket->write("x", 1);
+	socket->process();
+	test_check(socket->get_stats().mUnresponsiveCount == 1, "Silent NCP noticed");
+
+	ncp->mBehavior = SimulatedNcp::kGarbage;
+	usleep(2000);
+	socket->process();
+	test_check(socket->get_stats().mGarbageCount == 1, "Garbage header noticed");
+	test_check(socket->get_stats().mValidCount == 0, "Nothing valid yet");
+
+	ncp->mBehavior = SimulatedNcp::kNormal;
+	ncp->mResetFlag = true;
+	usleep(2000);
+	socket->process();
+	test_check(socket->get_stats().mSlaveResetCount == 1, "NCP reset noticed");
+	test_check(ncp->mFromHost.size() == 1, "Frame went out once the NCP recovered");
+
+	socket->write("y", 1);
+	socket->reset();
+	test_check(ncp->mResetCount == 1, "Reset line pulsed");
+	test_check(socket->process() == 0 && ncp->mFromHost.size() == 1, "Reset discards queued frames");
+}
+
+static void
+test_polling(void)
+{
+	SimulatedNcp* ncp = new SimulatedNcp(false);
+	boost::shared_ptr<SpiSocket> socket = SpiSocket::create(ncp);
+	cms_t timeout = CMS_DISTANT_FUTURE;
+
+	socket->process();
+	test_check(ncp->mTransferCount == 1, "First poll is immediate");
+
+	socket->process();
+	test_check(ncp->mTransferCount == 1, "No poll before the period is up");
+
+	socket->update_fd_interest(NULL, &timeout);
+	test_check(timeout > 0 && timeout <= SpiSocket::kMaxPollPeriod, "Wakes up for the next poll");
+
+	usleep((SpiSocket::kMaxPollPeriod + 5) * 1000);
+	ncp->mToHost.push_back("1");
+	ncp->mToHost.push_back("2");
+	socket->process();
+	test_check(read_equals(socket, "1") && read_equals(socket, "2"), "Polls again right away after a frame");
+
+	timeout = CMS_DISTANT_FUTURE;
+	socket->update_fd_interest(NULL, &timeout);
+	test_check(timeout < SpiSocket::kMaxPollPeriod, "Polls sooner while the NCP is busy");
+}
+
+int
+main(void)
+{
+	test_exchange();
+	test_large_frame();
+	test_adaptive_sizing();
+	test_duplex();
+	test_refused();
+	test_queue_limits();
+	test_alignment();
+	test_misbehaving();
+	test_polling();
+
+	return test_exit_status();
+}
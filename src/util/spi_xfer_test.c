@@ -0,0 +1,161 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Unit tests for SPI transaction sizing, polling and statistics.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi-xfer.h"
+#include "test-utils.h"
+
+#define TEST_MIN_LEN               32
+#define TEST_MAX_LEN               2043
+#define TEST_OVERHEAD              8
+
+static void
+test_sizer(void)
+{
+	struct spi_xfer_sizer sizer;
+	int i;
+
+	spi_xfer_sizer_init(&sizer, TEST_MIN_LEN, TEST_MAX_LEN, TEST_OVERHEAD);
+	test_check(spi_xfer_sizer_get_len(&sizer) == TEST_MIN_LEN, "Starts at the minimum");
+
+	// Small frames never need more than the minimum.
+	for (i = 0; i < SPI_XFER_HISTORY_LEN; i++) {
+		spi_xfer_sizer_note_frame(&sizer, 10);
+	}
+	test_check(spi_xfer_sizer_get_len(&sizer) == TEST_MIN_LEN, "Small frames keep the minimum");
+
+	// Once most frames are big, making room for them is cheaper than
+	// a second transaction for each.
+	for (i = 0; i < SPI_XFER_HISTORY_LEN; i++) {
+		spi_xfer_sizer_note_frame(&sizer, 120);
+	}
+	test_check(spi_xfer_sizer_get_len(&sizer) == 120, "Grows to fit big frames");
+
+	// One huge frame among many medium ones isn't worth clocking for
+	// on every transaction.
+	spi_xfer_sizer_note_frame(&sizer, 1500);
+	test_check(spi_xfer_sizer_get_len(&sizer) == 120, "Ignores an outlier");
+
+	// And the history is forgotten in time.
+	for (i = 0; i < SPI_XFER_HISTORY_LEN; i++) {
+		spi_xfer_sizer_note_frame(&sizer, 10);
+	}
+	test_check(spi_xfer_sizer_get_len(&sizer) == TEST_MIN_LEN, "Shrinks back once traffic is small");
+
+	spi_xfer_sizer_note_frame(&sizer, 5000);
+	test_check(sizer.history[(sizer.history_next + SPI_XFER_HISTORY_LEN - 1) % SPI_XFER_HISTORY_LEN] == TEST_MAX_LEN, "Frame lengths are clamped");
+
+	spi_xfer_sizer_init(&sizer, TEST_MIN_LEN, TEST_MAX_LEN, TEST_OVERHEAD);
+	spi_xfer_sizer_set_adaptive(&sizer, false);
+	for (i = 0; i < SPI_XFER_HISTORY_LEN; i++) {
+		spi_xfer_sizer_note_frame(&sizer, 120);
+	}
+	test_check(spi_xfer_sizer_get_len(&sizer) == TEST_MIN_LEN, "Fixed sizing stays at the minimum");
+}
+
+static void
+test_sizer_overhead(void)
+{
+	struct spi_xfer_sizer cheap;
+	struct spi_xfer_sizer costly;
+	int i;
+
+	// A quarter of the frames need 100 bytes. Whether making room for
+	// them is worth it depends on what a second transaction costs.
+	spi_xfer_sizer_init(&cheap, TEST_MIN_LEN, TEST_MAX_LEN, 0);
+	spi_xfer_sizer_init(&costly, TEST_MIN_LEN, TEST_MAX_LEN, 200);
+
+	for (i = 0; i < SPI_XFER_HISTORY_LEN; i++) {
+		const uint16_t len = (i % 4 == 0) ? 100 : 10;
+
+		spi_xfer_sizer_note_frame(&cheap, len);
+		spi_xfer_sizer_note_frame(&costly, len);
+	}
+
+	test_check(spi_xfer_sizer_get_len(&cheap) == TEST_MIN_LEN, "Cheap transactions favor the minimum");
+	test_check(spi_xfer_sizer_get_len(&costly) == 100, "Costly transactions favor fitting every frame");
+
+	test_check(spi_xfer_overhead_bytes(1000000, 20) == 8, "Overhead at 1MHz");
+	test_check(spi_xfer_overhead_bytes(8000000, 0) == 50, "Overhead at 8MHz");
+}
+
+static void
+test_poller(void)
+{
+	struct spi_xfer_poller poller;
+
+	spi_xfer_poller_init(&poller, 2, 33);
+	test_check(poller.period_ms == 33, "Starts slow");
+
+	spi_xfer_poller_note(&poller, true);
+	test_check(poller.period_ms == 2, "Speeds up on a frame");
+
+	spi_xfer_poller_note(&poller, false);
+	spi_xfer_poller_note(&poller, false);
+	test_check(poller.period_ms == 8, "Backs off while quiet");
+
+	spi_xfer_poller_note(&poller, false);
+	spi_xfer_poller_note(&poller, false);
+	spi_xfer_poller_note(&poller, false);
+	test_check(poller.period_ms == 33, "Backs off no further than the maximum");
+}
+
+static void
+test_stats(void)
+{
+	struct spi_xfer_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+
+	spi_xfer_stats_note_transaction(&stats, 37, 0, 0);
+	spi_xfer_stats_note_transaction(&stats, 37, 20, 0);
+	spi_xfer_stats_note_transaction(&stats, 105, 0, 100);
+
+	test_check(stats.transactions == 3, "Transactions counted");
+	test_check(stats.wasted == 1, "Wasted transaction counted");
+	test_check(stats.clocked_bytes == 179, "Clocked bytes counted");
+	test_check(stats.payload_bytes == 120, "Payload bytes counted");
+
+	spi_xfer_stats_note_latency(&stats, 100);
+	spi_xfer_stats_note_latency(&stats, 300);
+
+	test_check(stats.latency_count == 2 && stats.latency_sum_us == 400, "Latency summed");
+	test_check(stats.latency_max_us == 300, "Latency maximum");
+}
+
+int
+main(void)
+{
+	test_sizer();
+	test_sizer_overhead();
+	test_poller();
+	test_stats();
+
+	return test_exit_status();
+}
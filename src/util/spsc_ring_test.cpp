@@ -0,0 +1,163 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Checks `nl::SPSCRing` on its own and with a producer and a
+ *      consumer running on separate threads.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "SPSCRing.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+#define TEST_ELEMENT_COUNT         2000000
+
+static void
+test_single_thread(void)
+{
+	SPSCRing<int, 4> ring;
+	int i;
+
+	test_check(ring.empty() && (ring.front() == NULL), "Starts empty");
+
+	for (i = 0; i < 4; i++) {
+		int* slot = ring.back();
+
+		test_check(slot != NULL, "Room while not full");
+
+		if (slot != NULL) {
+			*slot = i;
+			ring.push();
+		}
+	}
+
+	test_check(ring.full() && (ring.back() == NULL), "Full after four");
+
+	for (i = 0; i < 4; i++) {
+		int* slot = ring.front();
+
+		test_check((slot != NULL) && (*slot == i), "Elements in order");
+		ring.pop();
+
+		// Wrap around while the ring is partially full.
+		if ((slot = ring.back()) != NULL) {
+			*slot = 4 + i;
+			ring.push();
+		}
+	}
+
+	test_check(ring.size() == 4, "Refilled while draining");
+
+	for (i = 4; i < 8; i++) {
+		int* slot = ring.front();
+
+		test_check((slot != NULL) && (*slot == i), "Elements in order after wrap");
+		ring.pop();
+	}
+
+	test_check(ring.empty(), "Empty after draining");
+}
+
+// Large enough that a torn read of a slot would be noticed.
+struct Element {
+	uint32_t mSequence;
+	uint8_t mPayload[60];
+};
+
+static SPSCRing<Element, 64> sRing;
+
+static void*
+producer(void* context)
+{
+	uint32_t sequence = 0;
+
+	while (sequence < TEST_ELEMENT_COUNT) {
+		Element* element = sRing.back();
+
+		if (element == NULL) {
+			sched_yield();
+			continue;
+		}
+
+		element->mSequence = sequence;
+		memset(element->mPayload, sequence & 0xFF, sizeof(element->mPayload));
+		sRing.push();
+		sequence++;
+	}
+
+	return NULL;
+}
+
+static void
+test_two_threads(void)
+{
+	pthread_t thread;
+	uint32_t expected = 0;
+	bool in_order = true;
+	bool intact = true;
+
+	if (pthread_create(&thread, NULL, &producer, NULL) != 0) {
+		perror("pthread_create");
+		exit(EXIT_FAILURE);
+	}
+
+	while (expected < TEST_ELEMENT_COUNT) {
+		const Element* element = sRing.front();
+		size_t i;
+
+		if (element == NULL) {
+			sched_yield();
+			continue;
+		}
+
+		in_order &= (element->mSequence == expected);
+
+		for (i = 0; i < sizeof(element->mPayload); i++) {
+			intact &= (element->mPayload[i] == (expected & 0xFF));
+		}
+
+		sRing.pop();
+		expected++;
+	}
+
+	pthread_join(thread, NULL);
+
+	test_check(in_order, "Elements in order across threads");
+	test_check(intact, "Elements intact across threads");
+	test_check(sRing.empty(), "Empty after transfer");
+}
+
+int
+main(void)
+{
+	test_single_thread();
+	test_two_threads();
+
+	return test_exit_status();
+}
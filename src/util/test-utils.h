@@ -0,0 +1,72 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Checks shared by the unit tests. Only to be included by the
+ *      single source file of a test program.
+ *
+ */
+
+#ifndef TEST_UTILS_HEADER_INCLUDED
+#define TEST_UTILS_HEADER_INCLUDED 1
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Exit status telling automake that the test was skipped. */
+#define EXIT_SKIPPED 77
+
+/* Number of checks that failed so far. */
+static int sErrors;
+
+/* Counts a failed check, unless `cond` holds, and prints the message
+ * given by `format`. */
+static inline void
+test_checkf(int cond, const char* format, ...)
+{
+	va_list args;
+
+	if (!cond) {
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+		printf("\n");
+		sErrors++;
+	}
+}
+
+static inline void
+test_check(int cond, const char* what)
+{
+	test_checkf(cond, "%s failed", what);
+}
+
+/* Prints how the test went, and returns the exit status for `main()`. */
+static inline int
+test_exit_status(void)
+{
+	if (sErrors != 0) {
+		printf("FAIL\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("OK\n");
+	return EXIT_SUCCESS;
+}
+
+#endif // TEST_UTILS_HEADER_INCLUDED
@@ -0,0 +1,253 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Cost of arming, re-arming, cancelling and firing many concurrent
+ *      `nl::Timer`s, compared against the sorted linked list the timer
+ *      module used to keep.
+ *
+ *      Usage: timer_bench [timer-count]
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <boost/bind.hpp>
+
+#include "Timer.h"
+
+using namespace nl;
+
+static uint32_t sSeed = 1;
+
+static uint32_t
+bench_random(void)
+{
+	sSeed = sSeed * 1103515245 + 12345;
+	return (sSeed >> 8) & 0xFFFFFF;
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+// ----------------------------------------------------------------------------
+// MARK: Reference implementation
+
+// The sorted singly linked list `nl::Timer` used before the heap.
+struct RefTimer {
+	cms_t mFireTime;
+	RefTimer* mNext;
+};
+
+static RefTimer* sRefHead;
+
+static void
+ref_remove(RefTimer* timer)
+{
+	RefTimer** iter;
+
+	for (iter = &sRefHead; *iter != NULL; iter = &(*iter)->mNext) {
+		if (*iter == timer) {
+			*iter = timer->mNext;
+			timer->mNext = NULL;
+			return;
+		}
+	}
+}
+
+static void
+ref_schedule(RefTimer* timer, cms_t interval)
+{
+	RefTimer** iter;
+
+	ref_remove(timer);
+
+	timer->mFireTime = time_ms() + interval;
+
+	for (iter = &sRefHead; *iter != NULL; iter = &(*iter)->mNext) {
+		if (timer->mFireTime - (*iter)->mFireTime < 0) {
+			break;
+		}
+	}
+
+	timer->mNext = *iter;
+	*iter = timer;
+}
+
+static size_t
+ref_process(void)
+{
+	size_t fired = 0;
+
+	while ((sRefHead != NULL) && (sRefHead->mFireTime - time_ms() <= 0)) {
+		RefTimer* timer = sRefHead;
+
+		sRefHead = timer->mNext;
+		timer->mNext = NULL;
+		fired++;
+	}
+
+	return fired;
+}
+
+// ----------------------------------------------------------------------------
+// MARK: Benchmarks
+
+static size_t sFired;
+
+static void
+count_fired(Timer* timer)
+{
+	sFired++;
+}
+
+static void
+report(const char* name, const char* impl, size_t ops, double elapsed)
+{
+	printf("  %-10s %-6s %10.3f ms %9.1f ns/op\n", name, impl, elapsed * 1.0e3, elapsed * 1.0e9 / ops);
+}
+
+static void
+bench_arm(size_t count, size_t rounds)
+{
+	std::vector<Timer> timers(count);
+	std::vector<RefTimer> ref_timers(count);
+	std::vector<cms_t> intervals(count * rounds);
+	const Timer::Callback callback(&count_fired);
+	double start;
+	size_t i, round;
+
+	for (i = 0; i < intervals.size(); i++) {
+		intervals[i] = 1000 + bench_random() % 600000;
+	}
+
+	printf("%zu timers, %zu rounds of re-arming:\n", count, rounds);
+
+	start = now_sec();
+	for (i = 0; i < count; i++) {
+		ref_timers[i].mNext = NULL;
+		ref_schedule(&ref_timers[i], intervals[i]);
+	}
+	report("arm", "list", count, now_sec() - start);
+
+	start = now_sec();
+	for (i = 0; i < count; i++) {
+		timers[i].schedule(intervals[i], callback);
+	}
+	report("arm", "heap", count, now_sec() - start);
+
+	start = now_sec();
+	for (round = 1; round < rounds; round++) {
+		for (i = 0; i < count; i++) {
+			ref_schedule(&ref_timers[i], intervals[round * count + i]);
+		}
+	}
+	report("re-arm", "list", count * (rounds - 1), now_sec() - start);
+
+	start = now_sec();
+	for (round = 1; round < rounds; round++) {
+		for (i = 0; i < count; i++) {
+			timers[i].schedule(intervals[round * count + i], callback);
+		}
+	}
+	report("re-arm", "heap", count * (rounds - 1), now_sec() - start);
+
+	start = now_sec();
+	for (i = 0; i < count; i++) {
+		ref_remove(&ref_timers[i]);
+	}
+	report("cancel", "list", count, now_sec() - start);
+
+	start = now_sec();
+	for (i = 0; i < count; i++) {
+		timers[i].cancel();
+	}
+	report("cancel", "heap", count, now_sec() - start);
+}
+
+// Arms `count` timers due over the next `spread` ms and runs them all,
+// timing only the calls that fire timers (not the time spent waiting).
+static void
+bench_fire(size_t count, cms_t spread)
+{
+	std::vector<Timer> timers(count);
+	std::vector<RefTimer> ref_timers(count);
+	const Timer::Callback callback(&count_fired);
+	double elapsed = 0;
+	size_t fired = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		ref_timers[i].mNext = NULL;
+		ref_schedule(&ref_timers[i], 1 + bench_random() % spread);
+	}
+
+	while (fired < count) {
+		double start = now_sec();
+		fired += ref_process();
+		elapsed += now_sec() - start;
+		usleep(500);
+	}
+	report("fire", "list", count, elapsed);
+
+	for (i = 0; i < count; i++) {
+		timers[i].schedule(1 + bench_random() % spread, callback);
+	}
+
+	elapsed = 0;
+	sFired = 0;
+
+	while (sFired < count) {
+		double start = now_sec();
+		Timer::process();
+		elapsed += now_sec() - start;
+		usleep(500);
+	}
+	report("fire", "heap", count, elapsed);
+}
+
+int
+main(int argc, char* argv[])
+{
+	size_t count = 10000;
+
+	if (argc > 1) {
+		count = strtoul(argv[1], NULL, 0);
+	}
+
+	if (count == 0) {
+		fprintf(stderr, "Timer count must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_arm(count, 5);
+	bench_fire(count, 200);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Checks ordering, cancellation, periodic restarts and slack
+ *      coalescing of `nl::Timer`.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include <boost/bind.hpp>
+
+#include "Timer.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+static uint32_t sSeed = 1;
+
+static uint32_t
+test_random(void)
+{
+	sSeed = sSeed * 1103515245 + 12345;
+	return (sSeed >> 8) & 0xFFFFFF;
+}
+
+// Runs the timers until none are left or `limit` ms have passed.
+static void
+run_timers(cms_t limit)
+{
+	const cms_t start = time_ms();
+
+	while ((Timer::get_scheduled_count() != 0) && (time_ms() - start < limit)) {
+		cms_t timeout = CMS_DISTANT_FUTURE;
+
+		Timer::update_timeout(&timeout);
+
+		if (timeout > 0) {
+			usleep(timeout * 1000);
+		}
+
+		Timer::process();
+	}
+}
+
+struct Record {
+	std::vector<int> mFired;
+	std::vector<cms_t> mFiredAt;
+};
+
+static void
+record_fired(Timer* timer, Record* record, int id)
+{
+	record->mFired.push_back(id);
+	record->mFiredAt.push_back(time_ms());
+}
+
+static void
+test_ordering(void)
+{
+	static const int kCount = 300;
+	std::vector<Timer> timers(kCount);
+	std::vector<cms_t> expected(kCount);
+	Record record;
+	int i;
+
+	for (i = 0; i < kCount; i++) {
+		cms_t interval = 1 + test_random() % 40;
+
+		expected[i] = time_ms() + interval;
+		timers[i].schedule(interval, boost::bind(&record_fired, _1, &record, i));
+	}
+
+	// Cancel every third timer, and reschedule some of the others.
+	for (i = 0; i < kCount; i += 3) {
+		timers[i].cancel();
+	}
+
+	for (i = 1; i < kCount; i += 6) {
+		cms_t interval = 1 + test_random() % 40;
+
+		expected[i] = time_ms() + interval;
+		timers[i].schedule(interval, boost::bind(&record_fired, _1, &record, i));
+	}
+
+	test_check(Timer::get_scheduled_count() == kCount - (kCount + 2) / 3, "Scheduled count");
+
+	run_timers(1000);
+
+	test_check(record.mFired.size() == kCount - (kCount + 2) / 3, "All timers fired");
+
+	for (i = 0; i < static_cast<int>(record.mFired.size()); i++) {
+		const int id = record.mFired[i];
+
+		test_check(id % 3 != 0, "Cancelled timer did not fire");
+		test_check(record.mFiredAt[i] - expected[id] >= 0, "Timer did not fire early");
+
+		if (i > 0) {
+			// Allow for `time_ms()` ticking between computing `expected` and scheduling.
+			test_check(expected[id] - expected[record.mFired[i - 1]] >= -1, "Timers fired in order");
+		}
+	}
+}
+
+static void
+cancel_other(Timer* timer, Timer* other, Record* record)
+{
+	other->cancel();
+	record_fired(timer, record, 0);
+}
+
+static void
+test_cancel_from_callback(void)
+{
+	Timer first;
+	Timer second;
+	Record record;
+
+	first.schedule(5, boost::bind(&cancel_other, _1, &second, &record));
+	second.schedule(5, boost::bind(&record_fired, _1, &record, 1));
+
+	run_timers(100);
+
+	test_check(record.mFired.size() == 1 && record.mFired[0] == 0, "Cancel from callback");
+}
+
+static void
+test_periodic(void)
+{
+	Timer timer;
+	Record record;
+	const cms_t scheduled_at = time_ms();
+
+	timer.schedule(3, boost::bind(&record_fired, _1, &record, 0), Timer::kPeriodicFixedRate);
+
+	while (record.mFired.size() < 5) {
+		run_timers(5);
+	}
+
+	timer.cancel();
+
+	test_check(Timer::get_scheduled_count() == 0, "Periodic timer cancelled");
+	// A late firing may be followed closely by the next one, but none
+	// may come before its time.
+	test_check(record.mFiredAt.back() - scheduled_at >= static_cast<cms_t>(record.mFired.size()) * 3, "Periodic timer interval");
+}
+
+static void
+test_slack(void)
+{
+	Timer lazy;
+	Timer strict;
+	Record record;
+	cms_t timeout = CMS_DISTANT_FUTURE;
+
+	// The lazy timer is due first, but may wait for the strict one.
+	lazy.set_slack(100);
+	lazy.schedule(10, boost::bind(&record_fired, _1, &record, 0));
+	strict.schedule(40, boost::bind(&record_fired, _1, &record, 1));
+
+	Timer::update_timeout(&timeout);
+	test_check(timeout > 10 && timeout <= 40, "Slack extends the timeout");
+
+	run_timers(200);
+
+	test_check(record.mFired.size() == 2, "Slack timers fired");
+	test_check(record.mFired.size() == 2 && record.mFiredAt[0] == record.mFiredAt[1], "Slack timers coalesced");
+}
+
+int
+main(void)
+{
+	test_ordering();
+	test_cancel_from_callback();
+	test_periodic();
+	test_slack();
+
+	return test_exit_status();
+}
@@ -0,0 +1,165 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Unit tests for `nl::UnixSocket` on sockets which keep message
+ *      boundaries, and for "unix:" socket paths.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "UnixSocket.h"
+#include "socket-utils.h"
+#include "test-utils.h"
+
+using namespace nl;
+
+static void
+make_pair(int type, int sv[2])
+{
+	if (socketpair(AF_UNIX, type, 0, sv) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+test_stream(void)
+{
+	int sv[2];
+
+	make_pair(SOCK_STREAM, sv);
+
+	{
+		boost::shared_ptr<SocketWrapper> socket = UnixSocket::create(sv[0], true);
+
+		test_check(!fd_keeps_message_boundaries(sv[1]), "Stream has no boundaries");
+		test_check(!socket->is_framed(), "Stream socket isn't framed");
+	}
+
+	close(sv[1]);
+
+	if (pipe(sv) < 0) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	test_check(!fd_keeps_message_boundaries(sv[0]), "Pipes have no boundaries");
+	close(sv[0]);
+	close(sv[1]);
+}
+
+static void
+test_seqpacket(void)
+{
+	int sv[2];
+	char buffer[16];
+	struct iovec iov[3];
+
+	make_pair(SOCK_SEQPACKET, sv);
+
+	boost::shared_ptr<SocketWrapper> socket = UnixSocket::create(sv[0], true);
+
+	test_check(fd_keeps_message_boundaries(sv[1]), "Seqpacket keeps boundaries");
+	test_check(socket->is_framed(), "Seqpacket socket is framed");
+
+	iov[0].iov_base = const_cast<char*>("one");
+	iov[0].iov_len = 3;
+	iov[1].iov_base = const_cast<char*>("two!");
+	iov[1].iov_len = 4;
+	iov[2].iov_base = const_cast<char*>("3");
+	iov[2].iov_len = 1;
+
+	test_check(socket->writev(iov, 3) == 8, "writev");
+	test_check(read(sv[1], buffer, sizeof(buffer)) == 3 && memcmp(buffer, "one", 3) == 0, "First buffer is its own message");
+	test_check(read(sv[1], buffer, sizeof(buffer)) == 4 && memcmp(buffer, "two!", 4) == 0, "Second buffer is its own message");
+	test_check(read(sv[1], buffer, sizeof(buffer)) == 1 && buffer[0] == '3', "Third buffer is its own message");
+
+	write(sv[1], "ab", 2);
+	write(sv[1], "cde", 3);
+	test_check(socket->read(buffer, sizeof(buffer)) == 2, "One message per read");
+	test_check(socket->read(buffer, sizeof(buffer)) == 3 && memcmp(buffer, "cde", 3) == 0, "Next message");
+
+	test_check(socket->enable_posted_reads() < 0 && !socket->has_posted_reads(), "No posted reads on a framed socket");
+
+	close(sv[1]);
+}
+
+static void
+test_unix_path(void)
+{
+	char path[sizeof(((struct sockaddr_un*)NULL)->sun_path)];
+	char socket_name[sizeof(path) + 8];
+	struct sockaddr_un addr;
+	int types[] = { SOCK_SEQPACKET, SOCK_STREAM };
+	size_t i;
+
+	snprintf(path, sizeof(path), "/tmp/unix_socket_test.%d", (int)getpid());
+	snprintf(socket_name, sizeof(socket_name), "unix:%s", path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	test_check(get_super_socket_type_from_path(socket_name) == SUPER_SOCKET_TYPE_UNIX, "unix: path type");
+
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		int listener = socket(AF_UNIX, types[i], 0);
+		int fd;
+
+		unlink(path);
+
+		if ((listener < 0) || (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(listener, 1) < 0)) {
+			perror("listen");
+			exit(EXIT_FAILURE);
+		}
+
+		fd = open_super_socket(socket_name);
+		test_check(fd >= 0, "Connect to a unix: path");
+
+		if (fd >= 0) {
+			test_check(fd_keeps_message_boundaries(fd) == (types[i] == SOCK_SEQPACKET), "Socket type follows the listener");
+			close_super_socket(fd);
+		}
+
+		close(listener);
+	}
+
+	unlink(path);
+	test_check(open_super_socket(socket_name) < 0, "Nobody listening");
+}
+
+int
+main(void)
+{
+	test_stream();
+	test_seqpacket();
+	test_unix_path();
+
+	return test_exit_status();
+}
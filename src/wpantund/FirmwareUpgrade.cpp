@@ -92,6 +92,7 @@ FirmwareUpgrade::close_upgrade_fd(void)
 {
 	if (mFirmwareUpgradeFD >= 0) {
 		IGNORE_RETURN_VALUE(write(mFirmwareUpgradeFD, "X", 1));
+		EventBackend::fd_closed(mFirmwareUpgradeFD);
 		close(mFirmwareUpgradeFD);
 		mFirmwareUpgradeFD = -1;
 	}
@@ -152,6 +153,7 @@ FirmwareUpgrade::set_firmware_upgrade_command(const std::string& command)
 	pid_t pid = -1;
 
 	if (mFirmwareUpgradeFD >= 0) {
+		EventBackend::fd_closed(mFirmwareUpgradeFD);
 		close(mFirmwareUpgradeFD);
 		mFirmwareUpgradeFD = -1;
 	}
@@ -390,17 +392,11 @@ FirmwareUpgrade::get_upgrade_status(void)
 }
 
 int
-FirmwareUpgrade::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout)
+FirmwareUpgrade::update_fd_interest(EventBackend *backend, cms_t *timeout)
 {
 	if ((mUpgradeStatus == EINPROGRESS) && (mFirmwareUpgradeFD >= 0)) {
-		if (read_fd_set != NULL) {
-			FD_SET(mFirmwareUpgradeFD, read_fd_set);
-		}
-		if (error_fd_set != NULL) {
-			FD_SET(mFirmwareUpgradeFD, error_fd_set);
-		}
-		if (max_fd != NULL) {
-			*max_fd = std::max(*max_fd, mFirmwareUpgradeFD);
+		if (backend != NULL) {
+			backend->watch(mFirmwareUpgradeFD, EventBackend::kEventRead | EventBackend::kEventError);
 		}
 	}
 
@@ -27,6 +27,7 @@
 #include <sys/select.h>
 #include <string>
 #include "time-utils.h"
+#include "EventBackend.h"
 
 namespace nl {
 namespace wpantund {
@@ -48,7 +49,7 @@ public:
 	//  * Any Other Value: An error occured when attempting to upgrade.
 	int get_upgrade_status(void);
 
-	int update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout);
+	int update_fd_interest(EventBackend *backend, cms_t *timeout);
 	void process(void);
 
 	bool can_upgrade_firmware(void);
@@ -107,7 +107,7 @@ public:
 
 	virtual cms_t get_ms_to_next_event(void) = 0;
 	virtual void process(void) = 0;
-	virtual int update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout) = 0;
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout) = 0;
 
 public:
 	void signal_fatal_error(int err);
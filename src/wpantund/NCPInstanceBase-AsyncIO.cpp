@@ -30,6 +30,7 @@
 #include <algorithm>
 #include "socket-utils.h"
 #include "SuperSocket.h"
+#include "LoopProfiler.h"
 
 using namespace nl;
 using namespace wpantund;
@@ -138,9 +139,9 @@ NCPInstanceBase::get_ms_to_next_event(void)
 {
 	cms_t ret(EventHandler::get_ms_to_next_event());
 
-	mSerialAdapter->update_fd_set(NULL, NULL, NULL, NULL, &ret);
-	mPrimaryInterface->update_fd_set(NULL, NULL, NULL, NULL, &ret);
-	mFirmwareUpgrade.update_fd_set(NULL, NULL, NULL, NULL, &ret);
+	mSerialAdapter->update_fd_interest(NULL, &ret);
+	mPrimaryInterface->update_fd_interest(NULL, &ret);
+	mFirmwareUpgrade.update_fd_interest(NULL, &ret);
 
 	if (mWasBusy && (mLastChangedBusy != 0)) {
 		cms_t temp_cms(MAX_INSOMNIA_TIME_IN_MS - (time_ms() - mLastChangedBusy));
@@ -169,7 +170,7 @@ NCPInstanceBase::get_ms_to_next_event(void)
 }
 
 int
-NCPInstanceBase::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout)
+NCPInstanceBase::update_fd_interest(EventBackend *backend, cms_t *timeout)
 {
 	int ret = -1;
 
@@ -177,27 +178,29 @@ NCPInstanceBase::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set
 		*timeout = std::min(*timeout, get_ms_to_next_event());
 	}
 
-	ret = mFirmwareUpgrade.update_fd_set(read_fd_set, write_fd_set, error_fd_set, max_fd, timeout);
+	ret = mFirmwareUpgrade.update_fd_interest(backend, timeout);
 
 	require_noerr(ret, bail);
 
-	ret = mPcapManager.update_fd_set(read_fd_set, write_fd_set, error_fd_set, max_fd, timeout);
+	ret = mPcapManager.update_fd_interest(backend, timeout);
 
 	require_noerr(ret, bail);
 
 	if (!ncp_state_is_detached_from_ncp(get_ncp_state())) {
-		nlpt_select_update_fd_set(&mDriverToNCPPumpPT, read_fd_set, write_fd_set, error_fd_set, max_fd);
-		nlpt_select_update_fd_set(&mNCPToDriverPumpPT, read_fd_set, write_fd_set, error_fd_set, max_fd);
+		if (backend != NULL) {
+			backend->watch(&mDriverToNCPPumpPT);
+			backend->watch(&mNCPToDriverPumpPT);
+		}
 
-		ret = mPrimaryInterface->update_fd_set(read_fd_set, write_fd_set, error_fd_set, max_fd, timeout);
+		ret = mPrimaryInterface->update_fd_interest(backend, timeout);
 		require_noerr(ret, bail);
 
 		if (is_legacy_interface_enabled()) {
-			ret = mLegacyInterface->update_fd_set(read_fd_set, write_fd_set, error_fd_set, max_fd, timeout);
+			ret = mLegacyInterface->update_fd_interest(backend, timeout);
 			require_noerr(ret, bail);
 		}
 
-		ret = mSerialAdapter->update_fd_set(read_fd_set, write_fd_set, error_fd_set, max_fd, timeout);
+		ret = mSerialAdapter->update_fd_interest(backend, timeout);
 		require_noerr(ret, bail);
 	}
 
@@ -226,27 +229,47 @@ NCPInstanceBase::process(void)
 
 	mRunawayResetBackoffManager.update();
 
-	mFirmwareUpgrade.process();
+	{
+		LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseNCPFirmwareUpgrade);
+		mFirmwareUpgrade.process();
+	}
 
-	mPcapManager.process();
+	{
+		LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseNCPPcap);
+		mPcapManager.process();
+	}
 
 	if (get_upgrade_status() != EINPROGRESS) {
-		refresh_address_route_prefix_entries();
+		{
+			LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseNCPInterface);
 
-		require_noerr(ret = mPrimaryInterface->process(), socket_failure);
+			refresh_address_route_prefix_entries();
 
-		if (is_legacy_interface_enabled()) {
-			mLegacyInterface->process();
+			require_noerr(ret = mPrimaryInterface->process(), socket_failure);
+
+			if (is_legacy_interface_enabled()) {
+				mLegacyInterface->process();
+			}
 		}
 
-		require_noerr(ret = mSerialAdapter->process(), socket_failure);
+		{
+			LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseNCPSerial);
+			require_noerr(ret = mSerialAdapter->process(), socket_failure);
+		}
 
-		ncp_to_driver_pump();
+		{
+			LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseNCPPumps);
+			ncp_to_driver_pump();
+		}
 	}
 
-	EventHandler::process_event(EVENT_IDLE);
+	{
+		LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseNCPTasks);
+		EventHandler::process_event(EVENT_IDLE);
+	}
 
 	if (get_upgrade_status() != EINPROGRESS) {
+		LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseNCPPumps);
 		driver_to_ncp_pump();
 	}
 
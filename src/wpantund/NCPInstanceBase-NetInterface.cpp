@@ -209,8 +209,9 @@ int
 NCPInstanceBase::set_commissioniner(int seconds, uint8_t traffic_type, in_port_t traffic_port)
 {
 	int ret = kWPANTUNDStatus_Ok;
+	IPv6PacketMatcherRule rule;
 
-	mCommissioningRule.clear();
+	mCommissioningMatcher.clear();
 
 	if ((seconds > 0) && (traffic_port == 0)) {
 		ret = kWPANTUNDStatus_InvalidArgument;
@@ -220,12 +221,14 @@ NCPInstanceBase::set_commissioniner(int seconds, uint8_t traffic_type, in_port_t
 	if (seconds > 0 && traffic_port) {
 		mCommissioningExpiration = time_get_monotonic() + seconds;
 
-		mCommissioningRule.type = traffic_type;
-		mCommissioningRule.local_port = traffic_port;
-		mCommissioningRule.local_port_match = true;
-		mCommissioningRule.local_address.s6_addr[0] = 0xFE;
-		mCommissioningRule.local_address.s6_addr[1] = 0x80;
-		mCommissioningRule.local_match_mask = 10;
+		rule.clear();
+		rule.type = traffic_type;
+		rule.local_port = traffic_port;
+		rule.local_port_match = true;
+		rule.local_address.s6_addr[0] = 0xFE;
+		rule.local_address.s6_addr[1] = 0x80;
+		rule.local_match_mask = 10;
+		mCommissioningMatcher.insert(rule);
 	} else {
 		mCommissioningExpiration = 0;
 		mInsecureFirewall.clear();
@@ -274,9 +277,13 @@ bool
 NCPInstanceBase::should_forward_hostbound_frame(uint8_t* type, const uint8_t* ip_packet, size_t packet_length)
 {
 	bool packet_should_be_dropped = false;
+	IPv6PacketFields fields;
 	IPv6PacketMatcherRule rule;
 
-	rule.update_from_inbound_packet(ip_packet);
+	// The header is only parsed here; everything below works from
+	// `fields` and the rule built from them.
+	fields.update_from_packet(ip_packet, packet_length);
+	rule.update_from_inbound_fields(fields);
 
 	// Handle special considerations for packets received
 	// from the insecure data channel.
@@ -297,11 +304,11 @@ NCPInstanceBase::should_forward_hostbound_frame(uint8_t* type, const uint8_t* ip
 				// We are in the middle of commissioning and we
 				// haven't expired yet.
 
-				if (mInsecureFirewall.count(rule)) {
+				if (mInsecureFirewall.lookup(rule)) {
 					syslog(LOG_INFO,
 						   "[NCP->] Routing insecure commissioning traffic.");
 					packet_should_be_dropped = false;
-				} else if (mCommissioningRule.match_inbound(ip_packet)) {
+				} else if (mCommissioningMatcher.match_inbound(fields) != NULL) {
 					rule.subtype = IPv6PacketMatcherRule::SUBTYPE_ALL;
 					mInsecureFirewall.insert(rule);
 					packet_should_be_dropped = false;
@@ -327,7 +334,7 @@ NCPInstanceBase::should_forward_hostbound_frame(uint8_t* type, const uint8_t* ip
 		(   (*type == FRAME_TYPE_DATA)
 			|| (*type == FRAME_TYPE_LEGACY_DATA)
 		)
-		&&	(mInsecureFirewall.size()>0)
+		&&	!mInsecureFirewall.empty()
 	) {
 		// In this case we want to make sure that if we receive
 		// a packet on a secure channel that we were previously
@@ -335,9 +342,8 @@ NCPInstanceBase::should_forward_hostbound_frame(uint8_t* type, const uint8_t* ip
 		// matching entry so that we don't route those packets
 		// over the insecure channel any more.
 
-		if (mInsecureFirewall.count(rule)) {
+		if (mInsecureFirewall.erase(rule)) {
 			syslog(LOG_NOTICE, "Secure packet matched rule on insecure firewall, removing rule.");
-			mInsecureFirewall.erase(rule);
 
 			if (*type == FRAME_TYPE_LEGACY_DATA) {
 				// The first packet to match the rule on the insecure firewall
@@ -377,7 +383,9 @@ NCPInstanceBase::should_forward_hostbound_frame(uint8_t* type, const uint8_t* ip
 		}
 	}
 
-	if ((*type == FRAME_TYPE_LEGACY_DATA) && mLegacyCommissioningMatcher.count(rule)) {
+	if ((*type == FRAME_TYPE_LEGACY_DATA)
+		&& (mLegacyCommissioningMatcher.match_inbound(fields) != NULL)
+	) {
 		// This is for ensuring that the commissioning TCP connection survives
 		// the transition to joining the network. In order for this to occur,
 		// we need to ensure that the packets for this particular connection
@@ -399,7 +407,9 @@ bool
 NCPInstanceBase::should_forward_ncpbound_frame(uint8_t* type, const uint8_t* ip_packet, size_t packet_length)
 {
 	bool should_forward = true;
+	IPv6PacketFields fields;
 	IPv6PacketMatcherRule rule;
+	const IPv6PacketMatcherRule* legacy_rule;
 
 	if (!ncp_state_is_interface_up(get_ncp_state())) {
 		syslog(LOG_DEBUG, "Dropping IPv6 packet, NCP not ready yet!");
@@ -416,15 +426,18 @@ NCPInstanceBase::should_forward_ncpbound_frame(uint8_t* type, const uint8_t* ip_
 		goto bail;
 	}
 
-	rule.update_from_outbound_packet(ip_packet);
+	fields.update_from_packet(ip_packet, packet_length);
+	rule.update_from_outbound_fields(fields);
 
-	if (mDropFirewall.match_outbound(ip_packet) != mDropFirewall.end()) {
+	if (mDropFirewall.match_outbound(fields) != NULL) {
 		syslog(LOG_INFO, "[->NCP] Dropping matched packet.");
 		should_forward = false;
 		goto bail;
 	}
 
-	if (mLegacyCommissioningMatcher.count(rule)) {
+	legacy_rule = mLegacyCommissioningMatcher.match_outbound(fields);
+
+	if (legacy_rule != NULL) {
 		if (*type == FRAME_TYPE_LEGACY_DATA) {
 			// This is for ensuring that the commissioning TCP connection survives
 			// the transition to joining the network. In order for this to occur,
@@ -432,15 +445,17 @@ NCPInstanceBase::should_forward_ncpbound_frame(uint8_t* type, const uint8_t* ip_
 			// continue to flow to and from the normal IPv6 data interface.
 			*type = FRAME_TYPE_DATA;
 		} else {
-			mLegacyCommissioningMatcher.erase(rule);
+			// Copied, since erasing the rule frees it.
+			const IPv6PacketMatcherRule matched_rule(*legacy_rule);
+			mLegacyCommissioningMatcher.erase(matched_rule);
 		}
 	}
 
 	rule.subtype = IPv6PacketMatcherRule::SUBTYPE_ALL;
 
-	if (mInsecureFirewall.count(rule)) {
-		// We use `count` instead of `match_outbound` in the
-		// check above because exact matches are faster.
+	if (!mInsecureFirewall.empty() && mInsecureFirewall.lookup(rule)) {
+		// We use an exact-match lookup instead of `match_outbound`
+		// in the check above because it is a single hash probe.
 		syslog(LOG_INFO, "[->NCP] Routing insecure commissioning traffic.");
 		*type = FRAME_TYPE_INSECURE_DATA;
 	}
@@ -33,6 +33,7 @@
 #include "wpantund.h"
 #include "any-to.h"
 #include "IPv6Helpers.h"
+#include "LoopProfiler.h"
 
 using namespace nl;
 using namespace wpantund;
@@ -42,10 +43,10 @@ using namespace wpantund;
 // MARK: Constructors/Destructors
 
 NCPInstanceBase::NCPInstanceBase(const Settings& settings):
-	mCommissioningRule(),
 	mCommissioningExpiration(0)
 {
 	std::string wpan_interface_name = "wpan0";
+	std::string io_backend;
 
 	mResetSocket_BeginReset = '0';
 	mResetSocket_EndReset = '1';
@@ -85,6 +86,9 @@ NCPInstanceBase::NCPInstanceBase(const Settings& settings):
 	mTerminateOnFault = false;
 	mWasBusy = false;
 	mNCPIsMisbehaving = false;
+	mPropertyGetGeneration = 0;
+	mPropertyGetRequestCount = 0;
+	mPropertyGetCoalescedCount = 0;
 
 	regsiter_all_get_handlers();
 	regsiter_all_set_handlers();
@@ -124,6 +128,9 @@ NCPInstanceBase::NCPInstanceBase(const Settings& settings):
 
 			} else if (strcaseequal(iter->first.c_str(), kWPANTUNDProperty_ConfigDaemonNetworkRetainCommand)) {
 				mNetworkRetain.set_network_retain_command(iter->second);
+
+			} else if (strcaseequal(iter->first.c_str(), kWPANTUNDProperty_ConfigDaemonIOBackend)) {
+				io_backend = iter->second;
 			}
 		}
 	}
@@ -147,6 +154,25 @@ NCPInstanceBase::NCPInstanceBase(const Settings& settings):
 
 	mPrimaryInterface->mLinkStateChanged.connect(boost::bind(&NCPInstanceBase::link_state_changed, this, _1, _2));
 
+	if (strcaseequal(io_backend.c_str(), "io_uring")) {
+		if (mRawSerialAdapter->enable_posted_reads() != 0) {
+			syslog(LOG_WARNING, "Unable to use io_uring for the NCP (%s), reading the NCP and TUN interface directly", strerror(errno));
+
+		} else if (mPrimaryInterface->enable_posted_reads() != 0) {
+			syslog(LOG_WARNING, "Unable to use io_uring for \"%s\" (%s), reading the NCP and TUN interface directly",
+				mPrimaryInterface->get_interface_name().c_str(), strerror(errno));
+
+			// Either both are read through io_uring or neither is.
+			mRawSerialAdapter->disable_posted_reads();
+
+		} else {
+			syslog(LOG_INFO, "Reads from the NCP and \"%s\" are posted to io_uring", mPrimaryInterface->get_interface_name().c_str());
+		}
+
+	} else if (!io_backend.empty() && !strcaseequal(io_backend.c_str(), "syscall")) {
+		syslog(LOG_WARNING, "Unknown " kWPANTUNDProperty_ConfigDaemonIOBackend " \"%s\", reading the NCP and TUN interface directly", io_backend.c_str());
+	}
+
 	set_ncp_power(true);
 
 	// Go ahead and start listening on ff03::1
@@ -192,6 +218,27 @@ NCPInstanceBase::NCPInstanceBase(const Settings& settings):
 		rule.subtype = IPv6PacketMatcherRule::SUBTYPE_ICMP_REDIRECT;
 		mDropFirewall.insert(rule);
 	}
+
+	update_kernel_packet_filter();
+}
+
+void
+NCPInstanceBase::update_kernel_packet_filter(void)
+{
+	IPv6PacketFilter filter;
+	int ret;
+
+	if (!filter.set_outbound_drop_rules(mDropFirewall)) {
+		syslog(LOG_WARNING, "Too many drop rules to filter packets in the kernel");
+	}
+
+	// Not being able to filter in the kernel (older kernels, or no
+	// CAP_BPF) is fine: the packets are still dropped when read.
+	ret = mPrimaryInterface->set_outbound_filter(filter);
+
+	if (ret < 0) {
+		syslog(LOG_INFO, "Unable to filter packets from \"%s\" in the kernel (%s)", mPrimaryInterface->get_interface_name().c_str(), strerror(-ret));
+	}
 }
 
 bool
@@ -205,7 +252,8 @@ NCPInstanceBase::setup_property_supported_by_class(const std::string& prop_name)
 		|| strcaseequal(prop_name.c_str(), kWPANTUNDProperty_ConfigNCPFirmwareCheckCommand)
 		|| strcaseequal(prop_name.c_str(), kWPANTUNDProperty_DaemonAutoFirmwareUpdate)
 		|| strcaseequal(prop_name.c_str(), kWPANTUNDProperty_ConfigNCPFirmwareUpgradeCommand)
-		|| strcaseequal(prop_name.c_str(), kWPANTUNDProperty_ConfigDaemonNetworkRetainCommand);
+		|| strcaseequal(prop_name.c_str(), kWPANTUNDProperty_ConfigDaemonNetworkRetainCommand)
+		|| strcaseequal(prop_name.c_str(), kWPANTUNDProperty_ConfigDaemonIOBackend);
 }
 
 NCPInstanceBase::~NCPInstanceBase()
@@ -313,6 +361,7 @@ NCPInstanceBase::get_supported_property_keys(void) const
 
 	properties.insert(kWPANTUNDProperty_DaemonVersion);
 	properties.insert(kWPANTUNDProperty_DaemonTerminateOnFault);
+	properties.insert(kWPANTUNDProperty_DaemonProfileEnabled);
 
 	properties.insert(kWPANTUNDProperty_NCPVersion);
 	properties.insert(kWPANTUNDProperty_NCPHardwareAddress);
@@ -352,6 +401,40 @@ NCPInstanceBase::to_upper(const std::string &str)
 // MARK: -
 // MARK: Property Get Handlers
 
+void
+NCPInstanceBase::property_get_finished(const std::string& key, uint32_t generation, int status, const boost::any& value)
+{
+	std::map<std::string, PendingPropertyGet>::iterator pending_iter = mPendingPropertyGets.find(key);
+	std::list<CallbackWithStatusArg1> callbacks;
+	std::list<CallbackWithStatusArg1>::iterator iter;
+
+	if ((pending_iter == mPendingPropertyGets.end()) || (pending_iter->second.mGeneration != generation)) {
+		// Superseded by a retry; its waiters are answered there.
+		return;
+	}
+
+	// A callback may well ask for the same property again, so get the
+	// entry out of the way before calling any of them.
+	callbacks.swap(pending_iter->second.mCallbacks);
+	mPendingPropertyGets.erase(pending_iter);
+
+	for (iter = callbacks.begin(); iter != callbacks.end(); ++iter) {
+		(*iter)(status, value);
+	}
+}
+
+void
+NCPInstanceBase::property_get_mark_stale(const std::string& key)
+{
+	std::map<std::string, PendingPropertyGet>::iterator pending_iter = mPendingPropertyGets.find(key);
+
+	// The get in flight may be answered with the old value, so later
+	// gets must not wait on it.
+	if (pending_iter != mPendingPropertyGets.end()) {
+		pending_iter->second.mIsStale = true;
+	}
+}
+
 void
 NCPInstanceBase::register_prop_get_handler(const char *prop, PropGetHandler handler)
 {
@@ -409,6 +492,13 @@ NCPInstanceBase::regsiter_all_get_handlers(void)
 	REGISTER_GET_HANDLER(IPv6MulticastAddresses);
 	REGISTER_GET_HANDLER(IPv6InterfaceRoutes);
 	REGISTER_GET_HANDLER(DaemonSyslogMask);
+	REGISTER_GET_HANDLER(DaemonPropertyGetCounters);
+	REGISTER_GET_HANDLER(DaemonInsecureFirewallCounters);
+	REGISTER_GET_HANDLER(DaemonKernelFilterCounters);
+	REGISTER_GET_HANDLER(DaemonProfileEnabled);
+	REGISTER_GET_HANDLER(DaemonProfilePhases);
+	REGISTER_GET_HANDLER(DaemonProfileHistograms);
+	REGISTER_GET_HANDLER(DaemonProfileWakeups);
 
 #undef REGISTER_GET_HANDLER
 }
@@ -417,11 +507,47 @@ void
 NCPInstanceBase::property_get_value(const std::string &key, CallbackWithStatusArg1 cb)
 {
 	std::map<std::string, PropGetHandlerEntry>::iterator iter;
+	const std::string upper_key = to_upper(key);
 
-	iter = mPropertyGetHandlers.find(to_upper(key));
+	iter = mPropertyGetHandlers.find(upper_key);
 
 	if (iter != mPropertyGetHandlers.end()) {
-		iter->second(cb);
+		std::map<std::string, PendingPropertyGet>::iterator pending_iter = mPendingPropertyGets.find(upper_key);
+
+		mPropertyGetRequestCount++;
+
+		if (pending_iter != mPendingPropertyGets.end()) {
+			PendingPropertyGet& pending = pending_iter->second;
+
+			pending.mCallbacks.push_back(cb);
+
+			// If the property has been changed since the request in
+			// flight was issued, or if that request has been around for
+			// much longer than any NCP command should take, start over,
+			// taking its waiters along.
+			if (pending.mIsStale) {
+				syslog(LOG_DEBUG, "property_get_value: \"%s\" changed since the last get, getting it again", key.c_str());
+
+			} else if (time_get_monotonic() - pending.mStartedAt <= kPropertyGetMaxAge) {
+				mPropertyGetCoalescedCount++;
+				return;
+
+			} else {
+				syslog(LOG_WARNING, "property_get_value: Get of \"%s\" is taking too long, retrying", key.c_str());
+			}
+		}
+
+		PendingPropertyGet& pending = mPendingPropertyGets[upper_key];
+
+		if (pending.mCallbacks.empty()) {
+			pending.mCallbacks.push_back(cb);
+		}
+
+		pending.mGeneration = ++mPropertyGetGeneration;
+		pending.mStartedAt = time_get_monotonic();
+		pending.mIsStale = false;
+
+		iter->second(boost::bind(&NCPInstanceBase::property_get_finished, this, upper_key, pending.mGeneration, _1, _2));
 
 	} else if (StatCollector::is_a_stat_property(key)) {
 		get_stat_collector().property_get_value(key, cb);
@@ -780,6 +906,84 @@ NCPInstanceBase::get_prop_IPv6InterfaceRoutes(CallbackWithStatusArg1 cb)
 	cb(kWPANTUNDStatus_Ok, boost::any(result));
 }
 
+void
+NCPInstanceBase::get_prop_DaemonPropertyGetCounters(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+	char c_string[80];
+
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Requests", mPropertyGetRequestCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "Coalesced", mPropertyGetCoalescedCount);
+	result.push_back(c_string);
+	snprintf(c_string, sizeof(c_string), "%-20s = %u", "InFlight", static_cast<unsigned int>(mPendingPropertyGets.size()));
+	result.push_back(c_string);
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+NCPInstanceBase::get_prop_DaemonInsecureFirewallCounters(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+
+	mInsecureFirewall.get_summary(result);
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+NCPInstanceBase::get_prop_DaemonKernelFilterCounters(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+
+	mPrimaryInterface->get_filter_counters(result);
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+NCPInstanceBase::get_prop_DaemonProfileEnabled(CallbackWithStatusArg1 cb)
+{
+	cb(kWPANTUNDStatus_Ok, boost::any(LoopProfiler::is_enabled()));
+}
+
+void
+NCPInstanceBase::get_prop_DaemonProfilePhases(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+
+	if (LoopProfiler::is_enabled()) {
+		LoopProfiler::get_phase_summary(result);
+	}
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+NCPInstanceBase::get_prop_DaemonProfileHistograms(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+
+	if (LoopProfiler::is_enabled()) {
+		LoopProfiler::get_histograms(result);
+	}
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
+void
+NCPInstanceBase::get_prop_DaemonProfileWakeups(CallbackWithStatusArg1 cb)
+{
+	std::list<std::string> result;
+
+	if (LoopProfiler::is_enabled()) {
+		LoopProfiler::get_wakeups(result);
+	}
+
+	cb(kWPANTUNDStatus_Ok, boost::any(result));
+}
+
 void
 NCPInstanceBase::get_prop_DaemonSyslogMask(CallbackWithStatusArg1 cb)
 {
@@ -857,6 +1061,7 @@ NCPInstanceBase::regsiter_all_set_handlers(void)
 	REGISTER_SET_HANDLER(IPv6MeshLocalAddress);
 	REGISTER_SET_HANDLER(DaemonAutoDeepSleep);
 	REGISTER_SET_HANDLER(DaemonSyslogMask);
+	REGISTER_SET_HANDLER(DaemonProfileEnabled);
 
 #undef REGISTER_SET_HANDLER
 }
@@ -877,6 +1082,7 @@ NCPInstanceBase::property_set_value(const std::string &key, const boost::any &va
 		iter = mPropertySetHandlers.find(to_upper(key));
 
 		if (iter != mPropertySetHandlers.end()) {
+			property_get_mark_stale(to_upper(key));
 			iter->second(value, cb);
 
 		} else if (StatCollector::is_a_stat_property(key)) {
@@ -962,6 +1168,15 @@ NCPInstanceBase::set_prop_DaemonAutoFirmwareUpdate(const boost::any &value, Call
 	cb(kWPANTUNDStatus_Ok);
 }
 
+void
+NCPInstanceBase::set_prop_DaemonProfileEnabled(const boost::any &value, CallbackWithStatus cb)
+{
+	// Setting it to true again starts over with fresh data.
+	LoopProfiler::set_enabled(false);
+	LoopProfiler::set_enabled(any_to_bool(value));
+	cb(kWPANTUNDStatus_Ok);
+}
+
 void
 NCPInstanceBase::set_prop_DaemonTerminateOnFault(const boost::any &value, CallbackWithStatus cb)
 {
@@ -1127,6 +1342,7 @@ NCPInstanceBase::property_insert_value(const std::string &key, const boost::any
 		iter = mPropertyInsertHandlers.find(to_upper(key));
 
 		if (iter != mPropertyInsertHandlers.end()) {
+			property_get_mark_stale(to_upper(key));
 			iter->second(value, cb);
 
 		} else {
@@ -1187,6 +1403,7 @@ NCPInstanceBase::property_remove_value(const std::string &key, const boost::any
 		iter = mPropertyRemoveHandlers.find(to_upper(key));
 
 		if (iter != mPropertyRemoveHandlers.end()) {
+			property_get_mark_stale(to_upper(key));
 			iter->second(value, cb);
 
 		} else {
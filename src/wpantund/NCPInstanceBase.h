@@ -31,6 +31,8 @@
 #include "NetworkRetain.h"
 #include "RunawayResetBackoffManager.h"
 #include "Pcap.h"
+#include "IPv6FlowTable.h"
+#include "IPv6PacketClassifier.h"
 
 namespace nl {
 namespace wpantund {
@@ -67,13 +69,7 @@ public:
 
 	virtual cms_t get_ms_to_next_event(void);
 
-	virtual int update_fd_set(
-		fd_set *read_fd_set,
-		fd_set *write_fd_set,
-		fd_set *error_fd_set,
-		int *max_fd,
-		cms_t *timeout
-	);
+	virtual int update_fd_interest(EventBackend *backend, cms_t *timeout);
 
 	virtual void process(void);
 
@@ -357,6 +353,9 @@ private:
 	void get_prop_NestLabs_LegacyMeshLocalPrefix(CallbackWithStatusArg1 cb);
 	void get_prop_NestLabs_LegacyMeshLocalAddress(CallbackWithStatusArg1 cb);
 	void get_prop_NCPState(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonPropertyGetCounters(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonInsecureFirewallCounters(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonKernelFilterCounters(CallbackWithStatusArg1 cb);
 	void get_prop_NetworkNodeType(CallbackWithStatusArg1 cb);
 	void get_prop_ThreadOnMeshPrefixes(CallbackWithStatusArg1 cb);
 	void get_prop_ThreadOffMeshRoutes(CallbackWithStatusArg1 cb);
@@ -366,6 +365,10 @@ private:
 	void get_prop_IPv6MulticastAddresses(CallbackWithStatusArg1 cb);
 	void get_prop_IPv6InterfaceRoutes(CallbackWithStatusArg1 cb);
 	void get_prop_DaemonSyslogMask(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonProfileEnabled(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonProfilePhases(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonProfileHistograms(CallbackWithStatusArg1 cb);
+	void get_prop_DaemonProfileWakeups(CallbackWithStatusArg1 cb);
 
 	void regsiter_all_set_handlers(void);
 
@@ -387,6 +390,7 @@ private:
 	void set_prop_IPv6MeshLocalAddress(const boost::any &value, CallbackWithStatus cb);
 	void set_prop_DaemonAutoDeepSleep(const boost::any &value, CallbackWithStatus cb);
 	void set_prop_DaemonSyslogMask(const boost::any &value, CallbackWithStatus cb);
+	void set_prop_DaemonProfileEnabled(const boost::any &value, CallbackWithStatus cb);
 
 	void regsiter_all_insert_handlers(void);
 
@@ -423,7 +427,30 @@ private:
 		PropUpdateHandler mHandler;
 	};
 
+	// Property gets that are waiting on a handler, keyed like
+	// `mPropertyGetHandlers`. Gets for a property that already has one
+	// in flight just add their callback here, unless the property has
+	// been changed since that one was issued.
+	enum {
+		kPropertyGetMaxAge = 60,  // seconds
+	};
+
+	struct PendingPropertyGet
+	{
+		uint32_t mGeneration;
+		time_t mStartedAt;
+		bool mIsStale;            // Issued before the latest change
+		std::list<CallbackWithStatusArg1> mCallbacks;
+	};
+
+	void property_get_finished(const std::string& key, uint32_t generation, int status, const boost::any& value);
+	void property_get_mark_stale(const std::string& key);
+
 	std::map<std::string, PropGetHandlerEntry> mPropertyGetHandlers;
+	std::map<std::string, PendingPropertyGet> mPendingPropertyGets;
+	uint32_t mPropertyGetGeneration;
+	uint32_t mPropertyGetRequestCount;
+	uint32_t mPropertyGetCoalescedCount;
 	std::map<std::string, PropUpdateHandlerEntry> mPropertySetHandlers;
 	std::map<std::string, PropUpdateHandlerEntry> mPropertyInsertHandlers;
 	std::map<std::string, PropUpdateHandlerEntry> mPropertyRemoveHandlers;
@@ -670,9 +697,13 @@ protected:
 
 protected:
 
-	IPv6PacketMatcherRule mCommissioningRule;
-	IPv6PacketMatcher mInsecureFirewall;
-	IPv6PacketMatcher mDropFirewall;
+	// Regenerates the filter the kernel applies to packets read from
+	// the primary interface. Must follow any change to `mDropFirewall`.
+	void update_kernel_packet_filter(void);
+
+	IPv6PacketClassifier mCommissioningMatcher;
+	IPv6FlowTable mInsecureFirewall;
+	IPv6PacketClassifier mDropFirewall;
 
 	time_t mCommissioningExpiration;
 
@@ -791,7 +822,7 @@ protected:
 	// MARK: Legacy Interface Support
 
 	boost::shared_ptr<TunnelIPv6Interface> mLegacyInterface;
-	IPv6PacketMatcher mLegacyCommissioningMatcher;
+	IPv6PacketClassifier mLegacyCommissioningMatcher;
 	uint8_t mNCPV6LegacyPrefix[8];
 	bool mLegacyInterfaceEnabled;
 	bool mNodeTypeSupportsLegacy;
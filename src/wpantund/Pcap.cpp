@@ -29,6 +29,9 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <vector>
+#include <algorithm>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -39,7 +42,7 @@ using namespace wpantund;
 
 
 PcapPacket::PcapPacket()
-	: mLen(sizeof(PcapFrameHeader)), mStatus(kWPANTUNDStatus_Ok)
+	: mFieldCount(0), mPayload(NULL), mPayloadLen(0), mLen(sizeof(PcapFrameHeader)), mStatus(kWPANTUNDStatus_Ok)
 {
 	mHeader.mSeconds = 0;
 	mHeader.mMicroSeconds = 0;
@@ -57,16 +60,41 @@ PcapPacket::get_status(void)const
 	return mStatus;
 }
 
-const uint8_t*
-PcapPacket::get_data_ptr(void)const
+int
+PcapPacket::get_data_len(void)const
 {
-	return mData;
+	return mLen;
 }
 
 int
-PcapPacket::get_data_len(void)const
+PcapPacket::get_iov(struct iovec* iov)const
 {
-	return mLen;
+	int count = 0;
+	int i;
+
+	iov[count].iov_base = const_cast<PcapFrameHeader*>(&mHeader);
+	iov[count].iov_len = sizeof(mHeader);
+	count++;
+
+	for (i = 0; i < mFieldCount; i++) {
+		iov[count].iov_base = const_cast<PcapPpiFieldHeader*>(&mFields[i].mHeader);
+		iov[count].iov_len = sizeof(PcapPpiFieldHeader);
+		count++;
+
+		if (mFields[i].mHeader.mSize != 0) {
+			iov[count].iov_base = const_cast<uint8_t*>(mFields[i].mData);
+			iov[count].iov_len = mFields[i].mHeader.mSize;
+			count++;
+		}
+	}
+
+	if (mPayloadLen != 0) {
+		iov[count].iov_base = const_cast<uint8_t*>(mPayload);
+		iov[count].iov_len = mPayloadLen;
+		count++;
+	}
+
+	return count;
 }
 
 PcapPacket&
@@ -97,21 +125,23 @@ PcapPacket::set_dlt(uint32_t i)
 PcapPacket&
 PcapPacket::append_ppi_field(uint16_t type, const uint8_t* field_ptr, int field_len)
 {
-	PcapPpiFieldHeader field_header;
-
-	assert(mLen <= sizeof(mData));
+	assert(mLen <= PCAP_PACKET_MAX_SIZE);
 
 	if (field_len < 0) {
 		mStatus = kWPANTUNDStatus_InvalidArgument;
 
-	} else if (mLen + field_len + sizeof(PcapPpiFieldHeader) > sizeof(mData)) {
+	} else if ((mFieldCount >= kMaxPpiFields) || (mPayload != NULL)) {
+		mStatus = kWPANTUNDStatus_InvalidArgument;
+
+	} else if (mLen + field_len + sizeof(PcapPpiFieldHeader) > PCAP_PACKET_MAX_SIZE) {
 		mStatus = kWPANTUNDStatus_InvalidArgument;
 
 	} else {
-		field_header.mType = type;
-		field_header.mSize = field_len;
-		memcpy(mData + mLen, &field_header, sizeof(PcapPpiFieldHeader));
-		memcpy(mData + mLen + sizeof(PcapPpiFieldHeader), field_ptr, field_len);
+		PpiField& field = mFields[mFieldCount++];
+
+		field.mHeader.mType = type;
+		field.mHeader.mSize = field_len;
+		field.mData = field_ptr;
 		mLen += field_len + sizeof(PcapPpiFieldHeader);
 		mHeader.mRecordedPayloadSize += field_len + sizeof(PcapPpiFieldHeader);
 		mHeader.mPpiHeader.mSize += field_len + sizeof(PcapPpiFieldHeader);
@@ -125,20 +155,17 @@ PcapPacket::append_ppi_field(uint16_t type, const uint8_t* field_ptr, int field_
 PcapPacket&
 PcapPacket::append_payload(const uint8_t* payload_ptr, int payload_len)
 {
-	assert(mLen <= sizeof(mData));
+	assert(mLen <= PCAP_PACKET_MAX_SIZE);
 
-	if (payload_len < 0) {
+	if ((payload_len < 0) || (mPayload != NULL)) {
 		mStatus = kWPANTUNDStatus_InvalidArgument;
 
-	} else if (mLen + payload_len > sizeof(mData)) {
-		memcpy(mData + mLen, payload_ptr, sizeof(mData) - mLen);
-		mLen = sizeof(mData);
-		mHeader.mRecordedPayloadSize += sizeof(mData) - mLen;
-
 	} else {
-		memcpy(mData + mLen, payload_ptr, payload_len);
-		mLen += payload_len;
-		mHeader.mRecordedPayloadSize += payload_len;
+		// Anything past the snapshot length is left out of the record.
+		mPayload = payload_ptr;
+		mPayloadLen = std::min(payload_len, PCAP_PACKET_MAX_SIZE - mLen);
+		mLen += mPayloadLen;
+		mHeader.mRecordedPayloadSize += mPayloadLen;
 	}
 
 	mHeader.mActualPayloadSize += payload_len;
@@ -263,6 +290,7 @@ PcapManager::close_fd_set(const std::set<int>& x)
 		) {
 			const int fd = *iter;
 			syslog(LOG_INFO, "PcapManager::close_fd_set: Closing FD %d", fd);
+			EventBackend::fd_closed(fd);
 			close(fd);
 			mFDSet.erase(fd);
 		}
@@ -275,21 +303,21 @@ PcapManager::push_packet(const PcapPacket& packet)
 {
 	std::set<int>::const_iterator iter;
 	std::set<int> remove_set;
+	struct iovec iov[PcapPacket::kMaxIOVCount];
+	int iovcnt;
 
 	require_noerr(packet.get_status(), bail);
 
+	iovcnt = packet.get_iov(iov);
+
 	for ( iter  = mFDSet.begin()
 	    ; iter != mFDSet.end()
 		; ++iter
 	) {
 		int ret;
 
-		// Send the PCAP frame.
-		ret = static_cast<int>(write(
-			*iter,
-			packet.get_data_ptr(),
-			packet.get_data_len()
-		));
+		// Send the PCAP frame, as a single datagram.
+		ret = static_cast<int>(writev(*iter, iov, iovcnt));
 
 		__ASSERT_MACROS_check(ret >= 0);
 
@@ -308,7 +336,7 @@ bail:
 }
 
 int
-PcapManager::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout)
+PcapManager::update_fd_interest(nl::EventBackend *backend, cms_t *timeout)
 {
 	std::set<int>::const_iterator iter;
 
@@ -316,18 +344,8 @@ PcapManager::update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *er
 	    ; iter != mFDSet.end()
 		; ++iter
 	) {
-		const int fd = *iter;
-
-		if (read_fd_set) {
-			FD_SET(fd, read_fd_set);
-		}
-
-		if (error_fd_set) {
-			FD_SET(fd, error_fd_set);
-		}
-
-		if (max_fd && (*max_fd < fd)) {
-			*max_fd = fd;
+		if (backend) {
+			backend->watch(*iter, nl::EventBackend::kEventRead | nl::EventBackend::kEventError);
 		}
 	}
 
@@ -338,41 +356,40 @@ void
 PcapManager::process(void)
 {
 	if (is_enabled()) {
-		fd_set fds;
-		int max_fd(-1);
-		int fds_ready;
-		struct timeval timeout = {};
-
-		FD_ZERO(&fds);
-
-		update_fd_set(&fds, NULL, &fds, &max_fd, NULL);
-
-		fds_ready = select(
-			max_fd + 1,
-			&fds,
-			NULL,
-			&fds,
-			&timeout
-		);
-
-		if (fds_ready > 0) {
-			// Tear down bad file descriptors.
-			std::set<int> remove_set;
-			std::set<int>::const_iterator iter;
-
-			for ( iter  = mFDSet.begin()
-				; (fds_ready > 0) && (iter != mFDSet.end())
-				; ++iter
-			) {
-				int fd = *iter;
-				if (!FD_ISSET(fd, &fds)) {
-					continue;
+		// Nothing is ever read from a pcap stream, so readability or an
+		// error means the other end went away. The main loop already
+		// waited on these descriptors, so use its results when we can.
+		EventBackend* backend = EventBackend::get_active();
+		std::set<int> remove_set;
+		std::set<int>::const_iterator iter;
+
+		if (backend != NULL) {
+			for (iter = mFDSet.begin(); iter != mFDSet.end(); ++iter) {
+				if (backend->take_ready(*iter, EventBackend::kEventRead) != 0) {
+					remove_set.insert(*iter);
 				}
-				fds_ready--;
-				remove_set.insert(fd);
 			}
 
-			close_fd_set(remove_set);
+		} else {
+			std::vector<struct pollfd> fds;
+			int fds_ready;
+
+			for (iter = mFDSet.begin(); iter != mFDSet.end(); ++iter) {
+				struct pollfd pollfd = { *iter, POLLIN | POLLPRI, 0 };
+				fds.push_back(pollfd);
+			}
+
+			fds_ready = poll(&fds[0], fds.size(), 0);
+
+			for (size_t i = 0; (fds_ready > 0) && (i < fds.size()); i++) {
+				if (fds[i].revents != 0) {
+					fds_ready--;
+					remove_set.insert(fds[i].fd);
+				}
+			}
 		}
+
+		// Tear down bad file descriptors.
+		close_fd_set(remove_set);
 	}
 }
@@ -21,8 +21,10 @@
 #define __wpantund__Pcap__
 
 #include <set>
+#include <sys/uio.h>
 #include "wpan-error.h"
 #include "time-utils.h"
+#include "EventBackend.h"
 
 namespace nl {
 namespace wpantund {
@@ -82,17 +84,30 @@ struct PcapFrameHeader {
 	};
 };
 
+// A PCAP record under construction. PPI field data and the payload are
+// referenced rather than copied, so they must stay put until the packet
+// has been pushed. PPI fields must be appended before the payload.
 class PcapPacket
 {
 public:
+	enum {
+		kMaxPpiFields = 2,
+
+		// The record header, a header and data for each PPI field, and
+		// the payload.
+		kMaxIOVCount = 1 + 2 * kMaxPpiFields + 1
+	};
+
 	PcapPacket();
 
 	wpantund_status_t get_status(void)const;
 
-	const uint8_t* get_data_ptr(void)const;
-
 	int get_data_len(void)const;
 
+	// Fills in `iov` (which has room for `kMaxIOVCount` entries) with
+	// the pieces of the record and returns how many were used.
+	int get_iov(struct iovec* iov)const;
+
 	PcapPacket& set_timestamp(struct timeval* tv = NULL);
 
 	PcapPacket& set_dlt(uint32_t i);
@@ -101,13 +116,17 @@ public:
 
 	PcapPacket& append_payload(const uint8_t* payload_ptr, int payload_len);
 
-	PcapPacket& finish(void);
-
 private:
-	union {
-		uint8_t         mData[PCAP_PACKET_MAX_SIZE];
-		PcapFrameHeader mHeader;
+	struct PpiField {
+		PcapPpiFieldHeader mHeader;
+		const uint8_t*     mData;
 	};
+
+	PcapFrameHeader   mHeader;
+	PpiField          mFields[kMaxPpiFields];
+	int               mFieldCount;
+	const uint8_t*    mPayload;
+	int               mPayloadLen;    // As recorded, after truncation
 	int               mLen;
 	wpantund_status_t mStatus;
 };
@@ -130,7 +149,7 @@ public:
 
 	void process(void);
 
-	int update_fd_set(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int *max_fd, cms_t *timeout);
+	int update_fd_interest(nl::EventBackend *backend, cms_t *timeout);
 
 	void close_fd_set(const std::set<int>& x);
 
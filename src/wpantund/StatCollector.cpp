@@ -30,6 +30,8 @@
 #include <iterator>
 #include "StatCollector.h"
 #include "any-to.h"
+#include "murmur3.h"
+#include "sec-random.h"
 #include "wpan-error.h"
 
 using namespace nl;
@@ -161,12 +163,19 @@ StatCollector::IPAddress::to_string(void) const
 	return std::string(address_string);
 }
 
+// Murmur3 over the address words.
+uint32_t
+StatCollector::IPAddress::hash(uint32_t seed) const
+{
+	return murmur3_32(mAddressBuffer, sizeof(mAddressBuffer)/sizeof(mAddressBuffer[0]), seed);
+}
+
 bool
 StatCollector::IPAddress::operator==(const IPAddress& lhs) const
 {
 	// Since IPv6 addresses typically start with same prefix, we intentionally
 	// start the comparison from the end of address buffer
-	for(int indx = sizeof(mAddressBuffer)/sizeof(mAddressBuffer[0]) - 1; indx ; indx--) {
+	for(int indx = sizeof(mAddressBuffer)/sizeof(mAddressBuffer[0]) - 1; indx >= 0; indx--) {
 		if (mAddressBuffer[indx] != lhs.mAddressBuffer[indx]) {
 			return false;
 		}
@@ -181,7 +190,7 @@ StatCollector::IPAddress::operator<(const IPAddress& lhs) const
 	// Since IPv6 addresses typically start with same prefix, we intentionally
 	// start the comparison from the end of address buffer
 
-	for(int indx = sizeof(mAddressBuffer)/sizeof(mAddressBuffer[0]) - 1; indx ; indx--) {
+	for(int indx = sizeof(mAddressBuffer)/sizeof(mAddressBuffer[0]) - 1; indx >= 0; indx--) {
 		if (mAddressBuffer[indx] < lhs.mAddressBuffer[indx]) {
 			return true;
 		}
@@ -519,81 +528,252 @@ StatCollector::ReadyForHostSleepState::to_string(void) const
 // Node Stat
 
 StatCollector::NodeStat::NodeStat():
-	mNodeInfoPool(), mNodeInfoMap()
+	mNodes(), mSlots(), mSlotMask(0), mFree(kNone), mNewest(kNone), mOldest(kNone), mCount(0), mEvictions(0)
 {
-	return;
+	// Remote nodes pick their own addresses, so the hash is seeded to
+	// keep anyone from lining them up in one run of slots.
+	if (sec_random_fill(reinterpret_cast<uint8_t *>(&mSeed), sizeof(mSeed)) < 0) {
+		mSeed = static_cast<uint32_t>(time_ms())
+			^ static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this));
+	}
+
+	resize(STAT_COLLECTOR_MAX_NODES, STAT_COLLECTOR_PER_NODE_RX_HISTORY_SIZE, STAT_COLLECTOR_PER_NODE_TX_HISTORY_SIZE);
 }
 
 void
 StatCollector::NodeStat::clear()
 {
-	mNodeInfoMap.clear();
-	mNodeInfoPool.free_all();
+	size_t i;
+
+	for (i = 0; i < mSlots.size(); i++) {
+		mSlots[i].mNode = kNone;
+	}
+
+	mFree = kNone;
+
+	for (i = mNodes.size(); i > 0; i--) {
+		mNodes[i - 1].mNewer = mFree;
+		mFree = static_cast<int32_t>(i - 1);
+	}
+
+	mNewest = kNone;
+	mOldest = kNone;
+	mCount = 0;
+	mEvictions = 0;
 }
 
-StatCollector::NodeStat::NodeInfo *
-StatCollector::NodeStat::find_node_info(const IPAddress& address)
+size_t
+StatCollector::NodeStat::get_slot_count(size_t capacity)
+{
+	size_t slot_count = 2;
+
+	// Keep the probe sequences short by having at least twice as many
+	// slots as there can be nodes.
+	while (slot_count < 2 * capacity) {
+		slot_count *= 2;
+	}
+
+	return slot_count;
+}
+
+size_t
+StatCollector::NodeStat::get_memory_usage(size_t capacity, int rx_history_size, int tx_history_size)
+{
+	return capacity * (sizeof(NodeInfo) + (rx_history_size + tx_history_size) * sizeof(PacketInfo))
+		+ get_slot_count(capacity) * sizeof(Slot);
+}
+
+void
+StatCollector::NodeStat::resize(size_t capacity, int rx_history_size, int tx_history_size)
+{
+	std::vector<NodeInfo> old_nodes;
+	std::vector<PacketInfo> old_rx_history_storage;
+	std::vector<PacketInfo> old_tx_history_storage;
+	std::vector<int32_t> kept;
+	size_t slot_count = get_slot_count(capacity);
+	int32_t index;
+	size_t i;
+
+	// The old nodes' histories still point into the old storage, so hold
+	// on to it until they have been copied.
+	old_nodes.swap(mNodes);
+	old_rx_history_storage.swap(mRxHistoryStorage);
+	old_tx_history_storage.swap(mTxHistoryStorage);
+
+	// Keep the most recently seen nodes, newest first.
+	for (index = mNewest; (index != kNone) && (kept.size() < capacity); index = old_nodes[index].mOlder) {
+		kept.push_back(index);
+	}
+
+	mNodes.assign(capacity, NodeInfo());
+	mRxHistoryStorage.assign(capacity * rx_history_size, PacketInfo());
+	mTxHistoryStorage.assign(capacity * tx_history_size, PacketInfo());
+
+	for (i = 0; i < capacity; i++) {
+		mNodes[i].mRxHistory.attach((rx_history_size != 0) ? &mRxHistoryStorage[i * rx_history_size] : NULL, rx_history_size);
+		mNodes[i].mTxHistory.attach((tx_history_size != 0) ? &mTxHistoryStorage[i * tx_history_size] : NULL, tx_history_size);
+	}
+
+	mSlots.assign(slot_count, Slot());
+	mSlotMask = static_cast<uint32_t>(slot_count - 1);
+
+	clear();
+
+	for (i = kept.size(); i > 0; i--) {
+		const NodeInfo& old_node_info = old_nodes[kept[i - 1]];
+
+		find_or_create_node_info(old_node_info.mAddress)->copy_from(old_node_info);
+	}
+}
+
+int32_t
+StatCollector::NodeStat::find_slot(const IPAddress& address, uint32_t hash) const
 {
-	std::map<IPAddress, NodeInfo*>::iterator it = mNodeInfoMap.find(address);
+	uint32_t slot = hash & mSlotMask;
 
-	if (it == mNodeInfoMap.end())
+	// The table is never more than half full, so there is always an
+	// empty slot to stop at.
+	while (mSlots[slot].mNode != kNone) {
+		if ((mSlots[slot].mHash == hash) && (mNodes[mSlots[slot].mNode].mAddress == address)) {
+			break;
+		}
+
+		slot = (slot + 1) & mSlotMask;
+	}
+
+	return static_cast<int32_t>(slot);
+}
+
+const StatCollector::NodeStat::NodeInfo *
+StatCollector::NodeStat::find_node_info(const IPAddress& address) const
+{
+	int32_t index;
+
+	if (mNodes.empty()) {
 		return NULL;
+	}
 
-	return it->second;
+	index = mSlots[find_slot(address, address.hash(mSeed))].mNode;
+
+	return (index != kNone) ? &mNodes[index] : NULL;
 }
 
+void
+StatCollector::NodeStat::unlink_node(int32_t index)
+{
+	NodeInfo& node_info = mNodes[index];
+
+	if (node_info.mNewer != kNone) {
+		mNodes[node_info.mNewer].mOlder = node_info.mOlder;
+	} else {
+		mNewest = node_info.mOlder;
+	}
+
+	if (node_info.mOlder != kNone) {
+		mNodes[node_info.mOlder].mNewer = node_info.mNewer;
+	} else {
+		mOldest = node_info.mNewer;
+	}
+}
+
+void
+StatCollector::NodeStat::link_newest_node(int32_t index)
+{
+	NodeInfo& node_info = mNodes[index];
+
+	node_info.mNewer = kNone;
+	node_info.mOlder = mNewest;
+
+	if (mNewest != kNone) {
+		mNodes[mNewest].mNewer = index;
+	} else {
+		mOldest = index;
+	}
+
+	mNewest = index;
+}
+
+// Finds the node and marks it as just seen, making room for it
+// if it isn't there yet.
 StatCollector::NodeStat::NodeInfo *
-StatCollector::NodeStat::create_new_node_info(const IPAddress& address)
+StatCollector::NodeStat::find_or_create_node_info(const IPAddress& address)
 {
-	NodeInfo *node_info_ptr = NULL;
+	const uint32_t hash = address.hash(mSeed);
+	int32_t slot;
+	int32_t index;
 
-	do {
-		node_info_ptr = mNodeInfoPool.alloc();
+	if (mNodes.empty()) {
+		return NULL;
+	}
+
+	slot = find_slot(address, hash);
+	index = mSlots[slot].mNode;
 
-		// If we can not allocate a new node info (all objects in the pool are used),
-		// we will remove oldest node info and try again.
-		if (!node_info_ptr) {
-			remove_oldest_node_info();
+	if (index != kNone) {
+		if (index != mNewest) {
+			unlink_node(index);
+			link_newest_node(index);
 		}
-	} while (!node_info_ptr);
 
-	node_info_ptr->clear();
+		return &mNodes[index];
+	}
+
+	if (mFree == kNone) {
+		remove_oldest_node_info();
 
-	mNodeInfoMap.insert(std::pair<IPAddress, NodeInfo*>(address, node_info_ptr));
+		// Removing a node can move others into the slot we found.
+		slot = find_slot(address, hash);
+	}
 
-	return node_info_ptr;
+	index = mFree;
+	mFree = mNodes[index].mNewer;
+	mCount++;
+
+	mNodes[index].clear();
+	mNodes[index].mAddress = address;
+	mSlots[slot].mNode = index;
+	mSlots[slot].mHash = hash;
+
+	link_newest_node(index);
+
+	return &mNodes[index];
 }
 
 void
 StatCollector::NodeStat::remove_oldest_node_info(void)
 {
-	std::map<IPAddress, NodeInfo*>::iterator cur_iter, oldest_iter;
-	TimeStamp ts, oldest_ts;
+	const int32_t index = mOldest;
+	uint32_t slot = static_cast<uint32_t>(find_slot(mNodes[index].mAddress, mNodes[index].mAddress.hash(mSeed)));
+	uint32_t next = slot;
 
-	for (cur_iter = oldest_iter = mNodeInfoMap.begin(); cur_iter != mNodeInfoMap.end(); cur_iter++) {
+	// Shift back any of the nodes after the freed slot which would no
+	// longer be found past it, so that the table needs no tombstones.
+	while (true) {
+		uint32_t home;
 
-		ts = cur_iter->second->get_last_rx_or_tx_time();
+		next = (next + 1) & mSlotMask;
 
-		if (oldest_ts.is_uninitialized()) {
-			oldest_ts = ts;
-			oldest_iter = cur_iter;
+		if (mSlots[next].mNode == kNone) {
+			break;
 		}
 
-		if (!ts.is_uninitialized()) {
-			if (ts < oldest_ts) {
-				oldest_ts = ts;
-				oldest_iter = cur_iter;
-			}
+		home = mSlots[next].mHash & mSlotMask;
+
+		if (((next - home) & mSlotMask) >= ((next - slot) & mSlotMask)) {
+			mSlots[slot] = mSlots[next];
+			slot = next;
 		}
 	}
 
-	if (oldest_iter != mNodeInfoMap.end()) {
-		NodeInfo *node_info_ptr = oldest_iter->second;
-		mNodeInfoMap.erase(oldest_iter);
-		mNodeInfoPool.free(node_info_ptr);
+	mSlots[slot].mNode = kNone;
 
-		syslog(LOG_INFO, "StatCollector: Out of NodeInfo objects --> Deleted the oldest NodeInfo");
-	}
+	unlink_node(index);
+	mNodes[index].mNewer = mFree;
+	mFree = index;
+	mCount--;
+	mEvictions++;
+
+	DEBUG_LOG("StatCollector: Out of NodeInfo objects --> Deleted the oldest NodeInfo");
 }
 
 void
@@ -601,10 +781,7 @@ StatCollector::NodeStat::update_from_inbound_packet(const PacketInfo& packet_inf
 {
 	NodeInfo *node_info_ptr;
 
-	node_info_ptr = find_node_info(packet_info.mSrcAddress);
-	if (!node_info_ptr) {
-		node_info_ptr = create_new_node_info(packet_info.mSrcAddress);
-	}
+	node_info_ptr = find_or_create_node_info(packet_info.mSrcAddress);
 
 	if (node_info_ptr) {
 		node_info_ptr->mRxPacketsTotal++;
@@ -621,10 +798,7 @@ StatCollector::NodeStat::update_from_outbound_packet(const PacketInfo& packet_in
 {
 	NodeInfo *node_info_ptr;
 
-	node_info_ptr = find_node_info(packet_info.mDstAddress);
-	if (!node_info_ptr) {
-		node_info_ptr = create_new_node_info(packet_info.mDstAddress);
-	}
+	node_info_ptr = find_or_create_node_info(packet_info.mDstAddress);
 
 	if (node_info_ptr) {
 		node_info_ptr->mTxPacketsTotal++;
@@ -637,22 +811,23 @@ StatCollector::NodeStat::update_from_outbound_packet(const PacketInfo& packet_in
 }
 
 void
-StatCollector::NodeStat::add_node_info_map_iter(StringList &output, const std::map<IPAddress, NodeInfo*>::const_iterator& it) const
+StatCollector::NodeStat::add_node_info(StringList &output, const NodeInfo& node_info) const
 {
 	output.push_back("========================================================");
-	output.push_back("Address: " + it->first.to_string());
-	it->second->add_node_info(output);
+	output.push_back("Address: " + node_info.mAddress.to_string());
+	node_info.add_node_info(output);
 	output.push_back("");
 }
 
+// Nodes are listed (and indexed) starting from the most recently seen.
 void
 StatCollector::NodeStat::add_node_stat_history(StringList& output, std::string node_indicator) const
 {
-	std::map<IPAddress, NodeInfo*>::const_iterator it;
+	int32_t index;
 
 	if (node_indicator.empty()) {
-		for (it = mNodeInfoMap.begin(); it != mNodeInfoMap.end(); it++) {
-			add_node_info_map_iter(output, it);
+		for (index = mNewest; index != kNone; index = mNodes[index].mOlder) {
+			add_node_info(output, mNodes[index]);
 		}
 	} else {
 		char c = node_indicator[0];
@@ -673,10 +848,12 @@ StatCollector::NodeStat::add_node_stat_history(StringList& output, std::string n
 
 			if (inet_pton(AF_INET6, ip_addr_str.c_str(), ip_addr_buf) > 0) {
 				IPAddress ip_address;
+				const NodeInfo *node_info_ptr;
+
 				ip_address.read_from(ip_addr_buf);
-				it = mNodeInfoMap.find(ip_address);
-				if (it != mNodeInfoMap.end()) {
-					add_node_info_map_iter(output, it);
+				node_info_ptr = find_node_info(ip_address);
+				if (node_info_ptr != NULL) {
+					add_node_info(output, *node_info_ptr);
 				} else {
 					output.push_back(string_printf("Error : Address does not exist (\'%s\')", node_indicator.c_str()));
 				}
@@ -684,14 +861,15 @@ StatCollector::NodeStat::add_node_stat_history(StringList& output, std::string n
 				output.push_back(string_printf("Error : Improper address format (\'%s\')", node_indicator.c_str()));
 			}
 		} else { // Index mode:
-			int index;
-			index = static_cast<int>(strtol(node_indicator.c_str(), NULL, 0));
-			if (index < mNodeInfoMap.size()) {
-				it = mNodeInfoMap.begin();
-				std::advance(it, index);
-				add_node_info_map_iter(output, it);
+			int indx;
+			indx = static_cast<int>(strtol(node_indicator.c_str(), NULL, 0));
+			if ((indx >= 0) && (indx < static_cast<int>(mCount))) {
+				for (index = mNewest; indx > 0; indx--) {
+					index = mNodes[index].mOlder;
+				}
+				add_node_info(output, mNodes[index]);
 			} else {
-				output.push_back(string_printf("Error: Out of bound index %d (\'%s\')", index, node_indicator.c_str()));
+				output.push_back(string_printf("Error: Out of bound index %d (\'%s\')", indx, node_indicator.c_str()));
 			}
 		}
 	}
@@ -700,13 +878,18 @@ StatCollector::NodeStat::add_node_stat_history(StringList& output, std::string n
 void
 StatCollector::NodeStat::add_node_stat(StringList& output) const
 {
-	std::map<IPAddress, NodeInfo*>::const_iterator it;
+	int32_t index;
+
+	output.push_back(string_printf("Tracking %d of at most %d nodes (%u evicted)",
+		static_cast<int>(mCount), static_cast<int>(mNodes.size()), mEvictions));
+
+	for (index = mNewest; index != kNone; index = mNodes[index].mOlder) {
+		const NodeInfo& node_info = mNodes[index];
 
-	for (it = mNodeInfoMap.begin(); it != mNodeInfoMap.end(); it++) {
 		output.push_back("========================================================");
-		output.push_back("Address: " + it->first.to_string());
-		it->second->add_tx_stat(output);
-		it->second->add_rx_stat(output);
+		output.push_back("Address: " + node_info.mAddress.to_string());
+		node_info.add_tx_stat(output);
+		node_info.add_rx_stat(output);
 		output.push_back("");
 	}
 }
@@ -714,11 +897,38 @@ StatCollector::NodeStat::add_node_stat(StringList& output) const
 //-------------------------------------------------------------------
 // NodeStat::NodeInfo
 
-StatCollector::NodeStat::NodeInfo::NodeInfo()
+StatCollector::NodeStat::NodeInfo::NodeInfo():
+	mAddress(), mNewer(-1), mOlder(-1)
 {
 	clear();
 }
 
+// Copies the counters and as much of the histories of `node_info` as
+// fit, leaving the address and the place in the LRU chain alone.
+void
+StatCollector::NodeStat::NodeInfo::copy_from(const NodeInfo& node_info)
+{
+	RingBufferView<PacketInfo>::Iterator iter;
+
+	mTxPacketsTotal = node_info.mTxPacketsTotal;
+	mTxPacketsUDP = node_info.mTxPacketsUDP;
+	mTxPacketsTCP = node_info.mTxPacketsTCP;
+
+	mRxPacketsTotal = node_info.mRxPacketsTotal;
+	mRxPacketsUDP = node_info.mRxPacketsUDP;
+	mRxPacketsTCP = node_info.mRxPacketsTCP;
+
+	mRxHistory.clear();
+	for (iter = node_info.mRxHistory.begin(); iter != node_info.mRxHistory.end(); ++iter) {
+		mRxHistory.force_write(*iter);
+	}
+
+	mTxHistory.clear();
+	for (iter = node_info.mTxHistory.begin(); iter != node_info.mTxHistory.end(); ++iter) {
+		mTxHistory.force_write(*iter);
+	}
+}
+
 void
 StatCollector::NodeStat::NodeInfo::clear(void)
 {
@@ -836,7 +1046,7 @@ StatCollector::NodeStat::NodeInfo::add_node_info(StringList& output) const
 	add_tx_stat(output, false);
 
 	if (!mTxHistory.empty()) {
-		RingBuffer<PacketInfo, STAT_COLLECTOR_PER_NODE_TX_HISTORY_SIZE>::ReverseIterator iter;
+		RingBufferView<PacketInfo>::ReverseIterator iter;
 
 		output.push_back(string_printf("\tLast %d tx packets", mTxHistory.size()));
 		for (iter = mTxHistory.rbegin(); iter != mTxHistory.rend(); ++iter) {
@@ -848,7 +1058,7 @@ StatCollector::NodeStat::NodeInfo::add_node_info(StringList& output) const
 	add_rx_stat(output, false);
 
 	if (!mRxHistory.empty()) {
-		RingBuffer<PacketInfo, STAT_COLLECTOR_PER_NODE_RX_HISTORY_SIZE>::ReverseIterator iter;
+		RingBufferView<PacketInfo>::ReverseIterator iter;
 
 		output.push_back(string_printf("\tLast %d rx packets", mRxHistory.size()));
 		for (iter = mRxHistory.rbegin(); iter != mRxHistory.rend(); ++iter) {
@@ -928,7 +1138,7 @@ StatCollector::LinkStat::LinkInfo::empty(void) const
 void
 StatCollector::LinkStat::LinkInfo::add_link_info(StringList& output, int count) const
 {
-	RingBuffer<LinkQuality, STAT_COLLECTOR_LINK_QUALITY_HISTORY_SIZE>::ReverseIterator iter;
+	RingBufferView<LinkQuality>::ReverseIterator iter;
 
 	if (count == 0) {
 		count = mLinkQualityHistory.size();
@@ -956,15 +1166,78 @@ StatCollector::LinkStat::LinkInfo::get_last_update_time(void) const
 // LinkStat
 
 StatCollector::LinkStat::LinkStat()
-		: mLinkInfoPool(), mLinkInfoMap()
+		: mLinkInfoPool(), mFreeLinkInfos(), mLinkQualityStorage(), mLinkInfoMap()
 {
+	resize(STAT_COLLECTOR_MAX_LINKS, STAT_COLLECTOR_LINK_QUALITY_HISTORY_SIZE);
 }
 
 void
 StatCollector::LinkStat::clear(void)
 {
+	size_t i;
+
 	mLinkInfoMap.clear();
-	mLinkInfoPool.free_all();
+	mFreeLinkInfos.clear();
+
+	for (i = mLinkInfoPool.size(); i > 0; i--) {
+		mFreeLinkInfos.push_back(&mLinkInfoPool[i - 1]);
+	}
+}
+
+size_t
+StatCollector::LinkStat::get_memory_usage(size_t capacity, int history_size)
+{
+	return capacity * (sizeof(LinkInfo) + sizeof(LinkInfo *) + history_size * sizeof(LinkQuality));
+}
+
+void
+StatCollector::LinkStat::resize(size_t capacity, int history_size)
+{
+	std::vector<LinkInfo> old_link_info_pool;
+	std::vector<LinkQuality> old_link_quality_storage;
+	std::map<EUI64Address, LinkInfo*>::iterator iter;
+	size_t i;
+
+	while (mLinkInfoMap.size() > capacity) {
+		remove_oldest_link_info();
+	}
+
+	// The old peers' histories still point into the old storage, so hold
+	// on to it until they have been copied.
+	old_link_info_pool.swap(mLinkInfoPool);
+	old_link_quality_storage.swap(mLinkQualityStorage);
+
+	mLinkInfoPool.assign(capacity, LinkInfo());
+	mLinkQualityStorage.assign(capacity * history_size, LinkQuality());
+
+	for (i = 0; i < capacity; i++) {
+		mLinkInfoPool[i].mLinkQualityHistory.attach((history_size != 0) ? &mLinkQualityStorage[i * history_size] : NULL, history_size);
+	}
+
+	mFreeLinkInfos.clear();
+
+	for (i = capacity; i > 0; i--) {
+		mFreeLinkInfos.push_back(&mLinkInfoPool[i - 1]);
+	}
+
+	for (iter = mLinkInfoMap.begin(); iter != mLinkInfoMap.end(); ++iter) {
+		const LinkInfo *old_link_info_ptr = iter->second;
+		LinkInfo *link_info_ptr = mFreeLinkInfos.back();
+		RingBufferView<LinkQuality>::Iterator quality_iter;
+
+		mFreeLinkInfos.pop_back();
+
+		link_info_ptr->mNodeType = old_link_info_ptr->mNodeType;
+
+		for (quality_iter = old_link_info_ptr->mLinkQualityHistory.begin();
+			quality_iter != old_link_info_ptr->mLinkQualityHistory.end();
+			++quality_iter
+		) {
+			link_info_ptr->mLinkQualityHistory.force_write(*quality_iter);
+		}
+
+		iter->second = link_info_ptr;
+	}
 }
 
 
@@ -984,15 +1257,14 @@ StatCollector::LinkStat::create_new_link_info(const EUI64Address& address)
 {
 	LinkInfo *link_info_ptr = NULL;
 
-	do {
-		link_info_ptr = mLinkInfoPool.alloc();
+	// If all of the link infos are in use, we will remove the oldest one
+	// in the map and use it instead.
+	if (mFreeLinkInfos.empty()) {
+		remove_oldest_link_info();
+	}
 
-		// If we can not allocate a new link info (all objects in the pool are used),
-		// we will remove oldest one in the map and try again.
-		if (!link_info_ptr) {
-			remove_oldest_link_info();
-		}
-	} while (!link_info_ptr);
+	link_info_ptr = mFreeLinkInfos.back();
+	mFreeLinkInfos.pop_back();
 
 	link_info_ptr->clear();
 
@@ -1027,7 +1299,7 @@ StatCollector::LinkStat::remove_oldest_link_info(void)
 	if (oldest_iter != mLinkInfoMap.end()) {
 		LinkInfo *link_info_ptr = oldest_iter->second;
 		mLinkInfoMap.erase(oldest_iter);
-		mLinkInfoPool.free(link_info_ptr);
+		mFreeLinkInfos.push_back(link_info_ptr);
 
 		syslog(LOG_INFO, "StatCollector: Out of LinkInfo objects --> Deleted the oldest LinkInfo");
 	}
@@ -1077,6 +1349,27 @@ StatCollector::LinkStat::add_link_stat(StringList& output, int count) const
 //-------------------------------------------------------------------
 // StatCollector
 
+// Gives `history` new storage of `history_size` entries, keeping as
+// many of its newest entries as fit.
+template <typename T>
+static void
+resize_history(std::vector<T>& storage, RingBufferView<T>& history, int history_size)
+{
+	std::vector<T> old_storage;
+	RingBufferView<T> old_history = history;
+	typename RingBufferView<T>::Iterator iter;
+
+	// `old_history` still points into the old storage, so hold on to it
+	// until the entries have been copied.
+	old_storage.swap(storage);
+	storage.assign(history_size, T());
+	history.attach((history_size != 0) ? &storage[0] : NULL, history_size);
+
+	for (iter = old_history.begin(); iter != old_history.end(); ++iter) {
+		history.force_write(*iter);
+	}
+}
+
 StatCollector::StatCollector() :
 		mTxBytesTotal(), mRxBytesTotal(),
 		mRxHistory(), mTxHistory(),
@@ -1086,6 +1379,23 @@ StatCollector::StatCollector() :
 {
 	mControlInterface = NULL;
 
+	// `mNodeStat` and `mLinkStat` start out with the same defaults.
+	mLimits.mRxHistory = STAT_COLLECTOR_RX_HISTORY_SIZE;
+	mLimits.mTxHistory = STAT_COLLECTOR_TX_HISTORY_SIZE;
+	mLimits.mNcpStateHistory = STAT_COLLECTOR_NCP_STATE_HISTORY_SIZE;
+	mLimits.mReadyForHostSleepHistory = STAT_COLLECTOR_NCP_READY_FOR_HOST_SLEEP_STATE_HISTORY_SIZE;
+	mLimits.mNodes = STAT_COLLECTOR_MAX_NODES;
+	mLimits.mNodeRxHistory = STAT_COLLECTOR_PER_NODE_RX_HISTORY_SIZE;
+	mLimits.mNodeTxHistory = STAT_COLLECTOR_PER_NODE_TX_HISTORY_SIZE;
+	mLimits.mLinks = STAT_COLLECTOR_MAX_LINKS;
+	mLimits.mLinkQualityHistory = STAT_COLLECTOR_LINK_QUALITY_HISTORY_SIZE;
+	mMemoryBudget = STAT_COLLECTOR_DEFAULT_MEMORY_BUDGET;
+
+	resize_history(mRxHistoryStorage, mRxHistory, mLimits.mRxHistory);
+	resize_history(mTxHistoryStorage, mTxHistory, mLimits.mTxHistory);
+	resize_history(mNCPStateHistoryStorage, mNCPStateHistory, mLimits.mNcpStateHistory);
+	resize_history(mReadyForSleepHistoryStorage, mReadyForSleepHistory, mLimits.mReadyForHostSleepHistory);
+
 	mTxPacketsTotal = 0;
 	mRxPacketsTotal = 0;
 	mRxPacketsUDP = 0;
@@ -1102,6 +1412,10 @@ StatCollector::StatCollector() :
 
 	mAutoLogState = kAutoLogShort;
 	mAutoLogPeriod = STAT_COLLECTOR_AUTO_LOG_PERIOD_IN_MIN * Timer::kOneMinute;
+
+	// Nobody cares if the periodic log is a second late, so let it ride
+	// along with whatever else wakes up the main loop.
+	mAutoLogTimer.set_slack(Timer::kOneSecond);
 	update_auto_log_timer();
 }
 
@@ -1214,7 +1528,7 @@ StatCollector::add_tx_history(StringList& output, int count) const
 	}
 
 	if (!mTxHistory.empty()) {
-		RingBuffer<PacketInfo, STAT_COLLECTOR_TX_HISTORY_SIZE>::ReverseIterator iter;
+		RingBufferView<PacketInfo>::ReverseIterator iter;
 
 		output.push_back("Tx History");
 		output.push_back("-------------------------");
@@ -1234,7 +1548,7 @@ StatCollector::add_rx_history(StringList& output, int count) const
 	}
 
 	if (!mRxHistory.empty()) {
-		RingBuffer<PacketInfo, STAT_COLLECTOR_RX_HISTORY_SIZE>::ReverseIterator iter;
+		RingBufferView<PacketInfo>::ReverseIterator iter;
 
 		output.push_back("Rx History");
 		output.push_back("-------------------------");
@@ -1254,7 +1568,7 @@ StatCollector::add_ncp_state_history(StringList& output, int count) const
 	}
 
 	if(!mNCPStateHistory.empty()) {
-		RingBuffer<NcpStateInfo, STAT_COLLECTOR_NCP_STATE_HISTORY_SIZE>::ReverseIterator iter;
+		RingBufferView<NcpStateInfo>::ReverseIterator iter;
 
 		output.push_back("NCP State History");
 		output.push_back("-------------------------");
@@ -1274,7 +1588,7 @@ StatCollector::add_ncp_ready_for_host_sleep_state_history(StringList& output, in
 	}
 
 	if (!mReadyForSleepHistory.empty() || (mLastReadyForHostSleepState == false)) {
-		RingBuffer<ReadyForHostSleepState, STAT_COLLECTOR_NCP_READY_FOR_HOST_SLEEP_STATE_HISTORY_SIZE>::ReverseIterator iter;
+		RingBufferView<ReadyForHostSleepState>::ReverseIterator iter;
 
 		output.push_back("\'NCP Ready For Host Sleep State\' History");
 		output.push_back("-------------------------");
@@ -1350,6 +1664,138 @@ StatCollector::add_all_info(StringList& output, int count) const
 	}
 }
 
+size_t
+StatCollector::get_memory_usage(const Limits& limits)
+{
+	return limits.mRxHistory * sizeof(PacketInfo)
+		+ limits.mTxHistory * sizeof(PacketInfo)
+		+ limits.mNcpStateHistory * sizeof(NcpStateInfo)
+		+ limits.mReadyForHostSleepHistory * sizeof(ReadyForHostSleepState)
+		+ NodeStat::get_memory_usage(limits.mNodes, limits.mNodeRxHistory, limits.mNodeTxHistory)
+		+ LinkStat::get_memory_usage(limits.mLinks, limits.mLinkQualityHistory);
+}
+
+// Resizes whichever histories changed, unless all of them together
+// would no longer fit in the memory budget.
+int
+StatCollector::set_limits(const Limits& limits)
+{
+	size_t memory_usage = get_memory_usage(limits);
+
+	if (memory_usage > mMemoryBudget) {
+		syslog(LOG_WARNING, "StatCollector: %u bytes of histories would not fit in the budget of %u bytes",
+			static_cast<unsigned int>(memory_usage), static_cast<unsigned int>(mMemoryBudget));
+		return kWPANTUNDStatus_InvalidArgument;
+	}
+
+	if (limits.mRxHistory != mLimits.mRxHistory) {
+		resize_history(mRxHistoryStorage, mRxHistory, limits.mRxHistory);
+	}
+
+	if (limits.mTxHistory != mLimits.mTxHistory) {
+		resize_history(mTxHistoryStorage, mTxHistory, limits.mTxHistory);
+	}
+
+	if (limits.mNcpStateHistory != mLimits.mNcpStateHistory) {
+		resize_history(mNCPStateHistoryStorage, mNCPStateHistory, limits.mNcpStateHistory);
+	}
+
+	if (limits.mReadyForHostSleepHistory != mLimits.mReadyForHostSleepHistory) {
+		resize_history(mReadyForSleepHistoryStorage, mReadyForSleepHistory, limits.mReadyForHostSleepHistory);
+	}
+
+	if ((limits.mNodes != mLimits.mNodes)
+		|| (limits.mNodeRxHistory != mLimits.mNodeRxHistory)
+		|| (limits.mNodeTxHistory != mLimits.mNodeTxHistory)
+	) {
+		mNodeStat.resize(limits.mNodes, limits.mNodeRxHistory, limits.mNodeTxHistory);
+	}
+
+	if ((limits.mLinks != mLimits.mLinks) || (limits.mLinkQualityHistory != mLimits.mLinkQualityHistory)) {
+		mLinkStat.resize(limits.mLinks, limits.mLinkQualityHistory);
+	}
+
+	mLimits = limits;
+
+	return kWPANTUNDStatus_Ok;
+}
+
+// Returns the field of `limits` set by the property `key`, and the range
+// of values it can take, or NULL if `key` is not such a property.
+int *
+StatCollector::get_limit(Limits& limits, const std::string& key, int& min_value, int& max_value)
+{
+	int *limit = NULL;
+
+	min_value = 0;
+	max_value = STAT_COLLECTOR_MAX_HISTORY_SIZE;
+
+	if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatRXDepth)) {
+		limit = &limits.mRxHistory;
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatTXDepth)) {
+		limit = &limits.mTxHistory;
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatNCPDepth)) {
+		limit = &limits.mNcpStateHistory;
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatBlockingHostSleepDepth)) {
+		limit = &limits.mReadyForHostSleepHistory;
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatNodeRXDepth)) {
+		limit = &limits.mNodeRxHistory;
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatNodeTXDepth)) {
+		limit = &limits.mNodeTxHistory;
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatLinkQualityDepth)) {
+		limit = &limits.mLinkQualityHistory;
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatNodeCapacity)) {
+		limit = &limits.mNodes;
+		min_value = 1;
+		max_value = STAT_COLLECTOR_MAX_NODE_CAPACITY;
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatLinkQualityCapacity)) {
+		limit = &limits.mLinks;
+		min_value = 1;
+		max_value = STAT_COLLECTOR_MAX_LINK_CAPACITY;
+	}
+
+	return limit;
+}
+
+void
+StatCollector::add_memory_usage(StringList& output) const
+{
+	size_t bytes;
+
+	output.push_back(string_printf("%-28s %-24s %10s", "History", "Entries", "Bytes"));
+
+	bytes = mLimits.mRxHistory * sizeof(PacketInfo);
+	output.push_back(string_printf("%-28s %-24d %10u", kWPANTUNDProperty_StatRXHistory, mLimits.mRxHistory,
+		static_cast<unsigned int>(bytes)));
+
+	bytes = mLimits.mTxHistory * sizeof(PacketInfo);
+	output.push_back(string_printf("%-28s %-24d %10u", kWPANTUNDProperty_StatTXHistory, mLimits.mTxHistory,
+		static_cast<unsigned int>(bytes)));
+
+	bytes = mLimits.mNcpStateHistory * sizeof(NcpStateInfo);
+	output.push_back(string_printf("%-28s %-24d %10u", kWPANTUNDProperty_StatNCP, mLimits.mNcpStateHistory,
+		static_cast<unsigned int>(bytes)));
+
+	bytes = mLimits.mReadyForHostSleepHistory * sizeof(ReadyForHostSleepState);
+	output.push_back(string_printf("%-28s %-24d %10u", kWPANTUNDProperty_StatBlockingHostSleep, mLimits.mReadyForHostSleepHistory,
+		static_cast<unsigned int>(bytes)));
+
+	bytes = NodeStat::get_memory_usage(mLimits.mNodes, mLimits.mNodeRxHistory, mLimits.mNodeTxHistory);
+	output.push_back(string_printf("%-28s %-24s %10u", kWPANTUNDProperty_StatNodeHistory,
+		string_printf("%d x (%d rx + %d tx)", mLimits.mNodes, mLimits.mNodeRxHistory, mLimits.mNodeTxHistory).c_str(),
+		static_cast<unsigned int>(bytes)));
+
+	bytes = LinkStat::get_memory_usage(mLimits.mLinks, mLimits.mLinkQualityHistory);
+	output.push_back(string_printf("%-28s %-24s %10u", kWPANTUNDProperty_StatLinkQualityLong,
+		string_printf("%d x %d", mLimits.mLinks, mLimits.mLinkQualityHistory).c_str(),
+		static_cast<unsigned int>(bytes)));
+
+	output.push_back(string_printf("%-28s %-24s %10u", "Total", "",
+		static_cast<unsigned int>(get_memory_usage(mLimits))));
+	output.push_back(string_printf("%-28s %-24s %10u", kWPANTUNDProperty_StatMemoryBudget, "",
+		static_cast<unsigned int>(mMemoryBudget)));
+}
+
 bool
 StatCollector::is_a_stat_property(const std::string& key)
 {
@@ -1377,6 +1823,17 @@ StatCollector::add_help(StringList& output) const
 	output.push_back(string_printf("\t %-26s - All info - short version", kWPANTUNDProperty_StatShort));
 	output.push_back(string_printf("\t %-26s - All info - long version", kWPANTUNDProperty_StatLong));
 	output.push_back(string_printf("\t "));
+	output.push_back(string_printf("\t %-26s - Max number of nodes to keep statistics for - get/set", kWPANTUNDProperty_StatNodeCapacity));
+	output.push_back(string_printf("\t %-26s - Max number of peers to keep link quality for - get/set", kWPANTUNDProperty_StatLinkQualityCapacity));
+	output.push_back(string_printf("\t %-26s - Number of packets kept in RX history (all nodes) - get/set", kWPANTUNDProperty_StatRXDepth));
+	output.push_back(string_printf("\t %-26s - Number of packets kept in TX history (all nodes) - get/set", kWPANTUNDProperty_StatTXDepth));
+	output.push_back(string_printf("\t %-26s - Number of NCP state changes kept - get/set", kWPANTUNDProperty_StatNCPDepth));
+	output.push_back(string_printf("\t %-26s - Number of \'Blocking Host Sleep\' state changes kept - get/set", kWPANTUNDProperty_StatBlockingHostSleepDepth));
+	output.push_back(string_printf("\t %-26s - Number of RX packets kept per node - get/set", kWPANTUNDProperty_StatNodeRXDepth));
+	output.push_back(string_printf("\t %-26s - Number of TX packets kept per node - get/set", kWPANTUNDProperty_StatNodeTXDepth));
+	output.push_back(string_printf("\t %-26s - Number of link qualities kept per peer - get/set", kWPANTUNDProperty_StatLinkQualityDepth));
+	output.push_back(string_printf("\t %-26s - Memory used by each history", kWPANTUNDProperty_StatMemory));
+	output.push_back(string_printf("\t %-26s - Max bytes all histories together may use - get/set", kWPANTUNDProperty_StatMemoryBudget));
 	output.push_back(string_printf("\t %-26s - Peer link quality information - get only", kWPANTUNDProperty_StatLinkQuality));
 	output.push_back(string_printf("\t %-26s - Period interval (in seconds) for collecting peer link quality - get/set - zero to disable", kWPANTUNDProperty_StatLinkQualityPeriod));
 	output.push_back(string_printf("\t %-26s - AutoLog information - get only", kWPANTUNDProperty_StatAutoLog));
@@ -1426,6 +1883,8 @@ StatCollector::get_stat_property(const std::string& key, StringList& output) con
 		mLinkStat.add_link_stat(output);
 	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatLinkQualityShort)) {
 		mLinkStat.add_link_stat(output, STAT_COLLECTOR_LINK_STAT_HISTORY_SIZE);
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatMemory)) {
+		add_memory_usage(output);
 	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatHelp)) {
 		add_help(output);
 	} else {
@@ -1440,6 +1899,10 @@ StatCollector::get_stat_property(const std::string& key, StringList& output) con
 void
 StatCollector::property_get_value(const std::string& key, CallbackWithStatusArg1 cb)
 {
+	Limits limits = mLimits;
+	int min_value, max_value;
+	int *limit = get_limit(limits, key, min_value, max_value);
+
 	// First check for AutoLog properties.
 	if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatAutoLog)) {
 		std::string str;
@@ -1496,6 +1959,12 @@ StatCollector::property_get_value(const std::string& key, CallbackWithStatusArg1
 		int period_in_sec = static_cast<int>(mLinkStatTimer.get_interval() / Timer::kOneSecond);
 		cb(kWPANTUNDStatus_Ok, boost::any(period_in_sec));
 
+	} else if (limit != NULL) {
+		cb(kWPANTUNDStatus_Ok, boost::any(*limit));
+
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatMemoryBudget)) {
+		cb(kWPANTUNDStatus_Ok, boost::any(static_cast<int>(mMemoryBudget)));
+
 	} else {
 		// If not an AutoLog property, check for the stat properties.
 		StringList output;
@@ -1516,6 +1985,9 @@ void
 StatCollector::property_set_value(const std::string& key, const boost::any& value, CallbackWithStatus cb)
 {
 	int status = kWPANTUNDStatus_Ok;
+	Limits limits = mLimits;
+	int min_value, max_value;
+	int *limit = get_limit(limits, key, min_value, max_value);
 
 	// First check for AutoLog properties.
 	if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatAutoLogState)) {
@@ -1578,6 +2050,21 @@ StatCollector::property_set_value(const std::string& key, const boost::any& valu
 		} else {
 			status = kWPANTUNDStatus_InvalidArgument;
 		}
+	} else if (limit != NULL) {
+		*limit = any_to_int(value);
+		if ((*limit >= min_value) && (*limit <= max_value)) {
+			status = set_limits(limits);
+		} else {
+			status = kWPANTUNDStatus_InvalidArgument;
+		}
+	} else if (strcaseequal(key.c_str(), kWPANTUNDProperty_StatMemoryBudget)) {
+		int budget = any_to_int(value);
+		// The budget can't be lowered below what is already in use.
+		if ((budget > 0) && (static_cast<size_t>(budget) >= get_memory_usage(mLimits))) {
+			mMemoryBudget = budget;
+		} else {
+			status = kWPANTUNDStatus_InvalidArgument;
+		}
 	} else {
 		StringList output;
 
@@ -27,9 +27,9 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
 #include "time-utils.h"
-#include "RingBuffer.h"
-#include "ObjectPool.h"
+#include "RingBufferView.h"
 #include "NCPControlInterface.h"
 #include "NCPTypes.h"
 #include "Timer.h"
@@ -38,29 +38,43 @@
 namespace nl {
 namespace wpantund {
 
-// Size of the rx/tx history (for all nodes)
+// The sizes below are defaults, which can be changed at run time through
+// the "Stat:*:Depth" and "Stat:*:Capacity" properties (or wpantund.conf),
+// as long as all of the histories together fit in the memory budget.
+
+// Default size of the rx/tx history (for all nodes)
 #define STAT_COLLECTOR_RX_HISTORY_SIZE        64
 #define STAT_COLLECTOR_TX_HISTORY_SIZE        64
 
-// Size of the NCP state history
+// Default size of the NCP state history
 #define STAT_COLLECTOR_NCP_STATE_HISTORY_SIZE 64
 
-// Size of the NCP "ReadyForHostSleep" state history
+// Default size of the NCP "ReadyForHostSleep" state history
 #define STAT_COLLECTOR_NCP_READY_FOR_HOST_SLEEP_STATE_HISTORY_SIZE  64
 
-// Max number of nodes to track at the same time (nodes are tracked by IP address)
+// Default number of nodes to track at the same time (nodes are tracked by IP
+// address), and the most that "Stat:Node:Capacity" can be set to.
 #define STAT_COLLECTOR_MAX_NODES   64
+#define STAT_COLLECTOR_MAX_NODE_CAPACITY  4096
 
-// Size of rx/tx history per node
+// Default size of rx/tx history per node
 #define STAT_COLLECTOR_PER_NODE_RX_HISTORY_SIZE  5
 #define STAT_COLLECTOR_PER_NODE_TX_HISTORY_SIZE  5
 
-// Maximm number of peer nodes for which we store link quality
+// Default number of peer nodes for which we store link quality, and the
+// most that "Stat:LinkQuality:Capacity" can be set to.
 #define STAT_COLLECTOR_MAX_LINKS   64
+#define STAT_COLLECTOR_MAX_LINK_CAPACITY  4096
 
-// History length of link quality info per peer
+// Default history length of link quality info per peer
 #define STAT_COLLECTOR_LINK_QUALITY_HISTORY_SIZE 40
 
+// Most entries that any one history can be set to hold
+#define STAT_COLLECTOR_MAX_HISTORY_SIZE  65536
+
+// Default limit on the memory used by all of the histories together
+#define STAT_COLLECTOR_DEFAULT_MEMORY_BUDGET  (1024 * 1024)
+
 class StatCollector
 {
 public:
@@ -85,10 +99,26 @@ private:
 
 	typedef std::list<std::string> StringList;
 
+	// How many entries each history holds, and for how many nodes and
+	// peers, which together decide how much memory is used.
+	struct Limits
+	{
+		int mRxHistory;
+		int mTxHistory;
+		int mNcpStateHistory;
+		int mReadyForHostSleepHistory;
+		int mNodes;
+		int mNodeRxHistory;
+		int mNodeTxHistory;
+		int mLinks;
+		int mLinkQualityHistory;
+	};
+
 	struct IPAddress
 	{
 		std::string to_string(void) const;
 		void read_from(const uint8_t *arr);
+		uint32_t hash(uint32_t seed) const;
 		bool operator==(const IPAddress& lhs) const;
 		bool operator<(const IPAddress& lhs) const;
 	private:
@@ -172,6 +202,14 @@ private:
 		TimeStamp mReadyForHostSleepTime;
 	};
 
+	// Per-node statistics, for at most a fixed number of nodes.
+	//
+	// Nodes are found by hashing their address into an open-addressed
+	// table and are kept in the order they were last seen, so that
+	// making room for a new node evicts the least recently seen one
+	// without a search. All storage, including the packet histories of
+	// every node, is allocated when the table is resized, so recording
+	// a packet never allocates.
 	class NodeStat
 	{
 	public:
@@ -186,11 +224,16 @@ private:
 			uint32_t mRxPacketsUDP;
 			uint32_t mRxPacketsTCP;
 
-			RingBuffer<PacketInfo, STAT_COLLECTOR_PER_NODE_RX_HISTORY_SIZE> mRxHistory;
-			RingBuffer<PacketInfo, STAT_COLLECTOR_PER_NODE_TX_HISTORY_SIZE> mTxHistory;
+			RingBufferView<PacketInfo> mRxHistory;
+			RingBufferView<PacketInfo> mTxHistory;
+
+			IPAddress mAddress;
+			int32_t mNewer;                 // Towards `mNewest`, or the next free node
+			int32_t mOlder;                 // Towards `mOldest`
 
 			NodeInfo();
 			void clear();
+			void copy_from(const NodeInfo& node_info);
 			TimeStamp get_last_rx_time(void) const;
 			TimeStamp get_last_tx_time(void) const;
 			TimeStamp get_last_rx_or_tx_time(void) const;
@@ -201,19 +244,52 @@ private:
 
 		NodeStat();
 		void clear(void);
+
+		// Keeps the most recently seen nodes, and their newest packets,
+		// which fit.
+		void resize(size_t capacity, int rx_history_size, int tx_history_size);
+		size_t get_capacity(void) const { return mNodes.size(); }
+
+		static size_t get_memory_usage(size_t capacity, int rx_history_size, int tx_history_size);
+
 		void update_from_inbound_packet(const PacketInfo& packet_info);
 		void update_from_outbound_packet(const PacketInfo& packet_info);
 		void add_node_stat(StringList& output) const;
 		void add_node_stat_history(StringList& output, std::string node_indicator = "") const;
 
 	private:
-		NodeInfo *find_node_info(const IPAddress& address);
-		NodeInfo *create_new_node_info(const IPAddress& address);
-		void remove_oldest_node_info(void);
-		void add_node_info_map_iter(StringList &output, const std::map<IPAddress, NodeInfo*>::const_iterator& it) const;
+		enum {
+			kNone = -1,
+		};
+
+		struct Slot
+		{
+			int32_t mNode;                  // Index into `mNodes`, or `kNone`
+			uint32_t mHash;
+		};
 
-		ObjectPool<NodeInfo, STAT_COLLECTOR_MAX_NODES> mNodeInfoPool;
-		std::map<IPAddress, NodeInfo*> mNodeInfoMap;
+		int32_t find_slot(const IPAddress& address, uint32_t hash) const;
+		const NodeInfo *find_node_info(const IPAddress& address) const;
+		NodeInfo *find_or_create_node_info(const IPAddress& address);
+		void remove_oldest_node_info(void);
+		void unlink_node(int32_t index);
+		void link_newest_node(int32_t index);
+		void add_node_info(StringList &output, const NodeInfo& node_info) const;
+
+		static size_t get_slot_count(size_t capacity);
+
+		std::vector<NodeInfo> mNodes;
+		std::vector<PacketInfo> mRxHistoryStorage; // A slice per node
+		std::vector<PacketInfo> mTxHistoryStorage;
+		std::vector<Slot> mSlots;           // Power of two, at most half full
+		uint32_t mSlotMask;
+		uint32_t mSeed;
+
+		int32_t mFree;
+		int32_t mNewest;
+		int32_t mOldest;
+		size_t mCount;
+		uint32_t mEvictions;
 	};
 
 	class LinkStat
@@ -237,7 +313,7 @@ private:
 		struct LinkInfo
 		{
 			NodeType mNodeType;
-			RingBuffer<LinkQuality, STAT_COLLECTOR_LINK_QUALITY_HISTORY_SIZE> mLinkQualityHistory;
+			RingBufferView<LinkQuality> mLinkQualityHistory;
 
 			LinkInfo();
 			void clear(void);
@@ -248,6 +324,13 @@ private:
 
 		LinkStat();
 		void clear();
+
+		// Keeps the most recently updated peers, and their newest link
+		// qualities, which fit.
+		void resize(size_t capacity, int history_size);
+
+		static size_t get_memory_usage(size_t capacity, int history_size);
+
 		void update(const uint8_t *eui64_address, int8_t rssi, uint8_t incoming_link_quality, uint8_t outgoing_link_quality,
 			NodeType node_type);
 		void add_link_stat(StringList& output, int count = 0) const;
@@ -257,7 +340,9 @@ private:
 		LinkInfo *create_new_link_info(const EUI64Address & address);
 		void remove_oldest_link_info(void);
 
-		ObjectPool<LinkInfo, STAT_COLLECTOR_MAX_LINKS> mLinkInfoPool;
+		std::vector<LinkInfo> mLinkInfoPool;
+		std::vector<LinkInfo *> mFreeLinkInfos;
+		std::vector<LinkQuality> mLinkQualityStorage; // A slice per peer
 		std::map<EUI64Address, LinkInfo *> mLinkInfoMap;
 	};
 
@@ -278,6 +363,10 @@ private:
 	void add_ncp_state_history(StringList& output, int count = 0) const;
 	void add_ncp_ready_for_host_sleep_state_history(StringList& output, int count = 0) const;
 	void add_help(StringList& output) const;
+	void add_memory_usage(StringList& output) const;
+	int  set_limits(const Limits& limits);
+	static int *get_limit(Limits& limits, const std::string& key, int& min_value, int& max_value);
+	static size_t get_memory_usage(const Limits& limits);
 	void add_all_info(StringList& output, int count = 0) const;
 	int  get_stat_property(const std::string& key, StringList& output) const;
 	void update_auto_log_timer(void);
@@ -304,18 +393,25 @@ private:
 	uint32_t mTxPacketsICMP;
 	BytesTotal mRxBytesTotal;
 
-	RingBuffer<PacketInfo, STAT_COLLECTOR_RX_HISTORY_SIZE> mRxHistory;
-	RingBuffer<PacketInfo, STAT_COLLECTOR_TX_HISTORY_SIZE> mTxHistory;
+	RingBufferView<PacketInfo> mRxHistory;
+	RingBufferView<PacketInfo> mTxHistory;
+	std::vector<PacketInfo> mRxHistoryStorage;
+	std::vector<PacketInfo> mTxHistoryStorage;
 
-	RingBuffer<NcpStateInfo, STAT_COLLECTOR_NCP_STATE_HISTORY_SIZE> mNCPStateHistory;
+	RingBufferView<NcpStateInfo> mNCPStateHistory;
+	std::vector<NcpStateInfo> mNCPStateHistoryStorage;
 
-	RingBuffer<ReadyForHostSleepState, STAT_COLLECTOR_NCP_READY_FOR_HOST_SLEEP_STATE_HISTORY_SIZE> mReadyForSleepHistory;
+	RingBufferView<ReadyForHostSleepState> mReadyForSleepHistory;
+	std::vector<ReadyForHostSleepState> mReadyForSleepHistoryStorage;
 	bool mLastReadyForHostSleepState;
 	TimeStamp mLastBlockingHostSleepTime;
 
 	NodeStat mNodeStat;
 	LinkStat mLinkStat;
 
+	Limits mLimits;
+	size_t mMemoryBudget;
+
 	Timer mAutoLogTimer;
 	Timer mLinkStatTimer;
 
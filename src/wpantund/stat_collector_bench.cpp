@@ -0,0 +1,145 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Time taken by `StatCollector` to record a packet, as the number
+ *      of nodes sending and receiving grows past the number tracked.
+ *
+ *      Usage: stat_collector_bench [packet-count]
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "StatCollector.h"
+#include "wpan-properties.h"
+
+using namespace nl;
+using namespace nl::wpantund;
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static const size_t kPacketSize = 48;
+static const size_t kDistinctPackets = 4096;
+
+static void
+did_set(int status)
+{
+	if (status != 0) {
+		fprintf(stderr, "Unable to set capacity (%d)\n", status);
+		exit(EXIT_FAILURE);
+	}
+}
+
+// UDP packets between the border router and `node_count` nodes, in a
+// random order.
+static void
+make_packets(size_t node_count, std::vector<uint8_t>& packets)
+{
+	size_t i;
+
+	packets.assign(kDistinctPackets * kPacketSize, 0);
+
+	for (i = 0; i < kDistinctPackets; i++) {
+		uint8_t* packet = &packets[i * kPacketSize];
+		size_t node = rand() % node_count;
+		uint8_t* remote = packet + ((i % 2) ? 8 : 24);
+		uint8_t* local = packet + ((i % 2) ? 24 : 8);
+
+		packet[0] = 0x60;
+		packet[5] = 8;
+		packet[6] = 17;
+		local[0] = 0xfd;
+		local[15] = 1;
+		remote[0] = 0xfd;
+		remote[13] = static_cast<uint8_t>(node >> 16);
+		remote[14] = static_cast<uint8_t>(node >> 8);
+		remote[15] = static_cast<uint8_t>(node);
+	}
+}
+
+static void
+run(size_t node_count, int capacity, size_t packet_count)
+{
+	StatCollector stats;
+	std::vector<uint8_t> packets;
+	double start;
+	double elapsed;
+	size_t i;
+
+	stats.property_set_value(kWPANTUNDProperty_StatNodeCapacity, boost::any(capacity), &did_set);
+	make_packets(node_count, packets);
+
+	start = now_sec();
+
+	// Odd packets come from a node, even ones go to it.
+	for (i = 0; i < packet_count; i++) {
+		const uint8_t* packet = &packets[(i % kDistinctPackets) * kPacketSize];
+
+		if (i % 2) {
+			stats.record_inbound_packet(packet);
+		} else {
+			stats.record_outbound_packet(packet);
+		}
+	}
+
+	elapsed = now_sec() - start;
+
+	printf("%6zu nodes, capacity %5d: %8.1f ns/packet\n", node_count, capacity, elapsed * 1.0e9 / packet_count);
+}
+
+int
+main(int argc, char* argv[])
+{
+	static const size_t kNodeCounts[] = { 10, 64, 500, 5000 };
+	static const int kCapacities[] = { STAT_COLLECTOR_MAX_NODES, 1024 };
+	size_t packet_count = 1000000;
+	size_t i, j;
+
+	if (argc > 1) {
+		packet_count = strtoul(argv[1], NULL, 0);
+
+		if (packet_count == 0) {
+			fprintf(stderr, "Packet count must be positive\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	srand(1);
+
+	for (i = 0; i < sizeof(kCapacities) / sizeof(kCapacities[0]); i++) {
+		for (j = 0; j < sizeof(kNodeCounts) / sizeof(kNodeCounts[0]); j++) {
+			run(kNodeCounts[j], kCapacities[i], packet_count);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,310 @@
+/*
+ *
+ * Copyright (c) 2016 Nest Labs, Inc.
+ * All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *    Description:
+ *      Unit tests for the per-node statistics of `StatCollector` and for
+ *      resizing its histories.
+ *
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "StatCollector.h"
+#include "wpan-properties.h"
+#include "wpan-error.h"
+#include "test-utils.h"
+
+using namespace nl;
+using namespace nl::wpantund;
+
+static int sStatus;
+static boost::any sValue;
+
+static void
+did_get(int status, const boost::any& value)
+{
+	sStatus = status;
+	sValue = value;
+}
+
+static void
+did_set(int status)
+{
+	sStatus = status;
+}
+
+// Outbound UDP packet to fd00::<node>.
+static void
+make_packet(uint8_t packet[48], int node)
+{
+	memset(packet, 0, 48);
+	packet[0] = 0x60;
+	packet[5] = 8;
+	packet[6] = 17;
+	packet[8] = 0xfd;
+	packet[23] = 1;
+	packet[24] = 0xfd;
+	packet[38] = static_cast<uint8_t>(node >> 8);
+	packet[39] = static_cast<uint8_t>(node);
+}
+
+static std::list<std::string>
+get_list(StatCollector& stats, const char* key)
+{
+	sValue = boost::any();
+	stats.property_get_value(key, &did_get);
+	return boost::any_cast<std::list<std::string> >(sValue);
+}
+
+// Addresses listed by "Stat:Node", most recently seen first.
+static std::vector<int>
+get_nodes(StatCollector& stats)
+{
+	std::list<std::string> output = get_list(stats, kWPANTUNDProperty_StatNode);
+	std::list<std::string>::const_iterator iter;
+	std::vector<int> nodes;
+
+	for (iter = output.begin(); iter != output.end(); ++iter) {
+		unsigned int node;
+
+		if (sscanf(iter->c_str(), "Address: fd00::%x", &node) == 1) {
+			nodes.push_back(static_cast<int>(node));
+		}
+	}
+
+	return nodes;
+}
+
+static void
+send_to(StatCollector& stats, int node)
+{
+	uint8_t packet[48];
+
+	make_packet(packet, node);
+	stats.record_outbound_packet(packet);
+}
+
+static void
+set_capacity(StatCollector& stats, int capacity)
+{
+	stats.property_set_value(kWPANTUNDProperty_StatNodeCapacity, boost::any(capacity), &did_set);
+}
+
+static void
+test_eviction(void)
+{
+	StatCollector stats;
+	std::vector<int> nodes;
+	int expected[] = { 5, 1, 4, 3 };
+
+	set_capacity(stats, 4);
+	test_check(sStatus == kWPANTUNDStatus_Ok, "Set capacity");
+
+	stats.property_get_value(kWPANTUNDProperty_StatNodeCapacity, &did_get);
+	test_check(boost::any_cast<int>(sValue) == 4, "Get capacity");
+
+	send_to(stats, 1);
+	send_to(stats, 2);
+	send_to(stats, 3);
+	send_to(stats, 4);
+	send_to(stats, 1);                       // 2 is now the least recently seen
+	send_to(stats, 5);
+
+	nodes = get_nodes(stats);
+	test_check(nodes == std::vector<int>(expected, expected + 4), "Least recently seen node evicted");
+	test_check(get_list(stats, kWPANTUNDProperty_StatNode).front() == "Tracking 4 of at most 4 nodes (1 evicted)", "Eviction counted");
+
+	test_check(get_list(stats, kWPANTUNDProperty_StatNodeHistoryID "[fd00::1]").front().find("Error") == std::string::npos, "Find by address");
+	test_check(get_list(stats, kWPANTUNDProperty_StatNodeHistoryID "[fd00::2]").front().find("Error") != std::string::npos, "Evicted node is gone");
+	test_check(*++get_list(stats, kWPANTUNDProperty_StatNodeHistoryID "1").begin() == "Address: fd00::1", "Find by index");
+
+	// Shrinking keeps the most recently seen nodes.
+	set_capacity(stats, 2);
+	nodes = get_nodes(stats);
+	test_check(nodes == std::vector<int>(expected, expected + 2), "Shrinking keeps newest nodes");
+
+	set_capacity(stats, 0);
+	test_check(sStatus == kWPANTUNDStatus_InvalidArgument, "Zero capacity rejected");
+	set_capacity(stats, STAT_COLLECTOR_MAX_NODE_CAPACITY + 1);
+	test_check(sStatus == kWPANTUNDStatus_InvalidArgument, "Too large capacity rejected");
+}
+
+// Many more nodes than fit, with repeats, checked against a simple
+// list kept in the order the nodes were last seen.
+static void
+test_churn(void)
+{
+	const int capacity = 50;
+	StatCollector stats;
+	std::vector<int> model;
+	int i;
+
+	set_capacity(stats, capacity);
+	srand(1);
+
+	for (i = 0; i < 20000; i++) {
+		int node = 1 + rand() % 120;
+		std::vector<int>::iterator iter = std::find(model.begin(), model.end(), node);
+
+		if (iter != model.end()) {
+			model.erase(iter);
+		} else if (model.size() == capacity) {
+			model.pop_back();
+		}
+
+		model.insert(model.begin(), node);
+		send_to(stats, node);
+	}
+
+	test_check(get_nodes(stats) == model, "Nodes match a least recently seen list");
+}
+
+static void
+set_int(StatCollector& stats, const char* key, int value)
+{
+	stats.property_set_value(key, boost::any(value), &did_set);
+}
+
+static int
+get_int(StatCollector& stats, const char* key)
+{
+	sValue = boost::any();
+	stats.property_get_value(key, &did_get);
+	return boost::any_cast<int>(sValue);
+}
+
+// Number of "Last N tx packets" lines, or zero if there are none.
+static int
+get_node_tx_history_size(StatCollector& stats, int node)
+{
+	char key[64];
+	std::list<std::string> output;
+	std::list<std::string>::const_iterator iter;
+	int count = 0;
+
+	snprintf(key, sizeof(key), kWPANTUNDProperty_StatNodeHistoryID "[fd00::%x]", node);
+	output = get_list(stats, key);
+
+	for (iter = output.begin(); iter != output.end(); ++iter) {
+		sscanf(iter->c_str(), "\tLast %d tx packets", &count);
+	}
+
+	return count;
+}
+
+// Bytes listed for `name` by "Stat:Memory", or -1 if it isn't there.
+static int
+get_memory_usage(StatCollector& stats, const char* name)
+{
+	std::list<std::string> output = get_list(stats, kWPANTUNDProperty_StatMemory);
+	std::list<std::string>::const_iterator iter;
+
+	for (iter = output.begin(); iter != output.end(); ++iter) {
+		if (iter->compare(0, strlen(name) + 1, std::string(name) + " ") == 0) {
+			return atoi(iter->c_str() + iter->find_last_of(' ') + 1);
+		}
+	}
+
+	return -1;
+}
+
+static void
+test_depths(void)
+{
+	StatCollector stats;
+	int total;
+	int i;
+
+	test_check(get_int(stats, kWPANTUNDProperty_StatNodeTXDepth) == STAT_COLLECTOR_PER_NODE_TX_HISTORY_SIZE, "Default depth");
+	test_check(get_int(stats, kWPANTUNDProperty_StatMemoryBudget) == STAT_COLLECTOR_DEFAULT_MEMORY_BUDGET, "Default budget");
+
+	for (i = 0; i < 18; i++) {
+		send_to(stats, 1 + i % 3);
+	}
+
+	test_check(get_node_tx_history_size(stats, 1) == STAT_COLLECTOR_PER_NODE_TX_HISTORY_SIZE, "History full");
+
+	// Growing and shrinking keeps the nodes and their newest packets.
+	set_int(stats, kWPANTUNDProperty_StatNodeTXDepth, 20);
+	test_check(sStatus == kWPANTUNDStatus_Ok, "Grow depth");
+	test_check(get_node_tx_history_size(stats, 1) == STAT_COLLECTOR_PER_NODE_TX_HISTORY_SIZE, "Growing keeps history");
+
+	for (i = 0; i < 30; i++) {
+		send_to(stats, 1);
+	}
+
+	test_check(get_node_tx_history_size(stats, 1) == 20, "Grown history fills up");
+
+	set_int(stats, kWPANTUNDProperty_StatNodeTXDepth, 2);
+	test_check(get_node_tx_history_size(stats, 1) == 2, "Shrinking keeps newest packets");
+	test_check(get_nodes(stats).size() == 3, "Resizing keeps nodes");
+
+	set_int(stats, kWPANTUNDProperty_StatNodeTXDepth, 0);
+	test_check(sStatus == kWPANTUNDStatus_Ok, "Zero depth allowed");
+	send_to(stats, 1);
+	test_check(get_node_tx_history_size(stats, 1) == 0, "Zero depth keeps nothing");
+
+	set_int(stats, kWPANTUNDProperty_StatTXDepth, -1);
+	test_check(sStatus == kWPANTUNDStatus_InvalidArgument, "Negative depth rejected");
+	set_int(stats, kWPANTUNDProperty_StatLinkQualityCapacity, 0);
+	test_check(sStatus == kWPANTUNDStatus_InvalidArgument, "Zero link capacity rejected");
+
+	// Memory use follows the depths.
+	set_int(stats, kWPANTUNDProperty_StatTXDepth, 10);
+	test_check(get_memory_usage(stats, kWPANTUNDProperty_StatTXHistory) * STAT_COLLECTOR_RX_HISTORY_SIZE
+		== get_memory_usage(stats, kWPANTUNDProperty_StatRXHistory) * 10, "TX memory follows depth");
+
+	set_int(stats, kWPANTUNDProperty_StatRXDepth, 0);
+	test_check(get_memory_usage(stats, kWPANTUNDProperty_StatRXHistory) == 0, "No RX memory");
+
+	// Nothing may be resized past the budget, and the budget can't be
+	// lowered below what is in use.
+	total = get_memory_usage(stats, "Total");
+	test_check(total > 0, "Total listed");
+
+	set_int(stats, kWPANTUNDProperty_StatMemoryBudget, total - 1);
+	test_check(sStatus == kWPANTUNDStatus_InvalidArgument, "Budget below usage rejected");
+
+	set_int(stats, kWPANTUNDProperty_StatMemoryBudget, total);
+	test_check(sStatus == kWPANTUNDStatus_Ok, "Budget at usage");
+	test_check(get_memory_usage(stats, kWPANTUNDProperty_StatMemoryBudget) == total, "Budget listed");
+
+	set_int(stats, kWPANTUNDProperty_StatTXDepth, 11);
+	test_check(sStatus == kWPANTUNDStatus_InvalidArgument, "Over budget rejected");
+	test_check(get_int(stats, kWPANTUNDProperty_StatTXDepth) == 10, "Rejected depth not applied");
+
+	set_int(stats, kWPANTUNDProperty_StatTXDepth, 9);
+	test_check(sStatus == kWPANTUNDStatus_Ok, "Shrinking within budget");
+	test_check(get_memory_usage(stats, "Total") < total, "Total shrinks");
+}
+
+int
+main(void)
+{
+	test_eviction();
+	test_churn();
+	test_depths();
+
+	return test_exit_status();
+}
@@ -30,13 +30,16 @@
 #define kWPANTUNDProperty_ConfigNCPHardResetPath                "Config:NCP:HardResetPath"
 #define kWPANTUNDProperty_ConfigNCPPowerPath                    "Config:NCP:PowerPath"
 #define kWPANTUNDProperty_ConfigNCPReliabilityLayer             "Config:NCP:ReliabilityLayer"
+#define kWPANTUNDProperty_ConfigNCPFraming                      "Config:NCP:Framing"
 #define kWPANTUNDProperty_ConfigNCPFirmwareCheckCommand         "Config:NCP:FirmwareCheckCommand"
 #define kWPANTUNDProperty_ConfigNCPFirmwareUpgradeCommand       "Config:NCP:FirmwareUpgradeCommand"
 #define kWPANTUNDProperty_ConfigTUNInterfaceName                "Config:TUN:InterfaceName"
 #define kWPANTUNDProperty_ConfigDaemonPIDFile                   "Config:Daemon:PIDFile"
 #define kWPANTUNDProperty_ConfigDaemonPrivDropToUser            "Config:Daemon:PrivDropToUser"
 #define kWPANTUNDProperty_ConfigDaemonChroot                    "Config:Daemon:Chroot"
+#define kWPANTUNDProperty_ConfigDaemonEventBackend              "Config:Daemon:EventBackend"
 #define kWPANTUNDProperty_ConfigDaemonNetworkRetainCommand      "Config:Daemon:NetworkRetainCommand"
+#define kWPANTUNDProperty_ConfigDaemonIOBackend                 "Config:Daemon:IOBackend"
 
 #define kWPANTUNDProperty_DaemonVersion                         "Daemon:Version"
 #define kWPANTUNDProperty_DaemonEnabled                         "Daemon:Enabled"
@@ -56,6 +59,23 @@
 #define kWPANTUNDProperty_DaemonOffMeshRouteAutoAddOnInterface  "Daemon:OffMeshRoute:AutoAddOnInterface"
 #define kWPANTUNDProperty_DaemonOffMeshRouteFilterSelfAutoAdded "Daemon:OffMeshRoute:FilterSelfAutoAdded"
 #define kWPANTUNDProperty_DaemonOnMeshPrefixAutoAddAsIfaceRoute "Daemon:OnMeshPrefix:AutoAddAsInterfaceRoute"
+#define kWPANTUNDProperty_DaemonNCPMaxFramesPerIteration        "Daemon:NCP:MaxFramesPerIteration"
+#define kWPANTUNDProperty_DaemonNCPInboundPumpCounters          "Daemon:NCP:InboundPumpCounters"
+#define kWPANTUNDProperty_DaemonNCPDataPlaneThread              "Daemon:NCP:DataPlaneThread"
+#define kWPANTUNDProperty_DaemonNCPDataPlaneCounters            "Daemon:NCP:DataPlaneCounters"
+#define kWPANTUNDProperty_DaemonNCPResponseCounters             "Daemon:NCP:ResponseCounters"
+#define kWPANTUNDProperty_DaemonNCPOutboundQueueDepth           "Daemon:NCP:OutboundQueue:Depth"
+#define kWPANTUNDProperty_DaemonNCPOutboundQueueLatency         "Daemon:NCP:OutboundQueue:Latency"
+#define kWPANTUNDProperty_DaemonNCPPropertyCache                "Daemon:NCP:PropertyCache"
+#define kWPANTUNDProperty_DaemonPropertyGetCounters             "Daemon:PropertyGet:Counters"
+#define kWPANTUNDProperty_DaemonInsecureFirewallCounters        "Daemon:InsecureFirewall:Counters"
+#define kWPANTUNDProperty_DaemonKernelFilterCounters            "Daemon:KernelFilter:Counters"
+#define kWPANTUNDProperty_DaemonTaskQueueDepth                  "Daemon:TaskQueue:Depth"
+#define kWPANTUNDProperty_DaemonTaskQueueWaitTime               "Daemon:TaskQueue:WaitTime"
+#define kWPANTUNDProperty_DaemonProfileEnabled                  "Daemon:Profile:Enabled"
+#define kWPANTUNDProperty_DaemonProfilePhases                   "Daemon:Profile:Phases"
+#define kWPANTUNDProperty_DaemonProfileHistograms               "Daemon:Profile:Histograms"
+#define kWPANTUNDProperty_DaemonProfileWakeups                  "Daemon:Profile:Wakeups"
 
 #define kWPANTUNDProperty_NCPVersion                            "NCP:Version"
 #define kWPANTUNDProperty_NCPState                              "NCP:State"
@@ -340,12 +360,19 @@
 #define kWPANTUNDProperty_StatTX                                "Stat:TX"
 #define kWPANTUNDProperty_StatRXHistory                         "Stat:RX:History"
 #define kWPANTUNDProperty_StatTXHistory                         "Stat:TX:History"
+#define kWPANTUNDProperty_StatRXDepth                           "Stat:RX:Depth"
+#define kWPANTUNDProperty_StatTXDepth                           "Stat:TX:Depth"
 #define kWPANTUNDProperty_StatHistory                           "Stat:History"
 #define kWPANTUNDProperty_StatNCP                               "Stat:NCP"
+#define kWPANTUNDProperty_StatNCPDepth                          "Stat:NCP:Depth"
 #define kWPANTUNDProperty_StatBlockingHostSleep                 "Stat:BlockingHostSleep"
+#define kWPANTUNDProperty_StatBlockingHostSleepDepth            "Stat:BlockingHostSleep:Depth"
 #define kWPANTUNDProperty_StatNode                              "Stat:Node"
 #define kWPANTUNDProperty_StatNodeHistory                       "Stat:Node:History"
 #define kWPANTUNDProperty_StatNodeHistoryID                     "Stat:Node:History:"
+#define kWPANTUNDProperty_StatNodeCapacity                      "Stat:Node:Capacity"
+#define kWPANTUNDProperty_StatNodeRXDepth                       "Stat:Node:RX:Depth"
+#define kWPANTUNDProperty_StatNodeTXDepth                       "Stat:Node:TX:Depth"
 #define kWPANTUNDProperty_StatShort                             "Stat:Short"
 #define kWPANTUNDProperty_StatLong                              "Stat:Long"
 #define kWPANTUNDProperty_StatAutoLog                           "Stat:AutoLog"
@@ -357,6 +384,10 @@
 #define kWPANTUNDProperty_StatLinkQualityLong                   "Stat:LinkQuality:Long"
 #define kWPANTUNDProperty_StatLinkQualityShort                  "Stat:LinkQuality:Short"
 #define kWPANTUNDProperty_StatLinkQualityPeriod                 "Stat:LinkQuality:Period"
+#define kWPANTUNDProperty_StatLinkQualityDepth                  "Stat:LinkQuality:Depth"
+#define kWPANTUNDProperty_StatLinkQualityCapacity               "Stat:LinkQuality:Capacity"
+#define kWPANTUNDProperty_StatMemory                            "Stat:Memory"
+#define kWPANTUNDProperty_StatMemoryBudget                      "Stat:Memory:Budget"
 #define kWPANTUNDProperty_StatHelp                              "Stat:Help"
 
 #define kWPANTUNDProperty_ThreadServices                        "Thread:Services"
@@ -46,6 +46,8 @@
 #include "version.h"
 #include "SuperSocket.h"
 #include "Timer.h"
+#include "EventBackend.h"
+#include "LoopProfiler.h"
 
 #include "IPCServer.h"
 
@@ -161,6 +163,7 @@ static int gRet;
 static const char* gProcessName = "wpantund";
 static const char* gPIDFilename = NULL;
 static const char* gChroot = WPANTUND_DEFAULT_CHROOT_PATH;
+static const char* gEventBackendName = "";
 
 #if HAVE_PWD_H
 static const char* gPrivDropToUser = WPANTUND_DEFAULT_PRIV_DROP_USER;
@@ -222,6 +225,16 @@ signal_SIGHUP(int sig)
 	// loop decide what to do for hangups.
 }
 
+static volatile sig_atomic_t gDumpProfile;
+
+static void
+signal_SIGUSR1(int sig)
+{
+	// The main loop logs the report, since
+	// syslog() isn't async signal safe.
+	gDumpProfile = 1;
+}
+
 static void
 signal_critical(int sig, siginfo_t * info, void * ucontext)
 {
@@ -325,6 +338,10 @@ set_config_param(
 		ret = 0;
 		require(9600 <= baud, bail);
 		gSocketWrapperBaud = baud;
+	} else if (strcaseequal(key, kWPANTUNDProperty_ConfigDaemonEventBackend)) {
+		require((value[0] == 0) || strcaseequal(value, "epoll") || strcaseequal(value, "select"), bail);
+		gEventBackendName = strdup(value);
+		ret = 0;
 #if !FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 #if HAVE_PWD_H
 	} else if (strcaseequal(key, kWPANTUNDProperty_ConfigDaemonPrivDropToUser)) {
@@ -435,70 +452,20 @@ print_version()
 /* ------------------------------------------------------------------------- */
 /* MARK: NLPT Hooks */
 
-static fd_set gReadableFDs;
-static fd_set gWritableFDs;
-static fd_set gErrorableFDs;
+static nl::EventBackend* gEventBackend;
 
 bool
 nlpt_hook_check_read_fd_source(struct nlpt* nlpt, int fd)
 {
-
-	bool ret = false;
-	if (fd >= 0 && fd < FD_SETSIZE) {
-		ret = FD_ISSET(fd, &gReadableFDs) || FD_ISSET(fd, &gErrorableFDs);
-		FD_CLR(fd, &gReadableFDs);
-		FD_CLR(fd, &gErrorableFDs);
-	}
-	return ret;
+	return (gEventBackend != NULL)
+		&& (gEventBackend->take_ready(fd, nl::EventBackend::kEventRead) != 0);
 }
 
 bool
 nlpt_hook_check_write_fd_source(struct nlpt* nlpt, int fd)
 {
-	bool ret = false;
-	if (fd >= 0 && fd < FD_SETSIZE) {
-		ret = FD_ISSET(fd, &gWritableFDs) || FD_ISSET(fd, &gErrorableFDs);
-		FD_CLR(fd, &gWritableFDs);
-		FD_CLR(fd, &gErrorableFDs);
-	}
-	return ret;
-}
-
-static void
-syslog_dump_select_info(int loglevel, fd_set *read_fd_set, fd_set *write_fd_set, fd_set *error_fd_set, int fd_count, cms_t timeout)
-{
-#define DUMP_FD_SET(l, x) do {\
-		int i; \
-		std::string buffer; \
-		for (i = 0; i < fd_count; i++) { \
-			if (!FD_ISSET(i, x)) { \
-				continue; \
-			} \
-			if (buffer.size() != 0) { \
-				buffer += ", "; \
-			} \
-			char str[10]; \
-			snprintf(str, sizeof(str), "%d", i); \
-			buffer += str; \
-		} \
-		syslog(l, "SELECT:     %s: %s", #x, buffer.c_str()); \
-	} while (0)
-
-	int logmask = setlogmask(0);
-	setlogmask(logmask);
-
-	if (fd_count > FD_SETSIZE) {
-		fd_count = FD_SETSIZE;
-	}
-
-	// Check the log level preemptively to avoid wasted CPU.
-	if((logmask&LOG_MASK(loglevel))) {
-		syslog(loglevel, "SELECT: fd_count=%d cms_timeout=%d", fd_count, timeout);
-
-		DUMP_FD_SET(loglevel, read_fd_set);
-		DUMP_FD_SET(loglevel, write_fd_set);
-		//DUMP_FD_SET(loglevel, error_fd_set); // Commented out to reduce log volume
-	}
+	return (gEventBackend != NULL)
+		&& (gEventBackend->take_ready(fd, nl::EventBackend::kEventWrite) != 0);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -508,19 +475,32 @@ class MainLoop
 	std::list<shared_ptr<nl::wpantund::IPCServer> > mIpcServerList;
 	std::map<std::string, std::string> mSettings;
 	nl::wpantund::NCPInstance * mNcpInstance;
+	nl::EventBackend * mEventBackend;
 
 	int mFdsReady;
 	bool mInterfaceAdded;
 	int mZeroCmsInARowCount;
 public:
 	MainLoop(const std::map<std::string, std::string>& settings = std::map<std::string, std::string>()):
-		mSettings(settings), mNcpInstance(NCPInstance::alloc(settings)),
+		mSettings(settings), mNcpInstance(NCPInstance::alloc(settings)), mEventBackend(NULL),
 		mFdsReady(0), mInterfaceAdded(false), mZeroCmsInARowCount(0)
 	{
 		if (mNcpInstance == NULL) {
 			throw std::invalid_argument("Unknown NCP Driver");
 		}
 
+		mEventBackend = nl::EventBackend::create(gEventBackendName);
+
+		if (mEventBackend == NULL) {
+			delete mNcpInstance;
+			throw std::invalid_argument("Unsupported event backend");
+		}
+
+		mEventBackend->set_active();
+		gEventBackend = mEventBackend;
+
+		syslog(LOG_INFO, "Main loop is using the %s event backend", mEventBackend->get_name());
+
 		mNcpInstance->mOnFatalError.connect(&handle_error);
 
 		mNcpInstance->get_stat_collector().set_ncp_control_interface(&mNcpInstance->get_control_interface());
@@ -528,6 +508,9 @@ public:
 
 	~MainLoop() {
 		delete mNcpInstance;
+
+		gEventBackend = NULL;
+		delete mEventBackend;
 	}
 
 	void add_ipc_server(shared_ptr<nl::wpantund::IPCServer> ipc_server) {
@@ -536,17 +519,25 @@ public:
 
 	void process() {
 		std::list<shared_ptr<nl::wpantund::IPCServer> >::iterator ipc_iter;
+		LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseIteration);
 
 		// Process callback timers.
-		Timer::process();
+		{
+			LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseTimers);
+			Timer::process();
+		}
 
 		// Process any necessary IPC actions.
 		for (ipc_iter = mIpcServerList.begin(); ipc_iter != mIpcServerList.end(); ++ipc_iter) {
+			LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseIPC);
 			(*ipc_iter)->process();
 		}
 
 		// Process the NCP instance.
-		mNcpInstance->process();
+		{
+			LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseNCP);
+			mNcpInstance->process();
+		}
 
 		// We only expose the interface via IPC after it is
 		// successfully initialized for the first time.
@@ -567,26 +558,20 @@ public:
 		int fds_ready = 0;
 		const cms_t max_main_loop_timeout(CMS_DISTANT_FUTURE);
 		cms_t cms_timeout(max_main_loop_timeout);
-		int max_fd(-1);
-		struct timeval timeout;
 		std::list<shared_ptr<nl::wpantund::IPCServer> >::iterator ipc_iter;
 
-		FD_ZERO(&gReadableFDs);
-		FD_ZERO(&gWritableFDs);
-		FD_ZERO(&gErrorableFDs);
+		{
+			LoopProfiler::Scope profile_scope(LoopProfiler::kPhasePrepare);
 
-		// Update the FD masks and timeouts
-		mNcpInstance->update_fd_set(&gReadableFDs, &gWritableFDs, &gErrorableFDs, &max_fd, &cms_timeout);
-		Timer::update_timeout(&cms_timeout);
+			mEventBackend->begin_update();
 
-		for (ipc_iter = mIpcServerList.begin(); ipc_iter != mIpcServerList.end(); ++ipc_iter) {
-			(*ipc_iter)->update_fd_set(&gReadableFDs, &gWritableFDs, &gErrorableFDs, &max_fd, &cms_timeout);
-		}
+			// Update the FD interest and timeouts
+			mNcpInstance->update_fd_interest(mEventBackend, &cms_timeout);
+			Timer::update_timeout(&cms_timeout);
 
-		if (max_fd >= FD_SETSIZE) {
-			syslog(LOG_ERR, "BUG: Too many file descriptors: %d (max %d)", max_fd, FD_SETSIZE);
-			gRet = ERRORCODE_UNKNOWN;
-			goto bail;
+			for (ipc_iter = mIpcServerList.begin(); ipc_iter != mIpcServerList.end(); ++ipc_iter) {
+				(*ipc_iter)->update_fd_interest(mEventBackend, &cms_timeout);
+			}
 		}
 
 		// Negative CMS timeout values are not valid.
@@ -627,35 +612,31 @@ public:
 			mZeroCmsInARowCount = 0;
 		}
 
-		// Convert our `cms` value into timeval compatible with select().
-		timeout.tv_sec = cms_timeout / MSEC_PER_SEC;
-		timeout.tv_usec = (cms_timeout % MSEC_PER_SEC) * USEC_PER_MSEC;
-
-#if FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-		// When fuzzing we don't wait for select.
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 0;
+#if VERBOSE_DEBUG
+		mEventBackend->dump(LOG_DEBUG, cms_timeout);
 #endif
 
 		// Block until we timeout or there is FD activity.
-		fds_ready = select(
-			max_fd + 1,
-			&gReadableFDs,
-			&gWritableFDs,
-			&gErrorableFDs,
-			&timeout
-		);
+		{
+			LoopProfiler::Scope profile_scope(LoopProfiler::kPhaseWait);
 
-#if VERBOSE_DEBUG
-		syslog_dump_select_info(
-			LOG_DEBUG,
-			&gReadableFDs,
-			&gWritableFDs,
-			&gErrorableFDs,
-			max_fd + 1,
-			cms_timeout
-		);
+#if FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+			// When fuzzing we don't block.
+			fds_ready = mEventBackend->wait(0);
+#else
+			fds_ready = mEventBackend->wait(cms_timeout);
 #endif
+		}
+
+		if (fds_ready > 0) {
+			LoopProfiler::note_wakeup(LoopProfiler::kWakeupDescriptor);
+		} else if (fds_ready < 0) {
+			LoopProfiler::note_wakeup(LoopProfiler::kWakeupInterrupted);
+		} else if (cms_timeout == 0) {
+			LoopProfiler::note_wakeup(LoopProfiler::kWakeupImmediate);
+		} else {
+			LoopProfiler::note_wakeup(LoopProfiler::kWakeupTimeout);
+		}
 
 #if FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 		// When fuzzing, if there were no FDs ready, then we just
@@ -665,25 +646,37 @@ public:
 		}
 #endif
 
-		if (fds_ready < 0) {
-			syslog(LOG_ERR, "select() errno=\"%s\" (%d)", strerror(errno),
+		if ((fds_ready < 0) && (errno != EINTR)) {
+			syslog(LOG_ERR, "%s() errno=\"%s\" (%d)", mEventBackend->get_name(), strerror(errno),
 				   errno);
-
-			if (errno != EINTR) {
-				gRet = ERRORCODE_ERRNO;
-			}
+			gRet = ERRORCODE_ERRNO;
 		}
 
-	bail:
 		return (fds_ready > 0) || (cms_timeout == 0);
 	}
 
 
+	void dump_profile() {
+		if (!LoopProfiler::is_enabled()) {
+			// Start collecting, so that the next signal has something to report.
+			LoopProfiler::set_enabled(true);
+			syslog(LOG_NOTICE, "Main loop profiling enabled, send SIGUSR1 again for a report");
+		} else {
+			LoopProfiler::dump(LOG_NOTICE);
+		}
+	}
+
 	void run() {
 		gRet = 0;
 
 		while (!gRet) {
 			block_until_ready();
+
+			if (gDumpProfile) {
+				gDumpProfile = 0;
+				dump_profile();
+			}
+
 			process();
 		}
 	}
@@ -713,6 +706,7 @@ main(int argc, char * argv[])
 	gPreviousHandlerForSIGINT = signal(SIGINT, &signal_SIGINT);
 	gPreviousHandlerForSIGTERM = signal(SIGTERM, &signal_SIGTERM);
 	signal(SIGHUP, &signal_SIGHUP);
+	signal(SIGUSR1, &signal_SIGUSR1);
 
 	// Always ignore SIGPIPE.
 	signal(SIGPIPE, SIG_IGN);
@@ -65,6 +65,9 @@
 #include <util.h>
 #endif
 
+#include "hdlc.h"
+#include "spi-xfer.h"
+
 /* ------------------------------------------------------------------------- */
 /* MARK: Macros and Constants */
 
@@ -91,7 +94,16 @@
 #define USEC_PER_SEC                    (USEC_PER_MSEC * MSEC_PER_SEC)
 #endif
 
-#define SPI_POLL_PERIOD_MSEC            (MSEC_PER_SEC/30)
+// Without an interrupt line the slave is polled every
+// SPI_POLL_PERIOD_MIN_MSEC while it has been sending us frames,
+// backing off to SPI_POLL_PERIOD_MAX_MSEC once it goes quiet.
+#define SPI_POLL_PERIOD_MIN_MSEC        2
+#define SPI_POLL_PERIOD_MAX_MSEC        (MSEC_PER_SEC/30)
+
+// The most transactions to run back to back for a single wakeup
+// while the slave keeps its interrupt asserted, before going back
+// to check on the HDLC descriptors.
+#define SPI_MAX_BURST_TRANSACTIONS      8
 
 #define IMMEDIATE_RETRY_COUNT           5
 #define FAST_RETRY_COUNT                15
@@ -113,9 +125,9 @@
 
 #define AUTO_PRINT_BACKTRACE_STACK_DEPTH     20
 
+#define HDLC_INPUT_CHUNK_SIZE           4096
+
 static const uint8_t kHdlcResetSignal[] = { 0x7E, 0x13, 0x11, 0x7E };
-static const uint16_t kHdlcCrcCheckValue = 0xf0b8;
-static const uint16_t kHdlcCrcResetValue = 0xffff;
 
 enum {
     MODE_STDIO = 0,
@@ -159,8 +171,19 @@ static bool sSpiTxIsReady = false;
 static int sSpiTxRefusedCount = 0;
 static uint8_t sSpiTxFrameBuffer[MAX_FRAME_SIZE + SPI_RX_ALIGN_ALLOWANCE_MAX];
 
+// HDLC de-framing state. Input is read in chunks, so bytes following
+// a completed frame are kept here until the frame has been sent.
+static struct hdlc_decoder sHdlcDecoder;
+static uint8_t sHdlcInputChunk[HDLC_INPUT_CHUNK_SIZE];
+static size_t sHdlcInputChunkLen;
+static size_t sHdlcInputChunkOffset;
+
 static int sSpiRxAlignAllowance = 0;
 static int sSpiSmallPacketSize  = 32;      // in bytes
+static bool sSpiAdaptive        = true;
+
+static struct spi_xfer_sizer sSpiXferSizer;
+static struct spi_xfer_poller sSpiPoller;
 
 static bool sSlaveDidReset = false;
 
@@ -175,6 +198,16 @@ static int sRet = 0;
 
 static bool sDumpStats = false;
 
+// Set while push_hdlc()/push_raw() are part way through writing
+// a frame out of sHdlcOutputFd.
+static bool sHdlcOutputIsPending = false;
+
+// When the frame in sSpiTxFrameBuffer became ready, and when
+// the interrupt was first seen asserted for the slave's next
+// frame (or zero), for measuring latency.
+static uint64_t sSpiTxReadyTime;
+static uint64_t sSpiIntAssertTime;
+
 static sig_t sPreviousHandlerForSIGINT;
 static sig_t sPreviousHandlerForSIGTERM;
 
@@ -192,6 +225,7 @@ static uint64_t sHdlcTxFrameByteCount = 0;
 static uint64_t sHdlcRxFrameCount = 0;
 static uint64_t sHdlcTxFrameCount = 0;
 static uint64_t sHdlcRxBadCrcCount = 0;
+static struct spi_xfer_stats sSpiXferStats;
 
 /* ------------------------------------------------------------------------- */
 /* MARK: Signal Handlers */
@@ -274,6 +308,7 @@ static void signal_clearstats(int sig)
     sHdlcRxFrameCount = 0;
     sHdlcTxFrameCount = 0;
     sHdlcRxBadCrcCount = 0;
+    memset(&sSpiXferStats, 0, sizeof(sSpiXferStats));
 
     // Ignore signal argument.
     (void)sig;
@@ -499,6 +534,9 @@ static int push_pull_spi(void)
     uint8_t slave_header;
     uint16_t slave_max_rx;
     int successful_exchanges = 0;
+    uint16_t rx_len = 0;
+    uint16_t tx_len = 0;
+    uint64_t now;
 
     static uint16_t slave_data_len;
 
@@ -538,6 +576,11 @@ static int push_pull_spi(void)
         {
             spi_xfer_bytes = sSpiTxPayloadSize;
         }
+
+        if (sSpiTxRefusedCount != 0)
+        {
+            sSpiXferStats.retries++;
+        }
     }
 
     if (sSpiRxPayloadSize == 0)
@@ -554,12 +597,13 @@ static int push_pull_spi(void)
         }
         else
         {
-            // Set up a minimum transfer size to allow small
-            // frames the slave wants to send us to be handled
-            // in a single transaction.
-            if (sSpiSmallPacketSize > spi_xfer_bytes)
+            // Set up a minimum transfer size to allow frames
+            // the size the slave usually sends us to be handled
+            // in a single transaction. This is never less than
+            // the small-packet size.
+            if (spi_xfer_sizer_get_len(&sSpiXferSizer) > spi_xfer_bytes)
             {
-                spi_xfer_bytes = (uint16_t)sSpiSmallPacketSize;
+                spi_xfer_bytes = spi_xfer_sizer_get_len(&sSpiXferSizer);
             }
         }
 
@@ -583,6 +627,8 @@ static int push_pull_spi(void)
         goto bail;
     }
 
+    now = spi_xfer_time_us();
+
     // Account for misalignment (0xFF bytes at the start)
     spiRxFrameBuffer = get_real_rx_frame_start();
 
@@ -671,11 +717,26 @@ static int push_pull_spi(void)
         // We have received a packet. Set sSpiRxPayloadSize so that
         // the packet will eventually get queued up by push_hdlc().
         sSpiRxPayloadSize = slave_data_len;
+        rx_len = slave_data_len;
+
+        spi_xfer_sizer_note_frame(&sSpiXferSizer, slave_data_len);
+
+        if (sSpiIntAssertTime != 0)
+        {
+            spi_xfer_stats_note_latency(&sSpiXferStats, now - sSpiIntAssertTime);
+            sSpiIntAssertTime = 0;
+        }
 
         slave_data_len = 0;
 
         successful_exchanges++;
     }
+    else if (slave_data_len != 0)
+    {
+        // The slave's frame didn't fit in the room we made for
+        // it, so it will take another transaction to get it.
+        sSpiXferStats.short_reads++;
+    }
 
     // Handle transmitted packet, if any.
     if ( sSpiTxIsReady
@@ -686,6 +747,9 @@ static int push_pull_spi(void)
             // Our outbound packet has been successfully transmitted. Clear
             // sSpiTxPayloadSize and sSpiTxIsReady so that pull_hdlc() can
             // pull another packet for us to send.
+            spi_xfer_stats_note_latency(&sSpiXferStats, now - sSpiTxReadyTime);
+            tx_len = sSpiTxPayloadSize;
+
             sSpiTxIsReady = false;
             sSpiTxPayloadSize = 0;
             sSpiTxRefusedCount = 0;
@@ -712,6 +776,16 @@ static int push_pull_spi(void)
         sSpiDuplexFrameCount++;
     }
 bail:
+    if (ret >= 0)
+    {
+        spi_xfer_stats_note_transaction(
+            &sSpiXferStats,
+            (size_t)(spi_xfer_bytes + HEADER_LEN + sSpiRxAlignAllowance),
+            rx_len,
+            tx_len
+        );
+    }
+
     return ret;
 }
 
@@ -733,7 +807,17 @@ static bool check_and_clear_interrupt(void)
         }
 
         // The interrupt pin is active low.
-        return GPIO_INT_ASSERT_STATE == atoi(value);
+        if (GPIO_INT_ASSERT_STATE != atoi(value))
+        {
+            return false;
+        }
+
+        if (sSpiIntAssertTime == 0)
+        {
+            sSpiIntAssertTime = spi_xfer_time_us();
+        }
+
+        return true;
     }
 
     return true;
@@ -742,89 +826,11 @@ static bool check_and_clear_interrupt(void)
 /* ------------------------------------------------------------------------- */
 /* MARK: HDLC Transfer Functions */
 
-#define HDLC_BYTE_FLAG             0x7E
-#define HDLC_BYTE_ESC              0x7D
-#define HDLC_BYTE_XON              0x11
-#define HDLC_BYTE_XOFF             0x13
-#define HDLC_BYTE_SPECIAL          0xF8
-#define HDLC_ESCAPE_XFORM          0x20
-
-static uint16_t hdlc_crc16(uint16_t aFcs, uint8_t aByte)
-{
-#if 1
-    // CRC-16/CCITT, CRC-16/CCITT-TRUE, CRC-CCITT
-    // width=16 poly=0x1021 init=0x0000 refin=true refout=true xorout=0x0000 check=0x2189 name="KERMIT"
-    // http://reveng.sourceforge.net/crc-catalogue/16.htm#crc.cat.kermit
-    static const uint16_t sFcsTable[256] =
-    {
-        0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-        0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-        0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-        0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-        0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-        0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-        0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-        0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-        0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-        0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-        0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-        0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-        0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-        0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-        0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-        0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-        0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-        0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-        0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-        0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-        0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-        0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-        0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-        0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-        0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-        0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-        0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-        0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-        0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-        0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-        0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-        0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-    };
-    return (aFcs >> 8) ^ sFcsTable[(aFcs ^ aByte) & 0xff];
-#else
-    // CRC-16/CCITT-FALSE, same CRC as 802.15.4
-    // width=16 poly=0x1021 init=0xffff refin=false refout=false xorout=0x0000 check=0x29b1 name="CRC-16/CCITT-FALSE"
-    // http://reveng.sourceforge.net/crc-catalogue/16.htm#crc.cat.crc-16-ccitt-false
-    aFcs = (uint16_t)((aFcs >> 8) | (aFcs << 8));
-    aFcs ^= aByte;
-    aFcs ^= ((aFcs & 0xff) >> 4);
-    aFcs ^= (aFcs << 12);
-    aFcs ^= ((aFcs & 0xff) << 5);
-    return aFcs;
-#endif
-}
-
-static bool hdlc_byte_needs_escape(uint8_t byte)
-{
-    switch(byte)
-    {
-    case HDLC_BYTE_SPECIAL:
-    case HDLC_BYTE_ESC:
-    case HDLC_BYTE_FLAG:
-    case HDLC_BYTE_XOFF:
-    case HDLC_BYTE_XON:
-        return true;
-
-    default:
-        return false;
-    }
-}
-
 static int push_hdlc(void)
 {
     int ret = 0;
     const uint8_t* spiRxFrameBuffer = get_real_rx_frame_start();
-    static uint8_t escaped_frame_buffer[MAX_FRAME_SIZE*2];
+    static uint8_t escaped_frame_buffer[HDLC_ENCODED_FRAME_SIZE_MAX(MAX_FRAME_SIZE)];
     static uint16_t unescaped_frame_len;
     static uint16_t escaped_frame_len;
     static uint16_t escaped_frame_sent;
@@ -844,52 +850,15 @@ static int push_hdlc(void)
         else if (sSpiRxPayloadSize != 0)
         {
             // Escape the frame.
-            uint8_t c;
-            uint16_t fcs = kHdlcCrcResetValue;
-            uint16_t i;
-
             unescaped_frame_len = sSpiRxPayloadSize;
 
-            for (i = 0; i < sSpiRxPayloadSize; i++)
-            {
-                c = spiRxFrameBuffer[i + HEADER_LEN];
-                fcs = hdlc_crc16(fcs, c);
-                if (hdlc_byte_needs_escape(c))
-                {
-                    escaped_frame_buffer[escaped_frame_len++] = HDLC_BYTE_ESC;
-                    escaped_frame_buffer[escaped_frame_len++] = c ^ HDLC_ESCAPE_XFORM;
-                }
-                else
-                {
-                    escaped_frame_buffer[escaped_frame_len++] = c;
-                }
-            }
-
-            fcs ^= 0xFFFF;
-
-            c = fcs & 0xFF;
-            if (hdlc_byte_needs_escape(c))
-            {
-                escaped_frame_buffer[escaped_frame_len++] = HDLC_BYTE_ESC;
-                escaped_frame_buffer[escaped_frame_len++] = c ^ HDLC_ESCAPE_XFORM;
-            }
-            else
-            {
-                escaped_frame_buffer[escaped_frame_len++] = c;
-            }
-
-            c = (fcs >> 8) & 0xFF;
-            if (hdlc_byte_needs_escape(c))
-            {
-                escaped_frame_buffer[escaped_frame_len++] = HDLC_BYTE_ESC;
-                escaped_frame_buffer[escaped_frame_len++] = c ^ HDLC_ESCAPE_XFORM;
-            }
-            else
-            {
-                escaped_frame_buffer[escaped_frame_len++] = c;
-            }
+            escaped_frame_len = (uint16_t)hdlc_encode_frame(
+                escaped_frame_buffer,
+                spiRxFrameBuffer + HEADER_LEN,
+                sSpiRxPayloadSize,
+                false
+            );
 
-            escaped_frame_buffer[escaped_frame_len++] = HDLC_BYTE_FLAG;
             escaped_frame_sent = 0;
             sSpiRxPayloadSize = 0;
 
@@ -936,84 +905,67 @@ static int push_hdlc(void)
     ret = 0;
 
 bail:
+    sHdlcOutputIsPending = (escaped_frame_len != 0);
+
     return ret;
 }
 
+static bool hdlc_input_is_buffered(void)
+{
+    return sHdlcInputChunkOffset < sHdlcInputChunkLen;
+}
+
 static int pull_hdlc(void)
 {
     int ret = 0;
-    static uint16_t fcs;
-    static bool unescape_next_byte = false;
 
-    if (!sSpiTxIsReady)
+    while (!sSpiTxIsReady)
     {
-        uint8_t byte;
-        while ((ret = (int)read(sHdlcInputFd, &byte, 1)) == 1)
+        hdlc_decode_status_t status;
+        size_t consumed = 0;
+
+        if (!hdlc_input_is_buffered())
         {
-            if (sSpiTxPayloadSize >= (MAX_FRAME_SIZE - HEADER_LEN))
-            {
-                syslog(LOG_WARNING, "HDLC frame was too big");
-                unescape_next_byte = false;
-                sSpiTxPayloadSize = 0;
-                fcs = kHdlcCrcResetValue;
+            ret = (int)read(sHdlcInputFd, sHdlcInputChunk, sizeof(sHdlcInputChunk));
 
-            }
-            else if (byte == HDLC_BYTE_FLAG)
+            if (ret <= 0)
             {
-                if (sSpiTxPayloadSize <= 2)
-                {
-                    unescape_next_byte = false;
-                    sSpiTxPayloadSize = 0;
-                    fcs = kHdlcCrcResetValue;
-                    continue;
-
-                }
-                else if (fcs != kHdlcCrcCheckValue)
-                {
-                    syslog(LOG_WARNING, "HDLC frame with bad CRC (LEN:%d, FCS:0x%04X)", sSpiTxPayloadSize, fcs);
-                    sHdlcRxBadCrcCount++;
-                    unescape_next_byte = false;
-                    sSpiTxPayloadSize = 0;
-                    fcs = kHdlcCrcResetValue;
-                    continue;
-                }
-
-                // Clip off the CRC
-                sSpiTxPayloadSize -= 2;
-
-                // Indicate that a frame is ready to go out
-                sSpiTxIsReady = true;
+                break;
+            }
 
-                // Increment counters for statistics
-                sHdlcRxFrameCount++;
-                sHdlcRxFrameByteCount += sSpiTxPayloadSize;
+            sHdlcInputChunkLen = (size_t)ret;
+            sHdlcInputChunkOffset = 0;
+        }
 
-                // Clean up for the next frame
-                unescape_next_byte = false;
-                fcs = kHdlcCrcResetValue;
-                break;
+        status = hdlc_decoder_feed(
+            &sHdlcDecoder,
+            sHdlcInputChunk + sHdlcInputChunkOffset,
+            sHdlcInputChunkLen - sHdlcInputChunkOffset,
+            &consumed
+        );
 
-            }
-            else if (byte == HDLC_BYTE_ESC)
-            {
-                unescape_next_byte = true;
-                continue;
+        sHdlcInputChunkOffset += consumed;
 
-            }
-            else if (hdlc_byte_needs_escape(byte))
-            {
-                // Skip all other control codes.
-                continue;
+        if (status == HDLC_DECODE_OVERFLOW)
+        {
+            syslog(LOG_WARNING, "HDLC frame was too big");
+        }
+        else if (status == HDLC_DECODE_BAD_CRC)
+        {
+            syslog(LOG_WARNING, "HDLC frame with bad CRC (LEN:%d, FCS:0x%04X)", (int)sHdlcDecoder.frame_len, sHdlcDecoder.crc);
+            sHdlcRxBadCrcCount++;
+        }
+        else if (status == HDLC_DECODE_FRAME)
+        {
+            sSpiTxPayloadSize = (uint16_t)sHdlcDecoder.frame_len;
 
-            }
-            else if (unescape_next_byte)
-            {
-                byte = byte ^ HDLC_ESCAPE_XFORM;
-                unescape_next_byte = false;
-            }
+            // Indicate that a frame is ready to go out
+            sSpiTxIsReady = true;
+            sSpiTxReadyTime = spi_xfer_time_us();
 
-            fcs = hdlc_crc16(fcs, byte);
-            sSpiTxFrameBuffer[HEADER_LEN + sSpiTxPayloadSize++] = byte;
+            // Increment counters for statistics
+            sHdlcRxFrameCount++;
+            sHdlcRxFrameByteCount += sSpiTxPayloadSize;
         }
     }
 
@@ -1108,6 +1060,8 @@ static int push_raw(void)
     ret = 0;
 
 bail:
+    sHdlcOutputIsPending = (raw_frame_len != 0);
+
     return ret;
 }
 
@@ -1136,6 +1090,7 @@ static int pull_raw(void)
         {
             sSpiTxPayloadSize = (uint16_t)ret;
             sSpiTxIsReady = true;
+            sSpiTxReadyTime = spi_xfer_time_us();
 
             // Increment counters for statistics
             sHdlcRxFrameCount++;
@@ -1469,7 +1424,12 @@ static void print_help(void)
     "                                   clip from start of MISO frame. Max value is 16.\n"
     "    --spi-small-packet=[n] ....... Specify the smallest packet we can receive\n"
     "                                   in a single transaction(larger packets will\n"
-    "                                   require two transactions). Default value is 32.\n"
+    "                                   require two transactions). Transactions are\n"
+    "                                   sized up from this to fit the packets the\n"
+    "                                   slave usually sends. Default value is 32.\n"
+    "    --spi-fixed-size ............. Always size transactions for a small packet\n"
+    "                                   and poll at a fixed rate, instead of adapting\n"
+    "                                   to recent traffic.\n"
     "    -v/--verbose ................. Increase debug verbosity. (Repeatable)\n"
     "    -h/-?/--help ................. Print out usage information and exit.\n"
     "\n";
@@ -1505,6 +1465,7 @@ int main(int argc, char *argv[])
         ARG_RAW = 1006,
         ARG_MTU = 1007,
         ARG_SPI_SMALL_PACKET = 1008,
+        ARG_SPI_FIXED_SIZE = 1009,
     };
 
     static struct option options[] = {
@@ -1522,6 +1483,7 @@ int main(int argc, char *argv[])
         { "spi-cs-delay",required_argument,NULL,   ARG_SPI_CS_DELAY },
         { "spi-align-allowance", required_argument, NULL, ARG_SPI_ALIGN_ALLOWANCE },
         { "spi-small-packet", required_argument, NULL, ARG_SPI_SMALL_PACKET },
+        { "spi-fixed-size", no_argument,   NULL,   ARG_SPI_FIXED_SIZE },
         { NULL,         0,                 NULL,   0             },
     };
 
@@ -1629,6 +1591,11 @@ int main(int argc, char *argv[])
                 syslog(LOG_NOTICE, "SPI small-packet size set to %d bytes.", sSpiSmallPacketSize);
                 break;
 
+            case ARG_SPI_FIXED_SIZE:
+                sSpiAdaptive = false;
+                syslog(LOG_NOTICE, "SPI transaction sizing and polling will not adapt to traffic.");
+                break;
+
             case ARG_SPI_CS_DELAY:
                 sSpiCsDelay = atoi(optarg);
                 if (sSpiCsDelay < 0)
@@ -1807,6 +1774,18 @@ int main(int argc, char *argv[])
         syslog(LOG_WARNING, "Interrupt pin was not set, must poll SPI. Performance will suffer.");
     }
 
+    hdlc_decoder_init(&sHdlcDecoder, &sSpiTxFrameBuffer[HEADER_LEN], MAX_FRAME_SIZE - HEADER_LEN);
+    sHdlcDecoder.drop_control_bytes = true;
+
+    spi_xfer_sizer_init(
+        &sSpiXferSizer,
+        (uint16_t)sSpiSmallPacketSize,
+        MAX_FRAME_SIZE - HEADER_LEN,
+        spi_xfer_overhead_bytes((uint32_t)sSpiSpeed, (uint32_t)sSpiCsDelay)
+    );
+    spi_xfer_sizer_set_adaptive(&sSpiXferSizer, sSpiAdaptive);
+    spi_xfer_poller_init(&sSpiPoller, SPI_POLL_PERIOD_MIN_MSEC, SPI_POLL_PERIOD_MAX_MSEC);
+
     trigger_reset();
 
     // ========================================================================
@@ -1824,6 +1803,12 @@ int main(int argc, char *argv[])
         {
             FD_SET(sHdlcInputFd, &read_set);
 
+            if (!sUseRawFrames && hdlc_input_is_buffered())
+            {
+                // There is already another frame's worth of
+                // input waiting in the chunk buffer.
+                timeout_ms = 0;
+            }
         }
         else
         {
@@ -1831,6 +1816,13 @@ int main(int argc, char *argv[])
             timeout_ms = 0;
         }
 
+        if (sHdlcOutputIsPending)
+        {
+            // We are part way through writing a frame out
+            // of the HDLC descriptor.
+            FD_SET(sHdlcOutputFd, &write_set);
+        }
+
         if (sSpiRxPayloadSize != 0)
         {
             // We have data that we are waiting to send out
@@ -1860,11 +1852,11 @@ int main(int argc, char *argv[])
             }
 
         }
-        else if (timeout_ms > SPI_POLL_PERIOD_MSEC)
+        else if (timeout_ms > sSpiPoller.period_ms)
         {
             // In this case we don't have an interrupt, so
             // we revert to SPI polling.
-            timeout_ms = SPI_POLL_PERIOD_MSEC;
+            timeout_ms = sSpiPoller.period_ms;
         }
 
         if (sDumpStats)
@@ -1959,11 +1951,25 @@ int main(int argc, char *argv[])
             syslog(LOG_NOTICE, "INFO: sHdlcRxFrameCount=%llu", (unsigned long long)sHdlcRxFrameCount);
             syslog(LOG_NOTICE, "INFO: sHdlcRxFrameByteCount=%llu", (unsigned long long)sHdlcRxFrameByteCount);
             syslog(LOG_NOTICE, "INFO: sHdlcRxBadCrcCount=%llu", (unsigned long long)sHdlcRxBadCrcCount);
+            syslog(LOG_NOTICE, "INFO: sSpiWastedFrameCount=%llu", (unsigned long long)sSpiXferStats.wasted);
+            syslog(LOG_NOTICE, "INFO: sSpiRetryFrameCount=%llu", (unsigned long long)sSpiXferStats.retries);
+            syslog(LOG_NOTICE, "INFO: sSpiShortReadCount=%llu", (unsigned long long)sSpiXferStats.short_reads);
+            syslog(LOG_NOTICE, "INFO: sSpiClockedByteCount=%llu", (unsigned long long)sSpiXferStats.clocked_bytes);
+            syslog(LOG_NOTICE, "INFO: sSpiPayloadByteCount=%llu", (unsigned long long)sSpiXferStats.payload_bytes);
+            syslog(LOG_NOTICE, "INFO: sSpiBytesPerTransaction=%llu", (unsigned long long)(sSpiXferStats.transactions
+                ? sSpiXferStats.clocked_bytes / sSpiXferStats.transactions
+                : 0));
+            syslog(LOG_NOTICE, "INFO: sSpiLatencyAvgUsec=%llu", (unsigned long long)(sSpiXferStats.latency_count
+                ? sSpiXferStats.latency_sum_us / sSpiXferStats.latency_count
+                : 0));
+            syslog(LOG_NOTICE, "INFO: sSpiLatencyMaxUsec=%lu", (unsigned long)sSpiXferStats.latency_max_us);
+            syslog(LOG_NOTICE, "INFO: sSpiXferSize=%u", (unsigned int)spi_xfer_sizer_get_len(&sSpiXferSizer));
         }
 
         // Handle serial input.
-        if (FD_ISSET(sHdlcInputFd, &read_set))
-        {
+        if ( FD_ISSET(sHdlcInputFd, &read_set)
+          || (!sUseRawFrames && !sSpiTxIsReady && hdlc_input_is_buffered())
+        ) {
             // Read in the data.
             if ((sUseRawFrames ? pull_raw() : pull_hdlc()) < 0)
             {
@@ -1985,17 +1991,71 @@ int main(int argc, char *argv[])
             continue;
         }
 
-        // Service the SPI port if we can receive
-        // a packet or we have a packet to be sent.
-        if ( (sSpiRxPayloadSize == 0)
-          && (sSpiTxIsReady || check_and_clear_interrupt())
-        ) {
-            // We guard this with the above check because we don't
-            // want to overwrite any previously received (but not
-            // yet pushed out) frames.
+        // Service the SPI port if we can receive a packet or we
+        // have a packet to be sent. While the slave keeps its
+        // interrupt asserted (or, when polling, keeps sending us
+        // frames) we run several transactions back to back rather
+        // than taking another trip through select() for each one.
+        for (i = 0; i < SPI_MAX_BURST_TRANSACTIONS; i++)
+        {
+            bool got_frame;
+
+            // We guard this with the following check because we
+            // don't want to overwrite any previously received (but
+            // not yet pushed out) frames.
+            if ( (sSpiRxPayloadSize != 0)
+              || !(sSpiTxIsReady || check_and_clear_interrupt())
+            ) {
+                break;
+            }
+
             if (push_pull_spi() < 0)
             {
                 sRet = EXIT_FAILURE;
+                break;
+            }
+
+            got_frame = (sSpiRxPayloadSize != 0);
+
+            if ((sIntGpioValueFd < 0) && sSpiAdaptive)
+            {
+                spi_xfer_poller_note(&sSpiPoller, got_frame);
+            }
+
+            if (got_frame || sSlaveDidReset)
+            {
+                if ((sUseRawFrames ? push_raw() : push_hdlc()) < 0)
+                {
+                    sRet = EXIT_FAILURE;
+                    break;
+                }
+            }
+
+            // Stop if the output is backing up, or if the slave
+            // wants us to hold off.
+            if ( (sSpiRxPayloadSize != 0)
+              || sHdlcOutputIsPending
+              || (sSpiTxRefusedCount != 0)
+            ) {
+                break;
+            }
+
+            if (!sSpiTxIsReady)
+            {
+                // Pick up the next frame to send along with
+                // whatever else the slave has for us.
+                if ((sUseRawFrames ? pull_raw() : pull_hdlc()) < 0)
+                {
+                    sRet = EXIT_FAILURE;
+                    break;
+                }
+            }
+
+            if ((sIntGpioValueFd < 0) && !got_frame && !sSpiTxIsReady)
+            {
+                // When polling, only keep going while the slave
+                // is sending us something.
+                break;
             }
         }
     }